@@ -0,0 +1,183 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+// BlockHashTree.cpp
+
+#include "BlockHashTree.h"
+#include <cryptopp/sha.h>
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+    constexpr uint8_t LEAF_PREFIX = 0x00;
+    constexpr uint8_t NODE_PREFIX = 0x01;
+
+    // SHA-256 of a domain prefix followed by the data, so a leaf can never pass for a node
+    BlockHashTree::Hash hash_with_prefix(uint8_t prefix, const uint8_t* data, size_t length,
+                                         const uint8_t* more = nullptr, size_t more_length = 0) {
+        BlockHashTree::Hash hash;
+        CryptoPP::SHA256 sha;
+        sha.Update(&prefix, 1);
+        sha.Update(data, length);
+        if (more) {
+            sha.Update(more, more_length);
+        }
+        sha.Final(hash.data());
+        return hash;
+    }
+}
+
+/**
+ * @brief Constructor for BlockHashTree.
+ *
+ * @param pool Threads that hash the blocks completed by add(), or nullptr for the calling thread.
+ */
+BlockHashTree::BlockHashTree(ThreadPool* pool) : pool(pool) {
+    carry.reserve(BLOCK_SIZE);
+}
+
+/**
+ * @brief Starts the tree of a new file.
+ *
+ * @param size The size of the file, which fixes the number of leaves.
+ */
+void BlockHashTree::reset(uint64_t size) {
+    file_size = size;
+    fed_size = 0;
+    next_leaf = 0;
+    leaves.assign(size_t((size + BLOCK_SIZE - 1) / BLOCK_SIZE), Hash{});
+    complete = false;
+    carry.clear();
+    staged.clear();
+    carry_staged = false;
+    tail = nullptr;
+    tail_length = 0;
+    if (leaves.empty()) {
+        build();
+    }
+}
+
+// Feeds the next chunk of the file, hashing the blocks it completes on the pool
+void BlockHashTree::add(const uint8_t* data, size_t length) {
+    size_t count = stage(data, length);
+    if (pool && count > 1) {
+        pool->run_batch(count, [this](size_t i) { hash_staged(i); });
+    } else {
+        for (size_t i = 0; i < count; i++) {
+            hash_staged(i);
+        }
+    }
+    commit();
+}
+
+/**
+ * @brief Queues the blocks completed by the next chunk of the file.
+ *
+ * The block left over from the previous chunk is completed first, then every whole block is
+ * taken straight from the chunk. The chunk must stay valid until commit().
+ *
+ * @return The number of blocks to pass to hash_staged().
+ * @throws std::runtime_error if more bytes are fed than the size given to reset().
+ */
+size_t BlockHashTree::stage(const uint8_t* data, size_t length) {
+    if (fed_size + length > file_size) {
+        throw std::runtime_error("More data than the size of the hashed file.");
+    }
+    fed_size += length;
+    staged.clear();
+    carry_staged = false;
+
+    size_t offset = 0;
+    if (!carry.empty()) {
+        size_t block_length = size_t(get_block_length(next_leaf));
+        size_t take = std::min(length, block_length - carry.size());
+        carry.insert(carry.end(), data, data + take);
+        offset = take;
+        if (carry.size() == block_length) {
+            staged.push_back({carry.data(), carry.size(), next_leaf++});
+            carry_staged = true;
+        }
+    }
+
+    while (next_leaf < leaves.size() && length - offset >= get_block_length(next_leaf)) {
+        size_t block_length = size_t(get_block_length(next_leaf));
+        staged.push_back({data + offset, block_length, next_leaf++});
+        offset += block_length;
+    }
+    tail = data + offset;
+    tail_length = length - offset;
+    return staged.size();
+}
+
+// Hashes one block queued by stage(). Different indices can be hashed on different threads.
+void BlockHashTree::hash_staged(size_t index) {
+    const StagedBlock& block = staged[index];
+    leaves[block.index] = hash_with_prefix(LEAF_PREFIX, block.source, block.length);
+}
+
+// Keeps the incomplete end of the chunk for the next one, and builds the tree after the last chunk
+void BlockHashTree::commit() {
+    if (carry_staged) {
+        carry.clear();
+    }
+    carry.insert(carry.end(), tail, tail + tail_length);
+    staged.clear();
+    carry_staged = false;
+    tail_length = 0;
+
+    if (fed_size == file_size && next_leaf == leaves.size() && !complete) {
+        build();
+    }
+}
+
+// Hashes the levels above the leaves, up to the root
+void BlockHashTree::build() {
+    if (leaves.empty()) {
+        CryptoPP::SHA256().CalculateDigest(root.data(), nullptr, 0);
+        complete = true;
+        return;
+    }
+
+    std::vector<Hash> level = leaves;
+    while (level.size() > 1) {
+        std::vector<Hash> parents;
+        parents.reserve((level.size() + 1) / 2);
+        for (size_t i = 0; i < level.size(); i += 2) {
+            if (i + 1 < level.size()) {
+                parents.push_back(hash_with_prefix(NODE_PREFIX, level[i].data(), HASH_SIZE,
+                                                   level[i + 1].data(), HASH_SIZE));
+            } else {
+                parents.push_back(level[i]); // The odd node moves up unchanged
+            }
+        }
+        level.swap(parents);
+    }
+    root = level[0];
+    complete = true;
+}
+
+// Returns true once every leaf is hashed and the root is built
+bool BlockHashTree::is_complete() const {
+    return complete;
+}
+
+// Returns the number of blocks of the file
+uint64_t BlockHashTree::get_leaf_count() const {
+    return leaves.size();
+}
+
+// Returns the length of block `index`; only the last block can be shorter than BLOCK_SIZE
+uint64_t BlockHashTree::get_block_length(uint64_t index) const {
+    return std::min<uint64_t>(BLOCK_SIZE, file_size - index * BLOCK_SIZE);
+}
+
+// Returns the leaf hashes in block order
+const std::vector<BlockHashTree::Hash>& BlockHashTree::get_leaves() const {
+    return leaves;
+}
+
+// Returns the root hash, valid once is_complete()
+const BlockHashTree::Hash& BlockHashTree::get_root() const {
+    return root;
+}
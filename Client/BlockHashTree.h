@@ -0,0 +1,76 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+#ifndef MAMAN15_BLOCKHASHTREE_H
+#define MAMAN15_BLOCKHASHTREE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "ThreadPool.h"
+
+// Merkle tree over the plaintext of a file, with one SHA-256 leaf per BLOCK_SIZE bytes.
+// When the server's CRC does not match, the leaves tell it which blocks of its copy differ,
+// so only those blocks are sent again.
+//
+// Leaf i is SHA-256(0x00 || block i), a node is SHA-256(0x01 || left || right), and the last
+// node of an odd level moves up unchanged. The tree of an empty file is SHA-256 of nothing.
+//
+// The file is fed in chunks of any size. stage() queues the blocks a chunk completes,
+// hash_staged() hashes one of them (the blocks are independent, so they can be hashed on
+// the pool together with other work), and commit() keeps the incomplete tail for the next chunk.
+class BlockHashTree {
+public:
+    static constexpr size_t BLOCK_SIZE = 256 * 1024;
+    static constexpr size_t HASH_SIZE = 32;
+    using Hash = std::array<uint8_t, HASH_SIZE>;
+
+    explicit BlockHashTree(ThreadPool* pool = nullptr);
+
+    // Starts the tree of a file of file_size bytes
+    void reset(uint64_t file_size);
+
+    // Feeds the next chunk of the file and hashes the blocks it completes
+    void add(const uint8_t* data, size_t length);
+
+    // Same as add(), in three steps so the hashing can share a batch with other work
+    size_t stage(const uint8_t* data, size_t length);
+    void hash_staged(size_t index);
+    void commit();
+
+    // True once the whole file was fed and the tree is built
+    bool is_complete() const;
+    uint64_t get_leaf_count() const;
+    uint64_t get_block_length(uint64_t index) const;
+    const std::vector<Hash>& get_leaves() const;
+    const Hash& get_root() const;
+
+private:
+    // A complete block waiting to be hashed
+    struct StagedBlock {
+        const uint8_t* source;
+        size_t length;
+        uint64_t index;
+    };
+
+    ThreadPool* pool;
+    uint64_t file_size = 0;
+    uint64_t fed_size = 0;          // Bytes of the file passed to stage() so far
+    uint64_t next_leaf = 0;         // Index of the block the carry belongs to
+    std::vector<Hash> leaves;
+    Hash root{};
+    bool complete = false;
+
+    std::vector<uint8_t> carry;     // Start of a block split over two chunks
+    std::vector<StagedBlock> staged;
+    bool carry_staged = false;
+    const uint8_t* tail = nullptr;  // Bytes of the last staged chunk after its last complete block
+    size_t tail_length = 0;
+
+    void build();
+};
+
+
+#endif //MAMAN15_BLOCKHASHTREE_H
@@ -4,36 +4,25 @@
 
 
 #include "Client.h"
-// Constructor to initialize the Client class
-// This constructor takes a reference to a TCP socket and initializes various client-related variables such as client_id, version, request_op_code, etc.
-// It attempts to read data from "transfer.info" and check if "me.info" exists for reconnection, otherwise registers a new client.
+#include <iostream>
+#include "UploadPipeline.h"
+#include "UringUpload.h"
 
-Client::Client(tcp::socket& socket)
-        : socket(socket), client_id(std::vector<uint8_t>(16,0)), version(3), request_op_code(0), payload_size(0),
-          client_name("") , header_buffer(std::vector<uint8_t>()), file_path(""), payload(std::vector<uint8_t>()), file_name("") {
 
-    try {
-        // Read the transfer info to initialize client name and file path
-        get_data_from_transfer_file();
-
-        // Check if "me.info" exists (used for reconnecting an existing client)
-        if (std::filesystem::exists("me.info")) {
-            std::cout << "Found existing client info, attempting to reconnect" << std::endl;
-            request_op_code = RECONNECT;  // Set request to reconnect
-            get_data_from_me_file();      // Get saved client data (name, UUID)
-            std::cout << "Reconnecting..." << std::endl;
-        } else {
-            // If no previous client data, register as a new client
-            std::cout << "No existing client info found, registering as new client" << std::endl;
-            request_op_code = REGISTER;  // Set request to register
-            std::cout << "Registering..." << std::endl;
-        }
-        // Send request op_code (either REGISTER or RECONNECT) to the server
-        handle_sending_opCode(request_op_code);
-    } catch (const std::exception& e) {
-        std::cerr << "Initialization Error: " << e.what() << std::endl;
-    }
-}
+// Constructor to initialize the Client class
+// This constructor takes a reference to a connected TCP socket and the configuration of the client.
+// The stream block size bounds how much of the file is held in memory while it is encrypted and sent.
+// Clients that run side by side can share one thread pool for encryption, otherwise each has its own.
+// Nothing is sent before start() or start_async(), so the setters still apply to the first request.
+Client::Client(tcp::socket& socket, ClientConfig client_config, size_t stream_block_size, bool pipelined,
+               ThreadPool* shared_pool)
+        : socket(socket), protocol(socket, std::move(client_config), SessionProtocol::Options{stream_block_size}, shared_pool),
+          pipelined(pipelined) {}
+
+// Reads the configuration from the working directory: transfer.info, me.info (used for reconnecting an
+// existing client) and the saved key, and keeps the upload index and the session ticket next to them
+Client::Client(tcp::socket& socket, size_t stream_block_size, bool pipelined, ThreadPool* shared_pool)
+        : Client(socket, ClientConfig::from_working_directory(), stream_block_size, pipelined, shared_pool) {}
 
 // Destructor for the Client class
 // Closes the socket and checks for any fatal errors during client operations.
@@ -48,467 +37,292 @@ Client::~Client() {
 
     // Handle any fatal error messages
     try {
-        if (!fatal_error_message.empty()) {
-            throw std::runtime_error(fatal_error_message);
+        if (!protocol.get_fatal_error().empty()) {
+            throw std::runtime_error(protocol.get_fatal_error());
         }
     } catch (const std::exception& e) {
         std::cerr << "Fatal error: " << e.what() << std::endl;
     }
 }
 
-// Reads data from the "me.info" file (used for reconnecting clients).
-// The file contains client information such as name and UUID.
-void Client::get_data_from_me_file() {
-    std::vector<std::string> data = get_file_data("me.info");
-    if (data.size() < 3) {
-        throw std::runtime_error("Invalid me.info file format");
-    }
-
-    // First line is the client name
-    client_name = data[0];
-    std::cout << "Client name: " << client_name << std::endl;
-
-    // Second line contains the client UUID in string format
+// Starts the client workflow.
+// Sends the header to the server, receives the response, and manages further steps based on the server's response.
+// Runs one request/response exchange per iteration until the session ends, so a batch of any size
+// does not grow the stack.
+void Client::start() {
     try {
-        client_uuid = boost::uuids::string_generator()(data[1]);
-        std::cout << "Loaded client info - Client name: " << client_name << ", UUID: " << client_uuid << std::endl;
+        protocol.begin(); // Prepare the first request, with the features set since the constructor
+        do {
+            std::cout << "Sending header to the server - Op Code: " << protocol.get_request_op_code() << std::endl;
+            send_request();  // Send the header, the payload and the encrypted body
+            std::cout << "Header sent successfully!" << std::endl;
+
+            std::cout << "Receiving response..." << std::endl;
+            receive_response();  // Receive response from server
+            std::cout << "Response received successfully!" ;
+
+            // Continue client workflow based on server response
+        } while (protocol.handle_response());
     } catch (const std::exception& e) {
-        throw std::runtime_error("Error parsing UUID from me.info file");
+        std::cerr << "Error during client start: " << e.what() << std::endl;
     }
+    protocol.return_unsent_files();
+    complete_session();
 }
 
-// Reads data from the "transfer.info" file (used for file transfer).
-// Extracts client name and file path for the file to be transferred.
-void Client::get_data_from_transfer_file() {
-
-    std::cout << "Loading transfer info" << std::endl;
-    std::vector<std::string> data = get_file_data("transfer.info");
-
-    if (data.size() < 3) {
-        throw std::runtime_error("Invalid transfer.info file format");
-    } else {
-        std::cout << "Reading from transfer file..." << std::endl;
+// Sends the request: the header, the payload and the first block of the body go out in one gathered
+// write, then the rest of the body one block at a time, and the commit checksum if the file is committed.
+// Only one plaintext block and one encrypted block are held in memory, whatever the size of the file.
+// In pipelined mode the three steps of a file body overlap on separate threads, with a few blocks in flight.
+// With io_uring the reads and sends of a file body are batched on a ring instead.
+// A striped file is sent over the extra connections first; STRIPES_COMPLETE follows on this one.
+void Client::send_request() {
+    try {
+        if (protocol.has_striped_upload()) {
+            protocol.run_striped_upload();
+        }
+        if (protocol.get_body_size() == 0) {
+            boost::asio::write(socket, protocol.request_buffers(false));
+            return;
+        }
+        uint64_t bytes_sent = 0;
+        if (use_io_uring && protocol.is_file_body()) {
+            boost::asio::write(socket, protocol.request_buffers(false));
+            SessionProtocol::FileBody body = protocol.get_file_body();
+            UringUpload upload(body.path, body.offset, body.length, body.encryptor, socket,
+                               protocol.get_options().stream_block_size);
+            bytes_sent = upload.run();
+            std::cout << upload.get_stats().to_string();
+        } else if (pipelined && protocol.is_file_body()) {
+            boost::asio::write(socket, protocol.request_buffers(false));
+            SessionProtocol::FileBody body = protocol.get_file_body();
+            UploadPipeline pipeline(body.input, body.length, body.encryptor, socket, protocol.get_options().stream_block_size);
+            bytes_sent = pipeline.run();
+            std::cout << pipeline.get_stats().to_string();
+        } else {
+            protocol.begin_body();
+            bool has_block = protocol.next_body_block();
+            bytes_sent = boost::asio::write(socket, protocol.request_buffers(has_block)) - protocol.get_request_prefix_size();
+            while (has_block && protocol.next_body_block()) {
+                bytes_sent += boost::asio::write(socket, boost::asio::buffer(protocol.get_body_block()));
+            }
+        }
+        protocol.end_body(bytes_sent);
+        if (protocol.has_commit_trailer()) {
+            boost::asio::write(socket, protocol.get_commit_trailer());
+        }
+    } catch (const boost::system::system_error& e) {
+        std::cerr << "Error during write: " << e.what() << std::endl;
+        throw;
     }
-
-    // The second line is the client name
-    client_name = data[1];
-    // The third line is the file path
-    file_path = data[2];
-
-    std::cout << "Loaded transfer info - Client name: " << client_name << ", File path: " << file_path << std::endl;
 }
 
-
-// Pads a string to a fixed length of 255 bytes for consistency in packet transmission.
-// Returns a byte array padded with zeroes to match the required size.
-std::vector<uint8_t> Client::pad_string_to_255(const std::string& name_str) {
-    std::vector<uint8_t> name_bytes(255, 0);  // Initialize the byte array with zeros
-    size_t name_length = name_str.size();
-
-    // Ensure the string is not longer than 254 characters
-    if (name_length > 254) {
-        std::cerr << "Error: Name exceeds 254 characters. Truncating..." << std::endl;
-        name_length = 254;  // Truncate the string if too long
+// Starts the session without blocking. Every read and write is an asynchronous operation of the
+// socket's io_context, and each completion handler starts the next step of the same request/response
+// state machine as start(). The session goes on while the caller runs the io_context, so one thread
+// can drive the sessions of many clients.
+void Client::start_async() {
+    protocol.get_options().asynchronous = true; // A watcher only drives blocking sessions
+    try {
+        protocol.begin(); // Prepare the first request, with the features set since the constructor
+    } catch (const std::exception& e) {
+        stop_async(e.what());
+        return;
     }
+    async_send_request();
+}
 
-    // Copy the characters of the string into the byte array
-    std::copy(name_str.begin(), name_str.begin() + name_length, name_bytes.begin());
-    name_bytes[name_length] = 0;  // Null-terminate the string
-    return name_bytes;
+// Returns true once an asynchronous session is over
+bool Client::is_finished() const {
+    return session_finished;
 }
 
+// Sends every file, including the ones the upload index holds as unchanged. They are still recorded.
+void Client::set_skip_unchanged(bool skip) {
+    protocol.get_options().skip_unchanged = skip;
+}
 
+// Chooses between the memory-mapped reader and the stream reader for the files sent next
+void Client::set_mapped_input(bool mapped) {
+    protocol.get_options().mapped_input = mapped;
+}
 
-// Reads data from the specified file and returns the contents as a vector of strings.
-// Each line of the file is treated as a separate string.
-std::vector<std::string> Client::get_file_data(const std::string& file_name) {
-    std::ifstream file(file_name);
-    if (!file.is_open()) {
-        std::cerr << "Error: Could not open file '" << file_name << "'." << std::endl;
-        return {};
+// Chooses the io_uring engine for the file bodies sent next, if this build and the kernel support it
+void Client::set_io_uring(bool enabled) {
+    use_io_uring = enabled && UringUpload::is_available();
+    if (enabled && !use_io_uring) {
+        std::cerr << "io_uring is not available, sending with blocking writes" << std::endl;
     }
+}
 
-    std::vector<std::string> data;
-    std::string line;
+// Chooses whether compression is offered to the server in the next key exchange
+void Client::set_compression(bool enabled) {
+    protocol.get_options().compression = enabled;
+}
 
-    // Read each line of the file and store it in the data vector
-    while (std::getline(file, line)) {
-        data.push_back(line);
-    }
-    file.close();
-    return data;
+// Chooses how many extra connections a large file may be striped over; striping is offered to the
+// server in the next key exchange unless max_streams is 0
+void Client::set_striping(size_t max_streams) {
+    protocol.get_options().max_stripe_streams = max_streams;
 }
 
+// Chooses how many files of a batch are interleaved on the connection; multiplexing is offered
+// in the key exchange unless max_streams is 0
+void Client::set_multiplexing(size_t max_streams) {
+    protocol.get_options().max_multiplex_streams = max_streams;
+}
 
+// Sets the watcher the next batches are taken from; nullptr ends the session with the batch
+void Client::set_watcher(DirectoryWatcher* directory_watcher) {
+    protocol.get_options().watcher = directory_watcher;
+}
 
-// Starts the client workflow.
-// Sends the header to the server, receives the response, and manages further steps based on the server's response.
-void Client::start() {
-    try {
-        std::cout << "Sending header to the server - Op Code: " << request_op_code << std::endl;
-        send_data_by_chunks();  // Send header in chunks
-        std::cout << "Header sent successfully!" << std::endl;
+size_t Client::get_verified_count() const {
+    return protocol.get_verified_count();
+}
 
-        std::cout << "Receiving response..." << std::endl;
-        std::vector<uint8_t> response = receive_data_by_chunks();  // Receive response from server
-        std::cout << "Response received successfully!" ;
+// Sets the handler called when the session ends, to hand the outcome of the files back to the caller
+void Client::set_completion_handler(std::function<void()> handler) {
+    completion_handler = std::move(handler);
+}
 
-        // Parse the response from the server
-        parse_response(response);
+const std::vector<std::string>& Client::get_file_paths() const {
+    return protocol.get_file_paths();
+}
 
-        // Continue client workflow based on server response
-        manage_client_flow();
-    } catch (const std::exception& e) {
-        std::cerr << "Error during client start: " << e.what() << std::endl;
-    }
+const std::vector<Client::FileStatus>& Client::get_file_statuses() const {
+    return protocol.get_file_statuses();
 }
 
-// Manages the client workflow after parsing the server's response.
-// Sends the next request operation code based on the server's response.
-void Client::manage_client_flow() {
-    try {
-        // If the received operation code is handled successfully, continue to send another request
-        if (handle_received_opCode(received_op_code)) {
-            handle_sending_opCode(request_op_code);  // Send the next request op code
-            start();  // Restart the client workflow
+// Sends the prepared header and payload with the first block of the body, if the request has one,
+// in one gathered write
+void Client::async_send_request() {
+    std::cout << "Sending header to the server - Op Code: " << protocol.get_request_op_code() << std::endl;
+    bool has_block = false;
+    if (protocol.get_body_size() > 0) {
+        try {
+            protocol.begin_body();
+            has_block = protocol.next_body_block();
+        } catch (const std::exception& e) {
+            stop_async(e.what());
+            return;
         }
-
-    } catch (const std::exception& e) {
-        std::cerr << "Error during client flow: " << e.what() << std::endl;
     }
+    boost::asio::async_write(socket, protocol.request_buffers(has_block),
+        [this](const boost::system::error_code& error, size_t bytes_transferred) {
+            if (error) {
+                stop_async("Error during write: " + error.message());
+                return;
+            }
+            if (protocol.get_body_size() > 0) {
+                body_bytes_sent = bytes_transferred - protocol.get_request_prefix_size();
+                async_send_body_block(); // Sends the rest of the body
+            } else {
+                async_receive_response();
+            }
+        });
 }
 
-// Sends data in chunks over the TCP socket to the server.
-// Uses a fixed chunk size to ensure consistent data transmission.
-void Client::send_data_by_chunks() {
-    uint32_t total_bytes_sent = 0;
-    uint32_t max_length = 1024;  // Maximum chunk size
-
+// Encrypts the next block of the body and sends it; the completion handler moves on to the following one
+void Client::async_send_body_block() {
     try {
-        // Continue sending data until all data in the header_buffer is sent
-        while (total_bytes_sent < header_buffer.size()) {
-            // Calculate how many bytes to send in the current chunk
-            uint32_t bytes_to_send = std::min(max_length, uint32_t(header_buffer.size() - total_bytes_sent));
-            total_bytes_sent += boost::asio::write(socket, boost::asio::buffer(header_buffer.data() + total_bytes_sent, bytes_to_send));
+        if (!protocol.next_body_block()) {
+            protocol.end_body(body_bytes_sent);
+            std::cout << "Header sent successfully!" << std::endl;
+            async_send_commit_trailer();
+            return;
         }
-    } catch (const boost::system::system_error& e) {
-        std::cerr << "Error during write: " << e.what() << std::endl;
+    } catch (const std::exception& e) {
+        stop_async(e.what());
         return;
     }
-}
-
-// Receives data from the server in chunks and returns the data as a vector of bytes.
-// Handles potential errors during data reception.
-std::vector<uint8_t> Client::receive_data_by_chunks() {
-    std::vector<uint8_t> response;
-    try {
-        std::vector<uint8_t> buffer(1024);  // Buffer to hold received data
-        boost::system::error_code error;
-
-        // Keep reading data until there is no more data to receive
-        while (true) {
-            size_t bytes_transferred = socket.read_some(boost::asio::buffer(buffer), error);
-
-            if (error == boost::asio::error::eof) {
-                break;  // End of file reached, stop receiving data
-            } else if (error) {
-                throw boost::system::system_error(error);
-            }
 
-            // Append received data to the response vector
-            response.insert(response.end(), buffer.begin(), buffer.begin() + bytes_transferred);
-
-            if (bytes_transferred < buffer.size()) {
-                break;
+    boost::asio::async_write(socket, boost::asio::buffer(protocol.get_body_block()),
+        [this](const boost::system::error_code& error, size_t bytes_transferred) {
+            if (error) {
+                stop_async("Error during write: " + error.message());
+                return;
             }
-        }
-
-    } catch (const std::exception& e) {
-        std::cerr << "Error during data reception: " << e.what() << std::endl;
-        throw;
-    }
-    return response;
+            body_bytes_sent += bytes_transferred;
+            async_send_body_block();
+        });
 }
 
-// Parses the response received from the server to extract relevant information
-void Client::parse_response(const std::vector<uint8_t>& response) {
-    // Check if the response is long enough to contain the required data
-    if (response.size() < 7) {
-        std::cerr << "Error: Response is too short." << std::endl;
-        return; // Early exit on invalid response size
+// Sends the checksum that follows a committed body, then reads the response
+void Client::async_send_commit_trailer() {
+    if (!protocol.has_commit_trailer()) {
+        async_receive_response();
+        return;
     }
-
-    // Extract version, operation code, and payload size from the response
-    uint8_t version1 = response[0];
-    received_op_code = ntohs(*reinterpret_cast<const uint16_t*>(&response[1]));
-    std::cout << " - Op Code: " << received_op_code << std::endl;
-    payload_size = ntohl(*reinterpret_cast<const uint32_t*>(&response[3]));
-    // Extract the payload from the response, starting from byte 7
-    payload = std::vector<uint8_t>(response.begin() + 7, response.end());
+    boost::asio::async_write(socket, protocol.get_commit_trailer(),
+        [this](const boost::system::error_code& error, size_t) {
+            if (error) {
+                stop_async("Error during write: " + error.message());
+                return;
+            }
+            async_receive_response();
+        });
 }
 
-// Handles the operation code received from the server and determines the next steps
-bool Client::handle_received_opCode(uint16_t op_code) {
-    switch(op_code) {
-        case REGISTER_OK: { // Handle successful registration
-            // Validate the payload length for UUID
-            if (payload.size() != 16) {
-                std::cerr << "Error: Invalid UUID length" << std::endl;
-                request_op_code = REGISTER_NOK; // Set request code for failed registration
-            } else {
-                // Copy the received UUID from the payload
-                std::copy(payload.begin(), payload.end(), client_uuid.begin());
-                std::cout << "REGISTER OK, UUID: " << client_uuid << std::endl;
-
-                try {
-                    // Create a file to store client information
-                    create_me_file();
-                    std::cout << "Me file created" << std::endl;
-                } catch (const std::exception& e) {
-                    std::cerr << "Me file creation failed" << std::endl;
-                    std::cerr << "Error: " << e.what() << std::endl;
-                    request_op_code = TERMINATE_CONNECTION; // Set termination request due to error
-                    break;
-                }
-                request_op_code = SENDING_PUBLIC_KEY; // Proceed to send public key
-            }
-            break;
-        }
-        case REGISTER_NOK: // Handle failed registration
-            connection_request_count++;
-            if (connection_request_count < 4) {
-                std::cout << "REGISTER NOK" << std::endl;
-                std::cout << "Trying to register again..." << std::endl;
-                request_op_code = REGISTER; // Retry registration
-            } else {
-                std::cout << "REGISTER NOK after 3 attempts" << std::endl;
-                std::cout << "Terminating connection..." << std::endl;
-                fatal_error_message = "Registration failed after 3 attempts"; // Log fatal error
-                request_op_code = TERMINATE_CONNECTION; // Set termination request
+// Reads the response header, then exactly the payload size it announces
+void Client::async_receive_response() {
+    std::cout << "Receiving response..." << std::endl;
+    boost::asio::async_read(socket, protocol.response_header_buffer(),
+        [this](const boost::system::error_code& error, size_t) {
+            if (error) {
+                stop_async("Error during data reception: " + error.message());
+                return;
             }
-            break;
-        case RECEIVE_AES_KEY: { // Handle received AES key
-            std::cout << "Analyzing AES key..." << std::endl;
-
-            // Extract the encrypted AES key from the payload
-            std::vector<uint8_t> encrypted_aes_key(payload.begin() + 16, payload.end());
+            boost::asio::mutable_buffer payload;
             try {
-                // Decrypt the AES key using the crypto key
-                crypto_key.decrypt_aes_key(encrypted_aes_key);
-                std::cout << "AES key decrypted successfully" << std::endl;
+                payload = protocol.response_payload_buffer();
             } catch (const std::exception& e) {
-                std::cout << "AES key decryption failed" << std::endl;
-                std::cerr << "Error: " << e.what() << std::endl;
-                request_op_code = TERMINATE_CONNECTION; // Set termination request due to error
-                break;
-            }
-            request_op_code = SENDING_FILE; // Proceed to send the file
-            break;
-        }
-        case FILE_RECEIVE_OK_AND_CRC: { // Handle file receipt confirmation and CRC check
-            std::cout << "Checking CRC32 checksum..." << std::endl;
-            uint32_t checksum = ntohl(*reinterpret_cast<const uint32_t*>(&payload[275])); // Extract checksum
-            // Verify the checksum using the crypto key
-            if (crypto_key.verify_checksum(checksum)) {
-                std::cout << "File received successfully" << std::endl;
-                request_op_code = CRC_OK; // Set request code for successful CRC
-            } else {
-                std::cout << "File not received successfully" << std::endl;
-                crc_not_ok_count++;
-                if (crc_not_ok_count < 4) {
-                    fatal_error_message = "File not received successfully CRC32 not equal to expected"; // Log error
-                    std::cout << "CRC NOT OK" << std::endl;
-                    request_op_code = CRC_NOT_OK; // Set request code for CRC failure
-                } else {
-                    std::cout << "CRC NOT OK after 4 attempts" << std::endl;
-                    fatal_error_message = "File not received successfully CRC32 not equal to expected after 4 attempts"; // Log fatal error
-                    std::cout << "Terminating connection..." << std::endl;
-                    request_op_code = CRC_TERMINATION; // Set termination request
-                }
+                stop_async(e.what());
+                return;
             }
-            break;
-        }
-        case MESSAGE_RECEIVE_OK: // Handle message receipt confirmation
-            if (crc_not_ok_count > 1 && crc_not_ok_count < 4) {
-                request_op_code = SENDING_FILE; // Retry sending the file
-            } else {
-                // Store the error message received in the payload
-                fatal_error_message = std::string(payload.begin() + 16, payload.end());
-                std::cout << "Message received successfully" << std::endl;
-                return false; // Indicate end of processing
-            }
-            break;
-        case RECONNECT_OK_SEND_AES: // Handle reconnection and send AES key
-            return handle_received_opCode(RECEIVE_AES_KEY); // Reuse AES key handling logic
-            break;
-        case RECONNECT_NOK: // Handle failed reconnection
-            reconnection_request_count++;
-            if (reconnection_request_count < 4) {
-                std::cout << "Reconnect failed" << std::endl;
-                request_op_code = RECONNECT; // Retry reconnection
-            } else {
-                std::cout << "Reconnect failed after 3 attempts" << std::endl;
-                std::cout << "Terminating connection..." << std::endl;
-                request_op_code = TERMINATE_CONNECTION; // Set termination request
-            }
-            break;
-        case GENERAL_ERROR: // Handle general error
-            std::cerr << "General error" << std::endl;
-            request_op_code = TERMINATE_CONNECTION; // Set termination request
-            break;
-    }
-
-    return true; // Indicate successful handling of the operation code
+            boost::asio::async_read(socket, payload,
+                [this](const boost::system::error_code& error, size_t) {
+                    if (error) {
+                        stop_async("Error during data reception: " + error.message());
+                        return;
+                    }
+                    std::cout << "Response received successfully!";
+                    // Continue with the next request, or end the session
+                    if (protocol.handle_response()) {
+                        async_send_request();
+                    } else {
+                        stop_async("");
+                    }
+                });
+        });
 }
 
-// Prepares the data to be sent based on the current operation code
-void Client::handle_sending_opCode(uint16_t op_code) {
-    payload.clear(); // Clear any existing payload data
-
-    switch(op_code) {
-        case REGISTER: // Prepare data for registration
-            add_to_payload(pad_string_to_255(client_name)); // Add client name to payload
-            std::cout << "Preparing registration request for client: " << client_name << std::endl;
-            break;
-
-        case SENDING_PUBLIC_KEY: { // Prepare data for sending the public key
-            add_to_payload(pad_string_to_255(client_name)); // Add client name to payload
-            std::vector<uint8_t> public_key = crypto_key.get_public_key_base64(); // Get public key
-            payload.insert(payload.end(), public_key.begin(), public_key.end()); // Add public key to payload
-
-            std::cout << "Sending public key" << std::endl;
-            break;
-        }
-
-        case RECONNECT: // Prepare data for reconnection
-            add_to_payload(pad_string_to_255(client_name)); // Add client name to payload
-            break;
-
-        case SENDING_FILE: { // Prepare data for sending a file
-            laod_file_content(); // Load the file content into memory
-            std::vector<uint8_t> decrypted_file_size = get_file_size(file_content); // Get size of the file
-            std::vector<uint8_t> encrypted_file = crypto_key.encrypt_file(file_content); // Encrypt the file content
-            std::vector<uint8_t> encrypted_file_size = get_file_size(encrypted_file); // Get size of the encrypted file
-
-            add_to_payload(encrypted_file_size); // Add encrypted file size to payload
-            add_to_payload(decrypted_file_size); // Add decrypted file size to payload
-            add_to_payload(pad_string_to_255(file_name)); // Add file name to payload
-            add_to_payload(encrypted_file); // Add encrypted file to payload
-
-            std::cout << "Preparing to send file: " << file_name << std::endl;
-            break;
-        }
-
-        case CRC_OK: // Handle successful CRC check
-            payload = std::vector<uint8_t>(file_name.begin(), file_name.end()); // Add file name to payload
-            break;
-
-        case CRC_NOT_OK: // Handle failed CRC check
-            payload = std::vector<uint8_t>(file_name.begin(), file_name.end()); // Add file name to payload
-            break;
-
-        case CRC_TERMINATION: // Handle termination due to CRC failure
-            payload = std::vector<uint8_t>(file_name.begin(), file_name.end()); // Add file name to payload
-            break;
-
-        case TERMINATE_CONNECTION: // Handle connection termination request
-            std::cout << "Termination request" << std::endl;
-            break;
-
-        default: // Handle unknown operation codes
-            std::cerr << "Unknown op_code: " << op_code << std::endl;
-            break;
+// Ends an asynchronous session; no further operation is started for this client
+void Client::stop_async(const std::string& error) {
+    if (!error.empty()) {
+        std::cerr << "Error during client start: " << error << std::endl;
     }
-
-    // Update the payload size after all data has been added
-    payload_size = uint32_t(payload.size());
-
-    // Load the header with the current request information
-    load_header();
-}
-
-
-void Client::load_header() {
-
-    header_buffer.clear();// Clear any existing data in the header_buffer
-    header_buffer.reserve(client_id.size() + sizeof(version) + sizeof(request_op_code) + sizeof(payload_size) + payload.size());
-
-    // Append client_id (as it's already a string of characters)
-    header_buffer.insert(header_buffer.end(), client_uuid.begin(), client_uuid.end());
-
-    // Append version (as a raw byte)
-    header_buffer.push_back(static_cast<uint8_t>(version));
-
-    // Append op_code (2 bytes, as it's a 16-bit integer)
-    header_buffer.push_back(static_cast<uint8_t>((request_op_code >> 8) & 0xFF));  // High byte
-    header_buffer.push_back(static_cast<uint8_t>(request_op_code & 0xFF));         // Low byte
-
-
-    // Append payload size (4 bytes, as it's a 32-bit integer)
-    header_buffer.push_back(static_cast<uint8_t>((payload_size >> 24) & 0xFF));  // Highest byte
-    header_buffer.push_back(static_cast<uint8_t>((payload_size >> 16) & 0xFF));  // High byte
-    header_buffer.push_back(static_cast<uint8_t>((payload_size >> 8) & 0xFF));   // Low byte
-    header_buffer.push_back(static_cast<uint8_t>(payload_size & 0xFF));          // Lowest byte
-
-    // Append the payload
-    header_buffer.insert(header_buffer.end(), payload.begin(), payload.end());
+    session_finished = true;
+    complete_session();
 }
 
-
-// Loads the content of the specified file into memory for sending
-void Client::laod_file_content() {
-    std::ifstream file(file_path, std::ios::binary); // Open the file in binary mode
-    if (!file.is_open()) { // Check if the file was opened successfully
-        std::cerr << "Error: Could not open the file" << std::endl; // Log an error message if not
-        return; // Exit the function if the file could not be opened
+// Calls the completion handler, once
+void Client::complete_session() {
+    if (completion_handler) {
+        std::function<void()> handler = std::move(completion_handler);
+        completion_handler = nullptr;
+        handler();
     }
-
-    // Update the file name based on the file path
-    file_name = file_path.substr(file_path.find_last_of("/\\") + 1);
-    file.seekg(0, std::ios::end); // Seek to the end of the file to determine its size
-    file_content.resize(file.tellg()); // Resize the vector to hold the file content
-    file.seekg(0, std::ios::beg); // Seek back to the beginning of the file
-
-    // Read the file content into the vector
-    file.read(reinterpret_cast<char*>(file_content.data()), file_content.size());
-    file.close(); // Close the file after reading
 }
 
-
-// Returns the size of the given file content as a vector of bytes
-std::vector<uint8_t> Client::get_file_size(std::vector<uint8_t> file_content) {
-    uint32_t file_size = file_content.size(); // Get the size of the file content
-    std::vector<uint8_t> size; // Vector to hold the size in byte format
-
-    // Convert the file size into a 4-byte representation
-    size.push_back(static_cast<uint8_t>((file_size >> 24) & 0xFF));  // Highest byte
-    size.push_back(static_cast<uint8_t>((file_size >> 16) & 0xFF));  // High byte
-    size.push_back(static_cast<uint8_t>((file_size >> 8) & 0xFF));   // Low byte
-    size.push_back(static_cast<uint8_t>(file_size & 0xFF));          // Lowest byte
-
-    return size; // Return the byte representation of the file size
-}
-
-// Adds a vector of data to the payload for sending
-void Client::add_to_payload(std::vector<uint8_t> data) {
-    payload.insert(payload.end(), data.begin(), data.end()); // Append the data to the payload
-}
-
-// Creates a file containing the client's information (name, UUID, private key)
-void Client::create_me_file() {
-    std::cout << "Creating me file" << std::endl; // Log the start of the file creation
-    std::ofstream file("me.info", std::ios::trunc); // Create or truncate the file for writing
-
-    if (!file.is_open()) { // Check if the file was opened successfully
-        std::cerr << "Error: Could not open the file" << std::endl; // Log an error message if not
-        throw std::invalid_argument("Error: Could not open the file"); // Throw an exception if the file cannot be opened
+// Receives one response from the server: exactly the 7-byte header, then exactly the payload size it
+// announces, however the bytes are split into TCP segments
+void Client::receive_response() {
+    try {
+        boost::asio::read(socket, protocol.response_header_buffer());
+        boost::asio::read(socket, protocol.response_payload_buffer());
+    } catch (const std::exception& e) {
+        std::cerr << "Error during data reception: " << e.what() << std::endl;
+        throw;
     }
-
-    std::cout << "me file created" << std::endl; // Log that the file has been created
-
-    // Write the client information to the file
-    file << client_name << std::endl; // Write the client name
-    file << client_uuid << std::endl; // Write the client UUID
-    file << crypto_key.get_private_key() << std::endl; // Write the client's private key
-    file.close(); // Close the file after writing
 }
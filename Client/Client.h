@@ -4,26 +4,34 @@
 
 #ifndef MAMAN14_CLIENT_H
 #define MAMAN14_CLIENT_H
+#include <functional>
+#include <string>
 #include <vector>
 #include <boost/asio.hpp>
-#include <filesystem>
-#include <iostream>
-#include <string>
-#include <boost/uuid/uuid.hpp>
-#include <boost/uuid/uuid_io.hpp>
-#include <boost/uuid/uuid_generators.hpp>
-#include <boost/lexical_cast.hpp>
-#include <boost/uuid/uuid_serialize.hpp>
-#include <fstream>
-#include <winsock2.h>
-#include "CryptoPPKey.h"
-#include <filesystem>
+#include "ClientConfig.h"
+#include "DirectoryWatcher.h"
+#include "SessionProtocol.h"
+#include "ThreadPool.h"
 
 using boost::asio::ip::tcp;
 
+// Runs the session of SessionProtocol on a connected socket: writes each request it prepares, with the
+// body through the engine chosen for it, and reads each response back into it, blocking or on the
+// socket's io_context.
 class Client {
 public:
-    explicit Client(tcp::socket& socket);
+    static constexpr size_t DEFAULT_STREAM_BLOCK_SIZE = SessionProtocol::DEFAULT_STREAM_BLOCK_SIZE;
+    using FileStatus = SessionProtocol::FileStatus; // Outcome of each file of the batch, printed in the summary
+
+    // Runs a session of the client described by `config` on the connected socket.
+    // With `pipelined` set, reading, encrypting and sending the file run on three threads.
+    // Clients running side by side can share `shared_pool`, otherwise the client starts its own.
+    Client(tcp::socket& socket, ClientConfig config, size_t stream_block_size = DEFAULT_STREAM_BLOCK_SIZE,
+           bool pipelined = false, ThreadPool* shared_pool = nullptr);
+
+    // Takes its configuration from the working directory, see ClientConfig::from_working_directory()
+    explicit Client(tcp::socket& socket, size_t stream_block_size = DEFAULT_STREAM_BLOCK_SIZE, bool pipelined = false,
+                    ThreadPool* shared_pool = nullptr);
     ~Client();
 
     // Deleted copy constructor and assignment operator
@@ -32,81 +40,67 @@ public:
 
     void start();
 
+    // Runs the session on the socket's io_context: returns at once, and the session progresses
+    // while the io_context runs. The client must outlive the run.
+    void start_async();
+    bool is_finished() const;
+
+    // Sends every file, even the ones unchanged since the server acknowledged them
+    void set_skip_unchanged(bool skip);
+
+    // Maps the files into memory instead of reading them with std::ifstream. A file truncated while it is
+    // mapped raises SIGBUS, so this is for files nothing writes to during the upload: it is off by
+    // default, and never used for the files of a directory watcher.
+    void set_mapped_input(bool mapped);
+
+    // Sends the file bodies through io_uring on Linux builds with liburing, falls back otherwise
+    void set_io_uring(bool enabled);
+
+    // Offers to compress the files that compress well before they are encrypted
+    void set_compression(bool enabled);
+
+    // Sends files of at least StripedUpload::MIN_FILE_SIZE over up to max_streams extra connections
+    // in blocking sessions; 0 sends every file over the main connection
+    void set_striping(size_t max_streams);
+
+    // Sends the files of a batch over the main connection at once, with up to max_streams of them
+    // interleaved, in blocking sessions; 0 sends them one after the other
+    void set_multiplexing(size_t max_streams);
+
+    // Keeps the session open when the batch ends and sends the files the watcher hands out next, in
+    // blocking sessions. The session ends once the watcher is stopped, or after one file if the server
+    // does not accept FEATURE_BATCH; files taken from the watcher and not sent are given back to it.
+    void set_watcher(DirectoryWatcher* watcher);
+
+    // Files verified in this session, including the ones confirmed unchanged by their checksum
+    size_t get_verified_count() const;
+
+    // Called once when the session ends, after start() or from the last handler of start_async();
+    // the client must not be destroyed from the handler
+    void set_completion_handler(std::function<void()> handler);
+
+    // Files of the current batch and their outcome, in the same order
+    const std::vector<std::string>& get_file_paths() const;
+    const std::vector<FileStatus>& get_file_statuses() const;
+
 private:
-    enum ClientRequestCode : uint16_t {
-        REGISTER = 825,
-        SENDING_PUBLIC_KEY = 826,
-        RECONNECT = 827,
-        SENDING_FILE = 828,
-        CRC_OK = 900,
-        CRC_NOT_OK = 901,
-        CRC_TERMINATION = 902,
-        TERMINATE_CONNECTION = 903
-    };
-
-    enum ServerResponseCode : uint16_t {
-        REGISTER_OK = 1600,
-        REGISTER_NOK = 1601,
-        RECEIVE_AES_KEY = 1602,
-        FILE_RECEIVE_OK_AND_CRC = 1603,
-        MESSAGE_RECEIVE_OK = 1604,
-        RECONNECT_OK_SEND_AES = 1605,
-        RECONNECT_NOK = 1606,
-        GENERAL_ERROR = 1607
-    };
-
-    static constexpr size_t MAX_RETRIES = 3;
-    static constexpr size_t CHUNK_SIZE = 1024;
-    static constexpr uint8_t CLIENT_VERSION = 100;
-    static constexpr size_t HEADER_SIZE = 23; // 16 (UUID) + 1 (version) + 2 (op code) + 4 (payload size)
-
-
-    // Core member variables
     tcp::socket& socket;
-    boost::uuids::uuid client_uuid;
-    CryptoPPKey crypto_key;
-
-
-    // State variables
-    std::string client_name;
-    std::string file_path;
-    std::string file_name;
-    std::vector<uint8_t> file_content;
-    std::vector<uint8_t> payload;
-    uint16_t request_op_code;
-    uint16_t received_op_code;
-    uint32_t payload_size;
-    std::string fatal_error_message;
-    std::vector<uint8_t> header_buffer;
-    std::vector<uint8_t> client_id;
-    uint8_t version;
-
-    // Retry counters
-    int connection_request_count = 1;
-    int crc_not_ok_count = 1;
-    int reconnection_request_count = 1;
-
-
-
-    // Helper functions
-    void get_data_from_me_file();
-    void get_data_from_transfer_file();
-    std::vector<std::string> get_file_data(const std::string& file_name);
-    std::vector<uint8_t> pad_string_to_255(const std::string& name_str);
-    void laod_file_content();
-    std::vector<uint8_t> get_file_size(std::vector<uint8_t> file_content);
-
-    void send_data_by_chunks();
-    std::vector<uint8_t> receive_data_by_chunks();
-
-    void handle_sending_opCode(uint16_t op_code);
-    bool handle_received_opCode(uint16_t request_code);
-    void manage_client_flow();
-    void load_header();
-
-    void parse_response(const std::vector<uint8_t>& response);
-    void add_to_payload(std::vector<uint8_t> data);
-    void create_me_file();
+    SessionProtocol protocol; // Prepares every request and handles every response
+    bool pipelined;
+    bool use_io_uring = false; // Send file bodies through UringUpload where io_uring is available
+    uint64_t body_bytes_sent = 0; // Bytes of the body sent by the asynchronous engine
+    bool session_finished = false;
+    std::function<void()> completion_handler;
+
+    void send_request();
+    void receive_response();
+
+    void async_send_request();
+    void async_send_body_block();
+    void async_send_commit_trailer();
+    void async_receive_response();
+    void stop_async(const std::string& error);
+    void complete_session();
 };
 
 
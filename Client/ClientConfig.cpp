@@ -0,0 +1,127 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+// ClientConfig.cpp
+
+#include "ClientConfig.h"
+#include "CryptoPPKey.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <boost/uuid/uuid.hpp>
+#include <boost/uuid/uuid_generators.hpp>
+#include <boost/uuid/uuid_io.hpp>
+
+namespace {
+    // Reads a file and returns its lines, or no line if it cannot be opened
+    std::vector<std::string> get_file_data(const std::string& file_name) {
+        std::ifstream file(file_name);
+        if (!file.is_open()) {
+            std::cerr << "Error: Could not open file '" << file_name << "'." << std::endl;
+            return {};
+        }
+
+        std::vector<std::string> data;
+        std::string line;
+
+        // Read each line of the file and store it in the data vector
+        while (std::getline(file, line)) {
+            data.push_back(line);
+        }
+        return data;
+    }
+
+    // Adds the file paths listed in a manifest file, one per line
+    void add_manifest_files(const std::string& manifest_path, std::vector<std::string>& files) {
+        std::ifstream manifest(manifest_path);
+        if (!manifest.is_open()) {
+            throw std::runtime_error("Could not open the manifest: " + manifest_path);
+        }
+        std::string line;
+        while (std::getline(manifest, line)) {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back(); // Manifests written on Windows
+            }
+            if (!line.empty()) {
+                files.push_back(line);
+            }
+        }
+    }
+}
+
+std::string ClientConfig::state_path(const std::string& file_name) const {
+    if (state_directory.empty()) {
+        return "";
+    }
+    return (std::filesystem::path(state_directory) / file_name).string();
+}
+
+/**
+ * @brief Reads the configuration of the command-line client from the working directory.
+ *
+ * The second line of transfer.info is the client name, and every line after it a file path, or a
+ * manifest listing one path per line if it starts with '@'. With a directory watcher the files may all
+ * come from it, so the file lines are optional. If me.info exists the client is registered: its name and
+ * id are taken from there. The private key is the one saved by an earlier run, if any.
+ *
+ * @throws std::runtime_error if transfer.info or me.info is invalid, or a manifest cannot be read.
+ */
+ClientConfig ClientConfig::from_working_directory() {
+    ClientConfig config;
+    config.state_directory = ".";
+    config.save_identity = true;
+
+    std::cout << "Loading transfer info" << std::endl;
+    std::vector<std::string> data = get_file_data("transfer.info");
+    if (data.size() < 2) {
+        throw std::runtime_error("Invalid transfer.info file format");
+    }
+    std::cout << "Reading from transfer file..." << std::endl;
+
+    // The second line is the client name, the following lines are file paths or manifests
+    config.name = data[1];
+    for (size_t i = 2; i < data.size(); i++) {
+        if (data[i].empty()) {
+            continue;
+        }
+        if (data[i][0] == '@') {
+            add_manifest_files(data[i].substr(1), config.files);
+        } else {
+            config.files.push_back(data[i]);
+        }
+    }
+    if (config.files.empty()) {
+        std::cout << "Loaded transfer info - Client name: " << config.name << ", no file path" << std::endl;
+    } else {
+        std::cout << "Loaded transfer info - Client name: " << config.name << ", File path: " << config.files[0];
+        if (config.files.size() > 1) {
+            std::cout << " and " << config.files.size() - 1 << " more";
+        }
+        std::cout << std::endl;
+    }
+
+    // me.info (name, UUID and private key) exists once the client registered
+    if (std::filesystem::exists("me.info")) {
+        std::cout << "Found existing client info, attempting to reconnect" << std::endl;
+        std::vector<std::string> me = get_file_data("me.info");
+        if (me.size() < 3) {
+            throw std::runtime_error("Invalid me.info file format");
+        }
+        config.name = me[0];
+        std::cout << "Client name: " << config.name << std::endl;
+        try {
+            boost::uuids::uuid uuid = boost::uuids::string_generator()(me[1]);
+            config.client_id.emplace();
+            std::copy(uuid.begin(), uuid.end(), config.client_id->begin());
+            std::cout << "Loaded client info - Client name: " << config.name << ", UUID: " << uuid << std::endl;
+        } catch (const std::exception& e) {
+            throw std::runtime_error("Error parsing UUID from me.info file");
+        }
+    }
+    // The key files hold the key of a registration that did not complete too, so it is sent again
+    config.private_key = CryptoPPKey::read_saved_key(config.state_directory);
+    return config;
+}
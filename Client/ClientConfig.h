@@ -0,0 +1,52 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+#ifndef MAMAN15_CLIENTCONFIG_H
+#define MAMAN15_CLIENTCONFIG_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Identity, key material and files of a client, passed to it instead of being read from the working
+// directory. A client with a client id reconnects with its private key; one without registers its name,
+// and reports the id and the key it registered with through on_registered, for the caller to keep.
+//
+// The upload index and the session ticket are kept in state_directory; with no state directory they
+// live in memory and end with the session. from_working_directory() reads the files of the command-line
+// client (transfer.info, me.info and the key files) into a config that keeps its state in the working
+// directory, as it always did.
+struct ClientConfig {
+    static constexpr size_t CLIENT_ID_SIZE = 16;
+    using ClientId = std::array<uint8_t, CLIENT_ID_SIZE>;
+
+    std::string name; // Registered name, up to 254 characters
+    std::optional<ClientId> client_id; // Id the server registered the client under, unset to register
+    std::string private_key; // Base64 X25519 or RSA private key, empty to generate one
+    std::vector<std::string> files; // Files of the first batch
+    // Register an X25519 key instead of an RSA key, so the session key is agreed rather than sent
+    // encrypted. Saves the client the RSA key generation and the server the RSA encryption.
+    bool key_agreement = true;
+
+    std::string state_directory; // Upload index and session ticket, empty to keep them in memory
+    bool save_identity = false; // Write me.info and the generated keys to the state directory
+
+    // Called once the server registered the client, with the name, the id and the private key it was
+    // registered with; on the thread running the session
+    std::function<void(const ClientConfig& identity)> on_registered;
+
+    // Path of a state file, or an empty string if the state is kept in memory
+    std::string state_path(const std::string& file_name) const;
+
+    // Reads transfer.info (line 2 the name, then file paths or '@' manifests), me.info and the saved key
+    // of the working directory. Throws std::runtime_error if transfer.info is missing or invalid.
+    static ClientConfig from_working_directory();
+};
+
+
+#endif //MAMAN15_CLIENTCONFIG_H
@@ -0,0 +1,51 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+#ifndef MAMAN15_CRC32_H
+#define MAMAN15_CRC32_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// CRC32 of the POSIX cksum utility (polynomial 0x04C11DB7, MSB first, length appended).
+// This is the checksum the server returns in FILE_RECEIVE_OK_AND_CRC.
+//
+// A checksum is computed in two steps: update() feeds data into a running state that
+// starts at 0, and finalize() appends the total length. States of consecutive ranges
+// can be merged with combine(), so separate ranges of a file can be checksummed on
+// separate threads.
+class Crc32 {
+public:
+    // Feeds data into a running state. Uses a carry-less multiply folding kernel when the
+    // CPU supports it and slicing-by-8 tables otherwise.
+    static uint32_t update(uint32_t state, const uint8_t* data, size_t length);
+
+    // Appends the total length to the state and returns the final checksum
+    static uint32_t finalize(uint32_t state, uint64_t length);
+
+    // Returns the state of range A followed by range B, where state_b was computed
+    // starting from 0 over the length_b bytes of range B
+    static uint32_t combine(uint32_t state_a, uint32_t state_b, uint64_t length_b);
+
+    // Checksum of a whole buffer
+    static uint32_t checksum(const uint8_t* data, size_t length);
+
+    // Checksum of a whole buffer, computed on up to thread_count threads
+    static uint32_t checksum_parallel(const uint8_t* data, size_t length, unsigned thread_count);
+
+    // Name of the kernel selected for this CPU ("vpclmulqdq", "pclmulqdq" or "slicing-by-8")
+    static const char* kernel_name();
+
+    // Names of the kernels this CPU supports, fastest first; update() uses the first one
+    static std::vector<std::string> supported_kernels();
+
+    // Feeds data into a running state with the named kernel, so the kernels can be checked against
+    // each other. Throws std::invalid_argument if the CPU does not support it.
+    static uint32_t update_with(const std::string& kernel_name, uint32_t state, const uint8_t* data, size_t length);
+};
+
+
+#endif //MAMAN15_CRC32_H
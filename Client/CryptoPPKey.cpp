@@ -5,49 +5,261 @@
 // CryptoPPKey.cpp
 
 #include "CryptoPPKey.h"
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <mutex>
 
 // Constants for key generation
 #define MODULUS_BITS_SIZE 1024 // Size of the RSA modulus in bits
 #define DEFAULT_KEY_LENGTH 32   // Default length for AES key
+#define AGREEMENT_KEY_FILE "x25519.key" // X25519 private key of a client that agrees the session key
+#define PRIVATE_KEY_FILE "priv.key" // RSA private key of a client
+#define SESSION_KEY_INFO "MAMAN15 session key" // HKDF context of the agreed AES key and IV, as on the server
+#define RESUMPTION_INFO "MAMAN15 resumption secret" // HKDF context of the secret a session ticket resumes with
+#define RESUMPTION_SECRET_SIZE 32
 
 using namespace CryptoPP;
 
+namespace {
+    std::mutex pending_key_mutex;
+    std::future<RSA::PrivateKey> pending_key; // Started by prepare_key_pair(), taken by the first CryptoPPKey that needs it
+
+    RSA::PrivateKey generate_private_key() {
+        AutoSeededRandomPool rng; // Random number generator
+        RSA::PrivateKey key;
+        key.Initialize(rng, MODULUS_BITS_SIZE); // Initialize the private key
+        return key;
+    }
+
+    // Starts generating a key pair on a background thread, unless one is already being generated
+    void start_key_generation() {
+        std::lock_guard<std::mutex> lock(pending_key_mutex);
+        if (!pending_key.valid()) {
+            pending_key = std::async(std::launch::async, generate_private_key);
+        }
+    }
+
+    // Takes the key pair being generated in the background, starting it if none is
+    std::shared_future<RSA::PrivateKey> take_key_generation() {
+        start_key_generation();
+        std::lock_guard<std::mutex> lock(pending_key_mutex);
+        return pending_key.share();
+    }
+}
+
 /**
  * @brief Constructor for CryptoPPKey.
  *
- * This constructor initializes the CryptoPPKey object. It first checks if the private key file
- * already exists. If it does, the private key is loaded from the file and decoded from Base64,
- * and the corresponding public key is generated. If the file does not exist, a new RSA key pair
- * is generated, and the private key is saved to a file.
- */
-CryptoPPKey::CryptoPPKey() {
-    // Check if the private key file already exists
-    if (std::filesystem::exists("priv.key")) {
-        // Load the private key from the file and decode it from Base64
-        StringSource ss(get_private_key_from_private_file(), true, new Base64Decoder);
-        privateKey.Load(ss); // Load the private key
+ * The private key of the client is passed in, in Base64, as read_saved_key() returns it. A 32-byte key
+ * is the X25519 key of a client registered with it, which needs no RSA key pair. Any other key is an
+ * RSA private key, and the corresponding public key is generated. Without a key, no RSA key pair is
+ * generated here: a client that registers an X25519 key never needs one, and the others generate it,
+ * or take the one started by prepare_key_pair(), once it is needed (see await_key_pair()).
+ *
+ * @param private_key The Base64-encoded private key, or empty for a client without one.
+ * @param key_directory Directory the generated keys are saved to, or empty to keep them in memory only.
+ */
+CryptoPPKey::CryptoPPKey(const std::string& private_key, std::string key_directory)
+        : key_directory(std::move(key_directory)) {
+    checksum = 0; // Initialize checksum
+
+    if (!private_key.empty()) {
+        std::string decoded;
+        StringSource ss(private_key, true, new Base64Decoder(new StringSink(decoded)));
+        if (decoded.size() == x25519::SECRET_KEYLENGTH) {
+            agreement_private_key = SecByteBlock(reinterpret_cast<const byte*>(decoded.data()), decoded.size());
+            AutoSeededRandomPool rng;
+            agreement_public_key = SecByteBlock(x25519::PUBLIC_KEYLENGTH);
+            x25519().GeneratePublicKey(rng, agreement_private_key, agreement_public_key);
+            key_agreement = true;
+            std::cout << "X25519 Key Pair loaded successfully.\n";
+            return;
+        }
+        StringSource key_source(decoded, true);
+        privateKey.Load(key_source); // Load the private key
         publicKey = CryptoPP::RSA::PublicKey(privateKey); // Generate the corresponding public key
-        checksum = 0; // Initialize checksum
-        crc32 = boost::crc_32_type(); // Initialize CRC32 calculator
+        key_pair_ready = true;
         std::cout << "RSA Key Pair loaded successfully.\n"; // Notify successful key loading
-        return; // Exit the constructor
     }
+}
+
+/**
+ * @brief Reads the private key saved in a key directory.
+ *
+ * @return The Base64-encoded X25519 key if the client agrees the session key, otherwise the RSA key,
+ * or an empty string if neither file exists.
+ */
+std::string CryptoPPKey::read_saved_key(const std::string& key_directory) {
+    for (const char* name : {AGREEMENT_KEY_FILE, PRIVATE_KEY_FILE}) {
+        std::ifstream key_file(std::filesystem::path(key_directory) / name);
+        if (!key_file.is_open()) {
+            continue;
+        }
+        std::string encoded;
+        std::string line;
+        while (std::getline(key_file, line)) { // Read the file line by line
+            encoded += line;
+        }
+        return encoded;
+    }
+    return "";
+}
+
+/**
+ * @brief Starts preparing the key pair of a client that has no saved key.
+ *
+ * A key pair from the pool is claimed by renaming its file to priv.key, which is atomic, so clients
+ * provisioned at the same time never share a key pair; the constructor then loads it like a saved key.
+ * If the pool is empty or missing, the key pair is generated on a background thread. A client that
+ * registers an X25519 key needs no RSA key pair, so it leaves the pool alone.
+ *
+ * @param key_pool_dir Directory filled by fill_key_pool(), or empty to always generate the key pair.
+ * @param key_agreement True if the client registers an X25519 key instead of an RSA key.
+ */
+void CryptoPPKey::prepare_key_pair(const std::string& key_pool_dir, bool key_agreement) {
+    if (std::filesystem::exists(PRIVATE_KEY_FILE) || std::filesystem::exists(AGREEMENT_KEY_FILE)) {
+        return; // The saved key is loaded by the constructor
+    }
+    if (key_agreement) {
+        return; // The X25519 key is generated when the client registers, far faster than an RSA key pair
+    }
+    if (!key_pool_dir.empty()) {
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator(key_pool_dir, error)) {
+            if (entry.path().extension() == ".key") {
+                std::filesystem::rename(entry.path(), PRIVATE_KEY_FILE, error);
+                if (!error) {
+                    std::cout << "RSA Key Pair taken from " << entry.path().string() << std::endl;
+                    return;
+                }
+            }
+        }
+        std::cout << "No key pair left in " << key_pool_dir << ", generating one" << std::endl;
+    }
+    start_key_generation();
+}
+
+/**
+ * @brief Fills a key pool with freshly generated RSA key pairs, for clients that register an RSA key.
+ *
+ * Each key pair is written to a temporary file and renamed into place, so a client never claims
+ * a key pair that is still being written.
+ *
+ * @param key_pool_dir The directory of the pool, created if it does not exist.
+ * @param count The number of key pairs to add.
+ * @param pool Threads the key pairs are generated on.
+ */
+void CryptoPPKey::fill_key_pool(const std::string& key_pool_dir, size_t count, ThreadPool& pool) {
+    std::filesystem::create_directories(key_pool_dir);
+    auto run_id = std::chrono::system_clock::now().time_since_epoch().count(); // Keeps the names of earlier fills apart
+    std::atomic<size_t> written{0};
+    pool.run_batch(count, [&](size_t index) {
+        RSA::PrivateKey key = generate_private_key();
+        std::string encoded;
+        Base64Encoder encoder(new StringSink(encoded)); // Base64 encode the private key, as in priv.key
+        key.DEREncode(encoder);
+        encoder.MessageEnd();
+
+        std::filesystem::path path = std::filesystem::path(key_pool_dir) / (std::to_string(run_id) + "-" + std::to_string(index) + ".key");
+        std::filesystem::path temp_path = path;
+        temp_path += ".tmp";
+        std::ofstream file(temp_path, std::ios::trunc);
+        if (!(file << encoded)) {
+            throw std::runtime_error("Failed to write " + temp_path.string());
+        }
+        file.close();
+        std::filesystem::rename(temp_path, path);
+        written++;
+    });
+    std::cout << "Added " << written << " key pairs to " << key_pool_dir << std::endl;
+}
 
-    // Generate a new RSA key pair if the file does not exist
-    CryptoPP::AutoSeededRandomPool rng; // Random number generator
-    privateKey.Initialize(rng, MODULUS_BITS_SIZE); // Initialize the private key
+/**
+ * @brief Waits for the key pair generated in the background and saves it to the private key file.
+ *
+ * Called before the key pair is first used; does nothing once the key pair is there. If its generation
+ * was not started yet, by prepare_key_pair() or drop_key_agreement(), it is started here and waited for.
+ */
+void CryptoPPKey::await_key_pair() {
+    if (key_pair_ready) {
+        return;
+    }
+    if (!pending_key_pair.valid()) {
+        pending_key_pair = take_key_generation();
+    }
+    privateKey = pending_key_pair.get(); // Rethrows if the generation failed
+    pending_key_pair = {};
     publicKey = CryptoPP::RSA::PublicKey(privateKey); // Generate the public key
+    key_pair_ready = true;
     std::cout << "RSA Key Pair generated successfully.\n"; // Notify successful key generation
-    checksum = 0; // Initialize checksum
-    crc32 = boost::crc_32_type(); // Initialize CRC32 calculator
-    make_private_file(); // Create a file to store the private key
+    if (!key_directory.empty()) {
+        make_private_file(); // Create a file to store the private key
+    }
 }
 
 // Destructor for CryptoPPKey
 CryptoPPKey::~CryptoPPKey() {
 
 }
+
+/**
+ * @brief Makes the X25519 key pair the identity of the client.
+ *
+ * A new key pair takes microseconds to generate, unlike an RSA key pair, and is saved to its file
+ * in the key directory right away, so a registration retried on the next run sends the same key.
+ */
+void CryptoPPKey::use_key_agreement() {
+    if (agreement_private_key.size() == 0) {
+        AutoSeededRandomPool rng;
+        agreement_private_key = SecByteBlock(x25519::SECRET_KEYLENGTH);
+        agreement_public_key = SecByteBlock(x25519::PUBLIC_KEYLENGTH);
+        x25519().GenerateKeyPair(rng, agreement_private_key, agreement_public_key);
+
+        if (!key_directory.empty()) {
+            std::ofstream agreement_file(std::filesystem::path(key_directory) / AGREEMENT_KEY_FILE, std::ios::trunc);
+            if (!(agreement_file << get_agreement_private_key())) {
+                throw std::runtime_error("Failed to write " AGREEMENT_KEY_FILE);
+            }
+        }
+        std::cout << "X25519 Key Pair generated successfully.\n";
+    }
+    key_agreement = true;
+}
+
+/**
+ * @brief Goes back to the RSA key pair and removes the X25519 key file, so later runs do not
+ * offer the agreement to a server that registered the RSA key. The RSA key pair is started in the
+ * background, and generated while the registration goes on.
+ */
+void CryptoPPKey::drop_key_agreement() {
+    key_agreement = false;
+    if (!key_pair_ready && !pending_key_pair.valid()) {
+        pending_key_pair = take_key_generation();
+    }
+    if (!key_directory.empty()) {
+        std::error_code error;
+        std::filesystem::remove(std::filesystem::path(key_directory) / AGREEMENT_KEY_FILE, error);
+    }
+}
+
+// Returns true if the session key is agreed with the X25519 key pair
+bool CryptoPPKey::uses_key_agreement() const {
+    return key_agreement;
+}
+
+// Returns the raw X25519 public key, sent instead of the RSA public key when the session key is agreed
+std::vector<uint8_t> CryptoPPKey::get_agreement_public_key() const {
+    return std::vector<uint8_t>(agreement_public_key.begin(), agreement_public_key.end());
+}
+
+// Returns the X25519 private key in Base64 format, as saved to its file
+std::string CryptoPPKey::get_agreement_private_key() const {
+    std::string encoded;
+    StringSource ss(agreement_private_key.data(), agreement_private_key.size(), true, new Base64Encoder(new StringSink(encoded), false));
+    return encoded;
+}
 /**
  * @brief Retrieves the public key in Base64 format.
  *
@@ -57,6 +269,7 @@ CryptoPPKey::~CryptoPPKey() {
  * @return A vector of uint8_t containing the Base64-encoded public key.
  */
 std::vector<uint8_t> CryptoPPKey::get_public_key_base64() {
+    await_key_pair();
     std::string publicKeyStr; // String to hold the Base64-encoded public key
 
     // Base64 encode the public key (DER format)
@@ -79,6 +292,7 @@ std::vector<uint8_t> CryptoPPKey::get_public_key_base64() {
  * @return A string containing the Base64-encoded private key.
  */
 std::string CryptoPPKey::get_private_key() {
+    await_key_pair();
     std::string privateKeyStr; // String to hold the Base64-encoded private key
     Base64Encoder encoder(new StringSink(privateKeyStr)); // Base64 encode the private key
     privateKey.DEREncode(encoder); // Encode the private key in DER format
@@ -97,6 +311,7 @@ std::string CryptoPPKey::get_private_key() {
  * @throws std::runtime_error if the AES key decryption fails.
  */
 void CryptoPPKey::decrypt_aes_key(const std::vector<uint8_t>& encrypted_aes_key) {
+    await_key_pair();
     AutoSeededRandomPool rng; // Random number generator
 
     // Decrypt AES key using private RSA key
@@ -122,78 +337,190 @@ void CryptoPPKey::decrypt_aes_key(const std::vector<uint8_t>& encrypted_aes_key)
 }
 
 /**
- * @brief Encrypts a file using AES and returns the encrypted content.
+ * @brief Derives the AES key and IV agreed with the server.
  *
- * This function encrypts the provided file content using AES encryption in CBC mode.
- * It first ensures that the AES key and IV are set, calculates the CRC32 checksum of the file content,
- * and then performs the encryption. The encrypted content is returned as a vector of uint8_t.
+ * The server generates an X25519 key pair for every session and sends its public key. The shared
+ * secret of that key and the client's private key is expanded with HKDF-SHA256, salted with the
+ * client ID, into the AES key and IV, as the server does.
  *
- * @param file_content A vector of uint8_t containing the content of the file to be encrypted.
- * @return A vector of uint8_t containing the encrypted content of the file.
- * @throws std::runtime_error if the AES key or IV is not set, or if an error occurs during encryption.
+ * @param server_public_key The server's raw X25519 public key.
+ * @param client_id The client ID, 16 bytes.
+ * @throws std::runtime_error if the server's public key is invalid.
  */
-std::vector<uint8_t> CryptoPPKey::encrypt_file(const std::vector<uint8_t>& file_content) {
-    // Ensure the AES key and IV are set
+void CryptoPPKey::derive_aes_key(const std::vector<uint8_t>& server_public_key, const std::vector<uint8_t>& client_id) {
+    if (server_public_key.size() != x25519::PUBLIC_KEYLENGTH || agreement_private_key.size() == 0) {
+        throw std::runtime_error("X25519 key agreement failed");
+    }
+    SecByteBlock shared_secret(x25519::SHARED_KEYLENGTH);
+    if (!x25519().Agree(shared_secret, agreement_private_key, server_public_key.data())) {
+        throw std::runtime_error("Invalid X25519 public key from the server");
+    }
+
+    SecByteBlock key_material(DEFAULT_KEY_LENGTH + AES::BLOCKSIZE);
+    HKDF<CryptoPP::SHA256>().DeriveKey(key_material, key_material.size(), shared_secret, shared_secret.size(),
+                             client_id.data(), client_id.size(),
+                             reinterpret_cast<const byte*>(SESSION_KEY_INFO), sizeof(SESSION_KEY_INFO) - 1);
+    aes_key = SecByteBlock(key_material.data(), DEFAULT_KEY_LENGTH);
+    aes_iv = SecByteBlock(key_material.data() + DEFAULT_KEY_LENGTH, AES::BLOCKSIZE);
+}
+
+/**
+ * @brief Derives the resumption secret of a session ticket issued in this session.
+ *
+ * The server derives the same secret from the AES key and IV and seals it in the ticket, so the
+ * secret itself is never sent.
+ *
+ * @param client_id The client ID, 16 bytes.
+ * @return The resumption secret.
+ * @throws std::runtime_error if the AES key or IV is not set.
+ */
+std::vector<uint8_t> CryptoPPKey::get_resumption_secret(const std::vector<uint8_t>& client_id) const {
     if (aes_key.size() == 0 || aes_iv.size() == 0) {
         throw std::runtime_error("AES key or IV is not set.");
-        return {};
     }
-    // Calculate the CRC32 checksum of the file content
-    calculate_checksum(file_content);
+    SecByteBlock key_iv(aes_key.size() + aes_iv.size());
+    std::memcpy(key_iv.data(), aes_key.data(), aes_key.size());
+    std::memcpy(key_iv.data() + aes_key.size(), aes_iv.data(), aes_iv.size());
 
-    AutoSeededRandomPool rng; // Random number generator
-    std::vector<uint8_t> encrypted_data; // Vector to hold the encrypted data
+    std::vector<uint8_t> secret(RESUMPTION_SECRET_SIZE);
+    HKDF<CryptoPP::SHA256>().DeriveKey(secret.data(), secret.size(), key_iv, key_iv.size(),
+                                       client_id.data(), client_id.size(),
+                                       reinterpret_cast<const byte*>(RESUMPTION_INFO), sizeof(RESUMPTION_INFO) - 1);
+    return secret;
+}
 
-    // Set up AES encryption in CBC mode
-    CBC_Mode<AES>::Encryption aesEncryptor;
-    aesEncryptor.SetKeyWithIV(aes_key, aes_key.size(), aes_iv);
+/**
+ * @brief Derives the AES key and IV of a session resumed with a ticket.
+ *
+ * The resumption secret is expanded with HKDF-SHA256, salted with the nonces of the client and the
+ * server, so every resumed session has its own key; no public-key operation is involved.
+ *
+ * @param resumption_secret The secret saved with the ticket.
+ * @param nonces The client's nonce followed by the server's.
+ */
+void CryptoPPKey::resume_aes_key(const std::vector<uint8_t>& resumption_secret, const std::vector<uint8_t>& nonces) {
+    SecByteBlock key_material(DEFAULT_KEY_LENGTH + AES::BLOCKSIZE);
+    HKDF<CryptoPP::SHA256>().DeriveKey(key_material, key_material.size(), resumption_secret.data(), resumption_secret.size(),
+                                       nonces.data(), nonces.size(),
+                                       reinterpret_cast<const byte*>(SESSION_KEY_INFO), sizeof(SESSION_KEY_INFO) - 1);
+    aes_key = SecByteBlock(key_material.data(), DEFAULT_KEY_LENGTH);
+    aes_iv = SecByteBlock(key_material.data() + DEFAULT_KEY_LENGTH, AES::BLOCKSIZE);
+}
 
-    // Encrypt the file content
-    std::string plain(reinterpret_cast<const char*>(file_content.data()), file_content.size()); // Convert file content to string
-    std::string cipher; // String to hold the encrypted content
+/**
+ * @brief Returns the size of the encrypted AES key.
+ *
+ * RSA-OAEP ciphertexts are as long as the modulus, so the server's response can carry more
+ * fields after the encrypted key.
+ *
+ * @return The size of the encrypted AES key in bytes.
+ */
+size_t CryptoPPKey::get_encrypted_aes_key_size() {
+    await_key_pair();
+    return privateKey.GetModulus().ByteCount();
+}
+
+/**
+ * @brief Sets the cipher mode used for the files encrypted from now on.
+ *
+ * @param mode The cipher mode the server selected during the key exchange.
+ */
+void CryptoPPKey::set_cipher_mode(CipherMode mode) {
+    cipher_mode = mode;
+}
+
+// Returns the cipher mode used for the files
+CipherMode CryptoPPKey::get_cipher_mode() const {
+    return cipher_mode;
+}
+
+/**
+ * @brief Encrypts a file using AES and returns the encrypted content.
+ *
+ * This function encrypts the provided file content using AES in the negotiated cipher mode.
+ * The CRC32 checksum is calculated in the same pass: the content is processed in
+ * cache-sized tiles that are checksummed and encrypted together, and the encrypted
+ * content is written straight into the returned vector.
+ *
+ * @param file_content A vector of uint8_t containing the content of the file to be encrypted.
+ * @return A vector of uint8_t containing the encrypted content of the file.
+ * @throws std::runtime_error if the AES key or IV is not set, or if an error occurs during encryption.
+ */
+std::vector<uint8_t> CryptoPPKey::encrypt_file(const std::vector<uint8_t>& file_content) {
+    std::unique_ptr<FileEncryptor> encryptor = create_file_encryptor(file_content.size());
+    std::vector<uint8_t> encrypted_data(encryptor->get_encrypted_size()); // Vector to hold the encrypted data
 
     try {
-        StringSource ss(plain, true,
-                        new StreamTransformationFilter(aesEncryptor,
-                                                       new StringSink(cipher)
-                        )
-        );
+        encryptor->encrypt_chunk(file_content.data(), file_content.size(), true, encrypted_data.data());
     } catch (const Exception& e) {
         std::cerr << "Error during encryption: " << e.what() << std::endl; // Log encryption error
         throw;
     }
 
-    // Copy encrypted data to std::vector<uint8_t>
-    encrypted_data.assign(cipher.begin(), cipher.end());
-
+    checksum = encryptor->get_checksum(); // Store the checksum calculated during encryption
     return encrypted_data; // Return the encrypted data
 }
 
+/**
+ * @brief Creates an encryptor that encrypts a file chunk by chunk.
+ *
+ * The returned FileEncryptor uses the session AES key and IV and the negotiated cipher mode,
+ * so the AES key must have been received from the server before calling this function.
+ *
+ * @param plain_size The size of the file that is going to be encrypted.
+ * @param pool Threads that encrypt CTR/GCM ranges in parallel, or nullptr.
+ * @return A FileEncryptor for the file.
+ * @throws std::runtime_error if the AES key or IV is not set.
+ */
+std::unique_ptr<FileEncryptor> CryptoPPKey::create_file_encryptor(uint64_t plain_size, ThreadPool* pool) {
+    // Ensure the AES key and IV are set
+    if (aes_key.size() == 0 || aes_iv.size() == 0) {
+        throw std::runtime_error("AES key or IV is not set.");
+    }
+    return std::make_unique<FileEncryptor>(aes_key, aes_iv, plain_size, cipher_mode, pool);
+}
+
 /**
  * @brief Calculates the CRC32 checksum of the given file content.
  *
  * This function computes the CRC32 checksum for the provided file content
- * using a predefined CRC table. The result is stored in the `checksum` member variable.
+ * using the Crc32 engine. The result is stored in the `checksum` member variable.
  *
  * @param file_content A vector of uint8_t containing the content of the file to be checksummed.
  */
 void CryptoPPKey::calculate_checksum(const std::vector<uint8_t>& file_content) {
-    size_t n = file_content.size(); // Get the size of the file content
-    unsigned int v = 0, c = 0; // Variables for CRC calculation
-    unsigned long s = 0; // Variable to hold the checksum
-    unsigned int tabidx; // Index for the CRC table
+    uint32_t s = update_checksum(0, file_content.data(), file_content.size()); // Checksum the content
+    checksum = finalize_checksum(s, file_content.size()); // Append the length and finalize
+}
 
-    for (int i = 0; i < n; i++) {
-        tabidx = (s >> 24) ^ (unsigned char)file_content[i]; // Calculate table index
-        s = UNSIGNED((s << 8)) ^ crctab[0][tabidx]; // Update checksum
-    }
+/**
+ * @brief Feeds data into a running CRC32 state.
+ *
+ * The state starts at 0 and can be updated any number of times, so a file can be
+ * checksummed one chunk at a time. The result is only a valid checksum after
+ * finalize_checksum() was applied.
+ *
+ * @param state The current CRC32 state.
+ * @param data Pointer to the data to be checksummed.
+ * @param length The length of the data.
+ * @return The updated CRC32 state.
+ */
+uint32_t CryptoPPKey::update_checksum(uint32_t state, const uint8_t* data, size_t length) const {
+    return Crc32::update(state, data, length);
+}
 
-    while (n) {
-        c = n & 0377; // Get the lowest 8 bits of n
-        n = n >> 8; // Shift n right by 8 bits
-        s = UNSIGNED(s << 8) ^ crctab[0][(s >> 24) ^ c]; // Update checksum
-    }
-    checksum = (unsigned long)UNSIGNED(~s); // Finalize checksum
+/**
+ * @brief Finalizes a running CRC32 state.
+ *
+ * Appends the length of the checksummed data (like the POSIX cksum utility) and
+ * complements the result.
+ *
+ * @param state The CRC32 state after all data was fed.
+ * @param length The total length of the checksummed data.
+ * @return The final CRC32 checksum.
+ */
+uint32_t CryptoPPKey::finalize_checksum(uint32_t state, uint64_t length) const {
+    return Crc32::finalize(state, length);
 }
 
 /**
@@ -212,40 +539,16 @@ bool CryptoPPKey::verify_checksum(uint32_t checksum) {
 /**
  * @brief Creates a file to store the private key.
  *
- * This function creates a file named "priv.key" and writes the Base64-encoded
+ * This function creates the file "priv.key" in the key directory and writes the Base64-encoded
  * private key to it. If the file cannot be opened, an error message is printed.
  */
 void CryptoPPKey::make_private_file() {
-    std::ofstream priv_file("priv.key"); // Open the private key file for writing
+    std::filesystem::path path = std::filesystem::path(key_directory) / PRIVATE_KEY_FILE;
+    std::ofstream priv_file(path); // Open the private key file for writing
     if (!priv_file.is_open()) { // Check if the file was opened successfully
-        std::cerr << "Failed to open file: priv.key" << std::endl; // Log an error message if not
+        std::cerr << "Failed to open file: " << path.string() << std::endl; // Log an error message if not
         return; // Exit the function if the file could not be opened
     }
     priv_file << get_private_key(); // Write the Base64-encoded private key to the file
     priv_file.close(); // Close the file after writing
 }
-
-/**
- * @brief Retrieves the private key from the private key file.
- *
- * This function reads the private key from the file named "priv.key" and returns it
- * as a string. If the file cannot be opened, an error message is printed and an empty
- * string is returned.
- *
- * @return A string containing the private key read from the file, or an empty string if the file cannot be opened.
- */
-std::string CryptoPPKey::get_private_key_from_private_file() {
-    std::string privateKeyStr; // String to hold the private key
-    std::ifstream priv_file("priv.key"); // Open the private key file
-    if (!priv_file.is_open()) { // Check if the file was opened successfully
-        std::cerr << "Failed to open file: priv.key" << std::endl; // Log an error message if not
-        return ""; // Return an empty string if the file could not be opened
-    }
-    std::string line; // String to hold each line read from the file
-    while (std::getline(priv_file, line)) { // Read the file line by line
-        privateKeyStr += line; // Append each line to the private key string
-    }
-    priv_file.close(); // Close the file after reading
-    return privateKeyStr; // Return the private key string
-}
-
@@ -0,0 +1,299 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+// DeltaEncoder.cpp
+
+#include "DeltaEncoder.h"
+#include "Crc32.h"
+#include <cryptopp/sha.h>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+    // Index of a weak checksum in the filter tested before the block map, as rsync does
+    inline size_t filter_index(uint32_t weak) {
+        return (weak ^ (weak >> 16)) & 0xFFFF;
+    }
+
+    void put_be(uint8_t* out, uint32_t value) {
+        out[0] = uint8_t(value >> 24);
+        out[1] = uint8_t(value >> 16);
+        out[2] = uint8_t(value >> 8);
+        out[3] = uint8_t(value);
+    }
+}
+
+/**
+ * @brief Constructor for DeltaEncoder.
+ *
+ * @param block_size Size of the blocks of the server's copy; the last block may be shorter.
+ * @param base_size Size of the server's copy.
+ * @param signatures One signature per block of the server's copy, in block order.
+ * @throws std::invalid_argument if the signatures do not describe a file of base_size bytes.
+ */
+DeltaEncoder::DeltaEncoder(uint32_t block_size, uint64_t base_size, std::vector<Signature> signatures)
+        : block_size(block_size), base_size(base_size), signatures(std::move(signatures)), weak_filter(1 << 16, false) {
+    if (block_size == 0 || this->signatures.size() != (base_size + block_size - 1) / block_size) {
+        throw std::invalid_argument("Block signatures do not match the size of the server's copy");
+    }
+    for (uint32_t i = 0; i < this->signatures.size(); i++) {
+        if (block_length(i) == block_size) { // A shorter last block can only match at the end of the file
+            full_blocks.emplace(this->signatures[i].weak, i);
+            weak_filter[filter_index(this->signatures[i].weak)] = true;
+        }
+    }
+}
+
+/**
+ * @brief Computes the delta of the file against the server's copy.
+ *
+ * The window moves one byte at a time while it matches no block, updating the weak checksum
+ * in constant time, and one block at a time after a match. After a match the next block of the
+ * server's copy is tried first, so unchanged runs become a single COPY. The last block of the
+ * server's copy, if shorter, is only tried against the end of the file.
+ *
+ * @param input The file, read once from the start.
+ * @param read_size Largest read asked from the input.
+ */
+void DeltaEncoder::scan(InputSource& input, size_t read_size) {
+    uint64_t size = input.size();
+    input.seek(0);
+    instructions.clear();
+    delta_size = 0;
+    copied_size = 0;
+    buffer.clear();
+    buffer_offset = 0;
+    loaded = 0;
+    crc_state = 0;
+    next_instruction = 0;
+    instruction_position = 0;
+
+    uint64_t position = 0;      // Start of the window
+    uint64_t literal_start = 0; // Start of the bytes not matched yet
+    int64_t expected = -1;      // Block following the last match
+    uint32_t a = 0;
+    uint32_t b = 0;
+    bool rolling = false;
+    while (!full_blocks.empty() && position + block_size <= size) {
+        uint64_t keep_from = position;
+        bool can_roll = position + block_size < size;
+        const uint8_t* data = window(input, position, position + block_size + (can_roll ? 1 : 0), keep_from, read_size);
+        if (!rolling) {
+            uint32_t weak = weak_checksum(data, block_size);
+            a = weak & 0xFFFF;
+            b = weak >> 16;
+            rolling = true;
+        }
+
+        int64_t match = -1;
+        uint32_t weak = a | (b << 16);
+        if (expected >= 0 && uint64_t(expected) < signatures.size() && signatures[size_t(expected)].weak == weak
+            && block_length(uint64_t(expected)) == block_size
+            && strong_hash(data, block_size) == signatures[size_t(expected)].strong) {
+            match = expected;
+        } else if (weak_filter[filter_index(weak)]) {
+            match = find_block(weak, data);
+        }
+        if (match >= 0) {
+            add_literal(literal_start, position);
+            add_copy(uint32_t(match));
+            position += block_size;
+            literal_start = position;
+            expected = match + 1;
+            rolling = false;
+            continue;
+        }
+        if (!can_roll) {
+            break;
+        }
+
+        // Roll the window one byte forward
+        uint32_t out = data[0];
+        uint32_t in = data[block_size];
+        a = (a - out + in) & 0xFFFF;
+        b = (b - block_size * out + a) & 0xFFFF;
+        position++;
+    }
+
+    // The shorter last block of the server's copy
+    uint64_t last_length = base_size % block_size;
+    if (last_length > 0 && size >= last_length && size - last_length >= literal_start) {
+        uint64_t tail = size - last_length;
+        const uint8_t* data = window(input, tail, size, std::min(tail, position), read_size);
+        const Signature& last = signatures.back();
+        if (weak_checksum(data, size_t(last_length)) == last.weak && strong_hash(data, size_t(last_length)) == last.strong) {
+            add_literal(literal_start, tail);
+            add_copy(uint32_t(signatures.size() - 1));
+            literal_start = size;
+        }
+    }
+    add_literal(literal_start, size);
+
+    window(input, size, size, size, read_size); // Reads the rest of the file for the checksum
+    buffer.clear();
+    buffer.shrink_to_fit();
+    checksum = Crc32::finalize(crc_state, size);
+}
+
+/**
+ * @brief Returns the file bytes [start, end), reading more of the file as needed.
+ *
+ * Bytes before keep_from are dropped from the buffer before each read, so it holds about one read
+ * plus one block whatever the size of the file. Every byte read is fed into the CRC32 of the file.
+ */
+const uint8_t* DeltaEncoder::window(InputSource& input, uint64_t start, uint64_t end, uint64_t keep_from, size_t read_size) {
+    uint64_t size = input.size();
+    while (loaded < end) {
+        if (keep_from > buffer_offset) {
+            size_t drop = size_t(std::min<uint64_t>(keep_from - buffer_offset, buffer.size()));
+            buffer.erase(buffer.begin(), buffer.begin() + drop);
+            buffer_offset += drop;
+        }
+        size_t length = size_t(std::min<uint64_t>(read_size, size - loaded));
+        if (length == 0) {
+            throw std::runtime_error("Error reading file");
+        }
+        const uint8_t* data = input.next(length);
+        crc_state = Crc32::update(crc_state, data, length);
+        buffer.insert(buffer.end(), data, data + length);
+        loaded += length;
+    }
+    return buffer.data() + (start - buffer_offset);
+}
+
+// Returns a full-size block with the given weak checksum and the strong hash of the data, or -1
+int64_t DeltaEncoder::find_block(uint32_t weak, const uint8_t* data) const {
+    auto range = full_blocks.equal_range(weak);
+    if (range.first == range.second) {
+        return -1;
+    }
+    StrongHash strong = strong_hash(data, block_size);
+    int64_t match = -1;
+    for (auto it = range.first; it != range.second; ++it) {
+        if (signatures[it->second].strong == strong && (match < 0 || int64_t(it->second) < match)) {
+            match = it->second; // The first of identical blocks, so runs of them merge into one COPY
+        }
+    }
+    return match;
+}
+
+uint64_t DeltaEncoder::block_length(uint64_t index) const {
+    return std::min<uint64_t>(block_size, base_size - index * block_size);
+}
+
+// Adds the file bytes [start, end) as a literal, appended to the previous literal if they follow it
+void DeltaEncoder::add_literal(uint64_t start, uint64_t end) {
+    if (end <= start) {
+        return;
+    }
+    if (!instructions.empty() && !instructions.back().copy
+        && instructions.back().start + instructions.back().length == start) {
+        instructions.back().length += end - start;
+    } else {
+        instructions.push_back({false, start, end - start});
+        delta_size += 5;
+    }
+    delta_size += end - start;
+}
+
+// Adds a reference to a block, merged into the previous COPY if it is the next block
+void DeltaEncoder::add_copy(uint32_t block) {
+    if (!instructions.empty() && instructions.back().copy
+        && instructions.back().start + instructions.back().length == block) {
+        instructions.back().length++;
+    } else {
+        instructions.push_back({true, block, 1});
+        delta_size += 9;
+    }
+    copied_size += block_length(block);
+}
+
+// Writes the fixed part of an instruction and returns its length
+size_t DeltaEncoder::instruction_header(const Instruction& instruction, uint8_t* out) const {
+    if (instruction.copy) {
+        out[0] = COPY;
+        put_be(out + 1, uint32_t(instruction.start));
+        put_be(out + 5, uint32_t(instruction.length));
+        return 9;
+    }
+    out[0] = LITERAL;
+    put_be(out + 1, uint32_t(instruction.length));
+    return 5;
+}
+
+/**
+ * @brief Writes the next part of the delta.
+ *
+ * @param input The file the delta was computed from; the literals are read from it.
+ * @param out Buffer of at least max_length bytes.
+ * @param max_length Largest number of bytes to write, at most the read size of the input.
+ * @return The number of bytes written.
+ */
+size_t DeltaEncoder::encode(InputSource& input, uint8_t* out, size_t max_length) {
+    size_t written = 0;
+    while (written < max_length && next_instruction < instructions.size()) {
+        const Instruction& instruction = instructions[next_instruction];
+        uint8_t header[9];
+        size_t header_length = instruction_header(instruction, header);
+        if (instruction_position < header_length) {
+            size_t length = std::min<size_t>(header_length - size_t(instruction_position), max_length - written);
+            std::memcpy(out + written, header + instruction_position, length);
+            written += length;
+            instruction_position += length;
+        } else {
+            uint64_t literal_written = instruction_position - header_length;
+            size_t length = size_t(std::min<uint64_t>(instruction.length - literal_written, max_length - written));
+            input.seek(instruction.start + literal_written);
+            std::memcpy(out + written, input.next(length), length);
+            written += length;
+            instruction_position += length;
+        }
+
+        if (instruction_position == header_length + (instruction.copy ? 0 : instruction.length)) {
+            next_instruction++; // The instruction is complete
+            instruction_position = 0;
+        }
+    }
+    return written;
+}
+
+// True once every instruction was written
+bool DeltaEncoder::is_encoded() const {
+    return next_instruction == instructions.size();
+}
+
+uint64_t DeltaEncoder::get_delta_size() const {
+    return delta_size;
+}
+
+uint64_t DeltaEncoder::get_copied_size() const {
+    return copied_size;
+}
+
+uint32_t DeltaEncoder::get_checksum() const {
+    return checksum;
+}
+
+uint32_t DeltaEncoder::get_block_size() const {
+    return block_size;
+}
+
+uint32_t DeltaEncoder::weak_checksum(const uint8_t* data, size_t length) {
+    uint32_t a = 0;
+    uint32_t b = 0;
+    for (size_t i = 0; i < length; i++) {
+        a += data[i];
+        b += uint32_t(length - i) * data[i];
+    }
+    return (a & 0xFFFF) | ((b & 0xFFFF) << 16);
+}
+
+DeltaEncoder::StrongHash DeltaEncoder::strong_hash(const uint8_t* data, size_t length) {
+    StrongHash hash;
+    CryptoPP::SHA256 sha;
+    sha.Update(data, length);
+    sha.TruncatedFinal(hash.data(), hash.size());
+    return hash;
+}
@@ -0,0 +1,97 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+#ifndef MAMAN15_DELTAENCODER_H
+#define MAMAN15_DELTAENCODER_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "InputSource.h"
+
+// rsync-style delta of a file against the copy the server holds.
+// The server describes its copy with one signature per block: a weak rolling checksum and a
+// truncated SHA-256. scan() slides a window of one block over the local file, one byte at a time,
+// and looks the rolling checksum up among the signatures; a block whose strong hash matches too is
+// replaced by a reference to the server's block. The bytes between matches are sent as literals.
+//
+// The delta is a sequence of instructions, in file order:
+//   LITERAL: 0x00, length (4 bytes), the bytes
+//   COPY:    0x01, first block (4 bytes), number of consecutive blocks (4 bytes)
+// Only offsets of the literal runs are kept, so encode() reads them from the file again and the
+// delta never has to be held in memory.
+class DeltaEncoder {
+public:
+    static constexpr size_t STRONG_HASH_SIZE = 16;       // First bytes of the SHA-256 of a block
+    static constexpr size_t SIGNATURE_SIZE = 4 + STRONG_HASH_SIZE;
+    static constexpr uint64_t MIN_FILE_SIZE = 64 * 1024; // Smaller files are always sent whole
+    static constexpr uint8_t LITERAL = 0x00;
+    static constexpr uint8_t COPY = 0x01;
+
+    using StrongHash = std::array<uint8_t, STRONG_HASH_SIZE>;
+
+    struct Signature {
+        uint32_t weak;
+        StrongHash strong;
+    };
+
+    DeltaEncoder(uint32_t block_size, uint64_t base_size, std::vector<Signature> signatures);
+
+    // Finds the server's blocks in the file, reading it once in reads of at most read_size bytes.
+    // The CRC32 of the file is computed in the same pass.
+    void scan(InputSource& input, size_t read_size);
+
+    // Writes the next bytes of the delta into `out`. Returns the number written, less than
+    // max_length only for the last part. The literals are read from `input` again.
+    size_t encode(InputSource& input, uint8_t* out, size_t max_length);
+    bool is_encoded() const;
+
+    uint64_t get_delta_size() const;
+    uint64_t get_copied_size() const; // Bytes of the file found in the server's copy
+    uint32_t get_checksum() const;    // CRC32 of the whole file, as the server computes it after rebuilding it
+    uint32_t get_block_size() const;
+
+    // Weak checksum of a block: a = sum of the bytes, b = sum of (length - i) * byte i, both mod 2^16
+    static uint32_t weak_checksum(const uint8_t* data, size_t length);
+    static StrongHash strong_hash(const uint8_t* data, size_t length);
+
+private:
+    struct Instruction {
+        bool copy;
+        uint64_t start;  // File offset of a literal, first block of a copy
+        uint64_t length; // Bytes of a literal, number of blocks of a copy
+    };
+
+    uint32_t block_size;
+    uint64_t base_size;
+    std::vector<Signature> signatures;
+    std::vector<bool> weak_filter; // Weak checksums of the full-size blocks, folded to 16 bits
+    std::unordered_multimap<uint32_t, uint32_t> full_blocks; // Weak checksum to the blocks of block_size bytes
+    std::vector<Instruction> instructions;
+    uint64_t delta_size = 0;
+    uint64_t copied_size = 0;
+    uint32_t checksum = 0;
+
+    // Scan window over the file
+    std::vector<uint8_t> buffer;
+    uint64_t buffer_offset = 0; // File offset of buffer[0]
+    uint64_t loaded = 0;        // Bytes of the file read so far
+    uint32_t crc_state = 0;
+
+    // Encoding progress
+    size_t next_instruction = 0;
+    uint64_t instruction_position = 0; // Bytes of the current instruction written
+
+    const uint8_t* window(InputSource& input, uint64_t start, uint64_t end, uint64_t keep_from, size_t read_size);
+    int64_t find_block(uint32_t weak, const uint8_t* data) const;
+    uint64_t block_length(uint64_t index) const;
+    void add_literal(uint64_t start, uint64_t end);
+    void add_copy(uint32_t block);
+    size_t instruction_header(const Instruction& instruction, uint8_t* out) const;
+};
+
+
+#endif //MAMAN15_DELTAENCODER_H
@@ -0,0 +1,359 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+// DirectoryWatcher.cpp
+
+#include "DirectoryWatcher.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef __linux__
+#define CLIENT_INOTIFY 1
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    constexpr size_t EVENT_BUFFER_SIZE = 64 * 1024;
+
+    bool is_hidden(const std::string& name) {
+        return name.empty() || name[0] == '.';
+    }
+}
+
+std::string DirectoryWatcher::Stats::to_string() const {
+    std::ostringstream out;
+    out << "Directory watcher: " << events << " events, " << coalesced << " coalesced, " << ready << " files ready, "
+        << requeued << " requeued, " << dropped << " dropped, " << overflows << " overflows, " << rescans << " rescans\n";
+    return out.str();
+}
+
+bool DirectoryWatcher::is_available() {
+#ifdef CLIENT_INOTIFY
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Starts watching the directories. Their files are scanned on the first wait.
+ *
+ * @param directory_paths The directories to watch; their subdirectories are not watched.
+ * @param settle_time How long a file must go untouched after it was closed before it is ready.
+ * @param max_pending Files tracked at once; events beyond it are left to a rescan.
+ * @throws std::runtime_error if inotify is not available or a directory cannot be watched.
+ */
+DirectoryWatcher::DirectoryWatcher(const std::vector<std::string>& directory_paths, std::chrono::milliseconds settle_time,
+                                   size_t max_pending)
+        : settle_time(settle_time), max_pending(std::max<size_t>(max_pending, 1)),
+          event_buffer(new char[EVENT_BUFFER_SIZE]) {
+#ifdef CLIENT_INOTIFY
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0 || pipe2(stop_pipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+        int error = errno;
+        close_descriptors();
+        throw std::runtime_error(std::string("Could not start the directory watcher: ") + std::strerror(error));
+    }
+    for (const std::string& path : directory_paths) {
+        Directory directory;
+        directory.path = path;
+        directory.watch = inotify_add_watch(inotify_fd, path.c_str(),
+                                            IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_ONLYDIR);
+        if (directory.watch < 0) {
+            int error = errno;
+            close_descriptors();
+            throw std::runtime_error("Could not watch " + path + ": " + std::strerror(error));
+        }
+        directories.push_back(std::move(directory));
+    }
+#else
+    throw std::runtime_error("Watching directories needs inotify, which this build does not have");
+#endif
+}
+
+DirectoryWatcher::~DirectoryWatcher() {
+    close_descriptors();
+}
+
+void DirectoryWatcher::close_descriptors() {
+#ifdef CLIENT_INOTIFY
+    for (int fd : {inotify_fd, stop_pipe[0], stop_pipe[1]}) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    inotify_fd = stop_pipe[0] = stop_pipe[1] = -1;
+#endif
+}
+
+/**
+ * @brief Waits until files are ready and takes up to max_files of them.
+ *
+ * A file that is no longer a regular file when it is taken (deleted meanwhile) is dropped.
+ *
+ * @return false once stop() was called.
+ */
+bool DirectoryWatcher::next_batch(std::vector<std::string>& files, size_t max_files) {
+    files.clear();
+    while (files.empty()) {
+        if (!wait(std::nullopt, true)) {
+            return false;
+        }
+        Clock::time_point now = Clock::now();
+        std::vector<std::pair<uint64_t, const std::string*>> ready;
+        for (const auto& [path, file] : pending) {
+            if (file.ready_at <= now) {
+                ready.emplace_back(file.order, &path);
+            }
+        }
+        std::sort(ready.begin(), ready.end());
+        ready.resize(std::min(ready.size(), max_files));
+
+        for (const auto& [order, path] : ready) {
+            std::error_code error;
+            if (std::filesystem::is_regular_file(*path, error)) {
+                files.push_back(*path);
+            }
+        }
+        for (const auto& [order, path] : ready) {
+            pending.erase(*path); // Erased last, the pointers refer to the keys
+        }
+    }
+    stats.ready += files.size();
+    return true;
+}
+
+bool DirectoryWatcher::wait_for_files() {
+    return wait(std::nullopt, true);
+}
+
+void DirectoryWatcher::idle(std::chrono::milliseconds duration) {
+    wait(Clock::now() + duration, false);
+}
+
+void DirectoryWatcher::take_removed(std::vector<std::string>& files) {
+    files.clear();
+    files.swap(removed);
+}
+
+// Queues the files again, ready at once. A file written again meanwhile keeps settling.
+void DirectoryWatcher::requeue(const std::vector<std::string>& files) {
+    for (const std::string& path : files) {
+        add_pending(path, Clock::now(), nullptr, false);
+    }
+    stats.requeued += files.size();
+}
+
+void DirectoryWatcher::stop() {
+    stopped = true;
+#ifdef CLIENT_INOTIFY
+    if (stop_pipe[1] >= 0) {
+        ssize_t written = write(stop_pipe[1], "x", 1); // Wakes the poll; a full pipe already does
+        (void)written;
+    }
+#endif
+}
+
+bool DirectoryWatcher::is_stopped() const {
+    return stopped;
+}
+
+const DirectoryWatcher::Stats& DirectoryWatcher::get_stats() const {
+    return stats;
+}
+
+/**
+ * @brief Follows the directories until a file is ready (until_ready) or the deadline passes.
+ *
+ * The inotify events are read as they come, and the rescans go on whenever there is room, so the
+ * kernel queue is drained while nothing is being uploaded.
+ *
+ * @return false once stop() was called.
+ */
+bool DirectoryWatcher::wait(std::optional<Clock::time_point> deadline, bool until_ready) {
+#ifdef CLIENT_INOTIFY
+    while (!stopped) {
+        rescan_directories();
+
+        Clock::time_point now = Clock::now();
+        std::optional<Clock::time_point> wake_at = deadline;
+        if (until_ready) {
+            std::optional<Clock::time_point> ready_at = next_ready_time();
+            if (ready_at && *ready_at <= now) {
+                return true;
+            }
+            if (ready_at && (!wake_at || *ready_at < *wake_at)) {
+                wake_at = ready_at;
+            }
+        }
+        if (deadline && *deadline <= now) {
+            return true;
+        }
+
+        int timeout = -1;
+        if (wake_at) {
+            auto remaining = std::chrono::ceil<std::chrono::milliseconds>(*wake_at - now).count();
+            timeout = int(std::clamp<decltype(remaining)>(remaining, 0, 60 * 60 * 1000));
+        }
+        pollfd fds[2] = {{inotify_fd, POLLIN, 0}, {stop_pipe[0], POLLIN, 0}};
+        if (poll(fds, 2, timeout) < 0 && errno != EINTR) {
+            throw std::runtime_error(std::string("Directory watcher poll failed: ") + std::strerror(errno));
+        }
+        if (fds[0].revents & POLLIN) {
+            read_events();
+        }
+    }
+#endif
+    return false;
+}
+
+// Reads every queued inotify event, without blocking
+void DirectoryWatcher::read_events() {
+#ifdef CLIENT_INOTIFY
+    while (true) {
+        ssize_t length = read(inotify_fd, event_buffer.get(), EVENT_BUFFER_SIZE);
+        if (length <= 0) {
+            if (length < 0 && errno == EINTR) {
+                continue;
+            }
+            return; // EAGAIN: the queue is drained
+        }
+        Clock::time_point now = Clock::now();
+        for (ssize_t offset = 0; offset < length;) {
+            const auto* event = reinterpret_cast<const inotify_event*>(event_buffer.get() + offset);
+            offset += ssize_t(sizeof(inotify_event) + event->len);
+            stats.events++;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                stats.overflows++; // Events were lost, look at every file again
+                for (Directory& directory : directories) {
+                    directory.rescan = true;
+                }
+                continue;
+            }
+            Directory* directory = find_directory(event->wd);
+            if (!directory) {
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                std::cerr << "No longer watching " << directory->path.string() << ", it was removed" << std::endl;
+                directory->watch = -1;
+                directory->cursor.reset();
+                continue;
+            }
+            std::string name = event->len > 0 ? std::string(event->name) : std::string();
+            if ((event->mask & IN_ISDIR) || is_hidden(name)) {
+                continue;
+            }
+            std::string path = (directory->path / name).string();
+
+            if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                pending.erase(path);
+                if (removed.size() < max_pending) {
+                    removed.push_back(path); // Beyond that, records of removed files stay in the index
+                }
+            } else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                add_pending(path, now + settle_time, directory, true);
+            } else if (event->mask & IN_MODIFY) {
+                add_pending(path, Clock::time_point::max(), directory, true); // Open for writing, not ready before it is closed
+            }
+        }
+    }
+#endif
+}
+
+/**
+ * @brief Moves the rescans forward while there is room for more pending files.
+ *
+ * A scan started while another is in progress (an overflow during a scan) starts over once that
+ * one ends, since the files before its cursor may have changed.
+ */
+void DirectoryWatcher::rescan_directories() {
+    for (Directory& directory : directories) {
+        if (directory.watch < 0 || (!directory.rescan && !directory.cursor)) {
+            continue;
+        }
+        std::error_code error;
+        if (!directory.cursor) {
+            directory.rescan = false;
+            directory.cursor.emplace(directory.path, std::filesystem::directory_options::skip_permission_denied, error);
+            if (error) {
+                std::cerr << "Could not scan " << directory.path.string() << ": " << error.message() << std::endl;
+                directory.cursor.reset();
+                continue;
+            }
+        }
+        std::filesystem::directory_iterator& cursor = *directory.cursor;
+        Clock::time_point ready_at = Clock::now() + settle_time;
+        while (cursor != std::filesystem::directory_iterator() && pending.size() < max_pending) {
+            const std::filesystem::directory_entry& entry = *cursor;
+            if (!is_hidden(entry.path().filename().string()) && entry.is_regular_file(error)) {
+                add_pending(entry.path().string(), ready_at, &directory, false);
+            }
+            cursor.increment(error);
+            if (error) {
+                std::cerr << "Could not scan " << directory.path.string() << ": " << error.message() << std::endl;
+                break;
+            }
+        }
+        if (error || cursor == std::filesystem::directory_iterator()) {
+            directory.cursor.reset();
+            stats.rescans++;
+        }
+    }
+}
+
+/**
+ * @brief Tracks a file, or updates the time a tracked file is ready at.
+ *
+ * @param replace Sets the time of a file already tracked; otherwise it keeps its own.
+ * @param directory The directory to rescan if there is no room for the file, nullptr for all of them.
+ */
+void DirectoryWatcher::add_pending(const std::string& path, Clock::time_point ready_at, Directory* directory, bool replace) {
+    auto it = pending.find(path);
+    if (it != pending.end()) {
+        stats.coalesced++;
+        if (replace) {
+            it->second.ready_at = ready_at;
+        }
+        return;
+    }
+    if (pending.size() >= max_pending) {
+        stats.dropped++; // Found again by the rescan
+        for (Directory& candidate : directories) {
+            if (!directory || &candidate == directory) {
+                candidate.rescan = true;
+            }
+        }
+        return;
+    }
+    pending.emplace(path, PendingFile{ready_at, next_order++});
+}
+
+// Earliest time a tracked file is ready at; files open for writing are not counted
+std::optional<DirectoryWatcher::Clock::time_point> DirectoryWatcher::next_ready_time() const {
+    std::optional<Clock::time_point> earliest;
+    for (const auto& [path, file] : pending) {
+        if (file.ready_at != Clock::time_point::max() && (!earliest || file.ready_at < *earliest)) {
+            earliest = file.ready_at;
+        }
+    }
+    return earliest;
+}
+
+DirectoryWatcher::Directory* DirectoryWatcher::find_directory(int watch) {
+    for (Directory& directory : directories) {
+        if (directory.watch == watch) {
+            return &directory;
+        }
+    }
+    return nullptr;
+}
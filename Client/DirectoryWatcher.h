@@ -0,0 +1,123 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+#ifndef MAMAN15_DIRECTORYWATCHER_H
+#define MAMAN15_DIRECTORYWATCHER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Watches directories with inotify (Linux) and hands out the files written to them once they are closed
+// and settled. A file becomes ready when it was closed after writing, or moved into the directory, and no
+// further write, close or move touched it for the settle time, so a burst of writes to one file is
+// uploaded once. A file written again before it is taken starts settling over; one deleted or moved away
+// is dropped, and reported by take_removed() so its record can be dropped from the upload index.
+//
+// Memory stays bounded however long the watcher runs: at most max_pending files are tracked at once. The
+// events that do not fit, and a kernel event queue that overflowed, mark the directory for a rescan. A
+// rescan walks the directory with a cursor kept between calls and adds its files as room frees up, so a
+// directory of any size is covered without being listed into memory. Every directory is scanned once at
+// start, for the files written while no watcher ran; the upload index skips the unchanged ones.
+//
+// Subdirectories are not watched, and hidden files (starting with '.') are ignored: writers use them as
+// temporary files and rename them into place, which shows up as a move.
+//
+// The watcher is used from one thread, except stop(), which can be called from a signal handler.
+class DirectoryWatcher {
+public:
+    static constexpr size_t DEFAULT_MAX_PENDING = 4096; // Files tracked at once
+    static constexpr std::chrono::milliseconds DEFAULT_SETTLE_TIME{500};
+
+    struct Stats {
+        uint64_t events = 0;    // inotify events read
+        uint64_t coalesced = 0; // Events on a file already pending
+        uint64_t ready = 0;     // Files handed out
+        uint64_t requeued = 0;
+        uint64_t dropped = 0;   // Events that did not fit, left to a rescan
+        uint64_t overflows = 0; // Kernel event queue overflows
+        uint64_t rescans = 0;   // Directory rescans completed
+
+        std::string to_string() const;
+    };
+
+    // True on builds with inotify
+    static bool is_available();
+
+    // Throws std::runtime_error if inotify is not available or a directory cannot be watched
+    explicit DirectoryWatcher(const std::vector<std::string>& directory_paths,
+                              std::chrono::milliseconds settle_time = DEFAULT_SETTLE_TIME,
+                              size_t max_pending = DEFAULT_MAX_PENDING);
+    ~DirectoryWatcher();
+
+    DirectoryWatcher(const DirectoryWatcher&) = delete;
+    DirectoryWatcher& operator=(const DirectoryWatcher&) = delete;
+
+    // Waits until files are ready and moves up to max_files of them to `files`, oldest first.
+    // Returns false, with no files, once stop() was called.
+    bool next_batch(std::vector<std::string>& files, size_t max_files);
+
+    // Waits until a file is ready, without taking it. Returns false once stop() was called.
+    bool wait_for_files();
+
+    // Follows the directories for the given time, or until stop() is called
+    void idle(std::chrono::milliseconds duration);
+
+    // Moves the files deleted or moved away since the last call to `files`; up to max_pending are kept
+    void take_removed(std::vector<std::string>& files);
+
+    // Queues files again that were taken but not uploaded; they are ready at once
+    void requeue(const std::vector<std::string>& files);
+
+    // Makes the waits return false. Async-signal-safe.
+    void stop();
+    bool is_stopped() const;
+
+    const Stats& get_stats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Directory {
+        std::filesystem::path path;
+        int watch = -1;
+        bool rescan = true; // Scanned at start
+        std::optional<std::filesystem::directory_iterator> cursor; // Position of the rescan in progress
+    };
+
+    struct PendingFile {
+        Clock::time_point ready_at; // The file is ready once this passes with no further event
+        uint64_t order = 0;         // Files are handed out in the order they were first seen
+    };
+
+    std::vector<Directory> directories;
+    std::unordered_map<std::string, PendingFile> pending;
+    std::vector<std::string> removed;
+    std::chrono::milliseconds settle_time;
+    size_t max_pending;
+    uint64_t next_order = 0;
+    int inotify_fd = -1;
+    int stop_pipe[2] = {-1, -1}; // stop() writes to it, to wake a wait
+    std::atomic<bool> stopped{false}; // Lock-free, so stop() can set it from a signal handler
+    std::unique_ptr<char[]> event_buffer;
+    Stats stats;
+
+    bool wait(std::optional<Clock::time_point> deadline, bool until_ready);
+    void read_events();
+    void rescan_directories();
+    void add_pending(const std::string& path, Clock::time_point ready_at, Directory* directory, bool replace);
+    std::optional<Clock::time_point> next_ready_time() const;
+    Directory* find_directory(int watch);
+    void close_descriptors();
+};
+
+
+#endif //MAMAN15_DIRECTORYWATCHER_H
@@ -0,0 +1,163 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+// FileCompressor.cpp
+
+#include "FileCompressor.h"
+#include "Crc32.h"
+#include <cryptopp/filters.h>
+#include <cryptopp/zlib.h>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+/**
+ * @brief Constructor for FileCompressor.
+ *
+ * @param pool Threads that compress the blocks of a batch, or nullptr for the calling thread.
+ */
+FileCompressor::FileCompressor(ThreadPool* pool)
+        : pool(pool), slots(pool ? std::max<size_t>(pool->get_concurrency(), 1) : 1) {}
+
+void FileCompressor::set_block_tree(BlockHashTree* tree) {
+    block_tree = tree;
+}
+
+/**
+ * @brief Measures the compressed size of the file.
+ *
+ * The first PROBE_SIZE bytes are compressed on their own first: logs and CSVs shrink several
+ * times, while media and archives do not shrink at all, so the start of a file tells them apart
+ * without reading the rest. Otherwise the whole file is compressed batch by batch, feeding the
+ * CRC32 and the block hash tree in file order.
+ *
+ * @param input The file, read from the start.
+ * @return True if the compressed file is at most 7/8 of the original.
+ */
+bool FileCompressor::scan(InputSource& input) {
+    file_size = input.size();
+    block_count = (file_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    compressed_size = 0;
+    next_block = 0;
+    batch_count = 0;
+    batch_index = 0;
+    batch_position = 0;
+
+    // Probe
+    Slot& probe = slots[0];
+    probe.plain.resize(BLOCK_SIZE);
+    size_t probe_length = size_t(std::min<uint64_t>(PROBE_SIZE, file_size));
+    input.seek(0);
+    input.read(probe.plain.data(), probe_length);
+    if (!worth_compressing(compress_block(probe.plain.data(), probe_length, probe.compressed), probe_length)) {
+        return false;
+    }
+
+    uint32_t crc_state = 0;
+    for (uint64_t block = 0; block < block_count;) {
+        size_t count = compress_batch(input, block);
+        for (size_t i = 0; i < count; i++) {
+            crc_state = Crc32::update(crc_state, slots[i].plain.data(), slots[i].plain_length);
+            if (block_tree) {
+                block_tree->add(slots[i].plain.data(), slots[i].plain_length);
+            }
+            compressed_size += slots[i].compressed_length;
+        }
+        block += count;
+    }
+    checksum = Crc32::finalize(crc_state, file_size);
+    return worth_compressing(compressed_size, file_size);
+}
+
+/**
+ * @brief Writes the next part of the compressed file.
+ *
+ * Each batch of blocks is read and compressed again on the pool when the previous one was
+ * copied out.
+ *
+ * @param input The file scan() measured.
+ * @param out Buffer of at least max_length bytes.
+ * @param max_length Largest number of bytes to write.
+ * @return The number of bytes written.
+ */
+size_t FileCompressor::encode(InputSource& input, uint8_t* out, size_t max_length) {
+    size_t written = 0;
+    while (written < max_length) {
+        if (batch_index == batch_count) {
+            if (next_block == block_count) {
+                break;
+            }
+            batch_count = compress_batch(input, next_block);
+            next_block += batch_count;
+            batch_index = 0;
+            batch_position = 0;
+        }
+        const Slot& slot = slots[batch_index];
+        size_t length = std::min(slot.compressed_length - batch_position, max_length - written);
+        std::memcpy(out + written, slot.compressed.data() + batch_position, length);
+        written += length;
+        batch_position += length;
+        if (batch_position == slot.compressed_length) {
+            batch_index++;
+            batch_position = 0;
+        }
+    }
+    return written;
+}
+
+// True once every block was compressed and copied out
+bool FileCompressor::is_encoded() const {
+    return next_block == block_count && batch_index == batch_count;
+}
+
+uint64_t FileCompressor::get_compressed_size() const {
+    return compressed_size;
+}
+
+uint32_t FileCompressor::get_checksum() const {
+    return checksum;
+}
+
+// Compression is worth the work on both sides if it saves at least 1/8 of the bytes
+bool FileCompressor::worth_compressing(uint64_t compressed, uint64_t original) const {
+    return compressed <= original - original / 8;
+}
+
+// Reads the blocks starting at first_block into the slots and compresses them on the pool.
+// Returns the number of blocks read.
+size_t FileCompressor::compress_batch(InputSource& input, uint64_t first_block) {
+    size_t count = size_t(std::min<uint64_t>(slots.size(), block_count - first_block));
+    input.seek(first_block * BLOCK_SIZE);
+    for (size_t i = 0; i < count; i++) {
+        Slot& slot = slots[i];
+        slot.plain.resize(BLOCK_SIZE);
+        slot.plain_length = size_t(std::min<uint64_t>(BLOCK_SIZE, file_size - (first_block + i) * BLOCK_SIZE));
+        input.read(slot.plain.data(), slot.plain_length);
+    }
+
+    auto compress = [this](size_t i) {
+        slots[i].compressed_length = compress_block(slots[i].plain.data(), slots[i].plain_length, slots[i].compressed);
+    };
+    if (pool && count > 1) {
+        pool->run_batch(count, compress);
+    } else {
+        for (size_t i = 0; i < count; i++) {
+            compress(i);
+        }
+    }
+    return count;
+}
+
+// Compresses a block into a zlib stream of its own and returns its length
+size_t FileCompressor::compress_block(const uint8_t* data, size_t length, std::vector<uint8_t>& out) {
+    out.resize(length + length / 64 + 64); // Stored blocks when the data does not compress, plus the zlib header
+    auto* sink = new CryptoPP::ArraySink(out.data(), out.size());
+    CryptoPP::ZlibCompressor compressor(sink, LEVEL); // Takes ownership of the sink
+    compressor.Put(data, length);
+    compressor.MessageEnd();
+    if (sink->TotalPutLength() > out.size()) {
+        throw std::runtime_error("Compressed block is larger than its buffer");
+    }
+    return size_t(sink->TotalPutLength());
+}
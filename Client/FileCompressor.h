@@ -0,0 +1,76 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+#ifndef MAMAN15_FILECOMPRESSOR_H
+#define MAMAN15_FILECOMPRESSOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "BlockHashTree.h"
+#include "InputSource.h"
+#include "ThreadPool.h"
+
+// Compression stage in front of the encryption of a file body.
+// The file is cut into BLOCK_SIZE blocks and each block is compressed into a zlib stream of its
+// own, so the blocks of a batch are compressed on the thread pool; the server inflates the streams
+// one after the other. The CRC32 stays over the original file, so verification does not change.
+//
+// The request header announces the size of the body before the body, so the file is compressed
+// twice: scan() measures the compressed size, and encode() compresses it again while it is sent.
+// Compression is deterministic, so both passes produce the same bytes. A probe of the start of the
+// file decides first whether the full pass is worth it, so compressed inputs are read only once.
+class FileCompressor {
+public:
+    static constexpr size_t BLOCK_SIZE = 256 * 1024;  // Plaintext bytes per zlib stream
+    static constexpr unsigned LEVEL = 1;              // Fastest deflate level: the aim is bandwidth, not the smallest body
+    static constexpr size_t PROBE_SIZE = 64 * 1024;   // Bytes compressed to decide whether the file compresses
+    static constexpr uint64_t MIN_FILE_SIZE = 4 * 1024; // Smaller files are always sent as they are
+
+    explicit FileCompressor(ThreadPool* pool = nullptr);
+
+    // Feeds the file into a block hash tree during scan(), so blocks can still be repaired after a CRC mismatch
+    void set_block_tree(BlockHashTree* tree);
+
+    // Compresses the file once to measure it, and computes its CRC32. Returns false as soon as it is
+    // clear compression saves less than 1/8 of the file; the file is then sent as it is.
+    bool scan(InputSource& input);
+
+    // Writes the next bytes of the compressed file into `out`. Returns the number written,
+    // less than max_length only for the last part.
+    size_t encode(InputSource& input, uint8_t* out, size_t max_length);
+    bool is_encoded() const;
+
+    uint64_t get_compressed_size() const;
+    uint32_t get_checksum() const; // CRC32 of the original file
+
+private:
+    struct Slot {
+        std::vector<uint8_t> plain;
+        size_t plain_length = 0;
+        std::vector<uint8_t> compressed;
+        size_t compressed_length = 0;
+    };
+
+    ThreadPool* pool;
+    BlockHashTree* block_tree = nullptr;
+    std::vector<Slot> slots; // One block per thread
+    uint64_t file_size = 0;
+    uint64_t block_count = 0;
+    uint64_t compressed_size = 0;
+    uint32_t checksum = 0;
+
+    // Encoding progress
+    uint64_t next_block = 0;  // First block of the next batch
+    size_t batch_count = 0;   // Blocks of the current batch
+    size_t batch_index = 0;   // Slot being copied out
+    size_t batch_position = 0; // Bytes of that slot copied out
+
+    bool worth_compressing(uint64_t compressed, uint64_t original) const;
+    size_t compress_batch(InputSource& input, uint64_t first_block);
+    static size_t compress_block(const uint8_t* data, size_t length, std::vector<uint8_t>& out);
+};
+
+
+#endif //MAMAN15_FILECOMPRESSOR_H
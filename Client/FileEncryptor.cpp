@@ -0,0 +1,343 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+// FileEncryptor.cpp
+
+#include "FileEncryptor.h"
+#include "Crc32.h"
+#include <cryptopp/osrng.h>
+#include <algorithm>
+#include <stdexcept>
+
+using namespace CryptoPP;
+
+/**
+ * @brief Constructor for FileEncryptor.
+ *
+ * Sets up AES encryption in the given mode with the session key and resets the running
+ * CRC32 state. The total plaintext size must be known up front because it is part of the
+ * request header and of the CRC32 checksum.
+ *
+ * CTR and GCM never reuse the session IV: every file gets a random IV that is sent in front
+ * of the body, so a key and counter pair is never used for two files.
+ *
+ * @param aes_key The AES session key.
+ * @param aes_iv The AES initialization vector (CBC only).
+ * @param plain_size The size of the file that is going to be encrypted.
+ * @param mode The cipher mode agreed with the server.
+ * @param pool Threads that encrypt the CTR/GCM ranges, or nullptr for the calling thread.
+ */
+FileEncryptor::FileEncryptor(const SecByteBlock& aes_key, const SecByteBlock& aes_iv, uint64_t plain_size,
+                             CipherMode mode, ThreadPool* pool)
+        : key(aes_key), file_iv(FILE_IV_SIZE), mode(mode), pool(pool), block_tree(nullptr), plain_size(plain_size),
+          prefix_size(0), processed_size(0), segment_count(0), crc_state(0), checksum(0), finished(false), iv_written(false) {
+    if (mode == CipherMode::CBC) {
+        encryptor.SetKeyWithIV(aes_key, aes_key.size(), aes_iv);
+        carry.reserve(AES::BLOCKSIZE);
+    } else {
+        AutoSeededRandomPool rng;
+        rng.GenerateBlock(file_iv, file_iv.size());
+        carry.reserve(mode == CipherMode::GCM ? GCM_SEGMENT_SIZE : 0);
+    }
+}
+
+/**
+ * @brief Returns the size of the encrypted file.
+ *
+ * CBC with PKCS7 padding always adds between 1 and 16 bytes, so the encrypted size is the
+ * plaintext size rounded up to the next whole AES block. CTR adds the file IV only, GCM adds
+ * the file IV and one tag per segment.
+ *
+ * @return The size of the encrypted file in bytes.
+ */
+uint64_t FileEncryptor::get_encrypted_size() const {
+    switch (mode) {
+        case CipherMode::CTR:
+            return FILE_IV_SIZE + plain_size;
+        case CipherMode::GCM: {
+            uint64_t segments = (plain_size + GCM_SEGMENT_SIZE - 1) / GCM_SEGMENT_SIZE;
+            return FILE_IV_SIZE + plain_size + segments * GCM_TAG_SIZE;
+        }
+        default:
+            return (plain_size / AES::BLOCKSIZE + 1) * AES::BLOCKSIZE;
+    }
+}
+
+// Returns the cipher mode of the file
+CipherMode FileEncryptor::get_mode() const {
+    return mode;
+}
+
+/**
+ * @brief Encrypts the next chunk of the file into a vector.
+ *
+ * The vector is resized to the number of encrypted bytes. Its capacity is kept, so a caller
+ * reusing the same vector for every chunk does not allocate after the first one.
+ *
+ * @param data Pointer to the plaintext chunk.
+ * @param length The length of the plaintext chunk.
+ * @param last True if this is the final chunk of the file.
+ * @param out Vector receiving the encrypted bytes of this chunk.
+ */
+void FileEncryptor::encrypt_chunk(const uint8_t* data, size_t length, bool last, std::vector<uint8_t>& out) {
+    out.resize(max_output_size(length));
+    out.resize(encrypt_chunk(data, length, last, out.data()));
+}
+
+/**
+ * @brief Encrypts the next chunk of the file.
+ *
+ * @param data Pointer to the plaintext chunk.
+ * @param length The length of the plaintext chunk.
+ * @param last True if this is the final chunk of the file.
+ * @param out Buffer of at least max_output_size(length) bytes receiving the encrypted bytes.
+ * @return The number of encrypted bytes written to `out`.
+ * @throws std::runtime_error if the file was already finished or its size does not match.
+ */
+size_t FileEncryptor::encrypt_chunk(const uint8_t* data, size_t length, bool last, uint8_t* out) {
+    if (finished) {
+        throw std::runtime_error("File encryption already finished.");
+    }
+    processed_size += length;
+    if (last && processed_size != plain_size) {
+        throw std::runtime_error("File size changed during encryption.");
+    }
+
+    if (mode == CipherMode::CBC) {
+        if (block_tree) {
+            block_tree->add(data, length);
+        }
+        return encrypt_cbc(data, length, last, out);
+    }
+    return encrypt_parallel(data, length, last, out);
+}
+
+/**
+ * @brief Encrypts the next chunk in CBC mode.
+ *
+ * The chunk is processed in FUSED_TILE_SIZE tiles. Each tile is fed into the CRC32 state and
+ * encrypted right away, while it is still in cache. Bytes that do not fill a whole AES block
+ * are kept until the next call. On the last chunk the PKCS7 padding is added.
+ */
+size_t FileEncryptor::encrypt_cbc(const uint8_t* data, size_t length, bool last, uint8_t* out) {
+    size_t offset = 0;
+    size_t written = 0;
+    // Complete the block left over from the previous chunk
+    if (!carry.empty()) {
+        size_t take = std::min(length, AES::BLOCKSIZE - carry.size());
+        crc_state = Crc32::update(crc_state, data, take);
+        carry.insert(carry.end(), data, data + take);
+        offset = take;
+        if (carry.size() == AES::BLOCKSIZE) {
+            encryptor.ProcessData(out, carry.data(), AES::BLOCKSIZE);
+            written = AES::BLOCKSIZE;
+            carry.clear();
+        }
+    }
+
+    // Checksum and encrypt whole blocks directly from the input, one tile at a time
+    while (length - offset >= AES::BLOCKSIZE) {
+        size_t tile = std::min(FUSED_TILE_SIZE, (length - offset) / AES::BLOCKSIZE * AES::BLOCKSIZE);
+        crc_state = Crc32::update(crc_state, data + offset, tile);
+        encryptor.ProcessData(out + written, data + offset, tile);
+        offset += tile;
+        written += tile;
+    }
+    crc_state = Crc32::update(crc_state, data + offset, length - offset);
+    carry.insert(carry.end(), data + offset, data + length);
+
+    if (!last) {
+        return written;
+    }
+
+    // Add PKCS7 padding and encrypt the final block
+    uint8_t padding = uint8_t(AES::BLOCKSIZE - carry.size());
+    carry.resize(AES::BLOCKSIZE, padding);
+    encryptor.ProcessData(out + written, carry.data(), AES::BLOCKSIZE);
+    written += AES::BLOCKSIZE;
+    carry.clear();
+
+    finish();
+    return written;
+}
+
+/**
+ * @brief Encrypts the next chunk in CTR or GCM mode.
+ *
+ * The chunk is cut into jobs that do not depend on each other: CTR ranges that start at a
+ * known counter, or whole GCM segments with their own nonce. The jobs run on the pool, each
+ * computing the CRC32 state of its own range, and the states are combined in file order.
+ * The blocks of the block hash tree completed by the chunk are hashed in the same batch.
+ * A GCM segment that is not complete yet is kept until the next call.
+ */
+size_t FileEncryptor::encrypt_parallel(const uint8_t* data, size_t length, bool last, uint8_t* out) {
+    size_t written = 0;
+    if (!iv_written) {
+        std::copy(file_iv.begin(), file_iv.end(), out);
+        written = FILE_IV_SIZE;
+        iv_written = true;
+    }
+
+    jobs.clear();
+    size_t offset = 0;
+    bool carry_used = false;
+    if (mode == CipherMode::CTR) {
+        // Split the chunk into one block-aligned range per thread
+        size_t threads = pool ? pool->get_concurrency() : 1;
+        size_t parts = std::clamp<size_t>(length / MIN_PARALLEL_RANGE, 1, threads);
+        size_t range = ((length + parts - 1) / parts + AES::BLOCKSIZE - 1) / AES::BLOCKSIZE * AES::BLOCKSIZE;
+        uint64_t position = processed_size - length;
+        while (offset < length) {
+            size_t part = std::min(range, length - offset);
+            jobs.push_back({data + offset, part, out + written, position + offset, true, 0});
+            offset += part;
+            written += part;
+        }
+    } else {
+        // Complete the segment left over from the previous chunk
+        if (!carry.empty()) {
+            size_t take = std::min(length, GCM_SEGMENT_SIZE - carry.size());
+            crc_state = Crc32::update(crc_state, data, take);
+            carry.insert(carry.end(), data, data + take);
+            offset = take;
+            if (carry.size() == GCM_SEGMENT_SIZE || last) {
+                jobs.push_back({carry.data(), carry.size(), out + written, segment_count++, false, 0});
+                written += carry.size() + GCM_TAG_SIZE;
+                carry_used = true;
+            }
+        }
+
+        // Whole segments, plus the final partial one, straight from the input
+        while (length - offset >= GCM_SEGMENT_SIZE || (last && offset < length)) {
+            size_t part = std::min(GCM_SEGMENT_SIZE, length - offset);
+            jobs.push_back({data + offset, part, out + written, segment_count++, true, 0});
+            offset += part;
+            written += part + GCM_TAG_SIZE;
+        }
+    }
+
+    size_t hash_count = block_tree ? block_tree->stage(data, length) : 0;
+    size_t task_count = jobs.size() + hash_count;
+    auto run_task = [this](size_t i) {
+        if (i < jobs.size()) {
+            run_job(jobs[i]);
+        } else {
+            block_tree->hash_staged(i - jobs.size());
+        }
+    };
+    if (pool && task_count > 1) {
+        pool->run_batch(task_count, run_task);
+    } else {
+        for (size_t i = 0; i < task_count; i++) {
+            run_task(i);
+        }
+    }
+    if (block_tree) {
+        block_tree->commit();
+    }
+    for (const Job& job : jobs) {
+        if (job.checksummed) {
+            crc_state = Crc32::combine(crc_state, job.crc, job.length);
+        }
+    }
+
+    if (carry_used) {
+        carry.clear();
+    }
+    crc_state = Crc32::update(crc_state, data + offset, length - offset);
+    carry.insert(carry.end(), data + offset, data + length);
+
+    if (last) {
+        finish();
+    }
+    return written;
+}
+
+/**
+ * @brief Checksums and encrypts one job.
+ *
+ * A CTR range seeks its own copy of the cipher to the range offset and processes the range in
+ * FUSED_TILE_SIZE tiles. A GCM segment is encrypted with the nonce file IV[0..8) + segment index
+ * (big-endian), and its tag is written right after its ciphertext.
+ */
+void FileEncryptor::run_job(Job& job) const {
+    job.crc = 0;
+    if (mode == CipherMode::CTR) {
+        CTR_Mode<AES>::Encryption ctr;
+        ctr.SetKeyWithIV(key, key.size(), file_iv);
+        ctr.Seek(job.position);
+        for (size_t offset = 0; offset < job.length; offset += FUSED_TILE_SIZE) {
+            size_t tile = std::min(FUSED_TILE_SIZE, job.length - offset);
+            job.crc = Crc32::update(job.crc, job.source + offset, tile);
+            ctr.ProcessData(job.destination + offset, job.source + offset, tile);
+        }
+        return;
+    }
+
+    uint8_t nonce[12];
+    std::copy(file_iv.begin(), file_iv.begin() + 8, nonce);
+    for (int i = 0; i < 4; i++) {
+        nonce[8 + i] = uint8_t(job.position >> (24 - 8 * i));
+    }
+    if (job.checksummed) {
+        job.crc = Crc32::update(0, job.source, job.length); // A segment fits in L2, it is still cached below
+    }
+    GCM<AES>::Encryption gcm;
+    gcm.SetKey(key, key.size());
+    gcm.EncryptAndAuthenticate(job.destination, job.destination + job.length, GCM_TAG_SIZE, nonce, sizeof(nonce),
+                               nullptr, 0, job.source, job.length);
+}
+
+/**
+ * @brief Starts the CRC32 from the state of the part of the file sent in an earlier upload.
+ *
+ * The encryptor then only encrypts the rest of the file, but its checksum covers the whole file,
+ * so it can be compared with the checksum the server computes over the file it assembled.
+ *
+ * @param prefix_state The CRC32 state of the first prefix_length bytes of the file.
+ * @param prefix_length The number of bytes sent before.
+ * @throws std::runtime_error if encryption already started.
+ */
+void FileEncryptor::resume_checksum(uint32_t prefix_state, uint64_t prefix_length) {
+    if (processed_size != 0 || finished) {
+        throw std::runtime_error("Checksum prefix set after encryption started.");
+    }
+    crc_state = prefix_state;
+    prefix_size = prefix_length;
+}
+
+// Sets the tree the plaintext is fed into, before the first chunk
+void FileEncryptor::set_block_tree(BlockHashTree* tree) {
+    block_tree = tree;
+}
+
+// Appends the length to the CRC32 state and marks the file as done
+void FileEncryptor::finish() {
+    checksum = Crc32::finalize(crc_state, prefix_size + plain_size);
+    finished = true;
+}
+
+// Largest number of encrypted bytes a chunk of `length` bytes can produce.
+// CBC: the carried partial block plus the padding block.
+// CTR/GCM: the file IV, and for GCM the carried segment plus a tag per segment.
+size_t FileEncryptor::max_output_size(size_t length) const {
+    switch (mode) {
+        case CipherMode::CTR:
+            return FILE_IV_SIZE + length;
+        case CipherMode::GCM:
+            return FILE_IV_SIZE + GCM_SEGMENT_SIZE + length + (length / GCM_SEGMENT_SIZE + 2) * GCM_TAG_SIZE;
+        default:
+            return length + 2 * AES::BLOCKSIZE;
+    }
+}
+
+// Returns the CRC32 checksum of the plaintext
+uint32_t FileEncryptor::get_checksum() const {
+    return checksum;
+}
+
+// Compares the checksum received from the server with the checksum of the plaintext
+bool FileEncryptor::verify_checksum(uint32_t received_checksum) const {
+    return finished && received_checksum == checksum;
+}
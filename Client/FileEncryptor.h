@@ -0,0 +1,108 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+#ifndef MAMAN15_FILEENCRYPTOR_H
+#define MAMAN15_FILEENCRYPTOR_H
+
+#include <cryptopp/aes.h>
+#include <cryptopp/modes.h>
+#include <cryptopp/gcm.h>
+#include <cryptopp/secblock.h>
+#include <cstdint>
+#include <vector>
+#include "BlockHashTree.h"
+#include "ThreadPool.h"
+
+// Cipher modes a file body can be encrypted with, as numbered in the key exchange response
+enum class CipherMode : uint8_t {
+    CBC = 0, // Serial, the mode of servers that do not negotiate
+    CTR = 1, // Body: 16 byte file IV + ciphertext
+    GCM = 2  // Body: 16 byte file IV + segments of up to GCM_SEGMENT_SIZE bytes, each followed by its tag
+};
+
+// Incremental encryptor for a single file.
+// The file is fed in arbitrary sized chunks and the CRC32 of the plaintext is
+// updated along the way, so the caller only ever holds one chunk in memory.
+// Each chunk is processed in cache-sized tiles: a tile is checksummed and encrypted
+// while it is still in L1/L2, so the plaintext is swept through memory only once.
+//
+// CBC chains every block to the previous one and runs on the calling thread. In CTR and
+// GCM mode a chunk is split into independent ranges (GCM: segments) that are checksummed
+// and encrypted on the thread pool; the checksums of the ranges are combined in file order.
+class FileEncryptor {
+public:
+    static constexpr size_t FUSED_TILE_SIZE = 32 * 1024; // Plaintext bytes checksummed and encrypted together
+    static constexpr size_t FILE_IV_SIZE = 16;            // Random IV at the start of a CTR/GCM body
+    static constexpr size_t GCM_SEGMENT_SIZE = 64 * 1024; // Plaintext bytes per authenticated GCM segment
+    static constexpr size_t GCM_TAG_SIZE = 16;
+    static constexpr size_t MIN_PARALLEL_RANGE = 64 * 1024; // Smallest CTR range handed to one thread
+
+    // Without a pool the CTR/GCM ranges are processed on the calling thread
+    FileEncryptor(const CryptoPP::SecByteBlock& aes_key, const CryptoPP::SecByteBlock& aes_iv, uint64_t plain_size,
+                  CipherMode mode = CipherMode::CBC, ThreadPool* pool = nullptr);
+
+    // Size of the whole encrypted file, known before the first chunk is encrypted
+    uint64_t get_encrypted_size() const;
+    CipherMode get_mode() const;
+
+    // Encrypts the next chunk of the file into `out` (replacing its content).
+    // `last` must be set for the final chunk so the padding or the final segment is written.
+    void encrypt_chunk(const uint8_t* data, size_t length, bool last, std::vector<uint8_t>& out);
+
+    // Same as above, writing to a buffer of at least max_output_size(length) bytes.
+    // Returns the number of encrypted bytes written.
+    size_t encrypt_chunk(const uint8_t* data, size_t length, bool last, uint8_t* out);
+    size_t max_output_size(size_t length) const;
+
+    // Continues the CRC32 of a file whose first prefix_length bytes were sent before, so the
+    // checksum covers the whole file. Must be called before the first chunk.
+    void resume_checksum(uint32_t prefix_state, uint64_t prefix_length);
+
+    // Feeds the plaintext into a block hash tree too. In CTR/GCM mode its blocks are hashed
+    // in the same pool batch as the ranges of each chunk.
+    void set_block_tree(BlockHashTree* tree);
+
+    // CRC32 checksum of the plaintext, valid once the last chunk was encrypted
+    uint32_t get_checksum() const;
+    bool verify_checksum(uint32_t received_checksum) const;
+
+private:
+    // A range of the file encrypted independently of the others
+    struct Job {
+        const uint8_t* source;
+        size_t length;
+        uint8_t* destination;
+        uint64_t position;  // CTR: plaintext offset in the file, GCM: segment index
+        bool checksummed;   // False if the bytes were already fed into the CRC32 state
+        uint32_t crc;       // CRC32 state of the range, starting from 0
+    };
+
+    CryptoPP::CBC_Mode<CryptoPP::AES>::Encryption encryptor;
+    CryptoPP::SecByteBlock key;
+    CryptoPP::SecByteBlock file_iv; // Random per file, CTR/GCM only
+    CipherMode mode;
+    ThreadPool* pool;
+    BlockHashTree* block_tree;
+
+    uint64_t plain_size;        // Total size of the plaintext
+    uint64_t prefix_size;       // Bytes of the file before this plaintext, sent in an earlier upload
+    uint64_t processed_size;    // Plaintext bytes consumed so far
+    uint64_t segment_count;     // GCM segments written so far
+    uint32_t crc_state;         // Running CRC32 state (before the length is appended)
+    uint32_t checksum;          // Final CRC32 checksum value
+    bool finished;
+    bool iv_written;
+
+    // Tail of the previous chunk that did not fill a whole AES block (GCM: a whole segment)
+    std::vector<uint8_t> carry;
+    std::vector<Job> jobs;
+
+    size_t encrypt_cbc(const uint8_t* data, size_t length, bool last, uint8_t* out);
+    size_t encrypt_parallel(const uint8_t* data, size_t length, bool last, uint8_t* out);
+    void run_job(Job& job) const;
+    void finish();
+};
+
+
+#endif //MAMAN15_FILEENCRYPTOR_H
@@ -0,0 +1,262 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+// InputSource.cpp
+
+#include "InputSource.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#define RELEASE_STEP (1024 * 1024) // Pages already read are dropped once this many bytes of them add up
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @brief Opens the plaintext of a file.
+ *
+ * @param path The file to read.
+ * @param max_length The longest range next() will be asked for.
+ * @param mapped Try the memory-mapped backend first.
+ * @return The memory-mapped source, or the stream source if mapping is off or fails.
+ * @throws std::runtime_error if the file cannot be opened at all.
+ */
+std::unique_ptr<InputSource> InputSource::open(const std::string& path, size_t max_length, bool mapped) {
+    if (mapped) {
+        try {
+            return std::make_unique<MappedInputSource>(path);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << ", reading it as a stream" << std::endl;
+        }
+    }
+    return std::make_unique<StreamInputSource>(path, max_length);
+}
+
+// Default copy for backends that hand out views
+void InputSource::read(uint8_t* out, size_t length) {
+    std::memcpy(out, next(length), length);
+}
+
+// StreamInputSource
+
+StreamInputSource::StreamInputSource(const std::string& path, size_t max_length)
+        : InputSource(path), file(path, std::ios::binary) {
+    if (!file.is_open()) {
+        throw std::runtime_error("Could not open the file: " + path);
+    }
+    file.seekg(0, std::ios::end);
+    file_size = uint64_t(file.tellg());
+    file.seekg(0, std::ios::beg);
+    buffer.resize(max_length);
+}
+
+uint64_t StreamInputSource::size() const {
+    return file_size;
+}
+
+void StreamInputSource::seek(uint64_t offset) {
+    file.clear();
+    file.seekg(std::streamoff(offset));
+}
+
+const uint8_t* StreamInputSource::next(size_t length) {
+    if (length > buffer.size()) {
+        buffer.resize(length);
+    }
+    read(buffer.data(), length);
+    return buffer.data();
+}
+
+void StreamInputSource::read(uint8_t* out, size_t length) {
+    file.read(reinterpret_cast<char*>(out), std::streamsize(length));
+    if (size_t(file.gcount()) != length) {
+        throw std::runtime_error("Error reading file: " + path);
+    }
+}
+
+const char* StreamInputSource::name() const {
+    return "stream";
+}
+
+// MappedInputSource
+
+MappedInputSource::MappedInputSource(const std::string& path) : InputSource(path) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    granularity = info.dwAllocationGranularity;
+
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Could not open the file: " + path);
+    }
+    file_handle = file;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        close();
+        throw std::runtime_error("Could not read the size of the file: " + path);
+    }
+    file_size = uint64_t(size.QuadPart);
+    if (file_size > 0) {
+        mapping_handle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping_handle) {
+            close();
+            throw std::runtime_error("Could not map the file: " + path);
+        }
+    }
+#else
+    granularity = uint64_t(sysconf(_SC_PAGESIZE));
+
+    file_descriptor = ::open(path.c_str(), O_RDONLY);
+    if (file_descriptor < 0) {
+        throw std::runtime_error("Could not open the file: " + path);
+    }
+    struct stat status {};
+    if (fstat(file_descriptor, &status) != 0 || !S_ISREG(status.st_mode)) {
+        close();
+        throw std::runtime_error("Could not map the file: " + path);
+    }
+    file_size = uint64_t(status.st_size);
+#endif
+    if (file_size > 0) {
+        try {
+            map_window(0, size_t(std::min<uint64_t>(file_size, WINDOW_SIZE)));
+        } catch (...) {
+            close();
+            throw;
+        }
+    }
+}
+
+MappedInputSource::~MappedInputSource() {
+    close();
+}
+
+uint64_t MappedInputSource::size() const {
+    return file_size;
+}
+
+void MappedInputSource::seek(uint64_t offset) {
+    position = offset;
+}
+
+/**
+ * @brief Returns the next bytes of the file straight from the mapping.
+ *
+ * A range that runs past the current window moves the window so that it starts at the range. The
+ * range handed out by the previous call is no longer in use, so the pages before this one are dropped.
+ *
+ * @throws std::runtime_error if the range runs past the end of the file.
+ */
+const uint8_t* MappedInputSource::next(size_t length) {
+    if (position + length > file_size) {
+        throw std::runtime_error("Error reading file: " + path);
+    }
+    if (length == 0) {
+        static const uint8_t empty = 0;
+        return &empty; // An empty file has no mapping
+    }
+    if (position < window_offset || position + length > window_offset + window_length) {
+        map_window(position, length);
+    } else {
+        release_read_pages();
+    }
+    const uint8_t* data = window + (position - window_offset);
+    position += length;
+    return data;
+}
+
+const char* MappedInputSource::name() const {
+    return "mapped";
+}
+
+// Maps the window that starts at `offset`, rounded down to the granularity, and covers at least `length` bytes
+void MappedInputSource::map_window(uint64_t offset, size_t length) {
+    unmap_window();
+    uint64_t start = offset - offset % granularity;
+    uint64_t end = std::min(file_size, std::max(start + WINDOW_SIZE, offset + length));
+    size_t mapped_length = size_t(end - start);
+
+#ifdef _WIN32
+    void* view = MapViewOfFile(mapping_handle, FILE_MAP_READ, DWORD(start >> 32), DWORD(start & 0xFFFFFFFF),
+                               mapped_length);
+    if (!view) {
+        throw std::runtime_error("Could not map the file: " + path);
+    }
+#else
+    void* view = mmap(nullptr, mapped_length, PROT_READ, MAP_PRIVATE, file_descriptor, off_t(start));
+    if (view == MAP_FAILED) {
+        throw std::runtime_error("Could not map the file: " + path);
+    }
+    madvise(view, mapped_length, MADV_SEQUENTIAL); // Read ahead aggressively
+#endif
+    window = static_cast<uint8_t*>(view);
+    window_offset = start;
+    window_length = mapped_length;
+    released_offset = start;
+}
+
+/**
+ * @brief Drops the pages of the window before the read position from the process.
+ *
+ * They stay in the page cache, and a seek back to them (block repair) faults them in again. Linux
+ * and macOS drop them with MADV_DONTNEED; on Windows, unlocking pages that are not locked removes
+ * them from the working set.
+ */
+void MappedInputSource::release_read_pages() {
+    uint64_t end = position - position % granularity;
+    if (end < released_offset + RELEASE_STEP) {
+        return;
+    }
+    uint8_t* start = window + (released_offset - window_offset);
+    size_t length = size_t(end - released_offset);
+#ifdef _WIN32
+    VirtualUnlock(start, length);
+#else
+    madvise(start, length, MADV_DONTNEED);
+#endif
+    released_offset = end;
+}
+
+void MappedInputSource::unmap_window() {
+    if (!window) {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(window);
+#else
+    munmap(window, size_t(window_length));
+#endif
+    window = nullptr;
+    window_offset = 0;
+    window_length = 0;
+}
+
+void MappedInputSource::close() {
+    unmap_window();
+#ifdef _WIN32
+    if (mapping_handle) {
+        CloseHandle(mapping_handle);
+        mapping_handle = nullptr;
+    }
+    if (file_handle) {
+        CloseHandle(file_handle);
+        file_handle = nullptr;
+    }
+#else
+    if (file_descriptor >= 0) {
+        ::close(file_descriptor);
+        file_descriptor = -1;
+    }
+#endif
+}
@@ -0,0 +1,105 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+#ifndef MAMAN15_INPUTSOURCE_H
+#define MAMAN15_INPUTSOURCE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Plaintext of the file being uploaded, as read by the encryption stage.
+// next() hands out the next bytes of the file without copying them where the backend allows it;
+// the returned pointer stays valid until the next call to next(), read() or seek().
+class InputSource {
+public:
+    virtual ~InputSource() = default;
+
+    // Opens the file memory-mapped if `mapped` is set and the system allows it, with the stream reader
+    // as the fallback. `max_length` is the longest range next() will be asked for.
+    static std::unique_ptr<InputSource> open(const std::string& path, size_t max_length, bool mapped = false);
+
+    virtual uint64_t size() const = 0;
+    virtual void seek(uint64_t offset) = 0;
+
+    // Returns the next `length` bytes of the file and moves past them
+    virtual const uint8_t* next(size_t length) = 0;
+
+    // Copies the next `length` bytes of the file into `out`
+    virtual void read(uint8_t* out, size_t length);
+
+    virtual const char* name() const = 0;
+
+protected:
+    explicit InputSource(const std::string& path) : path(path) {}
+
+    std::string path;
+};
+
+// Reads the file with std::ifstream into a buffer of its own
+class StreamInputSource : public InputSource {
+public:
+    StreamInputSource(const std::string& path, size_t max_length);
+
+    uint64_t size() const override;
+    void seek(uint64_t offset) override;
+    const uint8_t* next(size_t length) override;
+    void read(uint8_t* out, size_t length) override;
+    const char* name() const override;
+
+private:
+    std::ifstream file;
+    uint64_t file_size = 0;
+    std::vector<uint8_t> buffer;
+};
+
+// Maps the file into memory, so the pages are read by the kernel straight into the page cache and
+// never copied or zero-filled in user space. The file is mapped one small window at a time, and the
+// pages already read are dropped from the process as the reads move on, so resident memory stays
+// within a window however large the file is.
+//
+// A mapped file that is truncated while it is read raises SIGBUS on the next access past its new end,
+// so only files nothing writes to during the upload should be mapped.
+class MappedInputSource : public InputSource {
+public:
+    static constexpr uint64_t WINDOW_SIZE = 16 * 1024 * 1024;
+
+    // Throws std::runtime_error if the file cannot be opened or mapped
+    explicit MappedInputSource(const std::string& path);
+    ~MappedInputSource() override;
+
+    MappedInputSource(const MappedInputSource&) = delete;
+    MappedInputSource& operator=(const MappedInputSource&) = delete;
+
+    uint64_t size() const override;
+    void seek(uint64_t offset) override;
+    const uint8_t* next(size_t length) override;
+    const char* name() const override;
+
+private:
+#ifdef _WIN32
+    void* file_handle = nullptr;
+    void* mapping_handle = nullptr;
+#else
+    int file_descriptor = -1;
+#endif
+    uint64_t file_size = 0;
+    uint64_t granularity = 0;      // Window offsets must be multiples of it
+    uint64_t position = 0;
+    uint8_t* window = nullptr;
+    uint64_t window_offset = 0;    // File offset of the first byte of the window
+    uint64_t window_length = 0;
+    uint64_t released_offset = 0;  // File offset up to which the pages of the window were dropped
+
+    void map_window(uint64_t offset, size_t length);
+    void release_read_pages();
+    void unmap_window();
+    void close();
+};
+
+
+#endif //MAMAN15_INPUTSOURCE_H
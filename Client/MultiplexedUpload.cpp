@@ -0,0 +1,303 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+// MultiplexedUpload.cpp
+
+#include "MultiplexedUpload.h"
+#include "UploadIndex.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#define HEADER_SIZE 23           // 16 (UUID) + 1 (version) + 2 (op code) + 4 (payload size)
+#define RESPONSE_HEADER_SIZE 7   // 1 (version) + 2 (op code) + 4 (payload size)
+#define NAME_SIZE 255
+#define FRAME_METADATA_SIZE 5    // Stream id and flags
+#define OPEN_METADATA_SIZE (4 + 4 + NAME_SIZE) // Encrypted size, file size and file name
+#define MAX_RESPONSE_PAYLOAD_SIZE 1024
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+    void put_be(uint8_t* out, uint32_t value) {
+        out[0] = uint8_t(value >> 24);
+        out[1] = uint8_t(value >> 16);
+        out[2] = uint8_t(value >> 8);
+        out[3] = uint8_t(value);
+    }
+
+    uint32_t get_be(const uint8_t* in) {
+        return (uint32_t(in[0]) << 24) | (uint32_t(in[1]) << 16) | (uint32_t(in[2]) << 8) | uint32_t(in[3]);
+    }
+
+    long long to_ms(std::chrono::nanoseconds duration) {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+    }
+}
+
+/**
+ * @brief Constructor for MultiplexedUpload.
+ *
+ * @param socket The connection, after the key exchange.
+ * @param key The AES key of the session.
+ * @param pool Threads that encrypt the CTR/GCM ranges of a frame, or nullptr.
+ * @param header_prefix Client id and version of the request headers.
+ * @param max_streams Largest number of streams open at the same time, at most MAX_STREAMS.
+ * @param mapped_input Read the files through memory mappings rather than streams.
+ */
+MultiplexedUpload::MultiplexedUpload(tcp::socket& socket, CryptoPPKey& key, ThreadPool* pool,
+                                     const std::array<uint8_t, 17>& header_prefix, size_t max_streams,
+                                     bool mapped_input)
+        : socket(socket), key(key), pool(pool), header_prefix(header_prefix),
+          max_streams(std::clamp<size_t>(max_streams, 1, MAX_STREAMS)), mapped_input(mapped_input) {}
+
+void MultiplexedUpload::add_file(const std::string& path, const std::string& name) {
+    files.push_back(File{path, name});
+    results.emplace_back();
+    queue.push_back(files.size() - 1);
+}
+
+/**
+ * @brief Sends the queued files, interleaved on the connection.
+ *
+ * Each round gives every stream that still has frames to send its quantum, FRAME_SIZE times its
+ * weight, and sends its frames while they fit in what it has left. Answers are read between frames
+ * as soon as they arrive, so a verified stream frees its place for the next file during the round.
+ * Once every open stream sent its last frame, the engine waits for an answer.
+ */
+void MultiplexedUpload::run() {
+    Clock::time_point start = Clock::now();
+    while (!queue.empty() || !streams.empty()) {
+        open_streams();
+        bool sending = false;
+        for (size_t i = 0; i < streams.size(); i++) {
+            Stream& stream = *streams[i];
+            if (stream.ended || stream.closed) {
+                continue;
+            }
+            sending = true;
+            stream.deficit += FRAME_SIZE * stream.weight;
+            while (!stream.ended && !stream.closed && frame_cost(stream) <= stream.deficit) {
+                stream.deficit -= frame_cost(stream);
+                send_frame(stream);
+                while (receive_response(false)) {
+                }
+            }
+            if (stream.ended) {
+                stream.deficit = 0; // Deficit round robin: an idle stream keeps no credit
+            }
+        }
+        if (!sending && !streams.empty()) {
+            receive_response(true);
+        }
+        streams.erase(std::remove_if(streams.begin(), streams.end(),
+                                     [](const std::unique_ptr<Stream>& stream) { return stream->closed; }),
+                      streams.end());
+    }
+    stats.elapsed = Clock::now() - start;
+}
+
+const std::vector<MultiplexedUpload::Result>& MultiplexedUpload::get_results() const {
+    return results;
+}
+
+const MultiplexedUpload::Stats& MultiplexedUpload::get_stats() const {
+    return stats;
+}
+
+std::string MultiplexedUpload::Stats::to_string() const {
+    std::ostringstream out;
+    double seconds = std::chrono::duration<double>(elapsed).count();
+    out << "Multiplexed upload of " << files << " files finished in " << to_ms(elapsed) << " ms, " << frames
+        << " frames, " << retries << " sent again, up to " << max_open << " streams open, "
+        << (seconds > 0 ? double(bytes) / (1024 * 1024) / seconds : 0) << " MB/s\n";
+    if (!latencies.empty()) {
+        std::vector<std::chrono::nanoseconds> sorted;
+        for (const auto& latency : latencies) {
+            sorted.push_back(latency.second);
+        }
+        std::sort(sorted.begin(), sorted.end());
+        out << "  stream latency: median " << to_ms(sorted[sorted.size() / 2]) << " ms, max "
+            << to_ms(sorted.back()) << " ms\n";
+    }
+    for (const auto& latency : latencies) {
+        out << "  " << latency.first << ": " << to_ms(latency.second) << " ms\n";
+    }
+    return out.str();
+}
+
+// Opens streams for the queued files until max_streams are open
+void MultiplexedUpload::open_streams() {
+    for (auto it = queue.begin(); it != queue.end() && streams.size() < max_streams;) {
+        size_t index = *it;
+        const File& file = files[index];
+        if (name_in_use(file.name)) {
+            ++it; // The server saves one stream per file name at a time, the file waits for the other one
+            continue;
+        }
+        it = queue.erase(it);
+
+        Result& result = results[index];
+        auto stream = std::make_unique<Stream>();
+        try {
+            stream->input = InputSource::open(file.path, FRAME_SIZE, mapped_input);
+            result.size = stream->input->size();
+            result.modification_time = UploadIndex::modification_time(file.path);
+            stream->encryptor = key.create_file_encryptor(result.size, pool);
+            if (stream->encryptor->get_encrypted_size() > UINT32_MAX - FRAME_METADATA_SIZE - OPEN_METADATA_SIZE) {
+                throw std::runtime_error("File is too large for the 32-bit size fields of the protocol");
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Multiplexed upload of " << file.name << ": " << e.what() << std::endl;
+            result.outcome = Outcome::FAILED;
+            continue;
+        }
+        stream->id = next_stream_id++;
+        stream->file = index;
+        stream->remaining = result.size;
+        stream->weight = result.size <= SMALL_FILE_SIZE ? SMALL_FILE_WEIGHT : 1;
+        result.attempts++;
+        streams.push_back(std::move(stream));
+    }
+    stats.max_open = std::max(stats.max_open, streams.size());
+}
+
+bool MultiplexedUpload::name_in_use(const std::string& name) const {
+    return std::any_of(streams.begin(), streams.end(), [&](const std::unique_ptr<Stream>& stream) {
+        return !stream->closed && files[stream->file].name == name;
+    });
+}
+
+// Plaintext bytes the next frame of the stream takes from its deficit
+uint64_t MultiplexedUpload::frame_cost(const Stream& stream) const {
+    return std::min<uint64_t>(FRAME_SIZE, stream.remaining);
+}
+
+// Encrypts the next part of the stream's file and sends it as one frame
+void MultiplexedUpload::send_frame(Stream& stream) {
+    const File& file = files[stream.file];
+    size_t length = size_t(frame_cost(stream));
+    const uint8_t* data = length > 0 ? stream.input->next(length) : nullptr;
+    stream.remaining -= length;
+    bool last = stream.remaining == 0;
+    stream.encryptor->encrypt_chunk(data, length, last, cipher);
+
+    uint8_t flags = uint8_t((stream.opened ? 0 : FRAME_OPEN) | (last ? FRAME_END : 0));
+    size_t metadata_size = FRAME_METADATA_SIZE + (stream.opened ? 0 : OPEN_METADATA_SIZE);
+    std::array<uint8_t, HEADER_SIZE + FRAME_METADATA_SIZE + OPEN_METADATA_SIZE> request{};
+    std::copy(header_prefix.begin(), header_prefix.end(), request.begin());
+    request[17] = uint8_t(SENDING_FRAME >> 8);
+    request[18] = uint8_t(SENDING_FRAME & 0xFF);
+    put_be(&request[19], uint32_t(metadata_size + cipher.size()));
+    uint8_t* metadata = request.data() + HEADER_SIZE;
+    put_be(metadata, stream.id);
+    metadata[4] = flags;
+    if (!stream.opened) {
+        put_be(metadata + 5, uint32_t(stream.encryptor->get_encrypted_size()));
+        put_be(metadata + 9, uint32_t(results[stream.file].size));
+        std::memcpy(metadata + 13, file.name.data(), std::min<size_t>(file.name.size(), NAME_SIZE - 1));
+        stream.started = Clock::now();
+    }
+    std::array<boost::asio::const_buffer, 2> buffers{boost::asio::buffer(request.data(), HEADER_SIZE + metadata_size),
+                                                     boost::asio::buffer(cipher)};
+    boost::asio::write(socket, buffers);
+
+    stream.opened = true;
+    stream.ended = last;
+    stats.frames++;
+    stats.bytes += length;
+}
+
+// Tells the server whether the CRC of a file matched; the request is not answered
+void MultiplexedUpload::send_verdict(const File& file, uint8_t verdict) {
+    std::array<uint8_t, HEADER_SIZE + NAME_SIZE + 1> request{};
+    std::copy(header_prefix.begin(), header_prefix.end(), request.begin());
+    request[17] = uint8_t(STREAM_VERDICT >> 8);
+    request[18] = uint8_t(STREAM_VERDICT & 0xFF);
+    put_be(&request[19], NAME_SIZE + 1);
+    std::memcpy(&request[HEADER_SIZE], file.name.data(), std::min<size_t>(file.name.size(), NAME_SIZE - 1));
+    request[HEADER_SIZE + NAME_SIZE] = verdict;
+    boost::asio::write(socket, boost::asio::buffer(request));
+}
+
+/**
+ * @brief Reads and handles one answer of the server.
+ *
+ * @param wait Block until an answer arrives; otherwise only read one that is already buffered.
+ * @return True if an answer was handled.
+ * @throws On connection errors and on answers that belong to no stream.
+ */
+bool MultiplexedUpload::receive_response(bool wait) {
+    if (!wait && socket.available() < RESPONSE_HEADER_SIZE) {
+        return false;
+    }
+    std::array<uint8_t, RESPONSE_HEADER_SIZE> header{};
+    boost::asio::read(socket, boost::asio::buffer(header));
+    uint16_t op_code = uint16_t((header[1] << 8) | header[2]);
+    uint32_t size = get_be(&header[3]);
+    if (size > MAX_RESPONSE_PAYLOAD_SIZE) {
+        throw std::runtime_error("Response payload too large");
+    }
+    response.resize(size);
+    boost::asio::read(socket, boost::asio::buffer(response));
+    if ((op_code != STREAM_RECEIVED && op_code != STREAM_FAILED) || size < 20) { // 16 (client id) + 4 (stream id)
+        throw std::runtime_error("Unexpected response to a frame: " + std::to_string(op_code));
+    }
+
+    Stream* stream = find_stream(get_be(&response[16]));
+    if (!stream) {
+        return true; // The stream was answered before
+    }
+    const File& file = files[stream->file];
+    if (op_code == STREAM_FAILED) {
+        std::cerr << "Multiplexed upload: the server could not save " << file.name << std::endl;
+        retry_or_finish(*stream, Outcome::PENDING);
+        return true;
+    }
+    if (size < 24 || !stream->ended) {
+        throw std::runtime_error("Invalid answer for stream " + std::to_string(stream->id));
+    }
+
+    uint32_t checksum = get_be(&response[20]);
+    if (!stream->encryptor->verify_checksum(checksum)) {
+        std::cout << "CRC NOT OK: " << file.name << std::endl;
+        retry_or_finish(*stream, Outcome::CRC_FAILED);
+        return true;
+    }
+    Result& result = results[stream->file];
+    result.outcome = Outcome::VERIFIED;
+    result.checksum = checksum;
+    result.latency = Clock::now() - stream->started;
+    stream->closed = true;
+    stats.files++;
+    stats.latencies.emplace_back(file.name, result.latency);
+    send_verdict(file, VERDICT_OK);
+    return true;
+}
+
+MultiplexedUpload::Stream* MultiplexedUpload::find_stream(uint32_t id) {
+    for (auto& stream : streams) {
+        if (stream->id == id && !stream->closed) {
+            return stream.get();
+        }
+    }
+    return nullptr;
+}
+
+// Closes a stream that failed and queues its file again, or records how it ended after MAX_ATTEMPTS
+void MultiplexedUpload::retry_or_finish(Stream& stream, Outcome outcome) {
+    stream.closed = true;
+    Result& result = results[stream.file];
+    if (result.attempts < MAX_ATTEMPTS) {
+        queue.push_front(stream.file);
+        stats.retries++;
+        return;
+    }
+    result.outcome = outcome;
+    if (outcome == Outcome::CRC_FAILED) {
+        send_verdict(files[stream.file], VERDICT_FAILED);
+    }
+}
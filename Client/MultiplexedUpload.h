@@ -0,0 +1,144 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+#ifndef MAMAN15_MULTIPLEXEDUPLOAD_H
+#define MAMAN15_MULTIPLEXEDUPLOAD_H
+
+#include <boost/asio.hpp>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include "CryptoPPKey.h"
+#include "InputSource.h"
+#include "ThreadPool.h"
+
+using boost::asio::ip::tcp;
+
+// Upload engine that sends several files at once over one connection, as interleaved frames.
+// Sent one after the other, a small file waits until every large file queued before it is sent.
+// Here each file is a stream: its encrypted body is cut into frames of at most FRAME_SIZE plaintext
+// bytes, and the frames of the open streams are interleaved with deficit round robin. Each round a
+// stream may send FRAME_SIZE bytes times its weight, and small files have a higher weight, so a
+// small file is sent within one round whatever the size of the files next to it.
+//
+// SENDING_FRAME: stream id (4), flags (1), with FRAME_OPEN the encrypted size (4), file size (4)
+// and file name (255), then the part of the body. Frames are not answered; the frame with
+// FRAME_END is answered with STREAM_RECEIVED: client id (16), stream id (4) and the CRC32 of the
+// file (4). A stream the server cannot save is answered once with STREAM_FAILED: client id (16),
+// stream id (4), and its later frames are dropped. The client sends the result of the CRC check
+// in STREAM_VERDICT: file name (255) and VERDICT_OK or VERDICT_FAILED (1), not answered either.
+class MultiplexedUpload {
+public:
+    static constexpr size_t FRAME_SIZE = 64 * 1024;         // Plaintext bytes per frame
+    static constexpr size_t MAX_STREAMS = 64;                // Streams the server keeps open per connection
+    static constexpr uint64_t SMALL_FILE_SIZE = 4 * FRAME_SIZE; // Files up to this size are sent in one round
+    static constexpr size_t SMALL_FILE_WEIGHT = 4;
+    static constexpr size_t MAX_ATTEMPTS = 3;                // Attempts per file, as over the main connection
+    static constexpr uint16_t SENDING_FRAME = 838;
+    static constexpr uint16_t STREAM_VERDICT = 839;
+    static constexpr uint16_t STREAM_RECEIVED = 1612;
+    static constexpr uint16_t STREAM_FAILED = 1613;
+    static constexpr uint8_t FRAME_OPEN = 1;  // The frame opens its stream and carries the file metadata
+    static constexpr uint8_t FRAME_END = 2;   // The frame ends the body of its stream
+    static constexpr uint8_t VERDICT_OK = 0;
+    static constexpr uint8_t VERDICT_FAILED = 1;
+
+    enum class Outcome {
+        PENDING,    // Not sent, or every stream of it failed: the file is sent over the main flow
+        VERIFIED,   // The server's CRC matched
+        CRC_FAILED, // Still mismatching after the last attempt
+        FAILED      // Could not be opened
+    };
+
+    struct Result {
+        Outcome outcome = Outcome::PENDING;
+        uint64_t size = 0;
+        int64_t modification_time = 0; // Taken when the file was opened, before it was read
+        uint32_t checksum = 0;
+        size_t attempts = 0;
+        std::chrono::nanoseconds latency{0}; // From the first frame of the last attempt to its STREAM_RECEIVED
+    };
+
+    struct Stats {
+        size_t files = 0;        // Files verified
+        uint64_t frames = 0;
+        uint64_t retries = 0;    // Files sent again after a mismatching CRC or a failed stream
+        uint64_t bytes = 0;      // Plaintext bytes sent
+        size_t max_open = 0;     // Most streams open at the same time
+        std::chrono::nanoseconds elapsed{0};
+        std::vector<std::pair<std::string, std::chrono::nanoseconds>> latencies; // Per verified file
+
+        std::string to_string() const;
+    };
+
+    // `header_prefix` is the client id and version that start every request header.
+    // The connection must be idle: no request may wait for its response.
+    MultiplexedUpload(tcp::socket& socket, CryptoPPKey& key, ThreadPool* pool, const std::array<uint8_t, 17>& header_prefix,
+                      size_t max_streams, bool mapped_input);
+
+    MultiplexedUpload(const MultiplexedUpload&) = delete;
+    MultiplexedUpload& operator=(const MultiplexedUpload&) = delete;
+
+    // Queues a file; results are indexed in the order the files were added
+    void add_file(const std::string& path, const std::string& name);
+
+    // Sends every file and checks its CRC. Throws on connection errors, leaving the files
+    // whose streams did not end as PENDING.
+    void run();
+
+    const std::vector<Result>& get_results() const;
+    const Stats& get_stats() const;
+
+private:
+    struct Stream {
+        uint32_t id;
+        size_t file;                            // Index into files and results
+        std::unique_ptr<InputSource> input;
+        std::unique_ptr<FileEncryptor> encryptor;
+        uint64_t remaining = 0;                 // Plaintext bytes not sent yet
+        bool opened = false;                    // The FRAME_OPEN frame was sent
+        bool ended = false;                     // The FRAME_END frame was sent, the stream waits for its answer
+        bool closed = false;                    // Answered; removed after the round
+        size_t weight = 1;
+        uint64_t deficit = 0;                   // Bytes the stream may still send this round
+        std::chrono::steady_clock::time_point started;
+    };
+
+    struct File {
+        std::string path;
+        std::string name;
+    };
+
+    tcp::socket& socket;
+    CryptoPPKey& key;
+    ThreadPool* pool;
+    std::array<uint8_t, 17> header_prefix;
+    size_t max_streams;
+    bool mapped_input;
+
+    std::vector<File> files;
+    std::vector<Result> results;
+    std::deque<size_t> queue;                   // Files waiting for a stream
+    std::vector<std::unique_ptr<Stream>> streams; // Open streams, in round robin order
+    uint32_t next_stream_id = 1;                // Ids are never reused within a connection
+    std::vector<uint8_t> cipher;                // Encrypted part of the frame being sent
+    std::vector<uint8_t> response;
+    Stats stats;
+
+    void open_streams();
+    bool name_in_use(const std::string& name) const;
+    uint64_t frame_cost(const Stream& stream) const;
+    void send_frame(Stream& stream);
+    void send_verdict(const File& file, uint8_t verdict);
+    bool receive_response(bool wait);
+    Stream* find_stream(uint32_t id);
+    void retry_or_finish(Stream& stream, Outcome outcome);
+};
+
+
+#endif //MAMAN15_MULTIPLEXEDUPLOAD_H
@@ -0,0 +1,1528 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+// SessionProtocol.cpp
+
+#include "SessionProtocol.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <boost/uuid/uuid_io.hpp>
+#include <cryptopp/osrng.h>
+#include "MultiplexedUpload.h"
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <arpa/inet.h> // ntohl and ntohs
+#endif
+
+#define UPLOAD_INDEX_FILE "upload.index" // Files acknowledged in earlier runs
+#define SESSION_TICKET_FILE "ticket.info" // Ticket of the last key exchange
+
+// Takes the identity, the files and the state directory of the client from its configuration.
+// Nothing is sent until begin(), so the options can still be changed.
+SessionProtocol::SessionProtocol(tcp::socket& connection, ClientConfig client_config, Options session_options,
+                                 ThreadPool* shared_pool)
+        : connection(connection), config(std::move(client_config)), options(session_options),
+          crypto_key(config.private_key, config.save_identity ? config.state_directory : ""),
+          owned_pool(shared_pool ? nullptr : std::make_unique<ThreadPool>()),
+          cipher_pool(shared_pool ? *shared_pool : *owned_pool), block_tree(&cipher_pool),
+          upload_index(config.state_path(UPLOAD_INDEX_FILE)), session_ticket(config.state_path(SESSION_TICKET_FILE)) {
+    options.stream_block_size = std::max<size_t>(options.stream_block_size, CryptoPP::AES::BLOCKSIZE);
+    file_paths = std::move(config.files);
+    file_statuses.assign(file_paths.size(), FileStatus::PENDING);
+    if (!file_paths.empty()) {
+        select_file(0);
+    }
+    if (config.client_id) {
+        std::copy(config.client_id->begin(), config.client_id->end(), client_uuid.begin());
+    }
+}
+
+SessionProtocol::Options& SessionProtocol::get_options() {
+    return options;
+}
+
+void SessionProtocol::begin() {
+    if (file_paths.empty() && !watching()) {
+        throw std::runtime_error("No file to transfer");
+    }
+    prepare_request(first_request());
+}
+
+// A client with an id reconnects, resuming the session of its ticket if it has one, otherwise it registers
+// and sends its public key at once
+uint16_t SessionProtocol::first_request() {
+    if (config.client_id) {
+        uint16_t op_code = RECONNECT;
+        SessionTicket::ClientId id;
+        std::copy(client_uuid.begin(), client_uuid.end(), id.begin());
+        if (session_ticket.load(id)) {
+            op_code = RECONNECT_WITH_TICKET; // Resume the session of the saved ticket
+            std::cout << "Found a session ticket, resuming the session" << std::endl;
+        }
+        std::cout << "Reconnecting..." << std::endl;
+        return op_code;
+    }
+    std::cout << "No existing client info found, registering as new client" << std::endl;
+    if (config.key_agreement) {
+        crypto_key.use_key_agreement(); // Register an X25519 key, the session key is then agreed with it
+    }
+    std::cout << "Registering..." << std::endl;
+    return REGISTER_WITH_KEY;
+}
+
+std::array<boost::asio::const_buffer, 3> SessionProtocol::request_buffers(bool with_body_block) const {
+    return {boost::asio::buffer(header_buffer), boost::asio::buffer(payload),
+            with_body_block ? boost::asio::buffer(cipher_block) : boost::asio::const_buffer()};
+}
+
+uint16_t SessionProtocol::get_request_op_code() const {
+    return request_op_code;
+}
+
+size_t SessionProtocol::get_request_prefix_size() const {
+    return HEADER_SIZE + payload.size();
+}
+
+uint64_t SessionProtocol::get_body_size() const {
+    return streamed_body_size;
+}
+
+/**
+ * Prepares `op_code` as the next request. A step that finds it should send something else instead
+ * (the file is unchanged, the server is asked about it first, it is compressed or striped) names the
+ * request to prepare in its place, until one is ready to be sent.
+ */
+void SessionProtocol::prepare_request(uint16_t op_code) {
+    std::optional<uint16_t> next = op_code;
+    while (next) {
+        request_op_code = *next;
+        payload.clear(); // Clear any existing payload data
+        streamed_body_size = 0; // Only a file request streams data after the payload
+        commit_trailer = false;
+        next = prepare(request_op_code);
+    }
+    load_header();
+}
+
+// Prepares the payload of one request. Returns the request to prepare instead, if any.
+std::optional<uint16_t> SessionProtocol::prepare(uint16_t op_code) {
+    switch (op_code) {
+        case REGISTER:
+        case REGISTER_WITH_KEY:
+        case SENDING_PUBLIC_KEY:
+            prepare_registration(op_code);
+            break;
+        case RECONNECT:
+        case RECONNECT_WITH_TICKET:
+            prepare_reconnect(op_code);
+            break;
+        case SENDING_FILE:
+        case SENDING_FILE_RESUME:
+            if (std::optional<uint16_t> instead = choose_file_request(op_code)) {
+                return instead;
+            }
+            prepare_file(op_code);
+            break;
+        case RESUME_QUERY: // Ask the server how much of the file it already holds before sending anything
+            add_name_to_payload(current.name); // Add file name to payload
+            add_size_to_payload(uint32_t(std::min<uint64_t>(current.size, UINT32_MAX))); // Add decrypted file size to payload
+            break;
+        case SIGNATURE_QUERY: // Ask for the signatures of the server's copy, a delta may be much smaller than the file
+            add_name_to_payload(current.name); // Add file name to payload
+            break;
+        case SENDING_DELTA:
+            prepare_delta_body();
+            break;
+        case SENDING_FILE_COMPRESSED:
+            prepare_compressed_body();
+            break;
+        case STRIPES_COMPLETE:
+            prepare_striped_file();
+            break;
+        case BLOCK_HASHES:
+            prepare_block_hashes();
+            break;
+        case SENDING_BLOCKS:
+            return prepare_blocks();
+        case CRC_OK:
+        case CRC_NOT_OK:
+        case CRC_TERMINATION:
+            payload.assign(current.name.begin(), current.name.end()); // Add file name to payload
+            break;
+        case TERMINATE_CONNECTION:
+            std::cout << "Termination request" << std::endl;
+            break;
+        default:
+            std::cerr << "Unknown op_code: " << op_code << std::endl;
+            break;
+    }
+    return std::nullopt;
+}
+
+// REGISTER, REGISTER_WITH_KEY or SENDING_PUBLIC_KEY: the client name, then the offered features and the
+// public key, the X25519 key if the session key is agreed
+void SessionProtocol::prepare_registration(uint16_t op_code) {
+    add_name_to_payload(config.name); // Add client name to payload
+    if (op_code == REGISTER) {
+        std::cout << "Preparing registration request for client: " << config.name << std::endl;
+        return;
+    }
+    if (op_code == REGISTER_WITH_KEY) {
+        add_size_to_payload(offered_features()); // Offer the features, every server that reads this request negotiates
+        add_to_payload(crypto_key.uses_key_agreement() ? crypto_key.get_agreement_public_key() : crypto_key.get_public_key_base64());
+        std::cout << "Preparing registration request with the public key for client: " << config.name << std::endl;
+        return;
+    }
+    if (server_version >= MIN_NEGOTIATING_SERVER_VERSION) {
+        add_size_to_payload(offered_features()); // Offer the features, older servers expect the key here
+    }
+    add_to_payload(crypto_key.get_public_key_base64()); // Add public key to payload
+    std::cout << "Sending public key" << std::endl;
+}
+
+// RECONNECT, or RECONNECT_WITH_TICKET with the nonce of the client and the saved ticket
+void SessionProtocol::prepare_reconnect(uint16_t op_code) {
+    add_name_to_payload(config.name); // Add client name to payload
+    add_size_to_payload(offered_features()); // Offer the features, older servers ignore them
+    if (op_code == RECONNECT_WITH_TICKET) {
+        session_nonce.assign(SESSION_NONCE_SIZE, 0);
+        CryptoPP::AutoSeededRandomPool().GenerateBlock(session_nonce.data(), session_nonce.size());
+        add_to_payload(session_nonce); // Add the nonce of the client, the server adds its own
+        add_to_payload(session_ticket.get_ticket()); // Add the ticket
+    }
+}
+
+/**
+ * Decides how the current file is sent, before SENDING_FILE or SENDING_FILE_RESUME is prepared.
+ * Returns the request to send instead: TERMINATE_CONNECTION once no file is left, a query about
+ * the file, or its compressed or striped form. Opens the file for every request that reads it.
+ */
+std::optional<uint16_t> SessionProtocol::choose_file_request(uint16_t op_code) {
+    if (file_paths.empty()) {
+        // The watcher provides the files, the session waits for them once the key is exchanged
+        batch_ended = true;
+        return TERMINATE_CONNECTION;
+    }
+    bool first_attempt = op_code == SENDING_FILE && !current.resume_checked && !current.delta_attempted;
+    if (first_attempt && skip_unchanged_files()) {
+        return TERMINATE_CONNECTION; // Every remaining file of the batch is unchanged since it was acknowledged
+    }
+    if (first_attempt && multiplexing_enabled() && !batch_multiplexed && !run_multiplexed_upload()) {
+        batch_ended = true;
+        return TERMINATE_CONNECTION; // Every file of the batch was sent as a stream
+    }
+    try {
+        open_file_for_streaming(); // Open the file, its content is read while it is sent
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        finish_current_file(FileStatus::FAILED);
+        // Nothing was sent for this file yet, so the session can go on with the next one
+        return select_next_file() ? SENDING_FILE : TERMINATE_CONNECTION;
+    }
+    if (op_code == SENDING_FILE && resume_enabled() && !current.resume_checked) {
+        return RESUME_QUERY;
+    }
+    if (op_code == SENDING_FILE && delta_enabled() && !current.delta_attempted && current.size >= DeltaEncoder::MIN_FILE_SIZE) {
+        current.delta_attempted = true;
+        return SIGNATURE_QUERY;
+    }
+    current.resume_checked = false; // The next attempt asks again
+    current.compressor.reset(); // Set only while the body of the current file is compressed
+    if (op_code == SENDING_FILE && compression_enabled() && current.compress && current.size >= FileCompressor::MIN_FILE_SIZE) {
+        current.compressor = std::make_unique<FileCompressor>(&cipher_pool);
+        if (block_repair_enabled()) {
+            block_tree.reset(current.size);
+            current.compressor->set_block_tree(&block_tree); // Hash the blocks while the file is measured
+        }
+        if (current.compressor->scan(*current.input)) {
+            return SENDING_FILE_COMPRESSED;
+        }
+        current.compressor.reset(); // The file does not compress well enough, send it as it is
+    }
+    if (op_code == SENDING_FILE && striping_enabled() && current.stripe && current.size >= StripedUpload::MIN_FILE_SIZE) {
+        return STRIPES_COMPLETE; // Send the segments over several connections, then tell the server the file is complete
+    }
+    return std::nullopt;
+}
+
+// SENDING_FILE or SENDING_FILE_RESUME: the sizes and the name of the file, then its encrypted body
+// from the start or from the part the server already holds
+void SessionProtocol::prepare_file(uint16_t op_code) {
+    // Skip the part of the file the server already holds
+    current.stream_offset = (op_code == SENDING_FILE_RESUME) ? current.resume_offset : 0;
+    current.input->seek(current.stream_offset);
+    current.encryptor = crypto_key.create_file_encryptor(current.size - current.stream_offset, &cipher_pool);
+    if (current.stream_offset > 0) {
+        current.encryptor->resume_checksum(current.resume_crc_state, current.stream_offset); // The checksum still covers the whole file
+    }
+    if (block_repair_enabled()) {
+        if (current.stream_offset == 0) {
+            block_tree.reset(current.size); // When resuming, the tree already holds the skipped part
+        }
+        current.encryptor->set_block_tree(&block_tree); // Hash the blocks while they are encrypted
+    }
+    uint64_t encrypted_size = current.encryptor->get_encrypted_size();
+    if (encrypted_size > UINT32_MAX - FILE_METADATA_SIZE) {
+        throw std::runtime_error("File is too large for the 32-bit size fields of the protocol");
+    }
+
+    add_size_to_payload(uint32_t(encrypted_size)); // Add encrypted file size to payload
+    add_size_to_payload(uint32_t(current.size)); // Add decrypted file size to payload
+    add_name_to_payload(current.name); // Add file name to payload
+    if (op_code == SENDING_FILE_RESUME) {
+        add_size_to_payload(uint32_t(current.stream_offset)); // Add the offset the body starts at
+        std::cout << "Resuming file: " << current.name << " at byte " << current.stream_offset << std::endl;
+    } else {
+        commit_trailer = commit_enabled(); // The checksum computed while the file is encrypted follows it
+    }
+    streamed_body_size = encrypted_size; // The encrypted file follows the payload
+
+    std::cout << "Preparing to send file: " << current.name << std::endl;
+}
+
+// SENDING_DELTA: the delta of the file against the server's copy
+void SessionProtocol::prepare_delta_body() {
+    current.resume_checked = false; // The next attempt asks again
+    current.stream_offset = 0;
+    current.encryptor = crypto_key.create_file_encryptor(current.delta_encoder->get_delta_size(), &cipher_pool);
+    uint64_t encrypted_size = current.encryptor->get_encrypted_size();
+    if (encrypted_size > UINT32_MAX - DELTA_METADATA_SIZE) {
+        throw std::runtime_error("Delta is too large for the 32-bit size fields of the protocol");
+    }
+
+    add_size_to_payload(uint32_t(encrypted_size)); // Add encrypted delta size to payload
+    add_size_to_payload(uint32_t(current.size)); // Add decrypted file size to payload
+    add_name_to_payload(current.name); // Add file name to payload
+    add_size_to_payload(current.delta_encoder->get_block_size()); // Add the block size of the signatures
+    commit_trailer = commit_enabled(); // The checksum of the rebuilt file follows the delta
+    streamed_body_size = encrypted_size; // The encrypted delta follows the payload
+}
+
+// SENDING_FILE_COMPRESSED: the compressed file, its blocks were hashed while it was measured
+void SessionProtocol::prepare_compressed_body() {
+    current.stream_offset = 0;
+    current.encryptor = crypto_key.create_file_encryptor(current.compressor->get_compressed_size(), &cipher_pool);
+    uint64_t encrypted_size = current.encryptor->get_encrypted_size();
+    if (encrypted_size > UINT32_MAX - FILE_METADATA_SIZE) {
+        throw std::runtime_error("File is too large for the 32-bit size fields of the protocol");
+    }
+
+    add_size_to_payload(uint32_t(encrypted_size)); // Add encrypted compressed size to payload
+    add_size_to_payload(uint32_t(current.size)); // Add decrypted file size to payload
+    add_name_to_payload(current.name); // Add file name to payload
+    commit_trailer = commit_enabled(); // The checksum of the decompressed file follows the body
+    streamed_body_size = encrypted_size; // The encrypted compressed file follows the payload
+
+    std::cout << "Preparing to send file: " << current.name << " compressed from " << current.size << " to "
+              << current.compressor->get_compressed_size() << " bytes" << std::endl;
+}
+
+// STRIPES_COMPLETE: the segments of the file are sent before this request, see run_striped_upload()
+void SessionProtocol::prepare_striped_file() {
+    current.striped_upload = std::make_unique<StripedUpload>(current.path, current.name, current.size, maps_files(),
+                                                             options.stream_block_size, options.max_stripe_streams,
+                                                             header_prefix(), [this]() { return open_stripe_stream(); });
+    add_size_to_payload(uint32_t(current.size)); // Add decrypted file size to payload
+    add_name_to_payload(current.name); // Add file name to payload
+
+    std::cout << "Preparing to send file: " << current.name << " over up to " << options.max_stripe_streams
+              << " connections" << std::endl;
+}
+
+// BLOCK_HASHES: the block hashes of the file, the server answers with the blocks that differ
+void SessionProtocol::prepare_block_hashes() {
+    add_name_to_payload(current.name); // Add file name to payload
+    add_size_to_payload(uint32_t(BlockHashTree::BLOCK_SIZE)); // Add the block size
+    add_size_to_payload(uint32_t(block_tree.get_leaf_count())); // Add the number of blocks
+    const BlockHashTree::Hash& root = block_tree.get_root();
+    payload.insert(payload.end(), root.begin(), root.end()); // Add the root, the server checks the leaves against it
+    for (const BlockHashTree::Hash& leaf : block_tree.get_leaves()) {
+        payload.insert(payload.end(), leaf.begin(), leaf.end()); // Add the leaves in block order
+    }
+}
+
+// SENDING_BLOCKS: the blocks the server holds a different copy of, read again from the file.
+// Returns CRC_TERMINATION instead if the file cannot be read.
+std::optional<uint16_t> SessionProtocol::prepare_blocks() {
+    try {
+        open_file_for_streaming(); // The blocks are read again from the file
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return CRC_TERMINATION; // The file cannot be repaired
+    }
+    add_name_to_payload(current.name); // Add file name to payload
+    add_size_to_payload(uint32_t(current.bad_blocks.size())); // Add the number of blocks
+
+    uint64_t encrypted_size = 0;
+    current.block_encryptors.clear();
+    for (uint32_t index : current.bad_blocks) {
+        add_size_to_payload(index); // Add the block index
+        current.block_encryptors.push_back(crypto_key.create_file_encryptor(block_tree.get_block_length(index), &cipher_pool));
+        encrypted_size += current.block_encryptors.back()->get_encrypted_size();
+    }
+    if (encrypted_size > UINT32_MAX - payload.size()) {
+        throw std::runtime_error("Blocks are too large for the 32-bit size fields of the protocol");
+    }
+    streamed_body_size = encrypted_size; // The encrypted blocks follow the payload
+    return std::nullopt;
+}
+
+// Writes the request header into header_buffer. The payload and the body are not copied behind it:
+// they stay in their own buffers and go out with the header in one gathered write.
+void SessionProtocol::load_header() {
+    uint8_t* header = header_buffer.data();
+    uint32_t payload_size = uint32_t(payload.size() + streamed_body_size + (commit_trailer ? commit_trailer_buffer.size() : 0));
+
+    // Client id (16 bytes)
+    std::copy(client_uuid.begin(), client_uuid.end(), header);
+
+    // Version (as a raw byte)
+    header[16] = PROTOCOL_VERSION;
+
+    // Op code (2 bytes, as it's a 16-bit integer)
+    header[17] = static_cast<uint8_t>((request_op_code >> 8) & 0xFF);  // High byte
+    header[18] = static_cast<uint8_t>(request_op_code & 0xFF);         // Low byte
+
+    // Payload size (4 bytes, as it's a 32-bit integer)
+    header[19] = static_cast<uint8_t>((payload_size >> 24) & 0xFF);  // Highest byte
+    header[20] = static_cast<uint8_t>((payload_size >> 16) & 0xFF);  // High byte
+    header[21] = static_cast<uint8_t>((payload_size >> 8) & 0xFF);   // Low byte
+    header[22] = static_cast<uint8_t>(payload_size & 0xFF);          // Lowest byte
+}
+
+// Appends a string to the payload padded to a fixed length of 255 bytes for consistency in packet transmission.
+// The name is written in place, padded with zeroes to match the required size.
+void SessionProtocol::add_name_to_payload(const std::string& name_str) {
+    size_t name_length = name_str.size();
+
+    // Ensure the string is not longer than 254 characters
+    if (name_length > 254) {
+        std::cerr << "Error: Name exceeds 254 characters. Truncating..." << std::endl;
+        name_length = 254;  // Truncate the string if too long
+    }
+
+    // Copy the characters of the string, then null-terminate and pad it
+    payload.insert(payload.end(), name_str.begin(), name_str.begin() + name_length);
+    payload.insert(payload.end(), 255 - name_length, 0);
+}
+
+// Appends the given size to the payload as 4 bytes (big-endian)
+void SessionProtocol::add_size_to_payload(uint32_t size) {
+    payload.push_back(static_cast<uint8_t>((size >> 24) & 0xFF));  // Highest byte
+    payload.push_back(static_cast<uint8_t>((size >> 16) & 0xFF));  // High byte
+    payload.push_back(static_cast<uint8_t>((size >> 8) & 0xFF));   // Low byte
+    payload.push_back(static_cast<uint8_t>(size & 0xFF));          // Lowest byte
+}
+
+// Adds a vector of data to the payload for sending
+void SessionProtocol::add_to_payload(const std::vector<uint8_t>& data) {
+    payload.insert(payload.end(), data.begin(), data.end()); // Append the data to the payload
+}
+
+// Prepares next_body_block() for the body of the current request
+void SessionProtocol::begin_body() {
+    body_remaining = current.size - current.stream_offset;
+    body_block_index = 0;
+    body_done = false;
+    if (request_op_code == SENDING_DELTA || request_op_code == SENDING_FILE_COMPRESSED) {
+        encoded_block.resize(options.stream_block_size);
+    }
+}
+
+/**
+ * Reads and encrypts the next block of the body into cipher_block.
+ * A file body is read in stream_block_size blocks; the body of SENDING_BLOCKS is one encrypted
+ * body per block listed in BAD_BLOCKS, each with its own file IV, so the server decrypts it
+ * without the rest of the file. The body of SENDING_DELTA is the delta, whose literals are read
+ * from the file again, and the body of SENDING_FILE_COMPRESSED is the file compressed again batch by batch.
+ * Returns false once the whole body was produced.
+ */
+bool SessionProtocol::next_body_block() {
+    if (request_op_code == SENDING_DELTA) {
+        if (body_done) {
+            return false;
+        }
+        size_t length = current.delta_encoder->encode(*current.input, encoded_block.data(), encoded_block.size());
+        body_done = current.delta_encoder->is_encoded();
+        current.encryptor->encrypt_chunk(encoded_block.data(), length, body_done, cipher_block);
+        return true;
+    }
+    if (request_op_code == SENDING_FILE_COMPRESSED) {
+        if (body_done) {
+            return false;
+        }
+        size_t length = current.compressor->encode(*current.input, encoded_block.data(), encoded_block.size());
+        body_done = current.compressor->is_encoded();
+        current.encryptor->encrypt_chunk(encoded_block.data(), length, body_done, cipher_block);
+        return true;
+    }
+    if (request_op_code == SENDING_BLOCKS) {
+        if (body_block_index == current.bad_blocks.size()) {
+            return false;
+        }
+        uint32_t index = current.bad_blocks[body_block_index];
+        size_t length = size_t(block_tree.get_block_length(index));
+        current.input->seek(uint64_t(index) * BlockHashTree::BLOCK_SIZE);
+        const uint8_t* block = current.input->next(length);
+        current.block_encryptors[body_block_index++]->encrypt_chunk(block, length, true, cipher_block);
+        return true;
+    }
+
+    if (body_done) {
+        return false;
+    }
+    size_t bytes_to_read = size_t(std::min<uint64_t>(options.stream_block_size, body_remaining));
+    const uint8_t* block = current.input->next(bytes_to_read); // A view of the mapping, or the stream's buffer
+    body_remaining -= bytes_to_read;
+    body_done = body_remaining == 0; // An empty file still has one (final) block
+
+    current.encryptor->encrypt_chunk(block, bytes_to_read, body_done, cipher_block);
+    return true;
+}
+
+const std::vector<uint8_t>& SessionProtocol::get_body_block() const {
+    return cipher_block;
+}
+
+// Closes the file once its body was sent and checks the body matches the announced size
+void SessionProtocol::end_body(uint64_t bytes_sent) {
+    current.input.reset();
+    current.block_encryptors.clear();
+    if (bytes_sent != streamed_body_size) {
+        throw std::runtime_error("Encrypted file size does not match the announced size");
+    }
+}
+
+// True if the body of the current request is the file itself, from the start or the resume offset
+bool SessionProtocol::is_file_body() const {
+    return request_op_code == SENDING_FILE || request_op_code == SENDING_FILE_RESUME;
+}
+
+SessionProtocol::FileBody SessionProtocol::get_file_body() {
+    return FileBody{current.path, *current.input, current.stream_offset, current.size - current.stream_offset,
+                    *current.encryptor};
+}
+
+bool SessionProtocol::has_commit_trailer() const {
+    return commit_trailer;
+}
+
+boost::asio::const_buffer SessionProtocol::get_commit_trailer() {
+    prepare_commit_trailer();
+    return boost::asio::buffer(commit_trailer_buffer);
+}
+
+// Writes the checksum the server verifies the file against into commit_trailer_buffer, once the body
+// was sent. A plain file is checksummed by its encryptor on the way out, so it is read only once.
+void SessionProtocol::prepare_commit_trailer() {
+    current.commit_checksum = request_op_code == SENDING_DELTA ? current.delta_encoder->get_checksum()
+                              : request_op_code == SENDING_FILE_COMPRESSED ? current.compressor->get_checksum()
+                              : current.encryptor->get_checksum();
+    uint32_t checksum = current.commit_checksum;
+    commit_trailer_buffer = {static_cast<uint8_t>((checksum >> 24) & 0xFF),
+                             static_cast<uint8_t>((checksum >> 16) & 0xFF),
+                             static_cast<uint8_t>((checksum >> 8) & 0xFF),
+                             static_cast<uint8_t>(checksum & 0xFF)};
+}
+
+bool SessionProtocol::has_striped_upload() const {
+    return request_op_code == STRIPES_COMPLETE && current.striped_upload;
+}
+
+// Sends the segments of the current file before STRIPES_COMPLETE. If the upload fails, the request
+// is still sent: the server checksums what it has, and the mismatch sends the file again over this connection.
+void SessionProtocol::run_striped_upload() {
+    current.input.reset(); // Each connection reads the file through its own input
+    current.striped_upload_ok = false;
+    try {
+        current.striped_checksum = current.striped_upload->run();
+        current.striped_upload_ok = true;
+        std::cout << current.striped_upload->get_stats().to_string();
+    } catch (const std::exception& e) {
+        std::cerr << "Striped upload of " << current.name << " failed: " << e.what() << std::endl;
+        current.stripe = false;
+    }
+    current.striped_upload.reset();
+}
+
+boost::asio::mutable_buffer SessionProtocol::response_header_buffer() {
+    response_buffer.resize(RESPONSE_HEADER_SIZE);
+    return boost::asio::buffer(response_buffer);
+}
+
+// Makes room for the payload announced by the response header. The buffer is reused, so once it grew
+// to the largest response no further allocation happens.
+boost::asio::mutable_buffer SessionProtocol::response_payload_buffer() {
+    uint32_t size = ntohl(*reinterpret_cast<const uint32_t*>(&response_buffer[3]));
+    if (size > MAX_RESPONSE_PAYLOAD_SIZE) {
+        throw std::runtime_error("Response payload too large");
+    }
+    response_buffer.resize(RESPONSE_HEADER_SIZE + size);
+    return boost::asio::buffer(response_buffer.data() + RESPONSE_HEADER_SIZE, size);
+}
+
+bool SessionProtocol::handle_response() {
+    try {
+        parse_response();
+        // If the received operation code is handled successfully, continue to send another request
+        if (!handle_response_code(received_op_code)) {
+            return false;
+        }
+        prepare_request(request_op_code);
+        // With a watcher the session waits for the next files instead of ending with the batch
+        while (request_op_code == TERMINATE_CONNECTION && batch_ended && watching() && wait_for_watched_files()) {
+            prepare_request(SENDING_FILE);
+        }
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Error during client flow: " << e.what() << std::endl;
+    }
+    return false;
+}
+
+// Parses the response in response_buffer to extract relevant information.
+// The payload is not copied: response_payload points into the buffer until the next response is read.
+void SessionProtocol::parse_response() {
+    // Check if the response is long enough to contain the required data
+    if (response_buffer.size() < RESPONSE_HEADER_SIZE) {
+        std::cerr << "Error: Response is too short." << std::endl;
+        return; // Early exit on invalid response size
+    }
+
+    // Extract version and operation code from the response
+    server_version = response_buffer[0];
+    received_op_code = ntohs(*reinterpret_cast<const uint16_t*>(&response_buffer[1]));
+    std::cout << " - Op Code: " << received_op_code << std::endl;
+    // The payload starts at byte 7
+    response_payload = PayloadView{response_buffer.data() + RESPONSE_HEADER_SIZE, response_buffer.size() - RESPONSE_HEADER_SIZE};
+}
+
+// Handles the operation code received from the server and chooses the next request.
+// Returns false if the session is over.
+bool SessionProtocol::handle_response_code(uint16_t op_code) {
+    switch (op_code) {
+        case REGISTER_OK:
+            handle_registered();
+            break;
+        case REGISTER_NOK:
+            handle_register_refused();
+            break;
+        case RECEIVE_AES_KEY:
+        case RECONNECT_OK_SEND_AES:
+            handle_key_exchange();
+            break;
+        case SESSION_RESUMED:
+            handle_session_resumed();
+            break;
+        case FILE_RECEIVE_OK_AND_CRC:
+            handle_checksum();
+            break;
+        case FILE_COMMITTED:
+            return handle_file_committed();
+        case FILE_COMMIT_FAILED: {
+            // The server kept its copy but marked it unverified, so the file is sent again without CRC_NOT_OK
+            uint16_t next_op_code = checksum_mismatch_request();
+            request_op_code = next_op_code == CRC_NOT_OK ? uint16_t(SENDING_FILE) : next_op_code;
+            break;
+        }
+        case MESSAGE_RECEIVE_OK:
+            return handle_message();
+        case RECONNECT_NOK:
+            handle_reconnect_refused();
+            break;
+        case RESUME_OFFSET:
+            handle_resume_offset();
+            break;
+        case BAD_BLOCKS:
+            handle_bad_blocks();
+            break;
+        case BLOCK_SIGNATURES:
+            handle_signatures();
+            break;
+        case GENERAL_ERROR:
+            handle_general_error();
+            break;
+    }
+    return true;
+}
+
+// REGISTER_OK: the UUID the server registered the client under, the public key follows
+void SessionProtocol::handle_registered() {
+    // Validate the payload length for UUID
+    if (response_payload.size() != 16) {
+        std::cerr << "Error: Invalid UUID length" << std::endl;
+        request_op_code = REGISTER_NOK; // Set request code for failed registration
+    } else if (!save_registration()) {
+        request_op_code = TERMINATE_CONNECTION; // Set termination request due to error
+    } else {
+        request_op_code = SENDING_PUBLIC_KEY; // Proceed to send public key
+    }
+}
+
+// REGISTER_NOK: the registration is sent again, up to three times
+void SessionProtocol::handle_register_refused() {
+    connection_request_count++;
+    if (connection_request_count < 4) {
+        std::cout << "REGISTER NOK" << std::endl;
+        std::cout << "Trying to register again..." << std::endl;
+        // Retry registration with the same request
+        return;
+    }
+    std::cout << "REGISTER NOK after 3 attempts" << std::endl;
+    std::cout << "Terminating connection..." << std::endl;
+    fatal_error_message = "Registration failed after 3 attempts"; // Log fatal error
+    request_op_code = TERMINATE_CONNECTION; // Set termination request
+}
+
+// RECEIVE_AES_KEY or RECONNECT_OK_SEND_AES: the AES key of the session, then the first file is sent
+void SessionProtocol::handle_key_exchange() {
+    if (request_op_code == REGISTER_WITH_KEY && (response_payload.size() < 16 || !save_registration())) {
+        // The client was registered, but its UUID could not be saved
+        request_op_code = TERMINATE_CONNECTION;
+        return;
+    }
+    std::cout << "Analyzing AES key..." << std::endl;
+    try {
+        // Decrypt the AES key and apply the cipher mode selected by the server
+        parse_key_exchange();
+        std::cout << "AES key decrypted successfully" << std::endl;
+    } catch (const std::exception& e) {
+        std::cout << "AES key decryption failed" << std::endl;
+        std::cerr << "Error: " << e.what() << std::endl;
+        request_op_code = TERMINATE_CONNECTION; // Set termination request due to error
+        return;
+    }
+    request_op_code = SENDING_FILE; // Proceed to send the file
+}
+
+// SESSION_RESUMED: the session of the ticket was resumed, then the first file is sent
+void SessionProtocol::handle_session_resumed() {
+    try {
+        // Derive the AES key from the ticket and apply the cipher mode selected by the server
+        parse_session_resumed();
+        std::cout << "Session resumed with the saved ticket" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        request_op_code = TERMINATE_CONNECTION; // Set termination request due to error
+        return;
+    }
+    request_op_code = SENDING_FILE; // Proceed to send the file
+}
+
+// FILE_RECEIVE_OK_AND_CRC: the checksum of the file the server saved, confirmed with CRC_OK if it matches
+void SessionProtocol::handle_checksum() {
+    std::cout << "Checking CRC32 checksum..." << std::endl;
+    if (response_payload.size() < 279) { // 16 (client id) + 4 (content size) + 255 (file name) + 4 (checksum)
+        std::cerr << "Error: CRC response is too short." << std::endl;
+        request_op_code = TERMINATE_CONNECTION;
+        return;
+    }
+    uint32_t checksum = ntohl(*reinterpret_cast<const uint32_t*>(&response_payload[275])); // Extract checksum
+    // Verify the checksum using the crypto key; after a delta or a compressed body, including the
+    // blocks of a compressed body sent again, the server checksums the file it rebuilt
+    bool checksum_ok = request_op_code == SENDING_DELTA
+                       ? current.delta_encoder && current.delta_encoder->get_checksum() == checksum
+                       : request_op_code == STRIPES_COMPLETE
+                       ? current.striped_upload_ok && current.striped_checksum == checksum
+                       : current.compressor
+                       ? current.compressor->get_checksum() == checksum
+                       : current.encryptor && current.encryptor->verify_checksum(checksum);
+    if (checksum_ok) {
+        std::cout << "File received successfully" << std::endl;
+        record_uploaded_file(checksum); // The file is skipped next time if it does not change
+        request_op_code = CRC_OK; // Set request code for successful CRC
+    } else {
+        request_op_code = checksum_mismatch_request();
+    }
+}
+
+// FILE_COMMITTED: the server verified the file against the checksum sent with it.
+// Returns false if the server closed the session after the file.
+bool SessionProtocol::handle_file_committed() {
+    std::cout << "File received and verified" << std::endl;
+    record_uploaded_file(current.commit_checksum); // The file is skipped next time if it does not change
+    finish_current_file(FileStatus::VERIFIED);
+    if (select_next_file()) {
+        request_op_code = SENDING_FILE; // Send the next file over the same session
+        return true;
+    }
+    if (accepted_features & FEATURE_BATCH) {
+        request_op_code = TERMINATE_CONNECTION; // The server waits for the next request
+        return true;
+    }
+    print_batch_summary();
+    return false;
+}
+
+// MESSAGE_RECEIVE_OK: the answer to CRC_OK, CRC_NOT_OK, CRC_TERMINATION and TERMINATE_CONNECTION.
+// Returns false if the session is over.
+bool SessionProtocol::handle_message() {
+    if (request_op_code == CRC_NOT_OK) {
+        request_op_code = SENDING_FILE; // Retry sending the file
+        return true;
+    }
+    if (request_op_code == CRC_OK || request_op_code == CRC_TERMINATION) {
+        finish_current_file(request_op_code == CRC_OK ? FileStatus::VERIFIED : FileStatus::CRC_FAILED);
+        if (select_next_file()) {
+            request_op_code = SENDING_FILE; // Send the next file over the same session
+            return true;
+        }
+        if (accepted_features & FEATURE_BATCH) {
+            request_op_code = TERMINATE_CONNECTION; // The server waits for the next request
+            return true;
+        }
+    }
+    // Store the error message received in the payload
+    fatal_error_message = std::string(response_payload.begin() + std::min<size_t>(16, response_payload.size()), response_payload.end());
+    std::cout << "Message received successfully" << std::endl;
+    print_batch_summary();
+    return false;
+}
+
+// RECONNECT_NOK: the reconnection is sent again, up to three times
+void SessionProtocol::handle_reconnect_refused() {
+    reconnection_request_count++;
+    if (reconnection_request_count < 4) {
+        std::cout << "Reconnect failed" << std::endl;
+        request_op_code = RECONNECT; // Retry reconnection
+        return;
+    }
+    std::cout << "Reconnect failed after 3 attempts" << std::endl;
+    std::cout << "Terminating connection..." << std::endl;
+    request_op_code = TERMINATE_CONNECTION; // Set termination request
+}
+
+// RESUME_OFFSET: the number of bytes of the file the server already holds, and their CRC32 state
+void SessionProtocol::handle_resume_offset() {
+    current.resume_checked = true;
+    current.resume_offset = 0;
+    if (response_payload.size() >= 24) {
+        uint32_t offset = ntohl(*reinterpret_cast<const uint32_t*>(&response_payload[16])); // Extract the offset
+        uint32_t crc_state = ntohl(*reinterpret_cast<const uint32_t*>(&response_payload[20])); // Extract its CRC32 state
+        // Only resume if the saved part matches the local file
+        if (offset > 0 && offset <= current.size && checksum_file_prefix(offset) == crc_state) {
+            current.resume_offset = offset;
+            current.resume_crc_state = crc_state;
+        } else if (offset > 0) {
+            std::cout << "Saved part of " << current.name << " does not match the local file" << std::endl;
+        }
+    }
+    request_op_code = current.resume_offset > 0 ? SENDING_FILE_RESUME : SENDING_FILE;
+}
+
+// BAD_BLOCKS: the blocks the server holds a different copy of
+void SessionProtocol::handle_bad_blocks() {
+    current.bad_blocks.clear();
+    if (response_payload.size() >= 20) {
+        uint32_t count = ntohl(*reinterpret_cast<const uint32_t*>(&response_payload[16])); // Extract the number of blocks
+        if (response_payload.size() >= 20 + size_t(count) * 4) {
+            for (uint32_t i = 0; i < count; i++) {
+                uint32_t index = ntohl(*reinterpret_cast<const uint32_t*>(&response_payload[20 + i * 4]));
+                if (index < block_tree.get_leaf_count()) {
+                    current.bad_blocks.push_back(index);
+                }
+            }
+        }
+    }
+    if (current.bad_blocks.empty()) {
+        std::cout << "Damaged blocks not found, sending the whole file again" << std::endl;
+        request_op_code = CRC_NOT_OK;
+    } else {
+        std::cout << "Sending again " << current.bad_blocks.size() << " of " << block_tree.get_leaf_count() << " blocks" << std::endl;
+        request_op_code = SENDING_BLOCKS;
+    }
+}
+
+// BLOCK_SIGNATURES: the signatures of the copy of the file the server holds
+void SessionProtocol::handle_signatures() {
+    bool use_delta = false;
+    try {
+        use_delta = prepare_delta();
+    } catch (const std::exception& e) {
+        std::cerr << "Delta of " << current.name << ": " << e.what() << std::endl;
+    }
+    request_op_code = use_delta ? SENDING_DELTA : SENDING_FILE;
+}
+
+// GENERAL_ERROR: falls back from the request the server could not handle, or ends the session
+void SessionProtocol::handle_general_error() {
+    std::cerr << "General error" << std::endl;
+    switch (request_op_code) {
+        case REGISTER_WITH_KEY:
+            // The server predates the combined request, register and send the public key one after the other
+            crypto_key.drop_key_agreement(); // Such servers only take RSA keys
+            request_op_code = REGISTER;
+            return;
+        case RECONNECT_WITH_TICKET:
+            // The server does not resume sessions, reconnect with a full key exchange
+            session_ticket.discard();
+            request_op_code = RECONNECT;
+            return;
+        case BLOCK_HASHES:
+        case SENDING_BLOCKS:
+            // The server could not repair its copy, send the whole file again
+            request_op_code = SENDING_FILE;
+            return;
+        case SIGNATURE_QUERY:
+        case SENDING_DELTA:
+            // The server could not rebuild the file from its copy, send the whole file
+            request_op_code = SENDING_FILE;
+            return;
+        case SENDING_FILE_COMPRESSED:
+            // The server could not decompress the file, send it as it is
+            current.compress = false;
+            request_op_code = SENDING_FILE;
+            return;
+        case STRIPES_COMPLETE:
+            // The server could not assemble the segments, send the file over the main connection
+            current.stripe = false;
+            request_op_code = SENDING_FILE;
+            return;
+        case SENDING_FILE:
+        case SENDING_FILE_RESUME:
+            if (resume_enabled() && current.resume_retry_count < 4) {
+                // The server kept what it saved before the error, retry with the rest of the file
+                current.resume_retry_count++;
+                std::cout << "Retrying file: " << current.name << std::endl;
+                request_op_code = SENDING_FILE;
+                return;
+            }
+            // The server skipped the rest of the file, in a batch the session goes on with the next one
+            finish_current_file(FileStatus::FAILED);
+            request_op_code = select_next_file() ? SENDING_FILE : TERMINATE_CONNECTION;
+            return;
+        default:
+            request_op_code = TERMINATE_CONNECTION; // Set termination request
+            return;
+    }
+}
+
+// Decrypts the AES key of a RECEIVE_AES_KEY/RECONNECT_OK_SEND_AES response and applies the cipher mode.
+// The payload is the client ID and the RSA encrypted key, followed by the cipher mode (1 byte) and the
+// accepted features (4 bytes) when the server negotiates. Servers that do not negotiate use CBC.
+// For a client with an X25519 key, the server's X25519 public key takes the place of the encrypted key.
+// A session ticket follows the accepted features if the server issues one.
+void SessionProtocol::parse_key_exchange() {
+    bool agreed = crypto_key.uses_key_agreement();
+    size_t key_size = agreed ? CryptoPPKey::AGREEMENT_KEY_SIZE : crypto_key.get_encrypted_aes_key_size();
+    if (response_payload.size() < 16 + key_size) {
+        throw std::runtime_error("Invalid AES key length");
+    }
+    std::vector<uint8_t> exchanged_key(response_payload.begin() + 16, response_payload.begin() + 16 + key_size);
+    apply_negotiation(16 + key_size);
+
+    if (agreed) {
+        if (!(accepted_features & FEATURE_X25519)) {
+            throw std::runtime_error("The server did not agree the session key with X25519");
+        }
+        // Derive the AES key from the server's public key
+        crypto_key.derive_aes_key(exchanged_key, std::vector<uint8_t>(client_uuid.begin(), client_uuid.end()));
+    } else {
+        // Decrypt the AES key with the private key
+        crypto_key.decrypt_aes_key(exchanged_key);
+    }
+
+    if (accepted_features & FEATURE_TICKET) {
+        save_session_ticket(16 + key_size + 5);
+    }
+}
+
+// Derives the AES key of a SESSION_RESUMED response from the saved ticket and applies the cipher mode.
+// The payload is the client ID, the nonce of the server, the cipher mode (1 byte) and the accepted features (4 bytes).
+void SessionProtocol::parse_session_resumed() {
+    if (response_payload.size() < 16 + SESSION_NONCE_SIZE + 5) {
+        throw std::runtime_error("Invalid session resumption");
+    }
+    std::vector<uint8_t> nonces = session_nonce; // The client's nonce, then the server's
+    nonces.insert(nonces.end(), response_payload.begin() + 16, response_payload.begin() + 16 + SESSION_NONCE_SIZE);
+    crypto_key.resume_aes_key(session_ticket.get_secret(), nonces);
+    apply_negotiation(16 + SESSION_NONCE_SIZE);
+}
+
+// Applies the cipher mode (1 byte) and the accepted features (4 bytes) found at the offset of a key
+// exchange response. Servers that do not negotiate send neither, and use CBC.
+void SessionProtocol::apply_negotiation(size_t offset) {
+    CipherMode mode = CipherMode::CBC;
+    accepted_features = FEATURE_CBC;
+    if (response_payload.size() >= offset + 5) {
+        uint8_t selected = response_payload[offset];
+        if (selected > uint8_t(CipherMode::GCM)) {
+            throw std::runtime_error("Server selected an unknown cipher mode");
+        }
+        mode = CipherMode(selected);
+        // Only the offered features count, whatever the server answers
+        accepted_features = ntohl(*reinterpret_cast<const uint32_t*>(&response_payload[offset + 1])) & offered_features();
+    }
+    crypto_key.set_cipher_mode(mode);
+
+    const char* mode_names[] = {"CBC", "CTR", "GCM"};
+    std::cout << "Cipher mode: " << mode_names[uint8_t(mode)] << std::endl;
+}
+
+// Saves the session ticket found at the offset of a key exchange response: its lifetime in seconds
+// (4 bytes), then the ticket. A ticket that cannot be saved only costs a full key exchange next time.
+void SessionProtocol::save_session_ticket(size_t offset) {
+    if (response_payload.size() <= offset + 4) {
+        return;
+    }
+    try {
+        uint32_t lifetime = ntohl(*reinterpret_cast<const uint32_t*>(&response_payload[offset]));
+        std::vector<uint8_t> ticket(response_payload.begin() + offset + 4, response_payload.end());
+        SessionTicket::ClientId id;
+        std::copy(client_uuid.begin(), client_uuid.end(), id.begin());
+        session_ticket.save(id, ticket, crypto_key.get_resumption_secret(std::vector<uint8_t>(id.begin(), id.end())), lifetime);
+        std::cout << "Session ticket saved, valid for " << lifetime << " seconds" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "Session ticket: " << e.what() << std::endl;
+    }
+}
+
+// Takes the UUID the server registered the client under from the start of the response and saves it,
+// with the name and the private key, in me.info if the identity is saved, then hands them to the
+// registration handler. Returns false if the file could not be written.
+bool SessionProtocol::save_registration() {
+    std::copy(response_payload.begin(), response_payload.begin() + 16, client_uuid.begin());
+    std::cout << "REGISTER OK, UUID: " << client_uuid << std::endl;
+
+    ClientConfig identity;
+    identity.name = config.name;
+    identity.client_id.emplace();
+    std::copy(client_uuid.begin(), client_uuid.end(), identity.client_id->begin());
+    // The client's private key, the X25519 key if the session key is agreed
+    identity.private_key = crypto_key.uses_key_agreement() ? crypto_key.get_agreement_private_key() : crypto_key.get_private_key();
+    try {
+        if (config.save_identity && !config.state_directory.empty()) {
+            // Create a file to store client information
+            create_me_file(identity);
+            std::cout << "Me file created" << std::endl;
+        }
+        if (config.on_registered) {
+            config.on_registered(identity);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Me file creation failed" << std::endl;
+        std::cerr << "Error: " << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Creates a file containing the client's information (name, UUID, private key) in the state directory
+void SessionProtocol::create_me_file(const ClientConfig& identity) {
+    std::cout << "Creating me file" << std::endl; // Log the start of the file creation
+    std::ofstream file(config.state_path("me.info"), std::ios::trunc); // Create or truncate the file for writing
+
+    if (!file.is_open()) { // Check if the file was opened successfully
+        std::cerr << "Error: Could not open the file" << std::endl; // Log an error message if not
+        throw std::invalid_argument("Error: Could not open the file"); // Throw an exception if the file cannot be opened
+    }
+
+    std::cout << "me file created" << std::endl; // Log that the file has been created
+
+    // Write the client information to the file
+    file << identity.name << std::endl; // Write the client name
+    file << client_uuid << std::endl; // Write the client UUID
+    file << identity.private_key << std::endl; // Write the client's private key
+    file.close(); // Close the file after writing
+}
+
+/**
+ * Parses BLOCK_SIGNATURES and computes the delta of the open file against the server's copy.
+ * The payload is the client ID, the size of the copy, the block size and the number of blocks
+ * (4 bytes each), then per block its weak checksum (4 bytes) and strong hash.
+ * Returns false if the server holds no copy or the delta would not save enough to be worth
+ * rebuilding the file on the server, then the whole file is sent.
+ */
+bool SessionProtocol::prepare_delta() {
+    current.delta_encoder.reset();
+    if (response_payload.size() < 28) {
+        throw std::runtime_error("Signature response is too short");
+    }
+    uint32_t base_size = ntohl(*reinterpret_cast<const uint32_t*>(&response_payload[16])); // Extract the size of the copy
+    uint32_t block_size = ntohl(*reinterpret_cast<const uint32_t*>(&response_payload[20])); // Extract the block size
+    uint32_t count = ntohl(*reinterpret_cast<const uint32_t*>(&response_payload[24])); // Extract the number of blocks
+    if (count == 0) {
+        std::cout << "The server holds no copy of " << current.name << ", sending the whole file" << std::endl;
+        return false;
+    }
+    if (response_payload.size() < 28 + size_t(count) * DeltaEncoder::SIGNATURE_SIZE) {
+        throw std::runtime_error("Signature response is too short");
+    }
+
+    std::vector<DeltaEncoder::Signature> signatures(count);
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t* signature = &response_payload[28 + size_t(i) * DeltaEncoder::SIGNATURE_SIZE];
+        signatures[i].weak = ntohl(*reinterpret_cast<const uint32_t*>(signature));
+        std::copy(signature + 4, signature + DeltaEncoder::SIGNATURE_SIZE, signatures[i].strong.begin());
+    }
+    current.delta_encoder = std::make_unique<DeltaEncoder>(block_size, base_size, std::move(signatures));
+    current.delta_encoder->scan(*current.input, options.stream_block_size);
+
+    uint64_t delta_size = current.delta_encoder->get_delta_size();
+    std::cout << "Delta of " << current.name << ": " << current.delta_encoder->get_copied_size() << " of " << current.size
+              << " bytes found on the server, " << delta_size << " bytes to send" << std::endl;
+    if (delta_size >= current.size - current.size / 8) {
+        current.delta_encoder.reset();
+        return false;
+    }
+    return true;
+}
+
+// Counts a checksum mismatch of the current file and returns the next request: the block hashes if the
+// server can tell which blocks to send again, CRC_NOT_OK to send the whole file, or CRC_TERMINATION
+// after the last attempt.
+uint16_t SessionProtocol::checksum_mismatch_request() {
+    std::cout << "File not received successfully" << std::endl;
+    current.crc_not_ok_count++;
+    if (current.crc_not_ok_count >= 4) {
+        std::cout << "CRC NOT OK after 4 attempts" << std::endl;
+        fatal_error_message = "File not received successfully CRC32 not equal to expected after 4 attempts"; // Log fatal error
+        std::cout << "Terminating connection..." << std::endl;
+        return CRC_TERMINATION;
+    }
+    fatal_error_message = "File not received successfully CRC32 not equal to expected"; // Log error
+    std::cout << "CRC NOT OK" << std::endl;
+    // With block hashes the server can tell which blocks to send again, otherwise the whole file is sent
+    // A delta and a striped file have no block hashes, the whole file is sent again instead
+    bool has_block_hashes = request_op_code != SENDING_DELTA && request_op_code != STRIPES_COMPLETE;
+    if (request_op_code == STRIPES_COMPLETE) {
+        current.stripe = false; // Send it again over the main connection
+    }
+    return has_block_hashes && block_repair_enabled() && block_tree.is_complete() ? BLOCK_HASHES : CRC_NOT_OK;
+}
+
+// Features offered in the key exchange: the supported ones, without the ones switched off
+uint32_t SessionProtocol::offered_features() const {
+    uint32_t features = SUPPORTED_FEATURES;
+    if (!options.compression) {
+        features &= ~uint32_t(FEATURE_COMPRESSION);
+    }
+    if (options.max_stripe_streams == 0) {
+        features &= ~uint32_t(FEATURE_STRIPING);
+    }
+    if (options.max_multiplex_streams == 0) {
+        features &= ~uint32_t(FEATURE_MULTIPLEX);
+    }
+    if (!crypto_key.uses_key_agreement()) {
+        features &= ~uint32_t(FEATURE_X25519); // Only clients registered with an X25519 key agree the session key
+    }
+    return features;
+}
+
+// Uploads can be resumed if the server accepted the feature and the body is CTR/GCM,
+// whose ciphertext does not depend on the bytes sent before
+bool SessionProtocol::resume_enabled() const {
+    return (accepted_features & FEATURE_RESUME) && crypto_key.get_cipher_mode() != CipherMode::CBC;
+}
+
+// Blocks can be sent again on their own in CTR/GCM mode, where each one is encrypted with its own file IV
+bool SessionProtocol::block_repair_enabled() const {
+    return (accepted_features & FEATURE_BLOCK_REPAIR) && crypto_key.get_cipher_mode() != CipherMode::CBC;
+}
+
+// Files are sent as a delta against the server's copy if the server accepted the feature.
+// The delta is a body like any other, so it works in every cipher mode.
+bool SessionProtocol::delta_enabled() const {
+    return (accepted_features & FEATURE_DELTA) != 0;
+}
+
+// Files are compressed before they are encrypted if the server accepted the feature.
+// Like a delta, the compressed file is a body like any other.
+bool SessionProtocol::compression_enabled() const {
+    return (accepted_features & FEATURE_COMPRESSION) != 0;
+}
+
+// Files are committed in one round trip if the server accepted the feature: the checksum follows the
+// body of SENDING_FILE, SENDING_DELTA and SENDING_FILE_COMPRESSED, and the server answers with the
+// verdict instead of FILE_RECEIVE_OK_AND_CRC. Resumed and striped files keep the CRC_OK exchange.
+bool SessionProtocol::commit_enabled() const {
+    return (accepted_features & FEATURE_COMMIT) != 0;
+}
+
+// Large files are striped if the server accepted the feature and the session is blocking:
+// the striped upload runs its connections on threads and returns when the file was sent
+bool SessionProtocol::striping_enabled() const {
+    return (accepted_features & FEATURE_STRIPING) && options.max_stripe_streams > 0 && !options.asynchronous;
+}
+
+// The files of a batch are multiplexed if the server accepted the feature and keeps the session open
+// between files, and the session is blocking: the multiplexed upload returns when every file was answered
+bool SessionProtocol::multiplexing_enabled() const {
+    return (accepted_features & FEATURE_MULTIPLEX) && (accepted_features & FEATURE_BATCH)
+           && options.max_multiplex_streams > 0 && !options.asynchronous;
+}
+
+// Watched files may still be written to while they are sent, and a mapped file that shrinks raises SIGBUS
+bool SessionProtocol::maps_files() const {
+    return options.mapped_input && !options.watcher;
+}
+
+// Opens the current file for streaming and determines its size.
+// The file is read as a stream, or memory-mapped if maps_files() and mapping works.
+void SessionProtocol::open_file_for_streaming() {
+    current.input.reset(); // Close the file of a previous attempt, if any
+    try {
+        current.input = InputSource::open(current.path, std::max(options.stream_block_size, BlockHashTree::BLOCK_SIZE),
+                                          maps_files());
+    } catch (const std::exception& e) {
+        std::cerr << "Error: Could not open the file" << std::endl; // Log an error message if not
+        throw;
+    }
+
+    // Update the file name based on the file path
+    current.name = current.path.substr(current.path.find_last_of("/\\") + 1);
+    current.size = current.input->size();
+    current.modification_time = UploadIndex::modification_time(current.path);
+}
+
+// Computes the CRC32 state of the first `length` bytes of the open file.
+// The bytes also start the block hash tree, whose leaves must cover the whole file.
+uint32_t SessionProtocol::checksum_file_prefix(uint64_t length) {
+    current.input->seek(0);
+    block_tree.reset(current.size);
+    uint32_t state = 0;
+    while (length > 0) {
+        size_t bytes_to_read = size_t(std::min<uint64_t>(options.stream_block_size, length));
+        const uint8_t* block = current.input->next(bytes_to_read);
+        state = crypto_key.update_checksum(state, block, bytes_to_read);
+        if (block_repair_enabled()) {
+            block_tree.add(block, bytes_to_read);
+        }
+        length -= bytes_to_read;
+    }
+    return state;
+}
+
+// Records the outcome of the current file
+void SessionProtocol::finish_current_file(FileStatus status) {
+    file_statuses[file_index] = status;
+}
+
+// Moves to the next file of the batch that was not sent yet. Returns false if there is none, or if the
+// server closes the session after a file, in which case the remaining files are skipped.
+bool SessionProtocol::select_next_file() {
+    size_t next_index = file_index + 1;
+    while (next_index < file_paths.size() && file_statuses[next_index] != FileStatus::PENDING) {
+        next_index++; // Sent as a stream of the multiplexed upload
+    }
+    if (next_index >= file_paths.size()) {
+        batch_ended = true;
+        return false;
+    }
+    if (!(accepted_features & FEATURE_BATCH)) {
+        std::fill(file_statuses.begin() + file_index + 1, file_statuses.end(), FileStatus::SKIPPED);
+        return false;
+    }
+    select_file(next_index);
+    return true;
+}
+
+// Makes a file of the batch the current one, with no attempt made yet
+void SessionProtocol::select_file(size_t index) {
+    file_index = index;
+    current = FileTransfer();
+    current.path = file_paths[file_index];
+}
+
+// The session waits for the watcher's next files when a batch ends, in blocking sessions. Without
+// FEATURE_BATCH the server closes the session after the first file, so it only waits for that one.
+bool SessionProtocol::watching() const {
+    return options.watcher && !options.asynchronous;
+}
+
+/**
+ * Waits for the next files written to the watched directories and makes them the batch.
+ * The connection stays idle meanwhile; the server keeps a batch session open between requests.
+ * Returns false once the watcher was stopped.
+ */
+bool SessionProtocol::wait_for_watched_files() {
+    print_batch_summary();
+    file_paths.clear();
+    file_statuses.clear();
+    std::cout << "Waiting for files to upload..." << std::endl;
+    std::vector<std::string> files;
+    if (!options.watcher->next_batch(files, WATCHED_BATCH_SIZE)) {
+        return false;
+    }
+    forget_removed_files();
+    file_paths = std::move(files);
+    file_statuses.assign(file_paths.size(), FileStatus::PENDING);
+    select_file(0);
+    batch_ended = false;
+    batch_multiplexed = false; // The new batch is multiplexed again
+    return true;
+}
+
+// Drops the upload index records of the files removed from the watched directories, so the index of a
+// long-running session does not grow with every file it ever sent
+void SessionProtocol::forget_removed_files() {
+    std::vector<std::string> removed;
+    options.watcher->take_removed(removed);
+    try {
+        UploadIndex::ClientId id;
+        std::copy(client_uuid.begin(), client_uuid.end(), id.begin());
+        upload_index.open(id);
+        for (const std::string& path : removed) {
+            upload_index.forget(path);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Upload index: " << e.what() << std::endl;
+    }
+}
+
+void SessionProtocol::return_unsent_files() {
+    if (!options.watcher) {
+        return;
+    }
+    std::vector<std::string> unsent;
+    for (size_t i = 0; i < file_paths.size(); i++) {
+        if (file_statuses[i] == FileStatus::PENDING || file_statuses[i] == FileStatus::SKIPPED) {
+            unsent.push_back(file_paths[i]);
+        }
+    }
+    options.watcher->requeue(unsent);
+}
+
+// Skips the current file and the ones after it while they are unchanged since the server acknowledged them.
+// Returns true if no file is left to send.
+bool SessionProtocol::skip_unchanged_files() {
+    while (is_unchanged_file()) {
+        std::cout << "Skipping unchanged file: " << current.path << std::endl;
+        finish_current_file(FileStatus::UNCHANGED);
+        if (!select_next_file()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Returns true if the current file is in the upload index with the same size and modification time,
+ * which needs no read of the file. A file of the same size whose modification time changed is
+ * checksummed once: if the content still matches, the record is refreshed and the file is skipped
+ * without being encrypted or sent.
+ * An index that cannot be read or written never stops the upload, the file is just sent.
+ */
+bool SessionProtocol::is_unchanged_file() {
+    if (!options.skip_unchanged) {
+        return false;
+    }
+    try {
+        UploadIndex::ClientId id;
+        std::copy(client_uuid.begin(), client_uuid.end(), id.begin());
+        upload_index.open(id);
+        const UploadIndex::Entry* entry = upload_index.find(current.path);
+        if (!entry || entry->size != std::filesystem::file_size(current.path)) {
+            return false;
+        }
+        if (entry->modification_time == UploadIndex::modification_time(current.path)) {
+            return true;
+        }
+
+        open_file_for_streaming();
+        uint32_t state = 0;
+        for (uint64_t remaining = current.size; remaining > 0;) {
+            size_t bytes_to_read = size_t(std::min<uint64_t>(options.stream_block_size, remaining));
+            state = crypto_key.update_checksum(state, current.input->next(bytes_to_read), bytes_to_read);
+            remaining -= bytes_to_read;
+        }
+        current.input.reset();
+        uint32_t checksum = crypto_key.finalize_checksum(state, current.size);
+        if (checksum == entry->checksum) {
+            record_uploaded_file(checksum);
+            return true;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Upload index: " << e.what() << std::endl;
+        current.input.reset();
+    }
+    return false;
+}
+
+// Records the current file in the upload index once the server acknowledged its checksum
+void SessionProtocol::record_uploaded_file(uint32_t checksum) {
+    verified_count++;
+    try {
+        UploadIndex::ClientId id;
+        std::copy(client_uuid.begin(), client_uuid.end(), id.begin());
+        upload_index.open(id);
+        upload_index.record(current.path, UploadIndex::Entry{current.size, current.modification_time, checksum});
+    } catch (const std::exception& e) {
+        std::cerr << "Upload index: " << e.what() << std::endl;
+    }
+}
+
+// Prints how each file of the batch ended
+void SessionProtocol::print_batch_summary() const {
+    if (file_paths.empty()) {
+        return; // Every batch taken from the watcher was summarized already
+    }
+    size_t counts[6] = {0, 0, 0, 0, 0, 0};
+    for (FileStatus status : file_statuses) {
+        counts[size_t(status)]++;
+    }
+    std::cout << "Batch summary: " << counts[size_t(FileStatus::VERIFIED)] << " verified, "
+              << counts[size_t(FileStatus::CRC_FAILED)] << " CRC failed, "
+              << counts[size_t(FileStatus::FAILED)] << " failed, "
+              << counts[size_t(FileStatus::SKIPPED)] << " skipped, "
+              << counts[size_t(FileStatus::UNCHANGED)] << " unchanged, "
+              << counts[size_t(FileStatus::PENDING)] << " not sent, of " << file_paths.size() << " files" << std::endl;
+
+    const char* names[] = {"not sent", "verified", "CRC failed", "failed", "skipped", "unchanged"};
+    for (size_t i = 0; i < file_paths.size(); i++) {
+        if (file_statuses[i] != FileStatus::VERIFIED && file_statuses[i] != FileStatus::UNCHANGED) {
+            std::cout << "  " << file_paths[i] << ": " << names[size_t(file_statuses[i])] << std::endl;
+        }
+    }
+}
+
+const std::vector<std::string>& SessionProtocol::get_file_paths() const {
+    return file_paths;
+}
+
+const std::vector<SessionProtocol::FileStatus>& SessionProtocol::get_file_statuses() const {
+    return file_statuses;
+}
+
+size_t SessionProtocol::get_verified_count() const {
+    return verified_count;
+}
+
+const std::string& SessionProtocol::get_fatal_error() const {
+    return fatal_error_message;
+}
+
+/**
+ * Sends the current file and the ones after it as interleaved streams over the connection.
+ * Unchanged files are skipped first, and files large enough to be striped are left to the
+ * sequential flow. The files whose streams failed on the server are left there too, and sent
+ * one by one afterwards. Returns false if no file is left to send, otherwise selects the first one.
+ */
+bool SessionProtocol::run_multiplexed_upload() {
+    batch_multiplexed = true;
+    MultiplexedUpload upload(connection, crypto_key, &cipher_pool, header_prefix(), options.max_multiplex_streams,
+                             maps_files());
+    std::vector<size_t> streamed; // Batch index of each file added to the upload
+    for (size_t i = file_index; i < file_paths.size(); i++) {
+        current.path = file_paths[i];
+        if (is_unchanged_file()) {
+            std::cout << "Skipping unchanged file: " << current.path << std::endl;
+            file_statuses[i] = FileStatus::UNCHANGED;
+            continue;
+        }
+        std::error_code error;
+        uint64_t size = std::filesystem::file_size(current.path, error);
+        if (!error && striping_enabled() && size >= StripedUpload::MIN_FILE_SIZE) {
+            continue; // Sent over several connections instead
+        }
+        upload.add_file(current.path, current.path.substr(current.path.find_last_of("/\\") + 1));
+        streamed.push_back(i);
+    }
+
+    std::cout << "Sending " << streamed.size() << " files over up to " << options.max_multiplex_streams << " streams" << std::endl;
+    try {
+        upload.run();
+        std::cout << upload.get_stats().to_string();
+    } catch (const std::exception& e) {
+        std::cerr << "Multiplexed upload failed: " << e.what() << std::endl;
+        fatal_error_message = e.what();
+        throw; // The connection is out of sync
+    }
+
+    const std::vector<MultiplexedUpload::Result>& results = upload.get_results();
+    for (size_t i = 0; i < streamed.size(); i++) {
+        const MultiplexedUpload::Result& result = results[i];
+        switch (result.outcome) {
+            case MultiplexedUpload::Outcome::VERIFIED:
+                file_statuses[streamed[i]] = FileStatus::VERIFIED;
+                current.path = file_paths[streamed[i]];
+                current.size = result.size;
+                current.modification_time = result.modification_time;
+                record_uploaded_file(result.checksum); // The file is skipped next time if it does not change
+                break;
+            case MultiplexedUpload::Outcome::CRC_FAILED:
+                file_statuses[streamed[i]] = FileStatus::CRC_FAILED;
+                break;
+            case MultiplexedUpload::Outcome::FAILED:
+                file_statuses[streamed[i]] = FileStatus::FAILED;
+                break;
+            case MultiplexedUpload::Outcome::PENDING:
+                break;
+        }
+    }
+
+    for (size_t i = file_index; i < file_paths.size(); i++) {
+        if (file_statuses[i] == FileStatus::PENDING) {
+            select_file(i);
+            return true;
+        }
+    }
+    file_index = file_paths.size() - 1;
+    return false;
+}
+
+// Client id and version, the start of every request header
+std::array<uint8_t, 17> SessionProtocol::header_prefix() const {
+    std::array<uint8_t, 17> prefix{};
+    std::copy(client_uuid.begin(), client_uuid.end(), prefix.begin());
+    prefix[16] = PROTOCOL_VERSION;
+    return prefix;
+}
+
+/**
+ * Opens an extra connection to the server for a striped upload and reconnects on it, like the main
+ * connection. The server sends the AES key of the client again, encrypted with its public key, or
+ * agrees a key for the connection with a client that has an X25519 key.
+ * Throws if the server refuses the connection or selects another cipher mode than on the main one.
+ */
+std::unique_ptr<StripedUpload::Stream> SessionProtocol::open_stripe_stream() {
+    auto stream = std::make_unique<StripedUpload::Stream>();
+    stream->socket.connect(connection.remote_endpoint());
+
+    std::vector<uint8_t> request(HEADER_SIZE + 255 + 4, 0); // Header, client name and offered features
+    std::copy(client_uuid.begin(), client_uuid.end(), request.begin());
+    request[16] = PROTOCOL_VERSION;
+    request[17] = uint8_t(RECONNECT >> 8);
+    request[18] = uint8_t(RECONNECT & 0xFF);
+    uint32_t request_payload_size = uint32_t(request.size() - HEADER_SIZE);
+    uint32_t features = offered_features() & ~uint32_t(FEATURE_TICKET); // The ticket of the main connection is kept
+    for (int i = 0; i < 4; i++) {
+        request[19 + i] = uint8_t(request_payload_size >> (24 - 8 * i));
+        request[HEADER_SIZE + 255 + i] = uint8_t(features >> (24 - 8 * i));
+    }
+    const std::string& client_name = config.name;
+    std::copy(client_name.begin(), client_name.begin() + std::min<size_t>(client_name.size(), 254), request.begin() + HEADER_SIZE);
+    boost::asio::write(stream->socket, boost::asio::buffer(request));
+
+    std::array<uint8_t, RESPONSE_HEADER_SIZE> header{};
+    boost::asio::read(stream->socket, boost::asio::buffer(header));
+    uint16_t op_code = ntohs(*reinterpret_cast<const uint16_t*>(&header[1]));
+    uint32_t size = ntohl(*reinterpret_cast<const uint32_t*>(&header[3]));
+    if (size > MAX_RESPONSE_PAYLOAD_SIZE) {
+        throw std::runtime_error("Response payload too large");
+    }
+    std::vector<uint8_t> response(size);
+    boost::asio::read(stream->socket, boost::asio::buffer(response));
+    bool agreed = crypto_key.uses_key_agreement();
+    size_t key_size = agreed ? CryptoPPKey::AGREEMENT_KEY_SIZE : crypto_key.get_encrypted_aes_key_size();
+    if (op_code != RECONNECT_OK_SEND_AES || response.size() < 16 + key_size + 5) {
+        throw std::runtime_error("The server refused the connection");
+    }
+    if (response[16 + key_size] != uint8_t(crypto_key.get_cipher_mode())) {
+        throw std::runtime_error("The server selected another cipher mode");
+    }
+
+    stream->key = std::make_unique<CryptoPPKey>(crypto_key); // The key pair of the client
+    std::vector<uint8_t> exchanged_key(response.begin() + 16, response.begin() + 16 + key_size);
+    if (agreed) {
+        stream->key->derive_aes_key(exchanged_key, std::vector<uint8_t>(client_uuid.begin(), client_uuid.end()));
+    } else {
+        stream->key->decrypt_aes_key(exchanged_key);
+    }
+    return stream;
+}
@@ -0,0 +1,362 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+#ifndef MAMAN15_SESSIONPROTOCOL_H
+#define MAMAN15_SESSIONPROTOCOL_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/uuid/uuid.hpp>
+#include "BlockHashTree.h"
+#include "ClientConfig.h"
+#include "CryptoPPKey.h"
+#include "DeltaEncoder.h"
+#include "DirectoryWatcher.h"
+#include "FileCompressor.h"
+#include "FileEncryptor.h"
+#include "InputSource.h"
+#include "SessionTicket.h"
+#include "StripedUpload.h"
+#include "ThreadPool.h"
+#include "UploadIndex.h"
+
+using boost::asio::ip::tcp;
+
+// The request/response state machine of one session of the client: which request comes next, its
+// header, payload and encrypted body, and what each response of the server means for the batch.
+// It does no I/O of its own; Client writes the requests and reads the responses, blocking or on the
+// io_context. Only the multiplexed upload of a batch and the extra connections of a striped file use
+// the connection directly, in blocking sessions, between two requests.
+//
+// A session starts with the key exchange: REGISTER_WITH_KEY for a client with no id, otherwise
+// RECONNECT, or RECONNECT_WITH_TICKET if a session ticket was saved. The files of the batch follow
+// one after the other, each with the requests the accepted features call for.
+class SessionProtocol {
+public:
+    static constexpr size_t DEFAULT_STREAM_BLOCK_SIZE = 1024 * 1024; // Plaintext bytes read and encrypted at a time
+    static constexpr size_t HEADER_SIZE = 23; // 16 (UUID) + 1 (version) + 2 (op code) + 4 (payload size)
+    static constexpr size_t RESPONSE_HEADER_SIZE = 7; // 1 (version) + 2 (op code) + 4 (payload size)
+
+    // Outcome of each file of the batch, printed in the summary
+    enum class FileStatus {
+        PENDING,    // Not sent yet
+        VERIFIED,   // The server's CRC matched
+        CRC_FAILED, // Still mismatching after the last retry
+        FAILED,     // Could not be opened or the server reported an error
+        SKIPPED,    // The server does not keep the session open for another file
+        UNCHANGED   // Acknowledged in an earlier run and not modified since
+    };
+
+    // How the files are read and which features are offered; set before begin()
+    struct Options {
+        size_t stream_block_size = DEFAULT_STREAM_BLOCK_SIZE;
+        bool mapped_input = false; // Memory-map the files, see Client::set_mapped_input()
+        bool skip_unchanged = true; // Skip the files the upload index holds as unchanged
+        bool compression = true; // Offer FEATURE_COMPRESSION in the key exchange
+        size_t max_stripe_streams = 0; // Offer FEATURE_STRIPING in the key exchange if not 0
+        size_t max_multiplex_streams = 0; // Offer FEATURE_MULTIPLEX in the key exchange if not 0
+        DirectoryWatcher* watcher = nullptr; // Hands out the next batch when the current one ends
+        bool asynchronous = false; // The session runs on the io_context, where the blocking striped and multiplexed uploads cannot
+    };
+
+    // The plaintext file of a SENDING_FILE or SENDING_FILE_RESUME body, for the engines that read and
+    // encrypt it themselves
+    struct FileBody {
+        const std::string& path;
+        InputSource& input; // Positioned at the offset
+        uint64_t offset; // First plaintext byte of the body, non-zero when resuming
+        uint64_t length;
+        FileEncryptor& encryptor;
+    };
+
+    // `connection` is the session's socket, owned by the caller; see the class comment for its use.
+    // Sessions that run side by side can share `shared_pool`, otherwise the protocol starts its own.
+    SessionProtocol(tcp::socket& connection, ClientConfig config, Options options, ThreadPool* shared_pool = nullptr);
+
+    SessionProtocol(const SessionProtocol&) = delete;
+    SessionProtocol& operator=(const SessionProtocol&) = delete;
+
+    Options& get_options();
+
+    // Prepares the first request of the session. Throws std::runtime_error if there is no file to send
+    // and no watcher to wait for.
+    void begin();
+
+    // The prepared request: the header, the payload and, if with_body_block, the block of the body
+    // produced last by next_body_block(). A gathered write sends them without joining them first.
+    std::array<boost::asio::const_buffer, 3> request_buffers(bool with_body_block) const;
+    uint16_t get_request_op_code() const;
+    size_t get_request_prefix_size() const; // Header and payload
+    uint64_t get_body_size() const; // Encrypted bytes that follow the payload, 0 if the request has no body
+
+    // Produces the body one encrypted block at a time, for get_body_block(); next_body_block()
+    // returns false once the whole body was produced. end_body() closes the file and throws if
+    // the bytes sent differ from the announced size.
+    void begin_body();
+    bool next_body_block();
+    const std::vector<uint8_t>& get_body_block() const;
+    void end_body(uint64_t bytes_sent);
+
+    // The body of SENDING_FILE and SENDING_FILE_RESUME is the file itself, which the pipelined and
+    // io_uring engines may read and encrypt instead of next_body_block()
+    bool is_file_body() const;
+    FileBody get_file_body();
+
+    // The checksum that follows a committed body, written once the body was sent
+    bool has_commit_trailer() const;
+    boost::asio::const_buffer get_commit_trailer();
+
+    // A striped file is sent over the extra connections before STRIPES_COMPLETE goes out on this one
+    bool has_striped_upload() const;
+    void run_striped_upload();
+
+    // The buffer the header of the next response is read into, then the buffer its payload is read
+    // into. Throws std::runtime_error if the header announces a payload that is too large.
+    boost::asio::mutable_buffer response_header_buffer();
+    boost::asio::mutable_buffer response_payload_buffer();
+
+    // Parses the response that was read, updates the batch and prepares the next request. With a
+    // watcher, waits for its next files when the batch ends. Returns false once the session is over.
+    bool handle_response();
+
+    // Gives the files of the batch that were not sent back to the watcher, when the session ends before them
+    void return_unsent_files();
+
+    // Files of the current batch and their outcome, in the same order
+    const std::vector<std::string>& get_file_paths() const;
+    const std::vector<FileStatus>& get_file_statuses() const;
+    size_t get_verified_count() const;
+
+    // The error the session ended with, if any
+    const std::string& get_fatal_error() const;
+
+private:
+    enum ClientRequestCode : uint16_t {
+        REGISTER = 825,
+        SENDING_PUBLIC_KEY = 826,
+        RECONNECT = 827,
+        SENDING_FILE = 828,
+        RESUME_QUERY = 829,
+        SENDING_FILE_RESUME = 830,
+        BLOCK_HASHES = 831,
+        SENDING_BLOCKS = 832,
+        SIGNATURE_QUERY = 833,
+        SENDING_DELTA = 834,
+        SENDING_FILE_COMPRESSED = 835,
+        STRIPES_COMPLETE = 837, // Every segment of a striped file was written (SENDING_SEGMENT, 836, is sent by StripedUpload)
+        REGISTER_WITH_KEY = 840, // REGISTER and SENDING_PUBLIC_KEY in one request, answered with RECEIVE_AES_KEY
+        RECONNECT_WITH_TICKET = 841, // RECONNECT with a session ticket, answered with SESSION_RESUMED or RECONNECT_OK_SEND_AES
+        CRC_OK = 900,
+        CRC_NOT_OK = 901,
+        CRC_TERMINATION = 902,
+        TERMINATE_CONNECTION = 903
+    };
+
+    enum ServerResponseCode : uint16_t {
+        REGISTER_OK = 1600,
+        REGISTER_NOK = 1601,
+        RECEIVE_AES_KEY = 1602,
+        FILE_RECEIVE_OK_AND_CRC = 1603,
+        MESSAGE_RECEIVE_OK = 1604,
+        RECONNECT_OK_SEND_AES = 1605,
+        RECONNECT_NOK = 1606,
+        GENERAL_ERROR = 1607,
+        RESUME_OFFSET = 1608,
+        BAD_BLOCKS = 1609,
+        BLOCK_SIGNATURES = 1610,
+        FILE_COMMITTED = 1614, // The checksum sent with the file matched, the file is verified
+        FILE_COMMIT_FAILED = 1615, // The checksum sent with the file did not match
+        SESSION_RESUMED = 1616 // The session of the ticket was resumed, the AES key is derived from it
+    };
+
+    // Feature bits the client offers in the key exchange; the server answers with the ones it accepts
+    enum ProtocolFeature : uint32_t {
+        FEATURE_CBC = 1u << 0,
+        FEATURE_CTR = 1u << 1,
+        FEATURE_GCM = 1u << 2,
+        FEATURE_BATCH = 1u << 3, // The session stays open after a file is verified, for the next file
+        FEATURE_RESUME = 1u << 4, // An interrupted CTR/GCM upload continues where the server stopped saving
+        FEATURE_BLOCK_REPAIR = 1u << 5, // On a CRC mismatch only the blocks whose hashes differ are sent again
+        FEATURE_DELTA = 1u << 6, // A file the server holds an older copy of is sent as a delta against it
+        FEATURE_COMPRESSION = 1u << 7, // A file that compresses well is sent compressed, then encrypted
+        FEATURE_STRIPING = 1u << 8, // A large file is sent in segments over several connections
+        FEATURE_MULTIPLEX = 1u << 9, // The files of a batch are sent at once, as interleaved frames
+        FEATURE_COMMIT = 1u << 10, // A file request carries the client's checksum, the server answers with the verdict
+        FEATURE_X25519 = 1u << 11, // The session key is agreed with the client's X25519 key instead of sent encrypted with RSA
+        FEATURE_TICKET = 1u << 12 // The key exchange issues a session ticket, a reconnect with it resumes with symmetric crypto only
+    };
+
+    // Non-owning view of a response payload, valid until the next response is read
+    struct PayloadView {
+        const uint8_t* bytes = nullptr;
+        size_t length = 0;
+
+        size_t size() const { return length; }
+        const uint8_t& operator[](size_t index) const { return bytes[index]; }
+        const uint8_t* begin() const { return bytes; }
+        const uint8_t* end() const { return bytes + length; }
+    };
+
+    // The current file of the batch and every attempt at sending it; replaced when the next file is selected
+    struct FileTransfer {
+        std::string path;
+        std::string name; // Sent to the server, the last component of the path
+        std::unique_ptr<InputSource> input; // Plaintext of the file, open while it is sent
+        uint64_t size = 0;
+        int64_t modification_time = 0; // Taken when the file is opened, before it is read
+        std::unique_ptr<FileEncryptor> encryptor;
+        uint64_t stream_offset = 0; // Offset of the first plaintext byte of the body, non-zero when resuming
+        uint64_t resume_offset = 0; // Bytes of the file the server already holds
+        uint32_t resume_crc_state = 0; // CRC32 state of those bytes
+        bool resume_checked = false; // The server was asked about the current attempt
+        int resume_retry_count = 1;
+        int crc_not_ok_count = 1;
+        std::vector<uint32_t> bad_blocks; // Blocks to send again, from BAD_BLOCKS
+        std::vector<std::unique_ptr<FileEncryptor>> block_encryptors; // One per block in bad_blocks
+        std::unique_ptr<DeltaEncoder> delta_encoder; // Delta against the server's copy, from BLOCK_SIGNATURES
+        bool delta_attempted = false; // The server was asked for the signatures of the file
+        std::unique_ptr<FileCompressor> compressor; // Compressed body of the file
+        bool compress = true; // Cleared when the server could not decompress the file
+        std::unique_ptr<StripedUpload> striped_upload; // Segments of the file, sent before STRIPES_COMPLETE
+        bool stripe = true; // Cleared when a striped upload of the file failed
+        uint32_t striped_checksum = 0; // CRC32 of the striped file, combined from the confirmed segments
+        bool striped_upload_ok = false; // Every segment of the last striped upload was confirmed
+        uint32_t commit_checksum = 0; // Checksum sent after the body, set when the file is committed in one round trip
+    };
+
+    static constexpr uint8_t PROTOCOL_VERSION = 4; // Version 4 adds the feature mask to the key exchange
+    static constexpr uint8_t MIN_NEGOTIATING_SERVER_VERSION = 21; // First server version that reads the feature mask
+    static constexpr uint32_t SUPPORTED_FEATURES = FEATURE_CBC | FEATURE_CTR | FEATURE_GCM | FEATURE_BATCH | FEATURE_RESUME
+                                                  | FEATURE_BLOCK_REPAIR | FEATURE_DELTA | FEATURE_COMPRESSION
+                                                  | FEATURE_STRIPING | FEATURE_MULTIPLEX | FEATURE_COMMIT
+                                                  | FEATURE_X25519 | FEATURE_TICKET;
+    static constexpr size_t FILE_METADATA_SIZE = 263; // 4 (encrypted size) + 4 (decrypted size) + 255 (file name)
+    static constexpr size_t DELTA_METADATA_SIZE = FILE_METADATA_SIZE + 4; // File metadata and the block size
+    static constexpr uint32_t MAX_RESPONSE_PAYLOAD_SIZE = 16 * 1024 * 1024;
+    static constexpr size_t SESSION_NONCE_SIZE = 16; // Nonce of each side of a resumed session
+    static constexpr size_t WATCHED_BATCH_SIZE = 64; // Files taken from the watcher at a time
+
+    // Identity and keys
+    tcp::socket& connection;
+    ClientConfig config; // Identity and state directory; its files are moved to file_paths
+    Options options;
+    boost::uuids::uuid client_uuid{};
+    CryptoPPKey crypto_key;
+    std::unique_ptr<ThreadPool> owned_pool; // Set when no pool is shared with other sessions
+    ThreadPool& cipher_pool; // Encrypts CTR/GCM ranges of the file in parallel
+    BlockHashTree block_tree; // Block hashes of the current file, built while it is encrypted
+    UploadIndex upload_index; // Files acknowledged in earlier runs, in the state directory
+    SessionTicket session_ticket; // Ticket of the last key exchange, in the state directory
+    std::vector<uint8_t> session_nonce; // Nonce of the client in the last RECONNECT_WITH_TICKET
+    uint8_t server_version = 0; // Version of the last response, 0 until the server answered
+    uint32_t accepted_features = FEATURE_CBC; // Features the server accepted in the key exchange
+    int connection_request_count = 1;
+    int reconnection_request_count = 1;
+    std::string fatal_error_message;
+
+    // The batch
+    std::vector<std::string> file_paths; // All files of the batch, current.path is file_paths[file_index]
+    std::vector<FileStatus> file_statuses;
+    size_t file_index = 0;
+    FileTransfer current;
+    bool batch_ended = false; // No file of the batch is left, the session ends unless the watcher has more
+    bool batch_multiplexed = false; // The files of the batch were sent as streams, the rest go one by one
+    size_t verified_count = 0;
+
+    // The request being prepared and the response last read
+    uint16_t request_op_code = 0;
+    std::array<uint8_t, HEADER_SIZE> header_buffer{}; // Sent before the payload
+    std::vector<uint8_t> payload;
+    uint64_t streamed_body_size = 0; // Bytes sent after the payload (the encrypted file)
+    bool commit_trailer = false; // The checksum the server verifies the file against follows the body
+    std::array<uint8_t, 4> commit_trailer_buffer{};
+    std::vector<uint8_t> encoded_block; // Plaintext of the delta or compressed file being encrypted
+    std::vector<uint8_t> cipher_block;
+    uint64_t body_remaining = 0; // Plaintext bytes of the file body not read yet
+    size_t body_block_index = 0; // Next entry of current.bad_blocks to send
+    bool body_done = false; // The last block of the file body was encrypted
+    std::vector<uint8_t> response_buffer; // Last response, header and payload, reused for every response
+    PayloadView response_payload; // Payload of the last response, inside response_buffer
+    uint16_t received_op_code = 0;
+
+    // Requests
+    void prepare_request(uint16_t op_code);
+    std::optional<uint16_t> prepare(uint16_t op_code);
+    uint16_t first_request();
+    void prepare_registration(uint16_t op_code);
+    void prepare_reconnect(uint16_t op_code);
+    std::optional<uint16_t> choose_file_request(uint16_t op_code);
+    void prepare_file(uint16_t op_code);
+    void prepare_delta_body();
+    void prepare_compressed_body();
+    void prepare_striped_file();
+    void prepare_block_hashes();
+    std::optional<uint16_t> prepare_blocks();
+    void load_header();
+    void add_name_to_payload(const std::string& name_str);
+    void add_size_to_payload(uint32_t size);
+    void add_to_payload(const std::vector<uint8_t>& data);
+    void prepare_commit_trailer();
+
+    // Responses
+    void parse_response();
+    bool handle_response_code(uint16_t op_code);
+    void handle_registered();
+    void handle_register_refused();
+    void handle_key_exchange();
+    void handle_session_resumed();
+    void handle_checksum();
+    bool handle_file_committed();
+    bool handle_message();
+    void handle_reconnect_refused();
+    void handle_resume_offset();
+    void handle_bad_blocks();
+    void handle_signatures();
+    void handle_general_error();
+    void parse_key_exchange();
+    void parse_session_resumed();
+    void apply_negotiation(size_t offset);
+    void save_session_ticket(size_t offset);
+    bool save_registration();
+    void create_me_file(const ClientConfig& identity);
+    bool prepare_delta();
+    uint16_t checksum_mismatch_request();
+
+    // Features
+    uint32_t offered_features() const;
+    bool resume_enabled() const;
+    bool block_repair_enabled() const;
+    bool delta_enabled() const;
+    bool compression_enabled() const;
+    bool commit_enabled() const;
+    bool striping_enabled() const;
+    bool multiplexing_enabled() const;
+    bool maps_files() const;
+
+    // Files
+    void open_file_for_streaming();
+    uint32_t checksum_file_prefix(uint64_t length);
+    void finish_current_file(FileStatus status);
+    bool select_next_file();
+    void select_file(size_t index);
+    bool watching() const;
+    bool wait_for_watched_files();
+    void forget_removed_files();
+    bool skip_unchanged_files();
+    bool is_unchanged_file();
+    void record_uploaded_file(uint32_t checksum);
+    void print_batch_summary() const;
+    bool run_multiplexed_upload();
+    std::unique_ptr<StripedUpload::Stream> open_stripe_stream();
+    std::array<uint8_t, 17> header_prefix() const;
+};
+
+
+#endif //MAMAN15_SESSIONPROTOCOL_H
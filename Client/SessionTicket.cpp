@@ -0,0 +1,130 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+// SessionTicket.cpp
+
+#include "SessionTicket.h"
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+    constexpr char MAGIC[4] = {'S', 'T', 'K', 'T'};
+
+    int64_t now_seconds() {
+        return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    void put_le(uint8_t* out, uint64_t value, size_t length) {
+        for (size_t i = 0; i < length; i++) {
+            out[i] = static_cast<uint8_t>(value >> (8 * i));
+        }
+    }
+
+    uint64_t get_le(const uint8_t* in, size_t length) {
+        uint64_t value = 0;
+        for (size_t i = 0; i < length; i++) {
+            value |= uint64_t(in[i]) << (8 * i);
+        }
+        return value;
+    }
+}
+
+/**
+ * @brief Constructor for SessionTicket. Nothing is read until load().
+ *
+ * @param ticket_path The ticket file, written when the server issues a ticket, or empty to keep the ticket in memory.
+ */
+SessionTicket::SessionTicket(std::string ticket_path) : ticket_path(std::move(ticket_path)) {}
+
+/**
+ * @brief Loads the cached ticket of the client.
+ *
+ * A ticket that expires within EXPIRY_MARGIN seconds is not used, so it does not expire on the way
+ * to the server; the server would accept the reconnect anyway, with a full key exchange.
+ *
+ * @return true if a ticket of the client that is still valid was loaded.
+ */
+bool SessionTicket::load(const ClientId& client_id) {
+    ticket.clear();
+    secret.clear();
+
+    std::ifstream in(ticket_path, std::ios::binary);
+    if (!in.is_open()) {
+        return false;
+    }
+    std::vector<uint8_t> data(HEADER_SIZE + MAX_TICKET_SIZE + 1);
+    in.read(reinterpret_cast<char*>(data.data()), std::streamsize(data.size()));
+    data.resize(size_t(in.gcount()));
+
+    if (data.size() <= HEADER_SIZE || data.size() > HEADER_SIZE + MAX_TICKET_SIZE
+        || std::memcmp(data.data(), MAGIC, sizeof(MAGIC)) != 0
+        || std::memcmp(data.data() + 4, client_id.data(), CLIENT_ID_SIZE) != 0) {
+        return false;
+    }
+    int64_t expiry = int64_t(get_le(data.data() + 4 + CLIENT_ID_SIZE, 8));
+    if (now_seconds() + EXPIRY_MARGIN >= expiry) {
+        return false;
+    }
+    const uint8_t* secret_start = data.data() + 4 + CLIENT_ID_SIZE + 8;
+    secret.assign(secret_start, secret_start + SECRET_SIZE);
+    ticket.assign(data.begin() + HEADER_SIZE, data.end());
+    return true;
+}
+
+/**
+ * @brief Saves a ticket issued by the server.
+ *
+ * The ticket is written to a temporary file and renamed over the old one, so an interrupted write
+ * never leaves a ticket that does not match its secret.
+ *
+ * @throws std::runtime_error if the ticket is too large or cannot be written.
+ */
+void SessionTicket::save(const ClientId& client_id, const std::vector<uint8_t>& new_ticket,
+                         const std::vector<uint8_t>& new_secret, uint32_t lifetime) {
+    if (new_ticket.empty() || new_ticket.size() > MAX_TICKET_SIZE || new_secret.size() != SECRET_SIZE) {
+        throw std::runtime_error("Invalid session ticket");
+    }
+    ticket = new_ticket;
+    secret = new_secret;
+    if (ticket_path.empty()) {
+        return;
+    }
+
+    uint8_t header[HEADER_SIZE];
+    std::memcpy(header, MAGIC, sizeof(MAGIC));
+    std::memcpy(header + 4, client_id.data(), CLIENT_ID_SIZE);
+    put_le(header + 4 + CLIENT_ID_SIZE, uint64_t(now_seconds() + lifetime), 8);
+    std::memcpy(header + 4 + CLIENT_ID_SIZE + 8, secret.data(), SECRET_SIZE);
+
+    std::string temporary_path = ticket_path + ".tmp";
+    {
+        std::ofstream out(temporary_path, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(ticket.data()), std::streamsize(ticket.size()));
+        if (!out) {
+            throw std::runtime_error("Could not write the session ticket: " + temporary_path);
+        }
+    }
+    std::filesystem::rename(temporary_path, ticket_path);
+}
+
+void SessionTicket::discard() {
+    ticket.clear();
+    secret.clear();
+    if (!ticket_path.empty()) {
+        std::error_code error;
+        std::filesystem::remove(ticket_path, error);
+    }
+}
+
+const std::vector<uint8_t>& SessionTicket::get_ticket() const {
+    return ticket;
+}
+
+const std::vector<uint8_t>& SessionTicket::get_secret() const {
+    return secret;
+}
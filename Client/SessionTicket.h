@@ -0,0 +1,53 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+#ifndef MAMAN15_SESSIONTICKET_H
+#define MAMAN15_SESSIONTICKET_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Session ticket the server issued in the last key exchange, cached next to me.info. A reconnect
+// that presents it resumes the session: the AES key is derived from the resumption secret kept
+// with the ticket and a nonce of each side, with no RSA or X25519 operation on either side. The
+// ticket itself is opaque to the client, only the server can open it.
+//
+// The file holds a magic, the client id, the time the ticket expires (seconds since the epoch),
+// the resumption secret and the ticket. A ticket of another client, or one about to expire, is
+// not used. With no ticket path the ticket is kept in memory only, and none is loaded.
+class SessionTicket {
+public:
+    static constexpr size_t CLIENT_ID_SIZE = 16;
+    static constexpr size_t SECRET_SIZE = 32;
+    using ClientId = std::array<uint8_t, CLIENT_ID_SIZE>;
+
+    explicit SessionTicket(std::string ticket_path);
+
+    // Loads the ticket of the client; returns false if there is none that is still valid
+    bool load(const ClientId& client_id);
+
+    // Saves a ticket the server accepts for lifetime seconds. Throws std::runtime_error if it cannot be written.
+    void save(const ClientId& client_id, const std::vector<uint8_t>& ticket, const std::vector<uint8_t>& secret, uint32_t lifetime);
+
+    // Forgets the ticket and removes its file, once the server refused it
+    void discard();
+
+    const std::vector<uint8_t>& get_ticket() const;
+    const std::vector<uint8_t>& get_secret() const;
+
+private:
+    static constexpr size_t HEADER_SIZE = 4 + CLIENT_ID_SIZE + 8 + SECRET_SIZE; // Magic, client id, expiry and secret
+    static constexpr size_t MAX_TICKET_SIZE = 1024;
+    static constexpr int64_t EXPIRY_MARGIN = 30; // Seconds before the expiry a ticket is no longer presented
+
+    std::string ticket_path;
+    std::vector<uint8_t> ticket;
+    std::vector<uint8_t> secret;
+};
+
+
+#endif //MAMAN15_SESSIONTICKET_H
@@ -0,0 +1,67 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+#ifndef MAMAN15_SPSCRING_H
+#define MAMAN15_SPSCRING_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// Bounded lock-free ring buffer for exactly one producer thread and one consumer thread.
+// The capacity is rounded up to a power of two. try_push() fails when the ring is full and
+// try_pop() fails when it is empty; the caller decides how to wait.
+template <typename T>
+class SpscRing {
+public:
+    explicit SpscRing(size_t capacity) : slots(round_up(capacity)), mask(slots.size() - 1) {}
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // Called by the producer thread only
+    bool try_push(const T& value) {
+        size_t tail = write_index.load(std::memory_order_relaxed);
+        if (tail - read_index.load(std::memory_order_acquire) == slots.size()) {
+            return false; // Full
+        }
+        slots[tail & mask] = value;
+        write_index.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Called by the consumer thread only
+    bool try_pop(T& value) {
+        size_t head = read_index.load(std::memory_order_relaxed);
+        if (head == write_index.load(std::memory_order_acquire)) {
+            return false; // Empty
+        }
+        value = slots[head & mask];
+        read_index.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t capacity() const {
+        return slots.size();
+    }
+
+private:
+    static size_t round_up(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        return size;
+    }
+
+    std::vector<T> slots;
+    const size_t mask;
+
+    // Each index is written by one side only; keep them on separate cache lines
+    alignas(64) std::atomic<size_t> read_index{0};
+    alignas(64) std::atomic<size_t> write_index{0};
+};
+
+
+#endif //MAMAN15_SPSCRING_H
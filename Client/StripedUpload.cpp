@@ -0,0 +1,358 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+// StripedUpload.cpp
+
+#include "StripedUpload.h"
+#include "Crc32.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#define HEADER_SIZE 23           // 16 (UUID) + 1 (version) + 2 (op code) + 4 (payload size)
+#define RESPONSE_HEADER_SIZE 7   // 1 (version) + 2 (op code) + 4 (payload size)
+#define NAME_SIZE 255
+#define SEGMENT_METADATA_SIZE (4 + 4 + NAME_SIZE + 4) // Encrypted size, file size, file name and offset
+#define MAX_RESPONSE_PAYLOAD_SIZE 1024
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+    void put_be(uint8_t* out, uint32_t value) {
+        out[0] = uint8_t(value >> 24);
+        out[1] = uint8_t(value >> 16);
+        out[2] = uint8_t(value >> 8);
+        out[3] = uint8_t(value);
+    }
+
+    uint32_t get_be(const uint8_t* in) {
+        return (uint32_t(in[0]) << 24) | (uint32_t(in[1]) << 16) | (uint32_t(in[2]) << 8) | uint32_t(in[3]);
+    }
+
+    double rate_mb(uint64_t bytes, std::chrono::nanoseconds duration) {
+        double seconds = std::chrono::duration<double>(duration).count();
+        return seconds > 0 ? double(bytes) / (1024 * 1024) / seconds : 0;
+    }
+}
+
+/**
+ * @brief Constructor for StripedUpload.
+ *
+ * @param file_path The file to send.
+ * @param file_name Its name on the server.
+ * @param file_size Its size; the file must fit the 32-bit offsets of the protocol.
+ * @param mapped_input Read the segments through memory mappings rather than streams.
+ * @param block_size Plaintext bytes read and encrypted at a time.
+ * @param max_streams Largest number of connections to open.
+ * @param header_prefix Client id and version of the request headers.
+ * @param connect Opens an authenticated connection.
+ */
+StripedUpload::StripedUpload(const std::string& file_path, const std::string& file_name, uint64_t file_size,
+                             bool mapped_input, size_t block_size, size_t max_streams,
+                             const std::array<uint8_t, 17>& header_prefix, Connector connect)
+        : file_path(file_path), file_name(file_name), file_size(file_size), mapped_input(mapped_input),
+          block_size(std::max<size_t>(block_size, 16)), max_streams(std::max<size_t>(max_streams, 1)),
+          header_prefix(header_prefix), connect(std::move(connect)),
+          segment_count((file_size + SEGMENT_SIZE - 1) / SEGMENT_SIZE),
+          segment_states(segment_count, 0), segment_attempts(segment_count, 0) {
+    if (file_size > UINT32_MAX) {
+        throw std::invalid_argument("File is too large for the 32-bit offsets of the protocol");
+    }
+}
+
+StripedUpload::~StripedUpload() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!finished() && !error) {
+            error = std::make_exception_ptr(std::runtime_error("Striped upload abandoned"));
+        }
+    }
+    changed.notify_all();
+    for (auto& worker : workers) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+}
+
+/**
+ * @brief Sends the file over as many connections as help.
+ *
+ * The calling thread opens the connections and measures the throughput; each connection runs
+ * on a thread of its own, taking segments until none is left.
+ *
+ * @return The CRC32 of the file.
+ * @throws The error of a segment that failed MAX_SEGMENT_ATTEMPTS times, or of the first
+ *         connection if none could be opened.
+ */
+uint32_t StripedUpload::run() {
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < std::min(INITIAL_STREAMS, max_streams); i++) {
+        open_stream();
+    }
+    if (workers.empty()) {
+        throw std::runtime_error("Could not open a connection for the striped upload");
+    }
+
+    // The throughput is measured over a window of MEASURE_INTERVALS probe intervals, starting one interval
+    // after a connection was opened so its key exchange and slow start do not count
+    uint64_t window_bytes = 0;
+    Clock::time_point window_start = Clock::now();
+    size_t intervals = 0;
+    size_t skip = 1;
+    double rate_before_growth = 0; // Total throughput before the last connection was added
+    double per_stream_rate = 0;    // Throughput of one connection at that time
+    bool measuring_growth = false; // A connection was added and the window measures its effect
+    bool growing = workers.size() < max_streams;
+    std::unique_lock<std::mutex> lock(mutex);
+    Clock::time_point next_probe = Clock::now() + PROBE_INTERVAL;
+    while (!changed.wait_until(lock, next_probe, [this]() { return finished() || error; })) {
+        next_probe += PROBE_INTERVAL;
+        if (skip > 0) {
+            skip--;
+            window_bytes = sent_bytes;
+            window_start = Clock::now();
+            intervals = 0;
+            continue;
+        }
+
+        bool open = false;
+        if (active_streams == 0) {
+            open = true; // Every connection failed, the segments they held wait in the queue
+        } else if (growing && ++intervals == MEASURE_INTERVALS) {
+            Clock::time_point now = Clock::now();
+            double rate = double(sent_bytes - window_bytes) / std::chrono::duration<double>(now - window_start).count();
+            bool work_left = next_segment < segment_count || !retry_queue.empty();
+            if (measuring_growth && rate - rate_before_growth < per_stream_rate / 2) {
+                growing = false; // The last connection did not help: the link is full
+            } else if (work_left && rate > 0) {
+                rate_before_growth = rate;
+                per_stream_rate = rate / double(active_streams);
+                open = true;
+                growing = workers.size() + 1 < max_streams;
+            }
+            intervals = 0;
+            window_bytes = sent_bytes;
+            window_start = now;
+        }
+        if (open) {
+            lock.unlock();
+            bool opened = open_stream();
+            lock.lock();
+            measuring_growth = opened;
+            if (!opened && active_streams == 0 && !error) {
+                error = std::make_exception_ptr(std::runtime_error("Every connection of the striped upload failed"));
+            }
+            skip = 1;
+            next_probe = Clock::now() + PROBE_INTERVAL;
+        }
+    }
+    lock.unlock();
+    changed.notify_all();
+    for (auto& worker : workers) {
+        worker->thread.join();
+    }
+    if (!finished()) {
+        std::rethrow_exception(error);
+    }
+
+    stats.elapsed = Clock::now() - start;
+    stats.streams = workers.size();
+    stats.segments = confirmed;
+    stats.bytes = confirmed_bytes;
+    for (const auto& worker : workers) {
+        stats.stream_rates.push_back(rate_mb(worker->bytes, worker->closed - worker->opened));
+    }
+
+    uint32_t crc_state = 0;
+    for (uint64_t segment = 0; segment < segment_count; segment++) {
+        crc_state = Crc32::combine(crc_state, segment_states[segment], segment_length(segment));
+    }
+    return Crc32::finalize(crc_state, file_size);
+}
+
+const StripedUpload::Stats& StripedUpload::get_stats() const {
+    return stats;
+}
+
+std::string StripedUpload::Stats::to_string() const {
+    std::ostringstream out;
+    out << "Striped upload finished in " << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count()
+        << " ms over " << streams << " connections, " << segments << " segments, " << retries << " sent again, "
+        << rate_mb(bytes, elapsed) << " MB/s\n";
+    for (size_t i = 0; i < stream_rates.size(); i++) {
+        out << "  connection " << i + 1 << ": " << stream_rates[i] << " MB/s\n";
+    }
+    return out.str();
+}
+
+// Opens a connection and starts its thread. Returns false if the connection could not be opened.
+bool StripedUpload::open_stream() {
+    auto worker = std::make_unique<Worker>();
+    try {
+        worker->stream = connect();
+    } catch (const std::exception& e) {
+        std::cerr << "Striped upload: could not open a connection: " << e.what() << std::endl;
+        return false;
+    }
+    worker->opened = Clock::now();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        active_streams++;
+    }
+    Worker& started = *worker;
+    workers.push_back(std::move(worker));
+    started.thread = std::thread([this, &started]() { send_segments(started); });
+    return true;
+}
+
+// Body of a connection's thread: sends segments until all of them are confirmed or the connection fails
+void StripedUpload::send_segments(Worker& worker) {
+    std::unique_ptr<InputSource> input;
+    std::vector<uint8_t> cipher;
+    uint64_t segment = 0;
+    try {
+        input = InputSource::open(file_path, block_size, mapped_input);
+        while (take_segment(segment)) {
+            uint32_t state = 0;
+            bool confirmed_segment = false;
+            try {
+                confirmed_segment = send_segment(*worker.stream, *input, segment, cipher, state);
+            } catch (...) {
+                requeue(segment, std::current_exception());
+                throw;
+            }
+            if (!confirmed_segment) {
+                requeue(segment, std::make_exception_ptr(
+                        std::runtime_error("The server did not confirm segment " + std::to_string(segment))));
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            segment_states[segment] = state;
+            confirmed++;
+            confirmed_bytes += segment_length(segment);
+            worker.bytes += segment_length(segment);
+            changed.notify_all();
+        }
+
+        // The server ends the session of this connection
+        std::array<uint8_t, HEADER_SIZE> header{};
+        std::copy(header_prefix.begin(), header_prefix.end(), header.begin());
+        header[17] = uint8_t(TERMINATE_CONNECTION >> 8);
+        header[18] = uint8_t(TERMINATE_CONNECTION & 0xFF);
+        boost::asio::write(worker.stream->socket, boost::asio::buffer(header));
+        std::array<uint8_t, RESPONSE_HEADER_SIZE> response{};
+        boost::asio::read(worker.stream->socket, boost::asio::buffer(response));
+    } catch (const std::exception& e) {
+        std::cerr << "Striped upload: connection closed: " << e.what() << std::endl;
+    }
+    boost::system::error_code ignored;
+    worker.stream->socket.close(ignored);
+    worker.closed = Clock::now();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    active_streams--;
+    changed.notify_all();
+}
+
+// Waits for a segment to send. Returns false once every segment is confirmed or the upload failed.
+bool StripedUpload::take_segment(uint64_t& segment) {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this]() {
+        return finished() || error || !retry_queue.empty() || next_segment < segment_count;
+    });
+    if (finished() || error) {
+        return false;
+    }
+    if (!retry_queue.empty()) {
+        segment = retry_queue.front();
+        retry_queue.pop_front();
+    } else {
+        segment = next_segment++;
+    }
+    return true;
+}
+
+// Queues a segment to be sent again, or fails the upload after MAX_SEGMENT_ATTEMPTS
+void StripedUpload::requeue(uint64_t segment, std::exception_ptr cause) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (++segment_attempts[segment] >= MAX_SEGMENT_ATTEMPTS) {
+        if (!error) {
+            error = cause;
+        }
+    } else {
+        retry_queue.push_back(segment);
+        stats.retries++;
+    }
+    changed.notify_all();
+}
+
+/**
+ * @brief Sends one segment as an encrypted body of its own and reads the server's answer.
+ *
+ * @param stream The connection, with the AES key of its key exchange.
+ * @param input The file, read at the offset of the segment.
+ * @param segment Index of the segment.
+ * @param cipher Buffer reused for the encrypted blocks.
+ * @param state Set to the CRC32 state of the segment, starting from 0.
+ * @return True if the server wrote the segment and its state matches.
+ * @throws On connection errors; the connection cannot be used any more.
+ */
+bool StripedUpload::send_segment(Stream& stream, InputSource& input, uint64_t segment,
+                                 std::vector<uint8_t>& cipher, uint32_t& state) {
+    uint64_t offset = segment * SEGMENT_SIZE;
+    uint64_t length = segment_length(segment);
+    std::unique_ptr<FileEncryptor> encryptor = stream.key->create_file_encryptor(length);
+    uint64_t encrypted_size = encryptor->get_encrypted_size();
+
+    std::array<uint8_t, HEADER_SIZE + SEGMENT_METADATA_SIZE> request{};
+    std::copy(header_prefix.begin(), header_prefix.end(), request.begin());
+    request[17] = uint8_t(SENDING_SEGMENT >> 8);
+    request[18] = uint8_t(SENDING_SEGMENT & 0xFF);
+    put_be(&request[19], uint32_t(SEGMENT_METADATA_SIZE + encrypted_size));
+    uint8_t* metadata = request.data() + HEADER_SIZE;
+    put_be(metadata, uint32_t(encrypted_size));
+    put_be(metadata + 4, uint32_t(file_size));
+    std::memcpy(metadata + 8, file_name.data(), std::min<size_t>(file_name.size(), NAME_SIZE - 1));
+    put_be(metadata + 8 + NAME_SIZE, uint32_t(offset));
+    boost::asio::write(stream.socket, boost::asio::buffer(request));
+
+    state = 0;
+    input.seek(offset);
+    uint64_t remaining = length;
+    do {
+        size_t bytes_to_read = size_t(std::min<uint64_t>(block_size, remaining));
+        const uint8_t* block = input.next(bytes_to_read);
+        remaining -= bytes_to_read;
+        state = Crc32::update(state, block, bytes_to_read);
+        encryptor->encrypt_chunk(block, bytes_to_read, remaining == 0, cipher);
+        boost::asio::write(stream.socket, boost::asio::buffer(cipher));
+        sent_bytes += bytes_to_read;
+    } while (remaining > 0);
+
+    std::array<uint8_t, RESPONSE_HEADER_SIZE> header{};
+    boost::asio::read(stream.socket, boost::asio::buffer(header));
+    uint16_t op_code = uint16_t((header[1] << 8) | header[2]);
+    uint32_t size = get_be(&header[3]);
+    if (size > MAX_RESPONSE_PAYLOAD_SIZE) {
+        throw std::runtime_error("Response payload too large");
+    }
+    std::vector<uint8_t> response(size);
+    boost::asio::read(stream.socket, boost::asio::buffer(response));
+    if (op_code != SEGMENT_RECEIVED || size < 28) { // 16 (client id) + 4 (offset) + 4 (length) + 4 (CRC32 state)
+        return false;
+    }
+    return get_be(&response[16]) == offset && get_be(&response[20]) == length && get_be(&response[24]) == state;
+}
+
+uint64_t StripedUpload::segment_length(uint64_t segment) const {
+    return std::min<uint64_t>(SEGMENT_SIZE, file_size - segment * SEGMENT_SIZE);
+}
+
+// True once the server confirmed every segment; called with the mutex held
+bool StripedUpload::finished() const {
+    return confirmed == segment_count;
+}
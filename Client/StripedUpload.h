@@ -0,0 +1,133 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+#ifndef MAMAN15_STRIPEDUPLOAD_H
+#define MAMAN15_STRIPEDUPLOAD_H
+
+#include <boost/asio.hpp>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "CryptoPPKey.h"
+#include "InputSource.h"
+
+using boost::asio::ip::tcp;
+
+// Upload engine that sends one large file as segments over several connections to the server.
+// A single TCP stream over a long, fat link is limited by its window, not by the link, so
+// each connection carries only part of the file and the server writes every segment at its
+// offset. Each connection completes its own key exchange, and each segment is an encrypted body
+// of its own, so any connection can carry any segment and a failed one is sent again elsewhere.
+//
+// The engine starts with INITIAL_STREAMS connections and measures the throughput over
+// MEASURE_INTERVALS probe intervals. It opens one more connection while the last one added raised
+// the total by at least half the throughput of one stream, i.e. while the streams are limited on
+// their own and not by the link, up to the stream limit.
+//
+// SENDING_SEGMENT: encrypted size (4), file size (4), file name (255), offset (4), then the body.
+// The server answers SEGMENT_RECEIVED: client id (16), offset (4), length (4), and the CRC32 state
+// of the bytes it wrote (4), which must match the state of the local segment.
+class StripedUpload {
+public:
+    static constexpr uint64_t MIN_FILE_SIZE = 64ull * 1024 * 1024; // Smaller files go over the main connection
+    static constexpr uint64_t SEGMENT_SIZE = 8ull * 1024 * 1024;   // Plaintext bytes per segment
+    static constexpr size_t INITIAL_STREAMS = 2;
+    static constexpr size_t MAX_SEGMENT_ATTEMPTS = 3;              // Attempts per segment before the upload fails
+    static constexpr std::chrono::milliseconds PROBE_INTERVAL{500};
+    static constexpr size_t MEASURE_INTERVALS = 2;                 // Probe intervals the throughput is averaged over
+    static constexpr uint16_t SENDING_SEGMENT = 836;
+    static constexpr uint16_t TERMINATE_CONNECTION = 903;
+    static constexpr uint16_t SEGMENT_RECEIVED = 1611;
+
+    // A connection that completed the key exchange, with the AES key the server sent on it
+    struct Stream {
+        boost::asio::io_context io_context;
+        tcp::socket socket{io_context};
+        std::unique_ptr<CryptoPPKey> key;
+    };
+
+    // Opens and authenticates a new connection; throws if the server refuses it
+    using Connector = std::function<std::unique_ptr<Stream>()>;
+
+    struct Stats {
+        size_t streams = 0;       // Connections opened
+        uint64_t segments = 0;    // Segments the server confirmed
+        uint64_t retries = 0;     // Segments sent again after an error or a mismatching state
+        uint64_t bytes = 0;       // Plaintext bytes confirmed
+        std::chrono::nanoseconds elapsed{0};
+        std::vector<double> stream_rates; // MB/s of each connection while it was open
+
+        std::string to_string() const;
+    };
+
+    // `header_prefix` is the client id and version that start every request header
+    StripedUpload(const std::string& file_path, const std::string& file_name, uint64_t file_size, bool mapped_input,
+                  size_t block_size, size_t max_streams, const std::array<uint8_t, 17>& header_prefix,
+                  Connector connect);
+    ~StripedUpload();
+
+    StripedUpload(const StripedUpload&) = delete;
+    StripedUpload& operator=(const StripedUpload&) = delete;
+
+    // Sends every segment and returns the CRC32 of the file, combined from the segment states
+    // the server confirmed. Rethrows the error that made a segment fail for good.
+    uint32_t run();
+
+    const Stats& get_stats() const;
+
+private:
+    struct Worker {
+        std::unique_ptr<Stream> stream;
+        std::thread thread;
+        uint64_t bytes = 0; // Plaintext bytes this connection had confirmed
+        std::chrono::steady_clock::time_point opened;
+        std::chrono::steady_clock::time_point closed;
+    };
+
+    std::string file_path;
+    std::string file_name;
+    uint64_t file_size;
+    bool mapped_input;
+    size_t block_size;
+    size_t max_streams;
+    std::array<uint8_t, 17> header_prefix;
+    Connector connect;
+    uint64_t segment_count;
+
+    // Shared state, guarded by mutex
+    std::mutex mutex;
+    std::condition_variable changed;
+    uint64_t next_segment = 0;          // First segment never taken
+    std::deque<uint64_t> retry_queue;   // Segments to send again
+    std::vector<uint32_t> segment_states;
+    std::vector<size_t> segment_attempts;
+    uint64_t confirmed = 0;             // Segments the server confirmed
+    uint64_t confirmed_bytes = 0;
+    size_t active_streams = 0;
+    std::exception_ptr error;
+    std::atomic<uint64_t> sent_bytes{0}; // Plaintext bytes written to the connections, for the throughput
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    Stats stats;
+
+    bool open_stream();
+    void send_segments(Worker& worker);
+    bool take_segment(uint64_t& segment);
+    void requeue(uint64_t segment, std::exception_ptr cause);
+    bool send_segment(Stream& stream, InputSource& input, uint64_t segment, std::vector<uint8_t>& cipher, uint32_t& state);
+    uint64_t segment_length(uint64_t segment) const;
+    bool finished() const;
+};
+
+
+#endif //MAMAN15_STRIPEDUPLOAD_H
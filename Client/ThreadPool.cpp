@@ -0,0 +1,128 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+// ThreadPool.cpp
+
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+
+/**
+ * @brief Constructor for ThreadPool.
+ *
+ * @param worker_count Number of worker threads, 0 for one per hardware thread minus the caller.
+ */
+ThreadPool::ThreadPool(size_t worker_count) {
+    if (worker_count == 0) {
+        unsigned int hardware = std::thread::hardware_concurrency();
+        worker_count = hardware > 1 ? hardware - 1 : 0;
+    }
+    workers.reserve(worker_count);
+    for (size_t i = 0; i < worker_count; i++) {
+        workers.emplace_back([this]() { worker_loop(); });
+    }
+}
+
+// Destructor for ThreadPool, stops and joins the workers
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        stopping = true;
+    }
+    queue_ready.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+// Number of threads that work on a batch, including the calling thread
+size_t ThreadPool::get_concurrency() const {
+    return workers.size() + 1;
+}
+
+/**
+ * @brief Runs a batch of tasks on the workers and the calling thread.
+ *
+ * Every participating thread takes the next task index until none is left, so uneven tasks
+ * balance themselves. The call returns once every task has finished.
+ *
+ * @param count Number of tasks.
+ * @param task Function called with each task index.
+ * @throws The first exception thrown by a task.
+ */
+void ThreadPool::run_batch(size_t count, const std::function<void(size_t)>& task) {
+    if (count == 0) {
+        return;
+    }
+
+    struct Batch {
+        std::atomic<size_t> next{0};
+        size_t remaining;
+        std::exception_ptr error;
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+    auto batch = std::make_shared<Batch>();
+    batch->remaining = count;
+
+    // Takes task indices until the batch is exhausted
+    auto work = [batch, count, &task]() {
+        size_t finished = 0;
+        for (size_t i = batch->next++; i < count; i = batch->next++) {
+            try {
+                task(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(batch->mutex);
+                if (!batch->error) {
+                    batch->error = std::current_exception();
+                }
+            }
+            finished++;
+        }
+        if (finished > 0) {
+            std::lock_guard<std::mutex> lock(batch->mutex);
+            batch->remaining -= finished;
+            if (batch->remaining == 0) {
+                batch->done.notify_all();
+            }
+        }
+    };
+
+    size_t helpers = std::min(workers.size(), count - 1);
+    if (helpers > 0) {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            for (size_t i = 0; i < helpers; i++) {
+                queue.emplace_back(work);
+            }
+        }
+        queue_ready.notify_all();
+    }
+    work(); // The calling thread takes part as well
+
+    std::unique_lock<std::mutex> lock(batch->mutex);
+    batch->done.wait(lock, [&batch]() { return batch->remaining == 0; });
+    if (batch->error) {
+        std::rethrow_exception(batch->error);
+    }
+}
+
+// Runs queued jobs until the pool is destroyed
+void ThreadPool::worker_loop() {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_ready.wait(lock, [this]() { return stopping || !queue.empty(); });
+            if (stopping && queue.empty()) {
+                return;
+            }
+            job = std::move(queue.front());
+            queue.pop_front();
+        }
+        job();
+    }
+}
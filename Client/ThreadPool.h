@@ -0,0 +1,46 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+#ifndef MAMAN15_THREADPOOL_H
+#define MAMAN15_THREADPOOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for data-parallel work such as encrypting independent
+// segments of a file. run_batch() spreads a batch of tasks over the workers and the
+// calling thread and returns when all of them are done.
+class ThreadPool {
+public:
+    // 0 workers means one per hardware thread, minus the calling thread
+    explicit ThreadPool(size_t worker_count = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Runs task(0) .. task(count - 1) and waits for all of them.
+    // Rethrows the first exception thrown by a task.
+    void run_batch(size_t count, const std::function<void(size_t)>& task);
+
+    // Number of threads that work on a batch, including the calling thread
+    size_t get_concurrency() const;
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> queue;
+    std::mutex queue_mutex;
+    std::condition_variable queue_ready;
+    bool stopping = false;
+
+    void worker_loop();
+};
+
+
+#endif //MAMAN15_THREADPOOL_H
@@ -0,0 +1,229 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+// UploadIndex.cpp
+
+#include "UploadIndex.h"
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+    constexpr char MAGIC[4] = {'U', 'I', 'D', 'X'};
+    constexpr uint32_t FORMAT_VERSION = 1;
+
+    void put_le(uint8_t* out, uint64_t value, size_t length) {
+        for (size_t i = 0; i < length; i++) {
+            out[i] = static_cast<uint8_t>(value >> (8 * i));
+        }
+    }
+
+    uint64_t get_le(const uint8_t* in, size_t length) {
+        uint64_t value = 0;
+        for (size_t i = 0; i < length; i++) {
+            value |= uint64_t(in[i]) << (8 * i);
+        }
+        return value;
+    }
+}
+
+/**
+ * @brief Constructor for UploadIndex. Nothing is read until open().
+ *
+ * @param index_path The index file, created on the first record, or empty to keep the records in memory.
+ */
+UploadIndex::UploadIndex(std::string index_path) : index_path(std::move(index_path)) {}
+
+// Loads the index of the client, once; an index of another client is started over
+void UploadIndex::open(const ClientId& client_id) {
+    if (loaded) {
+        return;
+    }
+    owner = client_id;
+    load();
+    loaded = true;
+}
+
+const UploadIndex::Entry* UploadIndex::find(const std::string& path) const {
+    auto it = entries.find(hash_path(path));
+    return it == entries.end() ? nullptr : &it->second;
+}
+
+/**
+ * @brief Records an acknowledged file.
+ *
+ * The record is appended and flushed at once, so an interrupted batch keeps the files it finished.
+ *
+ * @throws std::runtime_error if the index was not opened or cannot be written.
+ */
+void UploadIndex::record(const std::string& path, const Entry& entry) {
+    if (!loaded) {
+        throw std::runtime_error("The upload index is not open");
+    }
+    uint64_t path_hash = hash_path(path);
+    entries[path_hash] = entry;
+    if (index_path.empty()) {
+        return;
+    }
+    write_record(log, path_hash, entry);
+    log.flush();
+    if (!log) {
+        throw std::runtime_error("Could not write the upload index: " + index_path);
+    }
+    record_count++;
+    compact();
+}
+
+/**
+ * @brief Drops the record of a removed file.
+ *
+ * A removal record is appended, so the file stays dropped when the index is loaded again. A file
+ * created again under the same path is then sent like a new one.
+ *
+ * @throws std::runtime_error if the index cannot be written.
+ */
+void UploadIndex::forget(const std::string& path) {
+    if (!loaded) {
+        return;
+    }
+    uint64_t path_hash = hash_path(path);
+    if (entries.erase(path_hash) == 0 || index_path.empty()) {
+        return;
+    }
+    write_record(log, path_hash, Entry{UINT64_MAX, 0, 0}, RECORD_REMOVED); // Never matches a file, for older readers
+    log.flush();
+    if (!log) {
+        throw std::runtime_error("Could not write the upload index: " + index_path);
+    }
+    record_count++;
+    compact();
+}
+
+size_t UploadIndex::size() const {
+    return entries.size();
+}
+
+int64_t UploadIndex::modification_time(const std::string& path) {
+    return int64_t(std::filesystem::last_write_time(path).time_since_epoch().count());
+}
+
+// FNV-1a over the absolute path, so the same file is found whatever directory the client runs from
+uint64_t UploadIndex::hash_path(const std::string& path) {
+    std::string absolute = std::filesystem::absolute(path).lexically_normal().string();
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (unsigned char c : absolute) {
+        hash ^= c;
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+/**
+ * @brief Reads the index file in one pass and opens it for appending.
+ *
+ * A truncated last record, left by an interrupted write, is ignored. The file is rewritten when
+ * it belongs to another client or when replaced and removed records outnumber the live ones.
+ */
+void UploadIndex::load() {
+    entries.clear();
+    record_count = 0;
+    if (index_path.empty()) {
+        return;
+    }
+
+    std::vector<uint8_t> data;
+    std::ifstream in(index_path, std::ios::binary);
+    if (in.is_open()) {
+        in.seekg(0, std::ios::end);
+        data.resize(size_t(in.tellg()));
+        in.seekg(0, std::ios::beg);
+        in.read(reinterpret_cast<char*>(data.data()), std::streamsize(data.size()));
+        data.resize(size_t(in.gcount()));
+    }
+
+    bool valid = data.size() >= HEADER_SIZE && std::memcmp(data.data(), MAGIC, sizeof(MAGIC)) == 0
+                 && get_le(data.data() + 4, 4) == FORMAT_VERSION
+                 && std::memcmp(data.data() + 8, owner.data(), CLIENT_ID_SIZE) == 0;
+    if (valid) {
+        size_t count = (data.size() - HEADER_SIZE) / RECORD_SIZE;
+        entries.reserve(count);
+        for (size_t i = 0; i < count; i++) {
+            const uint8_t* record = data.data() + HEADER_SIZE + i * RECORD_SIZE;
+            Entry entry;
+            entry.size = get_le(record + 8, 8);
+            entry.modification_time = int64_t(get_le(record + 16, 8));
+            entry.checksum = uint32_t(get_le(record + 24, 4));
+            if (get_le(record + 28, 4) & RECORD_REMOVED) {
+                entries.erase(get_le(record, 8));
+            } else {
+                entries[get_le(record, 8)] = entry;
+            }
+        }
+        record_count = count;
+    }
+
+    if (!valid || needs_compaction() || data.size() != HEADER_SIZE + record_count * RECORD_SIZE) {
+        rewrite();
+    }
+    log.open(index_path, std::ios::binary | std::ios::app);
+    if (!log.is_open()) {
+        throw std::runtime_error("Could not open the upload index: " + index_path);
+    }
+}
+
+bool UploadIndex::needs_compaction() const {
+    return record_count > 2 * entries.size() + COMPACT_SLACK;
+}
+
+// Rewrites the open index once replaced and removed records outnumber the live ones
+void UploadIndex::compact() {
+    if (!needs_compaction()) {
+        return;
+    }
+    log.close();
+    rewrite();
+    log.open(index_path, std::ios::binary | std::ios::app);
+    if (!log.is_open()) {
+        throw std::runtime_error("Could not open the upload index: " + index_path);
+    }
+}
+
+// Writes the live records to a new file and replaces the index with it
+void UploadIndex::rewrite() {
+    std::string temporary_path = index_path + ".tmp";
+    {
+        std::ofstream out(temporary_path, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            throw std::runtime_error("Could not write the upload index: " + temporary_path);
+        }
+        write_header(out);
+        for (const auto& [path_hash, entry] : entries) {
+            write_record(out, path_hash, entry);
+        }
+        if (!out) {
+            throw std::runtime_error("Could not write the upload index: " + temporary_path);
+        }
+    }
+    std::filesystem::rename(temporary_path, index_path);
+    record_count = entries.size();
+}
+
+void UploadIndex::write_header(std::ostream& out) {
+    uint8_t header[HEADER_SIZE];
+    std::memcpy(header, MAGIC, sizeof(MAGIC));
+    put_le(header + 4, FORMAT_VERSION, 4);
+    std::memcpy(header + 8, owner.data(), CLIENT_ID_SIZE);
+    out.write(reinterpret_cast<const char*>(header), sizeof(header));
+}
+
+void UploadIndex::write_record(std::ostream& out, uint64_t path_hash, const Entry& entry, uint32_t flags) {
+    uint8_t record[RECORD_SIZE] = {};
+    put_le(record, path_hash, 8);
+    put_le(record + 8, entry.size, 8);
+    put_le(record + 16, uint64_t(entry.modification_time), 8);
+    put_le(record + 24, entry.checksum, 4);
+    put_le(record + 28, flags, 4);
+    out.write(reinterpret_cast<const char*>(record), sizeof(record));
+}
@@ -0,0 +1,83 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+#ifndef MAMAN15_UPLOADINDEX_H
+#define MAMAN15_UPLOADINDEX_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+
+// Persistent record of the files the server acknowledged with CRC_OK, so that unchanged files
+// are skipped on the next run. A file is looked up by the hash of its absolute path; it is
+// unchanged if its size and modification time match the record, which needs no read of the file.
+// The CRC32 of the acknowledged content is kept too, so a file that was only touched can be
+// confirmed with one checksum pass instead of being encrypted and sent.
+//
+// The index file is a header followed by fixed-size records, appended as files are acknowledged.
+// A later record of the same path replaces the earlier one, and a removal record drops it. It is read
+// in one pass the first time a file is looked up, and rewritten without the replaced and removed
+// records once they outnumber the live ones, so a long session keeps it bounded too.
+// An index written for another client id is discarded. With no index path the records are kept in
+// memory only, for the length of the session.
+class UploadIndex {
+public:
+    static constexpr size_t CLIENT_ID_SIZE = 16;
+    using ClientId = std::array<uint8_t, CLIENT_ID_SIZE>;
+
+    struct Entry {
+        uint64_t size = 0;
+        int64_t modification_time = 0;
+        uint32_t checksum = 0; // CRC32 of the content, as acknowledged by the server
+    };
+
+    explicit UploadIndex(std::string index_path);
+
+    UploadIndex(const UploadIndex&) = delete;
+    UploadIndex& operator=(const UploadIndex&) = delete;
+
+    // Loads the index of the given client, once. Throws std::runtime_error if it cannot be written.
+    void open(const ClientId& client_id);
+
+    // Returns the record of the file, or nullptr
+    const Entry* find(const std::string& path) const;
+
+    // Records an acknowledged file and appends the record to the index file
+    void record(const std::string& path, const Entry& entry);
+
+    // Drops the record of a file that was removed, so records of deleted files do not pile up
+    void forget(const std::string& path);
+
+    size_t size() const;
+
+    // Modification time of a file in the units of the file clock, as stored in the records
+    static int64_t modification_time(const std::string& path);
+
+private:
+    static constexpr size_t HEADER_SIZE = 24;  // 4 (magic) + 4 (format version) + 16 (client id)
+    static constexpr size_t RECORD_SIZE = 32;  // 8 (path hash) + 8 (size) + 8 (modification time) + 4 (CRC32) + 4 (flags)
+    static constexpr uint32_t RECORD_REMOVED = 1; // Flag of a removal record
+    static constexpr size_t COMPACT_SLACK = 4096; // Replaced records tolerated before a rewrite
+
+    std::string index_path;
+    ClientId owner{};
+    bool loaded = false;
+    std::unordered_map<uint64_t, Entry> entries;
+    uint64_t record_count = 0; // Records in the file, including replaced ones
+    std::ofstream log;
+
+    static uint64_t hash_path(const std::string& path);
+    void load();
+    void rewrite();
+    bool needs_compaction() const;
+    void compact();
+    void write_record(std::ostream& out, uint64_t path_hash, const Entry& entry, uint32_t flags = 0);
+    void write_header(std::ostream& out);
+};
+
+
+#endif //MAMAN15_UPLOADINDEX_H
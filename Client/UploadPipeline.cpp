@@ -0,0 +1,244 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+// UploadPipeline.cpp
+
+#include "UploadPipeline.h"
+#include <algorithm>
+#include <sstream>
+#include <thread>
+
+#define SPIN_ROUNDS 64      // Busy-wait rounds before yielding the CPU
+#define YIELD_ROUNDS 1024   // Yield rounds before sleeping between retries
+#define BACKOFF_SLEEP std::chrono::microseconds(50)
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * @brief Waits with increasing back-off: spin first, then yield, then sleep.
+ *
+ * Waiting stages do not burn a whole core while another stage is blocked in a system call.
+ */
+static void back_off(size_t round) {
+    if (round < SPIN_ROUNDS) {
+        return;
+    }
+    if (round < SPIN_ROUNDS + YIELD_ROUNDS) {
+        std::this_thread::yield();
+        return;
+    }
+    std::this_thread::sleep_for(BACKOFF_SLEEP);
+}
+
+/**
+ * @brief Constructor for UploadPipeline.
+ *
+ * Allocates the buffer pool up front; no memory is allocated while the file is transferred.
+ *
+ * @param input File positioned at the first byte to send.
+ * @param input_size Number of bytes to read from the file.
+ * @param encryptor Encryptor of the file, it also computes the CRC32 checksum.
+ * @param socket Connected socket the encrypted file is written to.
+ * @param block_size Plaintext bytes per buffer.
+ * @param depth Number of buffers shared by the stages.
+ */
+UploadPipeline::UploadPipeline(InputSource& input, uint64_t input_size, FileEncryptor& encryptor,
+                               tcp::socket& socket, size_t block_size, size_t depth)
+        : input(input), input_size(input_size), encryptor(encryptor), socket(socket),
+          block_size(std::max<size_t>(block_size, 1)), pool(std::max<size_t>(depth, 2)),
+          free_buffers(pool.size()), read_buffers(pool.size()), encrypted_buffers(pool.size()) {
+    // An empty file still produces one block, which carries the padding
+    block_count = std::max<uint64_t>((input_size + this->block_size - 1) / this->block_size, 1);
+
+    for (Buffer& buffer : pool) {
+        buffer.plain.resize(this->block_size);
+        buffer.cipher.resize(encryptor.max_output_size(this->block_size));
+        free_buffers.try_push(&buffer);
+    }
+}
+
+/**
+ * @brief Runs the reader, encryption and writer stages on their own threads.
+ *
+ * @return The number of encrypted bytes written to the socket.
+ * @throws The first exception raised by any of the stages.
+ */
+uint64_t UploadPipeline::run() {
+    Clock::time_point start = Clock::now();
+
+    std::thread reader([this]() { read_stage(); });
+    std::thread encryption([this]() { encrypt_stage(); });
+    std::thread writer([this]() { write_stage(); });
+    reader.join();
+    encryption.join();
+    writer.join();
+
+    stats.elapsed = Clock::now() - start;
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    return bytes_written;
+}
+
+// Returns the statistics of the last run
+const UploadPipeline::Stats& UploadPipeline::get_stats() const {
+    return stats;
+}
+
+// Reads the file into free buffers and hands them to the encryption stage
+void UploadPipeline::read_stage() {
+    try {
+        uint64_t remaining = input_size;
+        for (uint64_t i = 0; i < block_count; i++) {
+            Buffer* buffer = nullptr;
+            if (!pop(free_buffers, buffer, stats.reader.blocked)) {
+                return;
+            }
+
+            Clock::time_point start = Clock::now();
+            buffer->plain_length = size_t(std::min<uint64_t>(block_size, remaining));
+            input.read(buffer->plain.data(), buffer->plain_length);
+            remaining -= buffer->plain_length;
+            buffer->last = (i + 1 == block_count);
+            stats.reader.busy += Clock::now() - start;
+            stats.reader.blocks++;
+
+            if (!push(read_buffers, buffer, stats.reader.blocked)) {
+                return;
+            }
+        }
+    } catch (...) {
+        fail(std::current_exception());
+    }
+}
+
+// Checksums and encrypts the blocks in file order
+void UploadPipeline::encrypt_stage() {
+    try {
+        for (uint64_t i = 0; i < block_count; i++) {
+            Buffer* buffer = nullptr;
+            if (!pop(read_buffers, buffer, stats.encryptor.starved)) {
+                return;
+            }
+
+            Clock::time_point start = Clock::now();
+            size_t length = encryptor.encrypt_chunk(buffer->plain.data(), buffer->plain_length, buffer->last,
+                                                    buffer->cipher.data());
+            buffer->cipher.resize(length); // Never grows past the size reserved in the constructor
+            stats.encryptor.busy += Clock::now() - start;
+            stats.encryptor.blocks++;
+
+            if (!push(encrypted_buffers, buffer, stats.encryptor.blocked)) {
+                return;
+            }
+        }
+    } catch (...) {
+        fail(std::current_exception());
+    }
+}
+
+// Writes the encrypted blocks to the socket and returns the buffers to the pool
+void UploadPipeline::write_stage() {
+    try {
+        for (uint64_t i = 0; i < block_count; i++) {
+            Buffer* buffer = nullptr;
+            if (!pop(encrypted_buffers, buffer, stats.writer.starved)) {
+                return;
+            }
+
+            Clock::time_point start = Clock::now();
+            bytes_written += boost::asio::write(socket, boost::asio::buffer(buffer->cipher));
+            buffer->cipher.resize(buffer->cipher.capacity());
+            stats.writer.busy += Clock::now() - start;
+            stats.writer.blocks++;
+
+            if (!push(free_buffers, buffer, stats.writer.blocked)) {
+                return;
+            }
+        }
+    } catch (...) {
+        fail(std::current_exception());
+    }
+}
+
+// Records the first error and stops the other stages
+void UploadPipeline::fail(std::exception_ptr stage_error) {
+    std::lock_guard<std::mutex> lock(error_mutex);
+    if (!error) {
+        error = stage_error;
+    }
+    failed.store(true, std::memory_order_release);
+}
+
+/**
+ * @brief Pushes a buffer into a ring, waiting while the ring is full.
+ *
+ * @param ring The ring to push to.
+ * @param buffer The buffer to push.
+ * @param waited Accumulates the time spent waiting.
+ * @return False if another stage failed while waiting.
+ */
+bool UploadPipeline::push(SpscRing<Buffer*>& ring, Buffer* buffer, std::chrono::nanoseconds& waited) {
+    if (ring.try_push(buffer)) {
+        return true;
+    }
+    Clock::time_point start = Clock::now();
+    for (size_t round = 0; !ring.try_push(buffer); round++) {
+        if (failed.load(std::memory_order_acquire)) {
+            return false;
+        }
+        back_off(round);
+    }
+    waited += Clock::now() - start;
+    return true;
+}
+
+/**
+ * @brief Pops a buffer from a ring, waiting while the ring is empty.
+ *
+ * @param ring The ring to pop from.
+ * @param buffer Receives the buffer.
+ * @param waited Accumulates the time spent waiting.
+ * @return False if another stage failed while waiting.
+ */
+bool UploadPipeline::pop(SpscRing<Buffer*>& ring, Buffer*& buffer, std::chrono::nanoseconds& waited) {
+    if (ring.try_pop(buffer)) {
+        return true;
+    }
+    Clock::time_point start = Clock::now();
+    for (size_t round = 0; !ring.try_pop(buffer); round++) {
+        if (failed.load(std::memory_order_acquire)) {
+            return false;
+        }
+        back_off(round);
+    }
+    waited += Clock::now() - start;
+    return true;
+}
+
+// Returns the name of the stage that limited the transfer
+const char* UploadPipeline::Stats::bottleneck() const {
+    if (reader.busy >= encryptor.busy && reader.busy >= writer.busy) {
+        return "reader";
+    }
+    return encryptor.busy >= writer.busy ? "encryptor" : "writer";
+}
+
+// Formats the statistics of every stage in milliseconds
+std::string UploadPipeline::Stats::to_string() const {
+    auto ms = [](std::chrono::nanoseconds duration) {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+    };
+    auto stage = [&](std::ostringstream& out, const char* name, const StageStats& s) {
+        out << "  " << name << ": busy " << ms(s.busy) << " ms, starved " << ms(s.starved)
+            << " ms, blocked " << ms(s.blocked) << " ms, " << s.blocks << " blocks\n";
+    };
+
+    std::ostringstream out;
+    out << "Pipeline finished in " << ms(elapsed) << " ms, bottleneck: " << bottleneck() << "\n";
+    stage(out, "reader", reader);
+    stage(out, "encryptor", encryptor);
+    stage(out, "writer", writer);
+    return out.str();
+}
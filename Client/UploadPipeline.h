@@ -0,0 +1,96 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+#ifndef MAMAN15_UPLOADPIPELINE_H
+#define MAMAN15_UPLOADPIPELINE_H
+
+#include <boost/asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "FileEncryptor.h"
+#include "InputSource.h"
+#include "SpscRing.h"
+
+using boost::asio::ip::tcp;
+
+// Three-stage upload engine: a reader thread, an encryption thread and a socket-writer
+// thread pass pooled buffers to each other through bounded single-producer/single-consumer
+// rings. A full ring stalls the stage before it, so the transfer runs at the speed of the
+// slowest stage instead of the sum of all three.
+class UploadPipeline {
+public:
+    static constexpr size_t DEFAULT_DEPTH = 4; // Buffers in flight between the stages
+
+    // Time each stage spent working, waiting for input (starved) and waiting for room
+    // downstream (blocked, i.e. back-pressure)
+    struct StageStats {
+        std::chrono::nanoseconds busy{0};
+        std::chrono::nanoseconds starved{0};
+        std::chrono::nanoseconds blocked{0};
+        uint64_t blocks = 0;
+    };
+
+    struct Stats {
+        StageStats reader;
+        StageStats encryptor;
+        StageStats writer;
+        std::chrono::nanoseconds elapsed{0};
+
+        const char* bottleneck() const; // Name of the stage with the most busy time
+        std::string to_string() const;
+    };
+
+    UploadPipeline(InputSource& input, uint64_t input_size, FileEncryptor& encryptor, tcp::socket& socket,
+                   size_t block_size, size_t depth = DEFAULT_DEPTH);
+
+    UploadPipeline(const UploadPipeline&) = delete;
+    UploadPipeline& operator=(const UploadPipeline&) = delete;
+
+    // Runs the three stages until the whole input was sent. Returns the number of encrypted
+    // bytes written to the socket and rethrows the first error of any stage.
+    uint64_t run();
+
+    const Stats& get_stats() const;
+
+private:
+    struct Buffer {
+        std::vector<uint8_t> plain;
+        std::vector<uint8_t> cipher;
+        size_t plain_length = 0;
+        bool last = false;
+    };
+
+    InputSource& input;
+    uint64_t input_size;
+    FileEncryptor& encryptor;
+    tcp::socket& socket;
+    size_t block_size;
+    uint64_t block_count;
+
+    std::vector<Buffer> pool;
+    SpscRing<Buffer*> free_buffers;      // Writer -> reader
+    SpscRing<Buffer*> read_buffers;      // Reader -> encryptor
+    SpscRing<Buffer*> encrypted_buffers; // Encryptor -> writer
+
+    std::atomic<bool> failed{false};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    uint64_t bytes_written = 0;
+    Stats stats;
+
+    void read_stage();
+    void encrypt_stage();
+    void write_stage();
+    void fail(std::exception_ptr stage_error);
+
+    bool push(SpscRing<Buffer*>& ring, Buffer* buffer, std::chrono::nanoseconds& waited);
+    bool pop(SpscRing<Buffer*>& ring, Buffer*& buffer, std::chrono::nanoseconds& waited);
+};
+
+
+#endif //MAMAN15_UPLOADPIPELINE_H
@@ -0,0 +1,290 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+// UploadService.cpp
+
+#include "UploadService.h"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include "Client.h"
+#include "ThreadPool.h"
+
+// The state of the service, kept out of the header so the program that embeds the client does not
+// depend on Client, the socket it owns or Boost.Asio
+struct UploadService::Impl {
+    struct Job {
+        std::string path;
+        Callback callback;
+        size_t attempts = 0; // Sessions that ended without verifying a file while this one was unsent
+    };
+
+    struct Session {
+        explicit Session(boost::asio::io_context& io_context) : socket(io_context) {}
+
+        tcp::socket socket;
+        std::unique_ptr<Client> client;
+        std::vector<Job> jobs;
+    };
+
+    Options options;
+    boost::asio::io_context io_context;
+    std::optional<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> work_guard;
+    tcp::resolver::results_type endpoints;
+    ThreadPool cipher_pool; // Encrypts the file bodies of every session
+
+    mutable std::mutex mutex;
+    std::condition_variable idle; // Signalled when a session ends
+    ClientConfig config; // Identity of the client, completed once it registered
+    std::deque<Job> queue;
+    size_t active_sessions = 0;
+    size_t pending_count = 0;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+
+    Impl(const std::string& host, const std::string& port, ClientConfig client_config, Options service_options);
+    ~Impl();
+
+    void submit(const std::string& path, Callback callback);
+    void dispatch();
+    void start_session(const std::shared_ptr<Session>& session);
+    void finish_session(const std::shared_ptr<Session>& session);
+    void save_identity(const ClientConfig& identity);
+};
+
+// The outcome of a file as reported to the caller; SKIPPED files are queued again before this
+static UploadService::Status result_status(Client::FileStatus status) {
+    switch (status) {
+        case Client::FileStatus::VERIFIED:
+            return UploadService::Status::VERIFIED;
+        case Client::FileStatus::CRC_FAILED:
+            return UploadService::Status::CRC_FAILED;
+        case Client::FileStatus::UNCHANGED:
+            return UploadService::Status::UNCHANGED;
+        default:
+            return UploadService::Status::FAILED;
+    }
+}
+
+UploadService::UploadService(const std::string& host, const std::string& port, ClientConfig config)
+        : UploadService(host, port, std::move(config), Options()) {}
+
+/**
+ * @brief Resolves the server and starts the worker threads.
+ *
+ * @param host Server host name or address.
+ * @param port Server port.
+ * @param client_config Identity and key of the client; its files and state directory are not used.
+ * @param service_options Limits of the sessions and the threads.
+ * @throws std::runtime_error if the server cannot be resolved.
+ */
+UploadService::UploadService(const std::string& host, const std::string& port, ClientConfig client_config,
+                             Options service_options)
+        : impl(std::make_unique<Impl>(host, port, std::move(client_config), service_options)) {}
+
+UploadService::Impl::Impl(const std::string& host, const std::string& port, ClientConfig client_config,
+                          Options service_options)
+        : options(service_options), config(std::move(client_config)) {
+    options.max_sessions = std::max<size_t>(options.max_sessions, 1);
+    options.max_batch_files = std::max<size_t>(options.max_batch_files, 1);
+    options.max_attempts = std::max<size_t>(options.max_attempts, 1);
+    config.files.clear();
+
+    try {
+        tcp::resolver resolver(io_context);
+        endpoints = resolver.resolve(host, port); // Once, every session connects to the same endpoints
+    } catch (const boost::system::system_error& e) {
+        throw std::runtime_error("Could not resolve " + host + ":" + port + ": " + e.what());
+    }
+
+    work_guard.emplace(boost::asio::make_work_guard(io_context)); // The workers wait for sessions while none runs
+    size_t thread_count = options.worker_threads;
+    if (thread_count == 0) {
+        thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    workers.reserve(thread_count);
+    for (size_t i = 0; i < thread_count; i++) {
+        workers.emplace_back([this]() { io_context.run(); });
+    }
+}
+
+UploadService::~UploadService() = default;
+
+// Waits until every queued file was reported, then lets the workers finish the last handlers and joins them
+UploadService::Impl::~Impl() {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        stopping = true;
+        idle.wait(lock, [this]() { return queue.empty() && active_sessions == 0; });
+    }
+    work_guard.reset();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+std::future<UploadService::Result> UploadService::submit(const std::string& path) {
+    auto promise = std::make_shared<std::promise<Result>>();
+    std::future<Result> result = promise->get_future();
+    submit(path, [promise](const Result& outcome) { promise->set_value(outcome); });
+    return result;
+}
+
+/**
+ * @brief Queues a file and starts a session for it if fewer than max_sessions are open.
+ *
+ * @throws std::runtime_error if the service is being destroyed.
+ */
+void UploadService::submit(const std::string& path, Callback callback) {
+    impl->submit(path, std::move(callback));
+}
+
+void UploadService::Impl::submit(const std::string& path, Callback callback) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (stopping) {
+        throw std::runtime_error("The upload service is stopping");
+    }
+    queue.push_back(Job{path, std::move(callback)});
+    pending_count++;
+    dispatch();
+}
+
+size_t UploadService::get_pending_count() const {
+    std::lock_guard<std::mutex> lock(impl->mutex);
+    return impl->pending_count;
+}
+
+/**
+ * @brief Starts sessions for the queued files, up to max_sessions at once. Called with the mutex held.
+ *
+ * Until the client is registered only one session runs, so it registers once; the files queued
+ * meanwhile are spread over more sessions as soon as it did.
+ */
+void UploadService::Impl::dispatch() {
+    size_t max_sessions = config.client_id ? options.max_sessions : 1;
+    while (!queue.empty() && active_sessions < max_sessions) {
+        auto session = std::make_shared<Session>(io_context);
+        size_t count = std::min(queue.size(), options.max_batch_files);
+        for (size_t i = 0; i < count; i++) {
+            session->jobs.push_back(std::move(queue.front()));
+            queue.pop_front();
+        }
+        active_sessions++;
+        boost::asio::async_connect(session->socket, endpoints,
+            [this, session](const boost::system::error_code& error, const tcp::endpoint&) {
+                if (error) {
+                    std::cerr << "Connection failed: " << error.message() << std::endl;
+                    finish_session(session);
+                    return;
+                }
+                start_session(session);
+            });
+    }
+}
+
+// Runs the session of a connected socket with the identity known at this point
+void UploadService::Impl::start_session(const std::shared_ptr<Session>& session) {
+    boost::system::error_code error;
+    session->socket.set_option(boost::asio::socket_base::keep_alive(true), error);
+
+    ClientConfig session_config;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        session_config.name = config.name;
+        session_config.client_id = config.client_id;
+        session_config.private_key = config.private_key;
+        session_config.key_agreement = config.key_agreement;
+    }
+    session_config.on_registered = [this](const ClientConfig& identity) { save_identity(identity); };
+    for (const Job& job : session->jobs) {
+        session_config.files.push_back(job.path);
+    }
+
+    try {
+        session->client = std::make_unique<Client>(session->socket, std::move(session_config), options.stream_block_size,
+                                                   false, &cipher_pool);
+        session->client->set_compression(options.compression);
+        // The session holds itself until it ends; finish_session() lets it go
+        session->client->set_completion_handler([this, session]() { finish_session(session); });
+        session->client->start_async();
+    } catch (const std::exception& e) {
+        std::cerr << "Client operation failed: " << e.what() << std::endl;
+        if (!session->client || !session->client->is_finished()) {
+            if (session->client) {
+                session->client->set_completion_handler(nullptr);
+            }
+            finish_session(session);
+        }
+    }
+}
+
+/**
+ * @brief Reports the files of an ended session, and queues the unsent ones again.
+ *
+ * A session that verified a file made progress, so its unsent files (those a server without
+ * FEATURE_BATCH skipped) are not charged an attempt. The client is destroyed by a posted handler,
+ * since this runs from its own completion handler.
+ */
+void UploadService::Impl::finish_session(const std::shared_ptr<Session>& session) {
+    std::vector<Client::FileStatus> statuses(session->jobs.size(), Client::FileStatus::PENDING);
+    if (session->client && session->client->get_file_statuses().size() == statuses.size()) {
+        statuses = session->client->get_file_statuses();
+    }
+    bool progressed = std::count(statuses.begin(), statuses.end(), Client::FileStatus::VERIFIED) > 0;
+
+    std::vector<std::pair<Callback, Result>> reports;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = session->jobs.size(); i-- > 0;) { // Backwards, so the requeued files keep their order
+            Job& job = session->jobs[i];
+            Client::FileStatus status = statuses[i];
+            if (status == Client::FileStatus::PENDING || status == Client::FileStatus::SKIPPED) {
+                if (!progressed) {
+                    job.attempts++;
+                }
+                if (job.attempts < options.max_attempts) {
+                    queue.push_front(std::move(job));
+                    continue;
+                }
+                status = Client::FileStatus::FAILED;
+            }
+            reports.emplace_back(std::move(job.callback), Result{job.path, result_status(status)});
+            pending_count--;
+        }
+        active_sessions--;
+        dispatch();
+    }
+    for (auto it = reports.rbegin(); it != reports.rend(); ++it) {
+        if (it->first) {
+            it->first(it->second);
+        }
+    }
+    boost::asio::post(io_context, [session]() { session->client.reset(); });
+
+    std::lock_guard<std::mutex> lock(mutex);
+    idle.notify_all();
+}
+
+// Keeps the identity the first session registered with, so the next sessions reconnect with it
+void UploadService::Impl::save_identity(const ClientConfig& identity) {
+    std::function<void(const ClientConfig&)> on_registered;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        config.name = identity.name;
+        config.client_id = identity.client_id;
+        config.private_key = identity.private_key;
+        on_registered = config.on_registered;
+        dispatch(); // The files queued meanwhile no longer wait for this session
+    }
+    if (on_registered) {
+        on_registered(identity);
+    }
+}
@@ -0,0 +1,83 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+#ifndef MAMAN15_UPLOADSERVICE_H
+#define MAMAN15_UPLOADSERVICE_H
+
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include "ClientConfig.h"
+
+// Uploads files for a program that embeds the client, without blocking it: submit() queues a file and
+// returns at once, and its outcome is delivered through a future or a callback. The identity, the key and
+// the options are passed in; nothing is read from the working directory.
+//
+// Queued files are sent in batches of up to max_batch_files per session, over up to max_sessions
+// connections at once. Every session runs asynchronously on one io_context, driven by a fixed set of
+// worker threads, and the file bodies are encrypted on one shared thread pool, so the number of threads
+// does not grow with the number of uploads. A client with no id registers in the first session, and the
+// others wait for it; the identity it registered with is reported through the config's on_registered,
+// for the caller to keep and pass in next time.
+//
+// A file left unsent when its session ends (the server closed it, or keeps one file per session) is
+// queued again; after max_attempts sessions that verified no file it is reported FAILED. Nothing is
+// written to disk: the state directory of the config is not used, and each session keeps its upload
+// index and session ticket in memory, since several of them run at once.
+class UploadService {
+public:
+    struct Options {
+        size_t max_sessions = 4; // Connections open at once
+        size_t max_batch_files = 64; // Files sent in one session
+        size_t worker_threads = 0; // Threads running the sessions, 0 for one per hardware thread
+        size_t max_attempts = 3; // Sessions that verified no file before a file is reported FAILED
+        size_t stream_block_size = 1024 * 1024; // Plaintext bytes read and encrypted at a time
+        bool compression = true;
+    };
+
+    // Outcome of a submitted file
+    enum class Status {
+        PENDING,    // Not reported yet
+        VERIFIED,   // The server's CRC matched
+        CRC_FAILED, // Still mismatching after the last retry
+        FAILED,     // Could not be opened, the server reported an error, or max_attempts sessions did not send it
+        UNCHANGED   // Verified earlier in the same session and not modified since
+    };
+
+    struct Result {
+        std::string path;
+        Status status = Status::PENDING; // Any other status once reported
+    };
+
+    using Callback = std::function<void(const Result&)>;
+
+    // Resolves the server and starts the worker threads; no connection is made before the first submit().
+    // Throws std::runtime_error if the server cannot be resolved.
+    UploadService(const std::string& host, const std::string& port, ClientConfig config);
+    UploadService(const std::string& host, const std::string& port, ClientConfig config, Options options);
+
+    // Waits for the queued files to be sent, then stops the worker threads. Must not be called from a callback.
+    ~UploadService();
+
+    UploadService(const UploadService&) = delete;
+    UploadService& operator=(const UploadService&) = delete;
+
+    // Queues a file; the future is ready once the file was verified or given up on
+    std::future<Result> submit(const std::string& path);
+
+    // Queues a file; the callback runs on a worker thread once the file was verified or given up on
+    void submit(const std::string& path, Callback callback);
+
+    // Files queued or being sent
+    size_t get_pending_count() const;
+
+private:
+    struct Impl; // The io_context, the sessions and the queue, see UploadService.cpp
+    std::unique_ptr<Impl> impl;
+};
+
+
+#endif //MAMAN15_UPLOADSERVICE_H
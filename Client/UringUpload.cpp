@@ -0,0 +1,307 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+// UringUpload.cpp
+
+#include "UringUpload.h"
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+#if defined(__linux__) && __has_include(<liburing.h>)
+#define CLIENT_IO_URING 1
+#include <liburing.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+#ifdef CLIENT_IO_URING
+
+enum RequestKind : uint64_t {
+    READ_REQUEST = 0,
+    SEND_REQUEST = 1
+};
+
+// Indices of the registered files
+enum RegisteredFile : int {
+    INPUT_FILE = 0,
+    OUTPUT_SOCKET = 1
+};
+
+// The ring, the file it reads and the registrations. Registering the buffers needs locked memory
+// and can fail under a low RLIMIT_MEMLOCK; the ring then uses plain reads and writes on them.
+struct UringUpload::Ring {
+    io_uring ring{};
+    int file_descriptor = -1;
+    int socket_descriptor = -1;
+    bool fixed_buffers = false;
+    bool fixed_files = false;
+
+    Ring(const std::string& path, int socket_descriptor, std::vector<Slot>& slots) : socket_descriptor(socket_descriptor) {
+        file_descriptor = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (file_descriptor < 0) {
+            throw std::runtime_error("Could not open the file: " + path);
+        }
+        int result = io_uring_queue_init(unsigned(2 * slots.size() + 2), &ring, 0);
+        if (result < 0) {
+            ::close(file_descriptor);
+            throw boost::system::system_error(boost::system::error_code(-result, boost::system::system_category()),
+                                              "io_uring_queue_init");
+        }
+
+        std::vector<iovec> buffers;
+        for (Slot& slot : slots) {
+            buffers.push_back({slot.plain.data(), slot.plain.size()});
+            buffers.push_back({slot.cipher.data(), slot.cipher.size()});
+        }
+        fixed_buffers = io_uring_register_buffers(&ring, buffers.data(), unsigned(buffers.size())) == 0;
+        int files[] = {file_descriptor, socket_descriptor};
+        fixed_files = io_uring_register_files(&ring, files, 2) == 0;
+    }
+
+    ~Ring() {
+        io_uring_queue_exit(&ring);
+        ::close(file_descriptor);
+    }
+
+    // Returns a free submission entry; the ring is sized so that one is always left
+    io_uring_sqe* get_sqe() {
+        io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+        if (!sqe) {
+            throw std::runtime_error("io_uring submission queue is full");
+        }
+        return sqe;
+    }
+
+    void queue_read(size_t slot_index, uint8_t* data, size_t length, uint64_t file_offset) {
+        io_uring_sqe* sqe = get_sqe();
+        int target = fixed_files ? INPUT_FILE : file_descriptor;
+        if (fixed_buffers) {
+            io_uring_prep_read_fixed(sqe, target, data, unsigned(length), file_offset, int(2 * slot_index));
+        } else {
+            io_uring_prep_read(sqe, target, data, unsigned(length), file_offset);
+        }
+        finish_sqe(sqe, slot_index, READ_REQUEST);
+    }
+
+    void queue_send(size_t slot_index, const uint8_t* data, size_t length) {
+        io_uring_sqe* sqe = get_sqe();
+        int target = fixed_files ? OUTPUT_SOCKET : socket_descriptor;
+        if (fixed_buffers) {
+            io_uring_prep_write_fixed(sqe, target, data, unsigned(length), 0, int(2 * slot_index + 1));
+        } else {
+            io_uring_prep_write(sqe, target, data, unsigned(length), 0);
+        }
+        finish_sqe(sqe, slot_index, SEND_REQUEST);
+    }
+
+    void finish_sqe(io_uring_sqe* sqe, size_t slot_index, RequestKind kind) {
+        if (fixed_files) {
+            sqe->flags |= IOSQE_FIXED_FILE;
+        }
+        io_uring_sqe_set_data64(sqe, uint64_t(slot_index) << 1 | kind);
+    }
+};
+
+#else
+
+struct UringUpload::Ring {};
+
+#endif
+
+// Returns true if the client was built with liburing and the kernel accepts a ring.
+// The check runs once; containers often block io_uring with seccomp.
+bool UringUpload::is_available() {
+#ifdef CLIENT_IO_URING
+    static const bool available = []() {
+        io_uring ring{};
+        if (io_uring_queue_init(2, &ring, 0) < 0) {
+            return false;
+        }
+        io_uring_queue_exit(&ring);
+        return true;
+    }();
+    return available;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Constructor for UringUpload.
+ *
+ * Allocates the buffer pool up front; no memory is allocated while the file is transferred.
+ *
+ * @param path The file to send.
+ * @param offset Offset of the first byte to send.
+ * @param input_size Number of bytes to send from the offset.
+ * @param encryptor Encryptor of the file, it also computes the CRC32 checksum.
+ * @param socket Connected socket the encrypted file is written to.
+ * @param block_size Plaintext bytes per buffer.
+ * @param depth Number of slots, and so of blocks in flight.
+ */
+UringUpload::UringUpload(const std::string& path, uint64_t offset, uint64_t input_size, FileEncryptor& encryptor,
+                         tcp::socket& socket, size_t block_size, size_t depth)
+        : path(path), offset(offset), input_size(input_size), encryptor(encryptor), socket(socket),
+          block_size(std::max<size_t>(block_size, 1)), slots(std::max<size_t>(depth, 1)) {
+    // An empty file still produces one block, which carries the padding
+    block_count = std::max<uint64_t>((input_size + this->block_size - 1) / this->block_size, 1);
+
+    for (Slot& slot : slots) {
+        slot.plain.resize(this->block_size);
+        slot.cipher.resize(encryptor.max_output_size(this->block_size));
+    }
+}
+
+UringUpload::~UringUpload() = default;
+
+/**
+ * @brief Reads, encrypts and sends the input through the ring.
+ *
+ * Each round encrypts the blocks whose reads completed, in file order, queues the reads that reuse
+ * their plaintext buffers and the next send, then submits everything and waits for at least one
+ * completion in a single io_uring_enter call. Short reads and sends are queued again for the rest.
+ *
+ * @return The number of encrypted bytes written to the socket.
+ */
+uint64_t UringUpload::run() {
+#ifdef CLIENT_IO_URING
+    Clock::time_point start = Clock::now();
+    ring = std::make_unique<Ring>(path, int(socket.native_handle()), slots);
+    stats.fixed_buffers = ring->fixed_buffers;
+    size_t depth = slots.size();
+    size_t in_flight = 0;
+
+    auto queue_read = [&](uint64_t block) {
+        Slot& slot = slots[block % depth];
+        slot.block = block;
+        slot.plain_length = size_t(std::min<uint64_t>(block_size, input_size - block * block_size));
+        slot.read_length = 0;
+        slot.read_complete = slot.plain_length == 0; // The empty block of an empty file
+        if (!slot.read_complete) {
+            ring->queue_read(block % depth, slot.plain.data(), slot.plain_length, offset + block * block_size);
+            in_flight++;
+        }
+    };
+
+    uint64_t next_read = 0;    // Next block to read
+    uint64_t next_encrypt = 0; // Next block to encrypt
+    uint64_t next_send = 0;    // Block being sent, or next to send
+    bool send_in_flight = false;
+    for (; next_read < std::min<uint64_t>(depth, block_count); next_read++) {
+        queue_read(next_read);
+    }
+
+    while (next_send < block_count) {
+        // Encrypt the blocks that were read while the cipher buffer of their slot is free
+        while (next_encrypt < block_count) {
+            Slot& slot = slots[next_encrypt % depth];
+            if (!slot.read_complete || slot.send_pending) {
+                break;
+            }
+            slot.cipher_length = encryptor.encrypt_chunk(slot.plain.data(), slot.plain_length,
+                                                         next_encrypt + 1 == block_count, slot.cipher.data());
+            slot.sent_length = 0;
+            slot.read_complete = false;
+            slot.send_pending = true;
+            next_encrypt++;
+            if (next_read < block_count) {
+                queue_read(next_read++); // Reuses the plaintext buffer just encrypted
+            }
+        }
+
+        // Sends go out one at a time so the socket receives the blocks in order
+        while (!send_in_flight && next_send < next_encrypt) {
+            Slot& slot = slots[next_send % depth];
+            if (slot.sent_length == slot.cipher_length) { // Nothing to send for an empty final block
+                slot.send_pending = false;
+                next_send++;
+                stats.blocks++;
+                continue;
+            }
+            ring->queue_send(next_send % depth, slot.cipher.data() + slot.sent_length, slot.cipher_length - slot.sent_length);
+            in_flight++;
+            send_in_flight = true;
+        }
+        if (in_flight == 0) {
+            continue; // Everything left is ready to be encrypted or skipped
+        }
+
+        int result = io_uring_submit_and_wait(&ring->ring, 1);
+        stats.submissions++;
+        if (result < 0 && result != -EINTR) {
+            throw boost::system::system_error(boost::system::error_code(-result, boost::system::system_category()),
+                                              "io_uring_submit_and_wait");
+        }
+
+        io_uring_cqe* cqe = nullptr;
+        while (io_uring_peek_cqe(&ring->ring, &cqe) == 0) {
+            uint64_t data = io_uring_cqe_get_data64(cqe);
+            int res = cqe->res;
+            io_uring_cqe_seen(&ring->ring, cqe);
+            in_flight--;
+            stats.completions++;
+
+            size_t slot_index = size_t(data >> 1);
+            Slot& slot = slots[slot_index];
+            bool retry = res == -EAGAIN || res == -EINTR;
+            if (res < 0 && !retry) {
+                throw boost::system::system_error(boost::system::error_code(-res, boost::system::system_category()),
+                                                  (data & 1) == SEND_REQUEST ? "Error during write" : "Error reading file");
+            }
+            if ((data & 1) == READ_REQUEST) {
+                if (res == 0) {
+                    throw std::runtime_error("Error reading file: " + path);
+                }
+                slot.read_length += size_t(std::max(res, 0));
+                if (slot.read_length < slot.plain_length) { // Short read, read the rest
+                    ring->queue_read(slot_index, slot.plain.data() + slot.read_length, slot.plain_length - slot.read_length,
+                                     offset + slot.block * block_size + slot.read_length);
+                    in_flight++;
+                } else {
+                    slot.read_complete = true;
+                }
+            } else {
+                slot.sent_length += size_t(std::max(res, 0));
+                stats.bytes += uint64_t(std::max(res, 0));
+                send_in_flight = false;
+                if (slot.sent_length == slot.cipher_length) {
+                    slot.send_pending = false;
+                    next_send++;
+                    stats.blocks++;
+                } // Otherwise the rest is sent in the next round
+            }
+        }
+    }
+
+    ring.reset();
+    stats.elapsed = Clock::now() - start;
+    return stats.bytes;
+#else
+    throw std::runtime_error("The client was built without io_uring");
+#endif
+}
+
+// Returns the statistics of the last run
+const UringUpload::Stats& UringUpload::get_stats() const {
+    return stats;
+}
+
+// Formats the statistics, with the system calls per GiB sent
+std::string UringUpload::Stats::to_string() const {
+    std::ostringstream out;
+    double gib = double(bytes) / (1024.0 * 1024.0 * 1024.0);
+    out << "io_uring upload: " << blocks << " blocks, " << bytes << " bytes in "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() << " ms, "
+        << submissions << " submissions";
+    if (gib > 0) {
+        out << " (" << uint64_t(double(submissions) / gib) << " per GiB)";
+    }
+    out << ", " << completions << " completions" << (fixed_buffers ? ", registered buffers" : "") << std::endl;
+    return out.str();
+}
@@ -0,0 +1,85 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+#ifndef MAMAN15_URINGUPLOAD_H
+#define MAMAN15_URINGUPLOAD_H
+
+#include <boost/asio.hpp>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include "FileEncryptor.h"
+
+using boost::asio::ip::tcp;
+
+// Upload engine on Linux io_uring, for clients built with liburing.
+// The file reads and the socket sends of a file body are queued on one ring, so one io_uring_enter
+// call submits the next reads and send together and collects whatever completed meanwhile, instead of
+// a read and a write system call per block. The blocks live in a fixed pool of buffers registered with
+// the kernel; the file and the socket are registered too.
+//
+// A slot carries one block from the read to the send: block i uses slot i % depth. The reads of the
+// next `depth` blocks are in flight while the current block is encrypted, and one send is in flight
+// at a time, so the bytes reach the socket in file order.
+class UringUpload {
+public:
+    static constexpr size_t DEFAULT_DEPTH = 8; // Blocks in flight
+
+    struct Stats {
+        uint64_t blocks = 0;
+        uint64_t bytes = 0;
+        uint64_t submissions = 0;  // io_uring_enter calls, the only system calls of the transfer
+        uint64_t completions = 0;
+        bool fixed_buffers = false; // The buffer pool was registered with the kernel
+        std::chrono::nanoseconds elapsed{0};
+
+        std::string to_string() const;
+    };
+
+    // True if the client was built with liburing and the kernel accepts a ring
+    static bool is_available();
+
+    UringUpload(const std::string& path, uint64_t offset, uint64_t input_size, FileEncryptor& encryptor,
+                tcp::socket& socket, size_t block_size, size_t depth = DEFAULT_DEPTH);
+    ~UringUpload();
+
+    UringUpload(const UringUpload&) = delete;
+    UringUpload& operator=(const UringUpload&) = delete;
+
+    // Sends the encrypted input. Returns the number of encrypted bytes written to the socket.
+    // Throws std::runtime_error or boost::system::system_error on the first failed read or send.
+    uint64_t run();
+
+    const Stats& get_stats() const;
+
+private:
+    struct Slot {
+        std::vector<uint8_t> plain;
+        std::vector<uint8_t> cipher;
+        uint64_t block = 0;        // Block of the input the slot holds
+        size_t plain_length = 0;
+        size_t read_length = 0;    // Bytes of the block read so far
+        bool read_complete = false;
+        size_t cipher_length = 0;
+        size_t sent_length = 0;    // Bytes of cipher sent so far
+        bool send_pending = false; // Encrypted, not completely sent yet
+    };
+
+    struct Ring; // The io_uring and its registrations, defined where liburing is included
+
+    std::string path;
+    uint64_t offset;
+    uint64_t input_size;
+    FileEncryptor& encryptor;
+    tcp::socket& socket;
+    size_t block_size;
+    uint64_t block_count;
+    std::vector<Slot> slots;
+    std::unique_ptr<Ring> ring; // Destroyed before the slots it reads into
+    Stats stats;
+};
+
+
+#endif //MAMAN15_URINGUPLOAD_H
@@ -1,5 +1,11 @@
 #include <iostream>
 #include <boost/asio.hpp>
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <functional>
+#include <memory>
 #include <string>
 #include <fstream>
 #include "Client.h"
@@ -38,8 +44,138 @@ bool connect_to_server(tcp::socket& socket, const std::string& ip, const std::st
     }
 }
 
+// Watcher of the running upload agent, stopped by SIGINT and SIGTERM
+DirectoryWatcher* active_watcher = nullptr;
+
+void stop_upload_agent(int) {
+    if (active_watcher) {
+        active_watcher->stop(); // The batch being sent is finished, then the session ends
+    }
+}
+
+// Runs the client as an upload agent: a session stays open and uploads the files written to the watched
+// directories as they settle, so the process start, the key loading, the connection and the key exchange
+// are paid once instead of per file. When the session ends the agent connects again once there are files
+// to send, resuming with the session ticket; a session that verified nothing is followed by a backoff.
+// Returns when the watcher is stopped.
+int run_upload_agent(const std::string& ip, const std::string& port, DirectoryWatcher& watcher,
+                     const std::function<std::unique_ptr<Client>(tcp::socket&, ThreadPool*)>& make_client) {
+    constexpr std::chrono::milliseconds MIN_BACKOFF{1000};
+    constexpr std::chrono::milliseconds MAX_BACKOFF{60 * 1000};
+
+    boost::asio::io_context io_context; // Create an I/O context
+    ThreadPool cipher_pool; // Shared by the sessions, so reconnecting starts no threads
+    std::chrono::milliseconds backoff = MIN_BACKOFF;
+    while (!watcher.is_stopped()) {
+        size_t verified = 0;
+        tcp::socket socket(io_context); // Create a socket
+        if (connect_to_server(socket, ip, port)) {
+            boost::system::error_code error;
+            socket.set_option(boost::asio::socket_base::keep_alive(true), error); // Notice a dead server while idle
+            try {
+                std::unique_ptr<Client> client = make_client(socket, &cipher_pool);
+                client->set_watcher(&watcher);
+                client->start(); // Returns when the watcher is stopped or the connection is lost
+                verified = client->get_verified_count();
+            } catch (const std::exception& e) {
+                std::cerr << "Client operation failed: " << e.what() << std::endl;
+            }
+        }
+        std::cout << watcher.get_stats().to_string();
+        if (watcher.is_stopped()) {
+            break;
+        }
+        if (verified > 0) {
+            backoff = MIN_BACKOFF; // The session ended after sending, without FEATURE_BATCH it ends after every file
+        } else {
+            std::cerr << "Connecting again in " << backoff.count() << " ms" << std::endl;
+            watcher.idle(backoff);
+            backoff = std::min(backoff * 2, MAX_BACKOFF);
+        }
+        watcher.wait_for_files(); // Connect again once there is something to send
+    }
+    std::cout << "Upload agent stopped" << std::endl;
+    return 0;
+}
+
 // Main function to run the client
-int main() {
+// Pass --pipelined to read, encrypt and send the file on separate threads.
+// Pass --async to run the session on the io_context with asynchronous reads and writes.
+// Pass --mapped-input to map the files into memory instead of reading them with std::ifstream; only for
+// files nothing writes to during the upload, since a file truncated while it is mapped raises SIGBUS.
+// Pass --io-uring to send the files through io_uring on Linux.
+// Pass --full to send every file, even the ones unchanged since the server acknowledged them.
+// Pass --no-compression to send the files uncompressed.
+// Pass --stripes N to send large files over up to N extra connections.
+// Pass --multiplex N to send the files of a batch at once, up to N interleaved on the connection.
+// Pass --rsa to register a new client with an RSA key, for servers that cannot agree the session key.
+// Pass --key-pool DIR to register a new client with an RSA key pair taken from DIR instead of generating it.
+// Pass --fill-key-pool N with --key-pool DIR to add N RSA key pairs to DIR and exit.
+// Pass --watch DIR, once per directory, to run as an upload agent that sends the files written to them.
+// Pass --settle-ms N with --watch to wait N ms after a file was last closed before sending it.
+int main(int argc, char* argv[]) {
+    bool pipelined = false;
+    bool asynchronous = false;
+    bool mapped_input = false;
+    bool io_uring = false;
+    bool skip_unchanged = true;
+    bool compression = true;
+    bool key_agreement = true;
+    size_t stripes = 0;
+    size_t multiplex = 0;
+    std::string key_pool;
+    size_t key_pool_fill = 0;
+    std::vector<std::string> watch_directories;
+    std::chrono::milliseconds settle_time = DirectoryWatcher::DEFAULT_SETTLE_TIME;
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--pipelined") {
+            pipelined = true;
+        } else if (std::string(argv[i]) == "--async") {
+            asynchronous = true;
+        } else if (std::string(argv[i]) == "--mapped-input") {
+            mapped_input = true;
+        } else if (std::string(argv[i]) == "--io-uring") {
+            io_uring = true;
+        } else if (std::string(argv[i]) == "--full") {
+            skip_unchanged = false;
+        } else if (std::string(argv[i]) == "--no-compression") {
+            compression = false;
+        } else if (std::string(argv[i]) == "--rsa") {
+            key_agreement = false;
+        } else if (std::string(argv[i]) == "--stripes" && i + 1 < argc) {
+            stripes = std::strtoul(argv[++i], nullptr, 10);
+        } else if (std::string(argv[i]) == "--multiplex" && i + 1 < argc) {
+            multiplex = std::strtoul(argv[++i], nullptr, 10);
+        } else if (std::string(argv[i]) == "--key-pool" && i + 1 < argc) {
+            key_pool = argv[++i];
+            key_agreement = false; // The pool holds RSA key pairs
+        } else if (std::string(argv[i]) == "--fill-key-pool" && i + 1 < argc) {
+            key_pool_fill = std::strtoul(argv[++i], nullptr, 10);
+        } else if (std::string(argv[i]) == "--watch" && i + 1 < argc) {
+            watch_directories.push_back(argv[++i]);
+        } else if (std::string(argv[i]) == "--settle-ms" && i + 1 < argc) {
+            settle_time = std::chrono::milliseconds(std::strtoul(argv[++i], nullptr, 10));
+        }
+    }
+
+    if (key_pool_fill > 0) {
+        if (key_pool.empty()) {
+            std::cerr << "--fill-key-pool needs --key-pool DIR" << std::endl;
+            return 1;
+        }
+        try {
+            ThreadPool pool;
+            CryptoPPKey::fill_key_pool(key_pool, key_pool_fill, pool); // Generate the key pairs on every core
+        } catch (const std::exception& e) {
+            std::cerr << "Filling the key pool failed: " << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    // Start on the RSA key pair of a new client now, it is generated while the server is resolved and connected to
+    CryptoPPKey::prepare_key_pair(key_pool, key_agreement);
+
     std::string port_ip = get_port_ip(); // Retrieve the IP and port from the file
     if (port_ip.empty()) { // Check if the IP and port were retrieved successfully
         return 1;  // Exit if we failed to get IP and port
@@ -57,6 +193,48 @@ int main() {
 
     std::cout << "Connecting to server at IP: " << ip << " Port: " << port << std::endl; // Log the IP and port
 
+    // Creates a client with the options of the command line
+    auto make_client = [&](tcp::socket& socket, ThreadPool* shared_pool) {
+        ClientConfig config = ClientConfig::from_working_directory();
+        config.key_agreement = key_agreement;
+        auto client = std::make_unique<Client>(socket, std::move(config), Client::DEFAULT_STREAM_BLOCK_SIZE, pipelined,
+                                               shared_pool);
+        client->set_mapped_input(mapped_input);
+        client->set_io_uring(io_uring);
+        client->set_skip_unchanged(skip_unchanged);
+        client->set_compression(compression);
+        client->set_striping(stripes);
+        client->set_multiplexing(multiplex);
+        return client;
+    };
+
+    if (!watch_directories.empty()) {
+        if (asynchronous) {
+            std::cerr << "--watch runs blocking sessions, it cannot be combined with --async" << std::endl;
+            return 1;
+        }
+        if (mapped_input) {
+            std::cerr << "--watch reads files that may still change, it cannot be combined with --mapped-input" << std::endl;
+            return 1;
+        }
+        try {
+            DirectoryWatcher watcher(watch_directories, settle_time);
+            active_watcher = &watcher;
+            std::signal(SIGINT, stop_upload_agent);
+            std::signal(SIGTERM, stop_upload_agent);
+#ifdef SIGPIPE
+            std::signal(SIGPIPE, SIG_IGN); // A server gone while idle is an error of the next write, not a signal
+#endif
+            int result = run_upload_agent(ip, port, watcher, make_client);
+            active_watcher = nullptr;
+            return result;
+        } catch (const std::exception& e) {
+            active_watcher = nullptr;
+            std::cerr << "Upload agent failed: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+
     // Set up Boost.Asio
     boost::asio::io_context io_context; // Create an I/O context
     tcp::socket socket(io_context); // Create a socket
@@ -70,8 +248,13 @@ int main() {
 
     // Create the Client object and start communication
     try {
-        Client client(socket); // Create a Client object
-        client.start();  // Start communication (assuming `start` is a method in the Client class)
+        std::unique_ptr<Client> client = make_client(socket, nullptr); // Create a Client object
+        if (asynchronous) {
+            client->start_async(); // Queue the first request
+            io_context.run(); // Run the session until it ends
+        } else {
+            client->start();  // Start communication (assuming `start` is a method in the Client class)
+        }
     } catch (const std::exception& e) { // Catch any exceptions
         std::cerr << "Client operation failed: " << e.what() << std::endl; // Log the error message
         return 1; // Exit if an exception was thrown
@@ -3,10 +3,17 @@ Author: Lior Klunover
 Version: 1.0.1
 """
 from Crypto.Cipher import AES, PKCS1_OAEP
-from Crypto.PublicKey import RSA
+from Crypto.Hash import SHA256
+from Crypto.Protocol.DH import import_x25519_public_key, key_agreement
+from Crypto.Protocol.KDF import HKDF
+from Crypto.PublicKey import ECC, RSA
 from Crypto.Util.Padding import pad, unpad
 from Crypto.Random import get_random_bytes
 from base64 import b64decode
+import ctypes
+import ctypes.util
+from functools import lru_cache
+from typing import BinaryIO, Iterable, Iterator, Optional, Tuple
 
 
 
@@ -65,18 +72,167 @@ crctab = [ 0x00000000, 0x04c11db7, 0x09823b6e, 0x0d4326d9, 0x130476dc,
 
 UNSIGNED = lambda n: n & 0xffffffff
 AES_KEY_SIZE = 32  # AES-256 key size
-IV_SIZE = 16  # IV size for AES CBC mode
+IV_SIZE = 16  # IV size for AES CBC mode, and of the per-file IV of CTR/GCM bodies
+SESSION_KEY_INFO = b'MAMAN15 session key'  # HKDF context of the agreed AES key and IV
+RESUMPTION_INFO = b'MAMAN15 resumption secret'  # HKDF context of the secret a session ticket carries
+RESUMPTION_SECRET_SIZE = 32
+
+# Cipher modes of the file body, as sent in the key exchange response
+CIPHER_CBC = 0
+CIPHER_CTR = 1  # Body: file IV + ciphertext
+CIPHER_GCM = 2  # Body: file IV + segments of up to GCM_SEGMENT_SIZE bytes, each followed by its tag
+GCM_SEGMENT_SIZE = 64 * 1024
+GCM_TAG_SIZE = 16
+STREAM_READ_SIZE = 1024 * 1024  # Size of the reads used to checksum a saved file
+X25519_KEY_SIZE = 32  # Raw X25519 public key, registered instead of an RSA key by clients that agree the session key
+X25519_NID = 1034  # OpenSSL's identifier of X25519 keys
+
+CURVE25519_PRIME = 2 ** 255 - 19
+# u-coordinates of the points of small order, which would make the shared secret predictable (RFC 7748)
+X25519_SMALL_ORDER_POINTS = frozenset((0, 1, CURVE25519_PRIME - 1,
+                                       325606250916557431795983626356110631294008115727848805560023387167927233504,
+                                       39382357235489614581723060781553021112529911719440698176882885853963445705823))
+
+
+def check_x25519_public_key(public_key: bytes) -> bytes:
+    """
+    Checks a raw X25519 public key before it is registered or agreed with.
+
+    Returns:
+        bytes: The key.
+
+    Raises:
+        ValueError: If the key has the wrong size or is a point of small order.
+    """
+    if len(public_key) != X25519_KEY_SIZE:
+        raise ValueError(f"X25519 public key of {len(public_key)} bytes, expected {X25519_KEY_SIZE}")
+    u = int.from_bytes(public_key, 'little') & ((1 << 255) - 1)  # The top bit is ignored
+    if u % CURVE25519_PRIME in X25519_SMALL_ORDER_POINTS:
+        raise ValueError("X25519 public key of small order")
+    return public_key
+
+
+class CryptographyX25519:
+    """X25519 of the `cryptography` package, which runs it in OpenSSL."""
+    name = 'cryptography'
+
+    def __init__(self):
+        from cryptography.hazmat.primitives.asymmetric.x25519 import X25519PrivateKey, X25519PublicKey
+        from cryptography.hazmat.primitives.serialization import Encoding, PublicFormat
+        self.private_key_type, self.public_key_type = X25519PrivateKey, X25519PublicKey
+        self.raw = (Encoding.Raw, PublicFormat.Raw)
+
+    def agree(self, peer_public_key: bytes) -> Tuple[bytes, bytes]:
+        private_key = self.private_key_type.generate()
+        shared_secret = private_key.exchange(self.public_key_type.from_public_bytes(peer_public_key))
+        return private_key.public_key().public_bytes(*self.raw), shared_secret
+
+
+class OpenSSLX25519:
+    """
+    X25519 of the libcrypto the Python interpreter is linked with, called through ctypes, for servers
+    without the `cryptography` package. Needs OpenSSL 1.1.1 or later.
+    """
+    name = 'OpenSSL'
+
+    def __init__(self):
+        path = ctypes.util.find_library('crypto') or ctypes.util.find_library('libcrypto-3')
+        if not path:
+            raise OSError("libcrypto not found")
+        lib = ctypes.CDLL(path)
+        pointer, size_pointer = ctypes.c_void_p, ctypes.POINTER(ctypes.c_size_t)
+        for function, argtypes, restype in (
+                ('EVP_PKEY_new_raw_private_key', [ctypes.c_int, pointer, ctypes.c_char_p, ctypes.c_size_t], pointer),
+                ('EVP_PKEY_new_raw_public_key', [ctypes.c_int, pointer, ctypes.c_char_p, ctypes.c_size_t], pointer),
+                ('EVP_PKEY_get_raw_public_key', [pointer, ctypes.c_char_p, size_pointer], ctypes.c_int),
+                ('EVP_PKEY_CTX_new', [pointer, pointer], pointer),
+                ('EVP_PKEY_derive_init', [pointer], ctypes.c_int),
+                ('EVP_PKEY_derive_set_peer', [pointer, pointer], ctypes.c_int),
+                ('EVP_PKEY_derive', [pointer, ctypes.c_char_p, size_pointer], ctypes.c_int),
+                ('EVP_PKEY_CTX_free', [pointer], None),
+                ('EVP_PKEY_free', [pointer], None)):
+            getattr(lib, function).argtypes, getattr(lib, function).restype = argtypes, restype
+        self.lib = lib
+
+    def agree(self, peer_public_key: bytes) -> Tuple[bytes, bytes]:
+        lib = self.lib
+        private_key = lib.EVP_PKEY_new_raw_private_key(X25519_NID, None, get_random_bytes(X25519_KEY_SIZE),
+                                                       X25519_KEY_SIZE)
+        peer_key = lib.EVP_PKEY_new_raw_public_key(X25519_NID, None, peer_public_key, X25519_KEY_SIZE)
+        context = lib.EVP_PKEY_CTX_new(private_key, None) if private_key else None
+        try:
+            public_key = ctypes.create_string_buffer(X25519_KEY_SIZE)
+            shared_secret = ctypes.create_string_buffer(X25519_KEY_SIZE)
+            public_size, secret_size = ctypes.c_size_t(X25519_KEY_SIZE), ctypes.c_size_t(X25519_KEY_SIZE)
+            # The derivation fails if the secret is all zeros, which a key of small order gives
+            if (not peer_key or not context
+                    or lib.EVP_PKEY_get_raw_public_key(private_key, public_key, ctypes.byref(public_size)) != 1
+                    or lib.EVP_PKEY_derive_init(context) != 1
+                    or lib.EVP_PKEY_derive_set_peer(context, peer_key) != 1
+                    or lib.EVP_PKEY_derive(context, shared_secret, ctypes.byref(secret_size)) != 1):
+                raise ValueError("X25519 key agreement failed")
+            return public_key.raw, shared_secret.raw
+        finally:
+            lib.EVP_PKEY_CTX_free(context)
+            lib.EVP_PKEY_free(peer_key)
+            lib.EVP_PKEY_free(private_key)
+
+
+class PycryptodomeX25519:
+    """
+    X25519 of pycryptodome, always available but several times slower than the others: most of its
+    time goes to building the key objects in Python, not to the curve arithmetic.
+    """
+    name = 'pycryptodome'
+
+    @staticmethod
+    @lru_cache(maxsize=4096)
+    def import_public_key(public_key: bytes) -> ECC.EccKey:
+        """Imports a key; it costs about as much as the agreement, so the keys of clients that reconnect are kept."""
+        return import_x25519_public_key(public_key)
+
+    def agree(self, peer_public_key: bytes) -> Tuple[bytes, bytes]:
+        private_key = ECC.generate(curve='Curve25519')
+        shared_secret = key_agreement(static_pub=self.import_public_key(peer_public_key), eph_priv=private_key,
+                                      kdf=lambda secret: secret)
+        return private_key.public_key().export_key(format='raw'), shared_secret
+
+
+def load_x25519_backend():
+    """
+    Returns the fastest X25519 implementation this server can load. Its agree(peer_public_key) generates
+    a key pair for one agreement and returns its raw public key and the secret shared with the peer, or
+    raises ValueError if the agreement failed.
+    """
+    for backend in (CryptographyX25519, OpenSSLX25519):
+        try:
+            return backend()
+        except (ImportError, OSError, AttributeError):
+            continue
+    return PycryptodomeX25519()
+
+
+X25519_BACKEND = load_x25519_backend()
+
+
 class AES_EncryptionKey:
     """
        Handles AES encryption, decryption, and key management, including
-       RSA-based key exchange.
+       RSA-based key exchange and X25519 key agreement.
        """
 
     def __init__(self):
         self.aes_key = get_random_bytes(AES_KEY_SIZE)  # Generate AES-256 key
         self.iv = get_random_bytes(IV_SIZE)  # Generate IV for CBC mode
         self.client_public_key = None  # Placeholder for client's public RSA key
+        self.client_agreement_key = None  # Client's public X25519 key, if the session key is agreed
+        self.server_agreement_key = b''  # Public half of the key pair of the last agreement, sent to the client
         self.checksum = 0  # To store checksum of decrypted data
+        self.cipher_mode = CIPHER_CBC  # Cipher mode of the file body, agreed in the key exchange
+        # Decrypted bytes saved to disk by the last CTR/GCM upload and their running CRC32 state,
+        # kept up to date while the file arrives so an interrupted upload can be resumed
+        self.saved_size = 0
+        self.saved_state = 0
 
     # Receive the client's RSA public key base64 encoded
     def receive_rsa_public_key(self, public_key_data: str) -> None:
@@ -96,6 +252,78 @@ class AES_EncryptionKey:
         except (ValueError, IndexError, TypeError) as e:
             raise ValueError(f"Invalid public key format: {e}")
 
+    def receive_x25519_public_key(self, public_key_data: bytes) -> None:
+        """
+        Receives and sets the client's X25519 public key.
+
+        Args:
+            public_key_data (bytes): Raw X25519 public key.
+
+        Raises:
+            ValueError: If the key is not a valid X25519 public key.
+        """
+        try:
+            self.client_agreement_key = check_x25519_public_key(bytes(public_key_data))
+        except (ValueError, TypeError) as e:
+            raise ValueError(f"Invalid X25519 public key: {e}")
+
+    def agree_aes_key(self, client_id: bytes) -> None:
+        """
+        Agrees the AES key and IV of the session with the client's X25519 public key. A fresh key pair
+        is generated for every session, and the key and IV are derived from the shared secret with
+        HKDF-SHA256, salted with the client ID. The public half of the key pair is what the client
+        needs to derive them too. The Curve25519 operations run natively (see load_x25519_backend()) and cost the
+        server several times less than wrapping the key with RSA.
+
+        Args:
+            client_id (bytes): The client ID, 16 bytes.
+
+        Raises:
+            ValueError: If the client's X25519 public key is not set.
+        """
+        if self.client_agreement_key is None:
+            raise ValueError("Client's X25519 public key not set.")
+
+        self.server_agreement_key, shared_secret = X25519_BACKEND.agree(self.client_agreement_key)
+        key_material = HKDF(shared_secret, AES_KEY_SIZE + IV_SIZE, client_id, SHA256, context=SESSION_KEY_INFO)
+        self.aes_key = key_material[:AES_KEY_SIZE]
+        self.iv = key_material[AES_KEY_SIZE:]
+
+    def get_resumption_secret(self, client_id: bytes) -> bytes:
+        """
+        Derives the secret sessions resumed with a ticket of this session derive their AES key from.
+        The client derives it from the same AES key and IV, so the secret itself is never sent.
+
+        Args:
+            client_id (bytes): The client ID, 16 bytes.
+
+        Returns:
+            bytes: The resumption secret.
+        """
+        return HKDF(self.aes_key + self.iv, RESUMPTION_SECRET_SIZE, client_id, SHA256, context=RESUMPTION_INFO)
+
+    def resume_aes_key(self, resumption_secret: bytes, nonces: bytes) -> None:
+        """
+        Derives the AES key and IV of a resumed session from the resumption secret of its ticket, with
+        HKDF-SHA256 salted with the nonces of the client and the server. Only symmetric crypto is involved.
+
+        Args:
+            resumption_secret (bytes): The secret carried by the session ticket.
+            nonces (bytes): The client's nonce followed by the server's.
+        """
+        key_material = HKDF(resumption_secret, AES_KEY_SIZE + IV_SIZE, nonces, SHA256, context=SESSION_KEY_INFO)
+        self.aes_key = key_material[:AES_KEY_SIZE]
+        self.iv = key_material[AES_KEY_SIZE:]
+
+    def get_agreement_public_key(self) -> bytes:
+        """
+        Returns the public key the AES key was agreed with, sent instead of the encrypted AES key.
+
+        Returns:
+            bytes: Raw X25519 public key.
+        """
+        return self.server_agreement_key
+
     def get_aes_key(self) -> bytes:
         """
         Returns the raw AES key.
@@ -141,13 +369,178 @@ class AES_EncryptionKey:
         Raises:
             ValueError: If decryption fails.
         """
+        return self.decrypt_and_save_stream([encrypted_file_data], filename)
+
+    def set_cipher_mode(self, cipher_mode: int) -> None:
+        """
+        Sets the cipher mode of the files received from now on.
+
+        Args:
+            cipher_mode (int): CIPHER_CBC, CIPHER_CTR or CIPHER_GCM.
+        """
+        self.cipher_mode = cipher_mode
+
+    def decrypt_and_save_stream(self, encrypted_chunks: Iterable[bytes], filename: str,
+                                resume_from: Optional[Tuple[int, int]] = None) -> int:
+        """
+        Decrypts the encrypted file chunk by chunk and writes it to a file as it arrives,
+        so only one chunk is held in memory at a time.
+
+        Args:
+            encrypted_chunks (Iterable[bytes]): The encrypted file data, split in chunks of any size.
+            filename (str): The name of the file to save the decrypted data.
+            resume_from (Optional[Tuple[int, int]]): Size and CRC32 state of the part of the file
+                already saved; the encrypted data is the rest of the file (CTR/GCM only).
+
+        Returns:
+            int: CRC32 checksum of the decrypted file.
+
+        Raises:
+            ValueError: If decryption fails, or a GCM segment fails authentication.
+        """
+        self.saved_size, self.saved_state = resume_from if resume_from is not None else (0, 0)
+        if self.cipher_mode == CIPHER_CBC:
+            if resume_from is not None:
+                raise ValueError("CBC uploads cannot be resumed")
+            with open(filename, "wb") as file_out:
+                self._decrypt_cbc_stream(encrypted_chunks, file_out)
+        else:
+            with self._open_output(filename, resume_from) as file_out:
+                self._decrypt_counter_stream(encrypted_chunks, file_out)
+
+        # Calculate and store checksum
+        self.checksum = self.finalize_checksum_crc32(self.saved_state, self.saved_size)
+        return self.checksum
+
+    def decrypt_stream_to(self, encrypted_chunks: Iterable[bytes], writer: BinaryIO) -> int:
+        """
+        Decrypts a body in the current cipher mode and hands the plaintext to a writer,
+        for bodies that are not saved as they are, such as a delta.
+
+        Args:
+            encrypted_chunks (Iterable[bytes]): The encrypted body, split in chunks of any size.
+            writer (BinaryIO): Receives the decrypted data through write().
+
+        Returns:
+            int: The number of decrypted bytes.
+
+        Raises:
+            ValueError: If decryption fails, or a GCM segment fails authentication.
+        """
+        self.saved_size, self.saved_state = 0, 0
+        if self.cipher_mode == CIPHER_CBC:
+            self._decrypt_cbc_stream(encrypted_chunks, writer)
+        else:
+            self._decrypt_counter_stream(encrypted_chunks, writer)
+        return self.saved_size
+
+    def create_body_decryptor(self, writer: BinaryIO) -> 'BodyDecryptor':
+        """
+        Returns a decryptor that is handed the encrypted body piece by piece, for bodies that arrive
+        interleaved with other bodies, such as the streams of a multiplexed upload.
+
+        Args:
+            writer (BinaryIO): Receives the decrypted data through write().
+
+        Returns:
+            BodyDecryptor: The decryptor, in the current cipher mode and key.
+        """
+        return BodyDecryptor(self.aes_key, self.iv, self.cipher_mode, writer)
+
+    def decrypt_and_patch_stream(self, encrypted_chunks: Iterable[bytes], filename: str, offset: int) -> int:
+        """
+        Decrypts a CTR/GCM body holding one block of a saved file and writes it over the block,
+        leaving the rest of the file as it is.
+
+        Args:
+            encrypted_chunks (Iterable[bytes]): The encrypted block, a body with its own file IV.
+            filename (str): The saved file.
+            offset (int): The position of the block in the file.
+
+        Returns:
+            int: The number of decrypted bytes written.
+
+        Raises:
+            ValueError: If decryption fails, or a GCM segment fails authentication.
+        """
+        if self.cipher_mode == CIPHER_CBC:
+            raise ValueError("CBC bodies cannot be decrypted block by block")
+
+        self.saved_size, self.saved_state = 0, 0
+        with open(filename, "r+b") as file_out:
+            file_out.seek(offset)
+            self._decrypt_counter_stream(encrypted_chunks, file_out)
+        return self.saved_size
+
+    def checksum_saved_file(self, filename: str) -> int:
+        """
+        Computes the CRC32 checksum of a saved file, after blocks of it were patched.
+        The saved progress is set to the whole file.
+
+        Args:
+            filename (str): The saved file.
+
+        Returns:
+            int: CRC32 checksum of the file.
+        """
+        self.saved_size, self.saved_state = 0, 0
+        with open(filename, "rb") as file_in:
+            for data in iter(lambda: file_in.read(STREAM_READ_SIZE), b''):
+                self.saved_state = self.update_checksum_crc32(self.saved_state, data)
+                self.saved_size += len(data)
+
+        self.checksum = self.finalize_checksum_crc32(self.saved_state, self.saved_size)
+        return self.checksum
+
+    def encrypted_size(self, plain_size: int) -> int:
+        """
+        Returns the size of the body that encrypts plain_size bytes in the current cipher mode.
+
+        Args:
+            plain_size (int): The size of the plaintext.
+
+        Returns:
+            int: The size of the encrypted body.
+        """
+        if self.cipher_mode == CIPHER_CTR:
+            return IV_SIZE + plain_size
+        if self.cipher_mode == CIPHER_GCM:
+            segments = (plain_size + GCM_SEGMENT_SIZE - 1) // GCM_SEGMENT_SIZE
+            return IV_SIZE + plain_size + segments * GCM_TAG_SIZE
+        return (plain_size // AES.block_size + 1) * AES.block_size
+
+    def _decrypt_counter_stream(self, encrypted_chunks: Iterable[bytes], file_out: BinaryIO) -> None:
+        """Decrypts a CTR or GCM body into an open file, adding it to the saved progress."""
+        if self.cipher_mode == CIPHER_GCM:
+            self._decrypt_gcm_stream(encrypted_chunks, file_out)
+        else:
+            self._decrypt_ctr_stream(encrypted_chunks, file_out)
+
+    def _decrypt_cbc_stream(self, encrypted_chunks: Iterable[bytes], file_out: BinaryIO) -> None:
+        """Decrypts a CBC body with PKCS7 padding into an open file, adding it to the saved progress."""
+        cipher_aes = AES.new(self.aes_key, AES.MODE_CBC, self.iv)
+        pending = b''  # Encrypted bytes that do not fill a whole block yet
+        held = b''  # Last decrypted block, which holds the padding
+
         try:
-            cipher_aes = AES.new(self.aes_key, AES.MODE_CBC, self.iv)
-            decrypted_data = cipher_aes.decrypt(encrypted_file_data)
+            for chunk in encrypted_chunks:
+                data = pending + chunk
+                whole = len(data) - len(data) % AES.block_size
+                pending = data[whole:]
+                if not whole:
+                    continue
+
+                decrypted_data = held + cipher_aes.decrypt(data[:whole])
+                # Hold back the last block until we know whether it is the padded one
+                held = decrypted_data[-AES.block_size:]
+                self._save_decrypted(file_out, decrypted_data[:-AES.block_size])
+
+            if pending:
+                raise ValueError("Data is not a multiple of the AES block size")
 
             try:
                 # Remove PKCS7 padding, if any
-                decrypted_data = unpad(decrypted_data, AES.block_size)
+                held = unpad(held, AES.block_size)
             except ValueError:
                 # If unpadding fails, assume no padding was used
                 pass
@@ -155,13 +548,94 @@ class AES_EncryptionKey:
         except Exception as e:
             raise ValueError(f"Decryption failed: {e}")
 
-        # Save the decrypted data to a file
-        with open(filename, "wb") as file_out:
-            file_out.write(decrypted_data)
+        self._save_decrypted(file_out, held)
 
-        # Calculate and store checksum
-        self.checksum = self.calculate_checksum_crc32(decrypted_data)
-        return self.checksum
+    def _decrypt_ctr_stream(self, encrypted_chunks: Iterable[bytes], file_out: BinaryIO) -> None:
+        """Decrypts a CTR body: the file IV is the initial 128-bit counter block."""
+        try:
+            file_iv, chunks = self._split_file_iv(encrypted_chunks)
+            cipher_aes = AES.new(self.aes_key, AES.MODE_CTR, nonce=b'', initial_value=file_iv)
+            for chunk in chunks:
+                self._save_decrypted(file_out, cipher_aes.decrypt(chunk))
+        except Exception as e:
+            raise ValueError(f"Decryption failed: {e}")
+
+    def _decrypt_gcm_stream(self, encrypted_chunks: Iterable[bytes], file_out: BinaryIO) -> None:
+        """
+        Decrypts a GCM body segment by segment. Segment i uses the nonce
+        file IV[0:8] + i (4 bytes, big-endian) and is only written once its tag verified,
+        so the saved part of the file is always authenticated.
+        """
+        segment_size = GCM_SEGMENT_SIZE + GCM_TAG_SIZE
+        pending = bytearray()  # Encrypted bytes of the segment that is not complete yet
+        index = 0
+
+        def decrypt_segment(segment: bytes) -> bytes:
+            nonce = file_iv[:8] + index.to_bytes(4, 'big')
+            cipher_aes = AES.new(self.aes_key, AES.MODE_GCM, nonce=nonce, mac_len=GCM_TAG_SIZE)
+            return cipher_aes.decrypt_and_verify(segment[:-GCM_TAG_SIZE], segment[-GCM_TAG_SIZE:])
+
+        try:
+            file_iv, chunks = self._split_file_iv(encrypted_chunks)
+            for chunk in chunks:
+                pending += chunk
+                while len(pending) >= segment_size:
+                    decrypted_data = decrypt_segment(bytes(pending[:segment_size]))
+                    del pending[:segment_size]
+                    index += 1
+                    self._save_decrypted(file_out, decrypted_data)
+
+            if pending:
+                # The final segment is shorter than the others
+                if len(pending) <= GCM_TAG_SIZE:
+                    raise ValueError("Truncated GCM segment")
+                self._save_decrypted(file_out, decrypt_segment(bytes(pending)))
+        except Exception as e:
+            raise ValueError(f"Decryption failed: {e}")
+
+    def _open_output(self, filename: str, resume_from: Optional[Tuple[int, int]]) -> BinaryIO:
+        """
+        Opens the output file of a CTR/GCM upload.
+        When resuming, the file is cut back to the saved size and written from there.
+        """
+        if resume_from is None:
+            return open(filename, "wb")
+
+        file_out = open(filename, "r+b")
+        file_out.truncate(resume_from[0])
+        file_out.seek(resume_from[0])
+        return file_out
+
+    def _save_decrypted(self, file_out: BinaryIO, decrypted_data: bytes) -> None:
+        """Writes decrypted data and adds it to the saved progress."""
+        file_out.write(decrypted_data)
+        self.saved_state = self.update_checksum_crc32(self.saved_state, decrypted_data)
+        self.saved_size += len(decrypted_data)
+
+    @staticmethod
+    def _split_file_iv(encrypted_chunks: Iterable[bytes]) -> Tuple[bytes, Iterator[bytes]]:
+        """
+        Reads the per-file IV from the start of a CTR/GCM body.
+
+        Returns:
+            Tuple[bytes, Iterator[bytes]]: The file IV and the chunks of the rest of the body.
+
+        Raises:
+            ValueError: If the body is shorter than the IV.
+        """
+        chunks = iter(encrypted_chunks)
+        file_iv = b''
+        for chunk in chunks:
+            file_iv += chunk
+            if len(file_iv) >= IV_SIZE:
+                break
+        if len(file_iv) < IV_SIZE:
+            raise ValueError("Missing file IV")
+
+        def rest() -> Iterator[bytes]:
+            yield file_iv[IV_SIZE:]
+            yield from chunks
+        return file_iv[:IV_SIZE], rest()
 
     def update_aes_key(self, new_aes_key: bytes) -> None:
         """
@@ -185,14 +659,139 @@ class AES_EncryptionKey:
         Returns:
             int: CRC32 checksum.
         """
-        n = len(data)
-        i = c = s = 0
+        state = AES_EncryptionKey.update_checksum_crc32(0, data)
+        return AES_EncryptionKey.finalize_checksum_crc32(state, len(data))
+
+    @staticmethod
+    def update_checksum_crc32(state: int, data: bytes) -> int:
+        """
+        Feeds data into a running CRC32 state, starting from 0.
+
+        Args:
+            state (int): The current CRC32 state.
+            data (bytes): The data to add to the checksum.
+
+        Returns:
+            int: The updated CRC32 state.
+        """
+        s = state
         for ch in data:
             tabidx = (s >> 24) ^ ch
             s = UNSIGNED((s << 8)) ^ crctab[tabidx]
+        return s
+
+    @staticmethod
+    def finalize_checksum_crc32(state: int, n: int) -> int:
+        """
+        Appends the data length to a running CRC32 state and returns the final checksum.
+
+        Args:
+            state (int): The CRC32 state after all data was added.
+            n (int): The total length of the data.
 
+        Returns:
+            int: CRC32 checksum.
+        """
+        s = state
         while n:
             c = n & 0o377
             n = n >> 8
             s = UNSIGNED(s << 8) ^ crctab[(s >> 24) ^ c]
-        return UNSIGNED(~s)
\ No newline at end of file
+        return UNSIGNED(~s)
+
+
+class BodyDecryptor:
+    """
+    Decrypts one file body that is pushed in pieces of any size, instead of pulled from an iterable,
+    so several bodies can be decrypted at the same time on one thread. The CRC32 of the plaintext is
+    kept like the saved progress of AES_EncryptionKey.
+    """
+
+    def __init__(self, aes_key: bytes, iv: bytes, cipher_mode: int, writer: BinaryIO):
+        self.aes_key = aes_key
+        self.cipher_mode = cipher_mode
+        self.writer = writer
+        self.size = 0  # Decrypted bytes written
+        self.state = 0  # Running CRC32 state of those bytes
+        self.pending = bytearray()  # Encrypted bytes that do not fill a whole block (GCM: segment) yet
+        self.held = b''  # CBC: last decrypted block, which holds the padding
+        self.file_iv = None  # CTR/GCM: the file IV at the start of the body, once it arrived
+        self.segment_index = 0
+        self.cipher = AES.new(aes_key, AES.MODE_CBC, iv) if cipher_mode == CIPHER_CBC else None
+
+    def write(self, data: bytes) -> None:
+        """
+        Decrypts the next bytes of the body.
+
+        Raises:
+            ValueError: If a GCM segment fails authentication.
+        """
+        self.pending += data
+        if self.cipher_mode != CIPHER_CBC and self.file_iv is None:
+            if len(self.pending) < IV_SIZE:
+                return
+            self.file_iv = bytes(self.pending[:IV_SIZE])
+            del self.pending[:IV_SIZE]
+            if self.cipher_mode == CIPHER_CTR:
+                self.cipher = AES.new(self.aes_key, AES.MODE_CTR, nonce=b'', initial_value=self.file_iv)
+
+        if self.cipher_mode == CIPHER_CTR:
+            self._output(self.cipher.decrypt(bytes(self.pending)))
+            self.pending.clear()
+        elif self.cipher_mode == CIPHER_GCM:
+            segment_size = GCM_SEGMENT_SIZE + GCM_TAG_SIZE
+            while len(self.pending) >= segment_size:
+                self._output(self._decrypt_segment(bytes(self.pending[:segment_size])))
+                del self.pending[:segment_size]
+        else:
+            whole = len(self.pending) - len(self.pending) % AES.block_size
+            if whole:
+                decrypted_data = self.held + self.cipher.decrypt(bytes(self.pending[:whole]))
+                del self.pending[:whole]
+                # Hold back the last block until we know whether it is the padded one
+                self.held = decrypted_data[-AES.block_size:]
+                self._output(decrypted_data[:-AES.block_size])
+
+    def finish(self) -> int:
+        """
+        Decrypts the end of the body.
+
+        Returns:
+            int: CRC32 checksum of the decrypted body.
+
+        Raises:
+            ValueError: If the body is truncated, or the last GCM segment fails authentication.
+        """
+        if self.cipher_mode == CIPHER_CBC:
+            if self.pending or not self.held:
+                raise ValueError("Data is not a multiple of the AES block size")
+            try:
+                self._output(unpad(self.held, AES.block_size))  # Remove PKCS7 padding
+            except ValueError:
+                self._output(self.held)  # If unpadding fails, assume no padding was used
+        elif self.file_iv is None:
+            raise ValueError("Missing file IV")
+        elif self.cipher_mode == CIPHER_GCM and self.pending:
+            # The final segment is shorter than the others
+            if len(self.pending) <= GCM_TAG_SIZE:
+                raise ValueError("Truncated GCM segment")
+            self._output(self._decrypt_segment(bytes(self.pending)))
+            self.pending.clear()
+        return AES_EncryptionKey.finalize_checksum_crc32(self.state, self.size)
+
+    def _decrypt_segment(self, segment: bytes) -> bytes:
+        """Decrypts and authenticates GCM segment segment_index, with the nonce file IV[0:8] + index."""
+        nonce = self.file_iv[:8] + self.segment_index.to_bytes(4, 'big')
+        cipher_aes = AES.new(self.aes_key, AES.MODE_GCM, nonce=nonce, mac_len=GCM_TAG_SIZE)
+        try:
+            decrypted_data = cipher_aes.decrypt_and_verify(segment[:-GCM_TAG_SIZE], segment[-GCM_TAG_SIZE:])
+        except ValueError as e:
+            raise ValueError(f"Decryption failed: {e}")
+        self.segment_index += 1
+        return decrypted_data
+
+    def _output(self, decrypted_data: bytes) -> None:
+        """Writes decrypted data and adds it to the checksum."""
+        self.writer.write(decrypted_data)
+        self.state = AES_EncryptionKey.update_checksum_crc32(self.state, decrypted_data)
+        self.size += len(decrypted_data)
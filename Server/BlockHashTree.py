@@ -0,0 +1,91 @@
+"""
+Author: Lior Klunover
+Version: 1.0.1
+"""
+import hashlib
+
+from typing import List
+
+HASH_SIZE = 32  # SHA-256
+LEAF_PREFIX = b'\x00'  # Domain prefixes, so a leaf can never pass for a node
+NODE_PREFIX = b'\x01'
+
+
+class BlockHashTree:
+    """
+    Merkle tree over the blocks of a file, built the same way as the client's tree:
+    leaf i is SHA-256(0x00 || block i), a node is SHA-256(0x01 || left || right), and the
+    last node of an odd level moves up unchanged. The tree of an empty file is SHA-256 of nothing.
+    """
+
+    def __init__(self, leaves: List[bytes]):
+        """
+        Builds the tree from its leaves.
+
+        Args:
+            leaves (List[bytes]): The leaf hashes in block order.
+        """
+        self.levels = [list(leaves)]  # levels[0] are the leaves, the last level is the root
+        while len(self.levels[-1]) > 1:
+            level = self.levels[-1]
+            parents = [hashlib.sha256(NODE_PREFIX + level[i] + level[i + 1]).digest()
+                       for i in range(0, len(level) - 1, 2)]
+            if len(level) % 2:
+                parents.append(level[-1])  # The odd node moves up unchanged
+            self.levels.append(parents)
+
+    @classmethod
+    def from_file(cls, filename: str, block_size: int) -> 'BlockHashTree':
+        """
+        Hashes a saved file block by block.
+
+        Args:
+            filename (str): The file to hash.
+            block_size (int): Plaintext bytes per leaf.
+
+        Returns:
+            BlockHashTree: The tree of the file.
+        """
+        leaves = []
+        with open(filename, "rb") as file_in:
+            while True:
+                block = file_in.read(block_size)
+                if not block:
+                    break
+                leaves.append(hashlib.sha256(LEAF_PREFIX + block).digest())
+        return cls(leaves)
+
+    @property
+    def leaves(self) -> List[bytes]:
+        return self.levels[0]
+
+    @property
+    def root(self) -> bytes:
+        if not self.leaves:
+            return hashlib.sha256(b'').digest()
+        return self.levels[-1][0]
+
+    def differing_leaves(self, other: 'BlockHashTree') -> List[int]:
+        """
+        Returns the indices of the leaves that differ from the other tree, walking down from the root
+        and skipping every subtree whose hashes match. Both trees must have the same number of leaves.
+
+        Args:
+            other (BlockHashTree): The tree to compare with.
+
+        Returns:
+            List[int]: The differing leaf indices, in block order.
+        """
+        if len(self.leaves) != len(other.leaves):
+            raise ValueError("Trees of different sizes")
+        if not self.leaves:
+            return []
+
+        nodes = [0]  # Nodes of the current level whose hashes differ
+        for depth in range(len(self.levels) - 1, 0, -1):
+            if not nodes:
+                break
+            differing = [i for i in nodes if self.levels[depth][i] != other.levels[depth][i]]
+            below = len(self.levels[depth - 1])
+            nodes = [child for i in differing for child in (2 * i, 2 * i + 1) if child < below]
+        return [i for i in nodes if self.leaves[i] != other.leaves[i]]
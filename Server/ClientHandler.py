@@ -3,22 +3,77 @@
 Author: Lior Klunover
 Version: 1.0.1
 """
+import os
 import threading
 import uuid
 
-from typing import Union
-from Server.AES_EncryptionKey import AES_EncryptionKey
+from typing import Iterator, Optional, Tuple, Union
+from Server.AES_EncryptionKey import AES_EncryptionKey, CIPHER_CBC, CIPHER_CTR, CIPHER_GCM, X25519_KEY_SIZE
+from Server.BlockHashTree import BlockHashTree, HASH_SIZE
+from Server.Compression import Decompressor
+from Server.Delta import DeltaApplier, block_signatures, delta_block_size
+from Server.Multiplex import IncomingStream, MAX_FRAME_SIZE, MAX_STREAMS
 
 # Constants
 CHUNK_SIZE = 1024
+STREAM_CHUNK_SIZE = 64 * 1024  # Size of the reads used to stream a file body to disk
 HEADER_SIZE = 23
 STRING_SIZE = 255
+FILE_METADATA_SIZE = 8 + STRING_SIZE  # Encrypted size, decrypted size and file name
+FILE_RESUME_METADATA_SIZE = FILE_METADATA_SIZE + 4  # File metadata and the offset the body starts at
+SEGMENT_METADATA_SIZE = FILE_METADATA_SIZE + 4  # File metadata and the offset of the segment
+STRIPES_COMPLETE_SIZE = 4 + STRING_SIZE  # File size and file name
+FRAME_HEADER_SIZE = 5  # Stream id and flags, followed by the file metadata if the frame opens its stream
+STREAM_VERDICT_SIZE = STRING_SIZE + 1  # File name and verdict
+COMMIT_CHECKSUM_SIZE = 4  # Checksum that follows the body of a file request when the file is committed in one round trip
+BLOCKS_METADATA_SIZE = STRING_SIZE + 4  # File name and number of blocks sent again
+DELTA_METADATA_SIZE = FILE_METADATA_SIZE + 4  # File metadata and the block size of the signatures
+DELTA_SUFFIX = '.delta.tmp'  # The file is rebuilt next to the saved copy, then replaces it
+MAX_REPAIR_BLOCK_SIZE = 16 * 1024 * 1024  # Largest block size accepted in BLOCK_HASHES
+FEATURES_SIZE = 4
+SESSION_NONCE_SIZE = 16  # Nonce of each side of a resumed session
+NEGOTIATING_CLIENT_VERSION = 4  # Clients from this version send a feature mask in the key exchange
+
+# Feature bits of the key exchange
+FEATURE_CBC = 1 << 0
+FEATURE_CTR = 1 << 1
+FEATURE_GCM = 1 << 2
+FEATURE_BATCH = 1 << 3  # Keep the session open after a file is done, until TERMINATION_REQUEST
+FEATURE_RESUME = 1 << 4  # Interrupted CTR/GCM uploads continue from the bytes already saved
+FEATURE_BLOCK_REPAIR = 1 << 5  # On a CRC mismatch the client sends block hashes, then only the blocks that differ
+FEATURE_DELTA = 1 << 6  # A file saved before is sent as a delta against the saved copy
+FEATURE_COMPRESSION = 1 << 7  # A file that compresses well is compressed before it is encrypted
+FEATURE_STRIPING = 1 << 8  # A large file is sent in segments over several connections, written at their offsets
+FEATURE_MULTIPLEX = 1 << 9  # The files of a batch are sent at once, as interleaved frames of one stream per file
+FEATURE_COMMIT = 1 << 10  # File requests carry the client's checksum, answered with the verdict instead of the CRC
+FEATURE_X25519 = 1 << 11  # The session key is agreed with the client's X25519 key instead of sent encrypted with RSA
+FEATURE_TICKET = 1 << 12  # The key exchange issues a session ticket, a reconnect with it resumes with symmetric crypto only
+SUPPORTED_FEATURES = (FEATURE_CBC | FEATURE_CTR | FEATURE_GCM | FEATURE_BATCH | FEATURE_RESUME | FEATURE_BLOCK_REPAIR
+                      | FEATURE_DELTA | FEATURE_COMPRESSION | FEATURE_STRIPING | FEATURE_MULTIPLEX | FEATURE_COMMIT
+                      | FEATURE_X25519 | FEATURE_TICKET)
+FRAME_OPEN = 1  # The frame opens its stream
+FRAME_END = 2  # The frame ends the body of its stream
+VERDICT_OK = 0  # The client's CRC of the stream matched
+CIPHER_PREFERENCE = [(FEATURE_GCM, CIPHER_GCM), (FEATURE_CTR, CIPHER_CTR)]  # Best first, CBC otherwise
 
 # Operation Codes
 REGISTER_REQUEST = 825
 RECEIVED_PUBLIC_KEY = 826
 RECONNECT_REQUEST = 827
 RECEIVE_FILE = 828
+RESUME_QUERY = 829
+RECEIVE_FILE_RESUME = 830
+BLOCK_HASHES = 831
+RECEIVE_BLOCKS = 832
+SIGNATURE_QUERY = 833
+RECEIVE_DELTA = 834
+RECEIVE_FILE_COMPRESSED = 835
+RECEIVE_SEGMENT = 836
+STRIPES_COMPLETE = 837
+RECEIVE_FRAME = 838
+STREAM_VERDICT = 839
+REGISTER_WITH_KEY = 840
+RECONNECT_WITH_TICKET = 841
 CRC_OK = 900
 CRC_NOT_OK = 901
 CRC_TERMINATION = 902
@@ -33,14 +88,45 @@ RECEIVED_MESSAGE_ACK = 1604
 RECONNECT_ACK_SENDING_AES = 1605
 RECONNECT_NACK = 1606
 GENERAL_ERROR = 1607
+RESUME_OFFSET = 1608
+BAD_BLOCKS = 1609
+BLOCK_SIGNATURES = 1610
+SEGMENT_RECEIVED = 1611
+STREAM_RECEIVED = 1612
+STREAM_FAILED = 1613
+FILE_COMMITTED = 1614
+FILE_COMMIT_FAILED = 1615
+SESSION_RESUMED = 1616
+NO_RESPONSE = None  # Frames and verdicts are not answered
+
+
+class _SegmentWriter:
+    """Writes a segment of a striped file at its offset, refusing any byte past the end of the file."""
+
+    def __init__(self, file_out, offset: int, file_size: int):
+        self.file_out = file_out
+        self.end = offset  # Position of the next byte
+        self.file_size = file_size
+
+    def write(self, data: bytes) -> None:
+        """
+        Raises:
+            ValueError: If the data would end past the file size; nothing of it is written.
+        """
+        if self.end + len(data) > self.file_size:
+            raise ValueError(f"Segment ends past the file size of {self.file_size} bytes")
+        self.file_out.write(data)
+        self.end += len(data)
+
 
 class ClientHandler:
-    # Class-level lock shared by all instances of ClientHandler
-    shared_lock = threading.Lock()
     # Configure logging
 
     def __init__(self, client_socket, server: 'Server', database: 'DataBaseManager', logger):
         self.client_socket = client_socket
+        # Lock of this connection's socket. It is not shared between connections: receive() holds it while it
+        # waits for the next request, and the connections of a striped upload send their segments at the same time.
+        self.socket_lock = threading.Lock()
         self.server = server
         self.database = database
         self.aes_key_obj = AES_EncryptionKey()
@@ -62,6 +148,28 @@ class ClientHandler:
         self.encrypted_file_size = 0
         self.file_name = None
         self.cksum = 0
+        self.client_checksum = b''  # Checksum that followed the last file body, empty unless the file is committed
+        self.resume_offset = 0  # Bytes of the file already saved, reported in RESUME_OFFSET
+        self.resume_state = 0  # CRC32 state of those bytes
+        self.repair_block_size = 0  # Block size of the last BLOCK_HASHES
+        self.bad_blocks = []  # Blocks of the saved file that differ from the client's, reported in BAD_BLOCKS
+        self.delta_file_name = None  # File of the last SIGNATURE_QUERY
+        self.delta_base_size = 0  # Size of the saved copy the signatures describe
+        self.delta_block_size = 0
+        self.signatures = []  # (weak checksum, strong hash) of each block, reported in BLOCK_SIGNATURES
+        self.segment_offset = 0  # Segment of a striped file written last, reported in SEGMENT_RECEIVED
+        self.segment_length = 0
+        self.segment_state = 0  # CRC32 state of the segment, starting from 0
+        self.streams = {}  # Open streams of a multiplexed upload, by stream id
+        self.stream_id = 0  # Stream answered last, in STREAM_RECEIVED or STREAM_FAILED
+        # Key exchange state
+        self.client_features = None  # Features offered by the client, None if it does not negotiate
+        self.accepted_features = FEATURE_CBC
+        self.cipher_mode = CIPHER_CBC
+        self.server_nonce = b''  # Nonce of the server in SESSION_RESUMED
+        # Files of this session, for the summary logged when it ends
+        self.files_verified = 0
+        self.files_failed = 0
 
 
     def start(self):
@@ -69,11 +177,18 @@ class ClientHandler:
         try:
             while self.flag_connected:
                 self.receive()
-                self.send(self.header_to_send)
+                if self.header_to_send is not None:
+                    self.send(self.header_to_send)
 
         except Exception as e:
             self.logger.error(f"Error in client handler: {e}")
         finally:
+            for stream in self.streams.values():
+                stream.abort()  # Streams the connection ended in the middle of
+            self.streams.clear()
+            if self.accepted_features & FEATURE_BATCH:
+                self.logger.info(f"Batch session of {self.client_name} done: "
+                                 f"{self.files_verified} files verified, {self.files_failed} failed")
             self.logger.info("Terminating connection")
 
     def send(self, data: bytes) -> None:
@@ -86,7 +201,7 @@ class ClientHandler:
         Raises:
             RuntimeError: If the socket connection is broken
         """
-        with self.shared_lock:  # Ensure thread-safe access to the socket
+        with self.socket_lock:  # Ensure thread-safe access to the socket
             self.logger.info(f'Sending op code: {self.op_code}')  # Log the operation code being sent
             total_sent = 0  # Initialize the total number of bytes sent
             while total_sent < len(data):  # Loop until all data is sent
@@ -101,23 +216,77 @@ class ClientHandler:
                     raise  # Re-raise the exception to handle it further up the call stack
 
     def receive(self) -> None:
-        """Receive data from the client in a thread-safe manner."""
-        with self.shared_lock:  # Ensure thread-safe access to the socket
+        """
+        Receive a request from the client in a thread-safe manner.
+
+        The header is read first and then exactly the number of payload bytes it announces.
+        For a file request only the file metadata is read here; the encrypted file that
+        follows is streamed to disk while the request is handled.
+        """
+        with self.socket_lock:  # Ensure thread-safe access to the socket
             try:
-                chunks = []  # Initialize a list to store received chunks
-                while True:
-                    chunk = self.client_socket.recv(CHUNK_SIZE)  # Receive a chunk of data from the client
-                    if not chunk or len(chunk) < CHUNK_SIZE:  # Check if the chunk is empty or less than the chunk size
-                        chunks.append(chunk)  # Append the last chunk to the list
-                        break  # Exit the loop if no more data is received
-                    chunks.append(chunk)  # Append the received chunk to the list
-                self.client_header = b''.join(chunks)  # Combine all chunks into a single bytes object
+                header = self._receive_exact(HEADER_SIZE)  # Receive the fixed size header
+                op_code = int.from_bytes(header[17:19], 'big')
+                payload_size = int.from_bytes(header[19:HEADER_SIZE], 'big')
+                if op_code == RECEIVE_FILE or op_code == RECEIVE_FILE_COMPRESSED:
+                    payload_size = min(payload_size, FILE_METADATA_SIZE)  # Leave the file body on the socket
+                elif op_code == RECEIVE_FILE_RESUME:
+                    payload_size = min(payload_size, FILE_RESUME_METADATA_SIZE)
+                elif op_code == RECEIVE_BLOCKS:
+                    payload_size = min(payload_size, BLOCKS_METADATA_SIZE)  # The block indices are read by the handler
+                elif op_code == RECEIVE_DELTA:
+                    payload_size = min(payload_size, DELTA_METADATA_SIZE)  # Leave the delta on the socket
+                elif op_code == RECEIVE_SEGMENT:
+                    payload_size = min(payload_size, SEGMENT_METADATA_SIZE)  # Leave the segment on the socket
+                elif op_code == RECEIVE_FRAME:
+                    payload_size = min(payload_size, FRAME_HEADER_SIZE)  # The rest of the frame is read by the handler
+                self.client_header = header + self._receive_exact(payload_size)  # Combine header and payload
 
             except Exception as e:
                 self.logger.error(f"Error receiving data: {e}")  # Log any errors that occur during receiving
                 raise  # Re-raise the exception to handle it further up the call stack
         self.parse_header()  # Parse the received header
 
+    def _receive_exact(self, size: int) -> bytes:
+        """
+        Receive exactly `size` bytes from the client.
+
+        Raises:
+            ConnectionError: If the client closed the connection before all bytes arrived
+        """
+        chunks = []  # Initialize a list to store received chunks
+        while size > 0:
+            chunk = self.client_socket.recv(min(size, STREAM_CHUNK_SIZE))  # Receive a chunk of data from the client
+            if not chunk:
+                raise ConnectionError("Socket connection closed by client")
+            chunks.append(chunk)
+            size -= len(chunk)
+        return b''.join(chunks)
+
+    def _receive_stream(self, size: int) -> Iterator[bytes]:
+        """Yield the next `size` bytes from the client in chunks of at most STREAM_CHUNK_SIZE."""
+        while size > 0:
+            chunk = self.client_socket.recv(min(size, STREAM_CHUNK_SIZE))  # Receive a chunk of data from the client
+            if not chunk:
+                raise ConnectionError("Socket connection closed by client")
+            size -= len(chunk)
+            yield chunk
+
+    def _receive_body(self, size: int) -> Iterator[bytes]:
+        """
+        Yield the `size` bytes of a file body like _receive_stream, then receive the checksum that follows
+        the body when the file is committed into client_checksum. It is empty until the body was read to
+        its end, and for a session without FEATURE_COMMIT.
+        """
+        self.client_checksum = b''
+        yield from self._receive_stream(size)
+        self.client_checksum = b''.join(self._receive_stream(self._commit_size()))
+
+    def _discard_stream(self, size: int) -> None:
+        """Read and drop `size` bytes so the next request starts at a header boundary."""
+        for _ in self._receive_stream(size):
+            pass
+
     def parse_header(self) -> None:
         """Parse the client header and extract relevant information."""
         try:
@@ -140,24 +309,66 @@ class ClientHandler:
         if self.op_code == REGISTER_REQUEST:
             self._handle_register_request()  # Handle client registration request
 
+        elif self.op_code == REGISTER_WITH_KEY:
+            self._handle_register_with_key()  # Register the client and send the AES key in one answer
+
         elif self.op_code == RECEIVED_PUBLIC_KEY:
             self._handle_public_key()  # Handle received public key from client
 
         elif self.op_code == RECONNECT_REQUEST:
             self._handle_reconnect_request()  # Handle client reconnection request
 
+        elif self.op_code == RECONNECT_WITH_TICKET:
+            self._handle_reconnect_with_ticket()  # Resume the session of the ticket, or exchange keys again
+
         elif self.op_code == RECEIVE_FILE:
             self._handle_receive_file()  # Handle file reception from client
 
+        elif self.op_code == RESUME_QUERY:
+            self._handle_resume_query()  # Report how much of the file is already saved
+
+        elif self.op_code == RECEIVE_FILE_RESUME:
+            self._handle_receive_file_resume()  # Handle the rest of an interrupted file
+
+        elif self.op_code == BLOCK_HASHES:
+            self._handle_block_hashes()  # Report the blocks of the saved file that differ
+
+        elif self.op_code == RECEIVE_BLOCKS:
+            self._handle_receive_blocks()  # Write the blocks sent again over the saved file
+
+        elif self.op_code == SIGNATURE_QUERY:
+            self._handle_signature_query()  # Report the block signatures of the saved copy of the file
+
+        elif self.op_code == RECEIVE_DELTA:
+            self._handle_receive_delta()  # Rebuild the file from the saved copy and the delta
+
+        elif self.op_code == RECEIVE_FILE_COMPRESSED:
+            self._handle_receive_file_compressed()  # Decompress the file while it is decrypted
+
+        elif self.op_code == RECEIVE_SEGMENT:
+            self._handle_receive_segment()  # Write a segment of a striped file at its offset
+
+        elif self.op_code == STRIPES_COMPLETE:
+            self._handle_stripes_complete()  # Check the striped file once every segment was written
+
+        elif self.op_code == RECEIVE_FRAME:
+            self._handle_receive_frame()  # Decrypt the part of a stream carried by a frame
+
+        elif self.op_code == STREAM_VERDICT:
+            self._handle_stream_verdict()  # Record the client's CRC check of a stream
+
         elif self.op_code == CRC_OK:
             self._handle_crc_ok()  # Handle CRC check success
 
         elif self.op_code == CRC_NOT_OK:
+            self._clear_upload_progress()  # The saved part cannot be trusted, the file is sent again from the start
             self.error_msg = "Received invalid CRC"  # Set error message for invalid CRC
             self.op_code = RECEIVED_MESSAGE_ACK  # Acknowledge received message
 
         elif self.op_code == CRC_TERMINATION:
-            self.flag_connected = False  # Terminate connection on CRC termination
+            self._clear_upload_progress()
+            self.files_failed += 1
+            self.flag_connected = self._batch_session()  # Terminate connection on CRC termination, unless more files follow
             self.op_code = RECEIVED_MESSAGE_ACK  # Acknowledge received message
 
         elif self.op_code == TERMINATION_REQUEST:
@@ -171,11 +382,28 @@ class ClientHandler:
 
     def handle_send_opcode(self, op_code: int) -> None:
         """Prepare response based on operation code."""
+        if op_code is NO_RESPONSE:
+            self.header_to_send = None  # The client does not wait for an answer
+            return
         self.payload = self.client_id_binary  # Initialize payload with client ID
 
         if op_code == RECEIVED_PUBLIC_KEY_ACK_SENDING_AES or op_code == RECONNECT_ACK_SENDING_AES:
-            aes_key = self.aes_key_obj.get_encrypted_aes_key()  # Encrypt AES key with client's RSA public key
-            self.add_payload(aes_key)  # Add encrypted AES key to payload
+            if self.accepted_features & FEATURE_X25519:
+                self.add_payload(self.aes_key_obj.get_agreement_public_key())  # Add the public key the AES key was agreed with
+            else:
+                aes_key = self.aes_key_obj.get_encrypted_aes_key()  # Encrypt AES key with client's RSA public key
+                self.add_payload(aes_key)  # Add encrypted AES key to payload
+            if self.client_features is not None:
+                self.add_payload(self.cipher_mode.to_bytes(1, 'big'))  # Add the selected cipher mode
+                self.add_payload(self.accepted_features)  # Add the accepted features
+            if self.accepted_features & FEATURE_TICKET:
+                tickets = self.server.session_tickets
+                self.add_payload(tickets.lifetime)  # Add the lifetime of the ticket in seconds
+                self.add_payload(tickets.issue(self.client_id_binary, self.aes_key_obj.get_resumption_secret(self.client_id_binary)))
+        elif op_code == SESSION_RESUMED:
+            self.add_payload(self.server_nonce)  # Add the nonce of the server
+            self.add_payload(self.cipher_mode.to_bytes(1, 'big'))  # Add the selected cipher mode
+            self.add_payload(self.accepted_features)  # Add the accepted features
         elif op_code == REGISTER_NACK:
             self.payload = b''  # Set payload to empty bytes for REGISTER_NACK
         elif op_code == RECEIVED_FILE_ACK_WITH_CRC:
@@ -185,12 +413,37 @@ class ClientHandler:
             self.add_payload(self.cksum)  # Add checksum to payload
         elif op_code == RECEIVED_MESSAGE_ACK:
             self.add_payload(self.error_msg)  # Add error message to payload
+        elif op_code == RESUME_OFFSET:
+            self.add_payload(self.resume_offset)  # Add the number of bytes already saved
+            self.add_payload(self.resume_state)  # Add the CRC32 state of those bytes
+        elif op_code == BAD_BLOCKS:
+            self.add_payload(len(self.bad_blocks))  # Add the number of blocks that differ
+            for index in self.bad_blocks:
+                self.add_payload(index)  # Add the block index
+        elif op_code == BLOCK_SIGNATURES:
+            self.add_payload(self.delta_base_size)  # Add the size of the saved copy
+            self.add_payload(self.delta_block_size)  # Add the block size
+            self.add_payload(len(self.signatures))  # Add the number of blocks
+            for weak, strong in self.signatures:
+                self.add_payload(weak)  # Add the rolling checksum of the block
+                self.add_payload(strong)  # Add the truncated SHA-256 of the block
+        elif op_code == SEGMENT_RECEIVED:
+            self.add_payload(self.segment_offset)  # Add the offset of the segment
+            self.add_payload(self.segment_length)  # Add the number of bytes written
+            self.add_payload(self.segment_state)  # Add the CRC32 state of those bytes
+        elif op_code == STREAM_RECEIVED:
+            self.add_payload(self.stream_id)  # Add the id of the stream
+            self.add_payload(self.cksum)  # Add the checksum of its file
+        elif op_code == STREAM_FAILED:
+            self.add_payload(self.stream_id)  # Add the id of the stream
+        elif op_code == FILE_COMMITTED or op_code == FILE_COMMIT_FAILED:
+            self.add_payload(self.cksum)  # Add the checksum of the saved file
 
         self.header_to_send = self.create_header_to_send(op_code)  # Create header to send with the given opcode
 
     def _handle_register_request(self) -> None:
         """Handle client registration request."""
-        self.client_name = self.payload.split(b'\0', 1)[0].decode('utf-8')  # Extract client name from payload
+        self.client_name = self.payload[:STRING_SIZE].split(b'\0', 1)[0].decode('utf-8')  # Extract client name from payload
         if self.database.add_client(self.client_name):  # Attempt to add client to the database
             print(f"Client {self.client_name} registered successfully")  # Print success message
             self.op_code = REGISTER_ACK  # Set operation code to REGISTER_ACK
@@ -201,29 +454,116 @@ class ClientHandler:
             self.error_msg = f"Client {self.client_name} already exists"  # Set error message for existing client
             self.op_code = REGISTER_NACK  # Set operation code to REGISTER_NACK
 
+    def _handle_register_with_key(self) -> None:
+        """
+        Handle a registration that carries the public key, laid out as in RECEIVED_PUBLIC_KEY.
+        The answer is RECEIVED_PUBLIC_KEY_ACK_SENDING_AES, whose client ID is the one just registered,
+        or REGISTER_NACK if the name is taken.
+        """
+        self._handle_register_request()
+        if self.op_code == REGISTER_ACK:
+            self._handle_public_key()
+
     def _handle_public_key(self) -> None:
         """Handle received public key from client."""
-        public_key = self.payload[STRING_SIZE:]  # Extract the public key from the payload
-        self.aes_key_obj.receive_rsa_public_key(public_key)  # Receive and set the client's RSA public key
+        public_key_offset = STRING_SIZE
+        if self.version >= NEGOTIATING_CLIENT_VERSION:
+            public_key_offset += FEATURES_SIZE  # The feature mask precedes the public key
+            self._negotiate_features(self.payload[STRING_SIZE:public_key_offset])
+        else:
+            self._negotiate_features(None)
+        public_key = self.payload[public_key_offset:]  # Extract the public key from the payload
+        self._receive_client_key(public_key)  # Receive and set the client's public key
         self.database.add_public_key(self.client_id_binary, public_key)  # Add the public key to the database
         self.database.add_aes_key(self.client_id_binary, self.aes_key_obj.get_aes_key())  # Add the AES key to the database
         self.op_code = RECEIVED_PUBLIC_KEY_ACK_SENDING_AES  # Set operation code to acknowledge received public key and send AES key
     def _handle_reconnect_request(self) -> None:
         """Handle client reconnection request."""
+        features = self.payload[STRING_SIZE:STRING_SIZE + FEATURES_SIZE]
+        if self.version >= NEGOTIATING_CLIENT_VERSION and len(features) == FEATURES_SIZE:
+            self._negotiate_features(features)
+        else:
+            self._negotiate_features(None)
         if self.load_client_from_db():
             self.op_code = RECONNECT_ACK_SENDING_AES  # Set operation code to acknowledge reconnection and send AES key
         else:
             self.op_code = RECONNECT_NACK  # Set operation code to indicate reconnection failure
 
+    def _handle_reconnect_with_ticket(self) -> None:
+        """
+        Handle a reconnection that presents a session ticket: the client name, the offered features, the
+        nonce of the client and the ticket. If the ticket opens, the AES key of the session is derived from
+        its resumption secret and the nonces of both sides, and the answer is SESSION_RESUMED. Otherwise
+        the request is handled like RECONNECT_REQUEST, which issues a new ticket.
+        """
+        nonce_offset = STRING_SIZE + FEATURES_SIZE
+        client_nonce = self.payload[nonce_offset:nonce_offset + SESSION_NONCE_SIZE]
+        ticket = self.payload[nonce_offset + SESSION_NONCE_SIZE:]
+        resumption_secret = self.server.session_tickets.open(self.client_id_binary, ticket)
+        if resumption_secret is None or len(client_nonce) != SESSION_NONCE_SIZE:
+            self.logger.info("Session ticket refused, exchanging keys")
+            self._handle_reconnect_request()
+            return
+
+        self._negotiate_features(self.payload[STRING_SIZE:nonce_offset])
+        self.accepted_features &= ~FEATURE_X25519  # No key is agreed in a resumed session
+        if not self.load_client_from_db(exchange_key=False):
+            self.op_code = RECONNECT_NACK  # The client was removed since the ticket was issued
+            return
+        self.server_nonce = os.urandom(SESSION_NONCE_SIZE)
+        self.aes_key_obj.resume_aes_key(resumption_secret, client_nonce + self.server_nonce)
+        self.op_code = SESSION_RESUMED
+
+    def _receive_client_key(self, public_key: bytes) -> None:
+        """
+        Set the client's public key, registered or loaded from the database. A raw X25519 key means the
+        AES key of the session is agreed with it, which only clients that offered FEATURE_X25519 can do;
+        FEATURE_X25519 is dropped for clients with an RSA key.
+
+        Raises:
+            ValueError: If the key is invalid, or an X25519 key comes from a client that did not offer it.
+        """
+        if len(public_key) == X25519_KEY_SIZE:
+            if not self.accepted_features & FEATURE_X25519:
+                raise ValueError("The client has an X25519 key but did not offer FEATURE_X25519")
+            self.aes_key_obj.receive_x25519_public_key(public_key)
+            self.aes_key_obj.agree_aes_key(self.client_id_binary)  # A fresh AES key for every session
+        else:
+            self.accepted_features &= ~FEATURE_X25519
+            self.aes_key_obj.receive_rsa_public_key(public_key)
+
+    def _negotiate_features(self, offered: Union[bytes, None]) -> None:
+        """
+        Accept the features both sides support and select the cipher mode of the file body.
+        Clients that do not send a feature mask get CBC and the old response layout.
+        """
+        if offered is None:
+            self.client_features = None
+            self.accepted_features = FEATURE_CBC
+        else:
+            self.client_features = int.from_bytes(offered, 'big')
+            self.accepted_features = (self.client_features & SUPPORTED_FEATURES) | FEATURE_CBC
+
+        self.cipher_mode = CIPHER_CBC
+        for feature, cipher_mode in CIPHER_PREFERENCE:
+            if self.accepted_features & feature:
+                self.cipher_mode = cipher_mode
+                break
+        self.aes_key_obj.set_cipher_mode(self.cipher_mode)
+        self.logger.info(f"Negotiated features: {self.accepted_features:#x}, cipher mode: {self.cipher_mode}")
+
     def _handle_receive_file(self) -> None:
         """Handle file reception from client."""
         try:
+            body_size = max(self.payload_size - FILE_METADATA_SIZE - self._commit_size(), 0)  # Size of the encrypted file left on the socket
             self._parse_file_metadata()  # Parse metadata from the received file payload
-            if self.encrypted_file_size != len(self.payload):  # Check if the received payload size matches the expected encrypted file size
+            if self.encrypted_file_size != body_size:  # Check if the announced payload size matches the expected encrypted file size
+                self._discard_stream(body_size + self._commit_size())  # Skip the file body to stay in sync with the client
                 self.op_code = CRC_TERMINATION  # Set operation code to CRC_TERMINATION if sizes do not match
                 return  # Exit the function
 
             self._process_received_file()  # Process the received file
+            self._commit_file(self.client_checksum)
         except Exception as e:
             self.logger.error(f"Error handling file reception: {e}")  # Log any errors that occur during file reception
             self.op_code = GENERAL_ERROR  # Set operation code to GENERAL_ERROR in case of an exception
@@ -234,11 +574,415 @@ class ClientHandler:
         self.file_name = self.payload[8:8 + STRING_SIZE].split(b'\0', 1)[0].decode('utf-8')  # Extract and decode the file name, removing null padding
         self.payload = self.payload[8 + STRING_SIZE:]  # Update the payload to exclude the metadata
 
-    def _process_received_file(self) -> None:
+    def _handle_resume_query(self) -> None:
+        """
+        Report how many bytes of a file are already saved, with their CRC32 state, so the client
+        only sends the rest. The offset is 0 unless an upload of the same file and size was interrupted.
+        """
+        file_name = self.payload[:STRING_SIZE].split(b'\0', 1)[0].decode('utf-8')  # Extract the file name
+        file_size = int.from_bytes(self.payload[STRING_SIZE:STRING_SIZE + 4], 'big')  # Extract the decrypted file size
+        self.resume_offset, self.resume_state = 0, 0
+
+        progress = self.database.get_upload_progress(self.client_id_binary, file_name) if self._resumable() else None
+        if progress:
+            saved_file_size, received_size, crc_state = progress
+            if (saved_file_size == file_size and os.path.isfile(file_name)
+                    and os.path.getsize(file_name) >= received_size):
+                self.resume_offset, self.resume_state = received_size, crc_state
+        self.logger.info(f"Resume query for {file_name}: {self.resume_offset} of {file_size} bytes saved")
+        self.op_code = RESUME_OFFSET
+
+    def _handle_receive_file_resume(self) -> None:
+        """Handle the rest of a file, starting at the offset reported by RESUME_OFFSET."""
+        try:
+            body_size = max(self.payload_size - FILE_RESUME_METADATA_SIZE, 0)  # Size of the encrypted rest left on the socket
+            self._parse_file_metadata()  # Parse metadata from the received file payload
+            offset = int.from_bytes(self.payload[:4], 'big')  # Extract the offset the body starts at
+
+            progress = self.database.get_upload_progress(self.client_id_binary, self.file_name) if self._resumable() else None
+            if (self.encrypted_file_size != body_size or not progress
+                    or progress[0] != self.decrypted_file_size or progress[1] != offset):
+                self._discard_stream(body_size)  # Skip the file body to stay in sync with the client
+                self.op_code = GENERAL_ERROR  # The client falls back to sending the whole file
+                return
+
+            self._process_received_file(resume_from=(offset, progress[2]))  # Append the rest to the saved part
+        except Exception as e:
+            self.logger.error(f"Error handling file resume: {e}")
+            self.op_code = GENERAL_ERROR
+
+    def _handle_block_hashes(self) -> None:
+        """
+        Compare the client's block hash tree with the tree of the saved file, after a CRC mismatch,
+        and report the blocks that differ so only those are sent again.
+        """
+        try:
+            file_name = self.payload[:STRING_SIZE].split(b'\0', 1)[0].decode('utf-8')  # Extract the file name
+            block_size = int.from_bytes(self.payload[STRING_SIZE:STRING_SIZE + 4], 'big')  # Extract the block size
+            count = int.from_bytes(self.payload[STRING_SIZE + 4:STRING_SIZE + 8], 'big')  # Extract the number of blocks
+            hashes = self.payload[STRING_SIZE + 8:]  # The root, then the leaves
+            if (not self._block_repair_enabled() or file_name != self.file_name
+                    or not 0 < block_size <= MAX_REPAIR_BLOCK_SIZE
+                    or count != -(-self.decrypted_file_size // block_size)
+                    or len(hashes) != HASH_SIZE * (count + 1)):
+                raise ValueError("Block hashes do not describe the received file")
+
+            client_tree = BlockHashTree([hashes[HASH_SIZE * i:HASH_SIZE * (i + 1)] for i in range(1, count + 1)])
+            if client_tree.root != hashes[:HASH_SIZE]:
+                raise ValueError("Block hashes do not match their root")
+
+            if os.path.getsize(file_name) != self.decrypted_file_size:
+                os.truncate(file_name, self.decrypted_file_size)  # Missing blocks read as zeros and differ
+            saved_tree = BlockHashTree.from_file(file_name, block_size)
+            self.bad_blocks = saved_tree.differing_leaves(client_tree)
+            self.repair_block_size = block_size
+            self.logger.info(f"{len(self.bad_blocks)} of {count} blocks of {file_name} differ")
+            self.op_code = BAD_BLOCKS
+        except Exception as e:
+            self.logger.error(f"Error comparing block hashes: {e}")
+            self.op_code = GENERAL_ERROR
+
+    def _handle_receive_blocks(self) -> None:
+        """
+        Write the blocks listed in BAD_BLOCKS over the saved file and report the checksum of the
+        repaired file. Each block is an encrypted body of its own, with its own file IV.
+        """
+        body_size = max(self.payload_size - BLOCKS_METADATA_SIZE, 0)  # Indices and blocks left on the socket
+        try:
+            file_name = self.payload[:STRING_SIZE].split(b'\0', 1)[0].decode('utf-8')  # Extract the file name
+            count = int.from_bytes(self.payload[STRING_SIZE:STRING_SIZE + 4], 'big')  # Extract the number of blocks
+            if 4 * count > body_size:
+                raise ValueError("Block indices do not fit in the request")
+            indices_data = self._receive_exact(4 * count)
+            body_size -= 4 * count
+            indices = [int.from_bytes(indices_data[4 * i:4 * i + 4], 'big') for i in range(count)]
+            block_lengths = [min(self.repair_block_size, self.decrypted_file_size - index * self.repair_block_size)
+                             for index in indices]
+            encrypted_sizes = [self.aes_key_obj.encrypted_size(length) for length in block_lengths]
+
+            if (not self._block_repair_enabled() or file_name != self.file_name
+                    or not set(indices) <= set(self.bad_blocks) or sum(encrypted_sizes) != body_size):
+                self._discard_stream(body_size)  # Skip the blocks to stay in sync with the client
+                self.op_code = GENERAL_ERROR
+                return
+        except Exception as e:
+            self.logger.error(f"Error handling repaired blocks: {e}")
+            self._discard_stream(body_size)
+            self.op_code = GENERAL_ERROR
+            return
+
+        failed = False
+        for index, length, encrypted_size in zip(indices, block_lengths, encrypted_sizes):
+            block = self._receive_stream(encrypted_size)  # The encrypted block, still on the socket
+            if not failed:
+                try:
+                    offset = index * self.repair_block_size
+                    if self.aes_key_obj.decrypt_and_patch_stream(block, file_name, offset) != length:
+                        raise ValueError("Block size does not match")
+                except ValueError as e:
+                    self.logger.error(f"Error writing block {index}: {e}")
+                    failed = True
+            for _ in block:  # Skip what is left of the block to stay in sync with the client
+                pass
+
+        if failed:
+            self.op_code = GENERAL_ERROR
+            return
+        self.cksum = self.aes_key_obj.checksum_saved_file(file_name)  # Checksum of the repaired file
+        self._save_upload_progress()
+        self.logger.info(f"Wrote {count} blocks of {file_name} again")
+        self.op_code = RECEIVED_FILE_ACK_WITH_CRC
+
+    def _handle_signature_query(self) -> None:
+        """
+        Report the block signatures of the saved copy of a file, so the client can send a delta against it.
+        No signatures are reported if the feature is off, or if the client has no saved copy of the file.
+        """
+        file_name = self.payload[:STRING_SIZE].split(b'\0', 1)[0].decode('utf-8')  # Extract the file name
+        self.delta_file_name, self.delta_base_size, self.delta_block_size, self.signatures = file_name, 0, 0, []
+        try:
+            if (self._delta_enabled() and os.path.isfile(file_name)
+                    and self.database.file_exists(self.client_id_binary, file_name)):
+                self.delta_base_size = os.path.getsize(file_name)
+                self.delta_block_size = delta_block_size(self.delta_base_size)
+                self.signatures = block_signatures(file_name, self.delta_block_size)
+        except OSError as e:
+            self.logger.error(f"Error reading {file_name} for its signatures: {e}")
+            self.delta_base_size, self.delta_block_size, self.signatures = 0, 0, []
+        self.logger.info(f"Signature query for {file_name}: {len(self.signatures)} blocks of {self.delta_block_size} bytes")
+        self.op_code = BLOCK_SIGNATURES
+
+    def _handle_receive_delta(self) -> None:
+        """
+        Rebuild a file from the saved copy described in BLOCK_SIGNATURES and the delta the client sent,
+        then report the checksum of the rebuilt file. The file is rebuilt next to the saved copy and
+        only replaces it once the whole delta applied.
+        """
+        body_size = max(self.payload_size - DELTA_METADATA_SIZE - self._commit_size(), 0)  # Size of the encrypted delta left on the socket
+        try:
+            self._parse_file_metadata()  # Parse metadata from the received payload
+            block_size = int.from_bytes(self.payload[:4], 'big')  # Extract the block size of the signatures
+            if (not self._delta_enabled() or self.encrypted_file_size != body_size
+                    or self.file_name != self.delta_file_name or block_size != self.delta_block_size
+                    or not self.signatures or os.path.getsize(self.file_name) != self.delta_base_size):
+                self._discard_stream(body_size + self._commit_size())  # Skip the delta to stay in sync with the client
+                self.op_code = GENERAL_ERROR  # The client falls back to sending the whole file
+                return
+        except Exception as e:
+            self.logger.error(f"Error handling delta: {e}")
+            self._discard_stream(body_size + self._commit_size())
+            self.op_code = GENERAL_ERROR
+            return
+
+        body = self._receive_body(self.encrypted_file_size)  # The encrypted delta, still on the socket
+        rebuilt_name = self.file_name + DELTA_SUFFIX
+        try:
+            with open(self.file_name, "rb") as base, open(rebuilt_name, "wb") as file_out:
+                applier = DeltaApplier(base, self.delta_base_size, block_size, file_out)
+                delta_size = self.aes_key_obj.decrypt_stream_to(body, applier)
+                self.cksum = applier.finish()
+            if applier.size != self.decrypted_file_size:
+                raise ValueError(f"Rebuilt {applier.size} bytes, expected {self.decrypted_file_size}")
+            os.replace(rebuilt_name, self.file_name)
+            self.logger.info(f"Rebuilt {self.file_name} from a delta of {delta_size} bytes")
+            self._clear_upload_progress()  # Any saved part of an earlier upload is gone
+
+            if self.database.add_file(self.client_id_binary, self.file_name, self.file_name, False):
+                self.database.update_file_verified(self.client_id_binary, self.file_name, False)  # Until the client confirms the CRC
+                self.op_code = RECEIVED_FILE_ACK_WITH_CRC
+                self._commit_file(self.client_checksum)
+            else:
+                self.op_code = GENERAL_ERROR
+        except Exception as e:
+            self.logger.error(f"Error applying delta: {e}")
+            self.op_code = GENERAL_ERROR
+            for _ in body:  # Skip what is left of the delta to stay in sync with the client
+                pass
+            if os.path.exists(rebuilt_name):
+                os.remove(rebuilt_name)  # The saved copy is left as it was
+
+    def _handle_receive_file_compressed(self) -> None:
+        """
+        Save a file the client compressed before encrypting it, decompressing it as it is decrypted,
+        then report the checksum of the decompressed file. A compressed upload cannot be resumed,
+        so no progress is saved for it.
+        """
+        body_size = max(self.payload_size - FILE_METADATA_SIZE - self._commit_size(), 0)  # Size of the encrypted body left on the socket
+        try:
+            self._parse_file_metadata()  # Parse metadata from the received payload
+            if not self._compression_enabled() or self.encrypted_file_size != body_size:
+                self._discard_stream(body_size + self._commit_size())  # Skip the body to stay in sync with the client
+                self.op_code = GENERAL_ERROR  # The client falls back to sending the file uncompressed
+                return
+        except Exception as e:
+            self.logger.error(f"Error handling compressed file: {e}")
+            self._discard_stream(body_size + self._commit_size())
+            self.op_code = GENERAL_ERROR
+            return
+
+        body = self._receive_body(self.encrypted_file_size)  # The encrypted body, still on the socket
+        try:
+            self._clear_upload_progress()  # Any saved part of an earlier upload is overwritten
+            with open(self.file_name, "wb") as file_out:
+                decompressor = Decompressor(self.decrypted_file_size, file_out)
+                compressed_size = self.aes_key_obj.decrypt_stream_to(body, decompressor)
+                self.cksum = decompressor.finish()
+            self.logger.info(f"Decompressed {self.file_name} from {compressed_size} to {decompressor.size} bytes")
+
+            if self.database.add_file(self.client_id_binary, self.file_name, self.file_name, False):
+                self.database.update_file_verified(self.client_id_binary, self.file_name, False)  # Until the client confirms the CRC
+                self.op_code = RECEIVED_FILE_ACK_WITH_CRC
+                self._commit_file(self.client_checksum)
+            else:
+                self.op_code = GENERAL_ERROR
+        except Exception as e:
+            self.logger.error(f"Error decompressing file: {e}")
+            self.op_code = GENERAL_ERROR
+            for _ in body:  # Skip what is left of the body to stay in sync with the client
+                pass
+
+    def _handle_receive_segment(self) -> None:
+        """
+        Write a segment of a striped file at its offset, then report its CRC32 state so the client can check it.
+        The segments arrive on several connections of the same client, in any order; each is an encrypted body
+        of its own. The file is created by the first segment and never truncated here, so the segments written
+        by other connections stay; STRIPES_COMPLETE cuts the file to its size.
+        """
+        body_size = max(self.payload_size - SEGMENT_METADATA_SIZE, 0)  # Size of the encrypted segment left on the socket
+        try:
+            self._parse_file_metadata()  # Parse metadata from the received payload
+            offset = int.from_bytes(self.payload[:4], 'big')  # Extract the offset of the segment
+            if (not self._striping_enabled() or self.encrypted_file_size != body_size
+                    or offset >= max(self.decrypted_file_size, 1) or not self._is_plain_file_name(self.file_name)):
+                self._discard_stream(body_size)  # Skip the segment to stay in sync with the client
+                self.op_code = GENERAL_ERROR  # The client sends the segment again, or the file over one connection
+                return
+        except Exception as e:
+            self.logger.error(f"Error handling segment: {e}")
+            self._discard_stream(body_size)
+            self.op_code = GENERAL_ERROR
+            return
+
+        body = self._receive_stream(self.encrypted_file_size)  # The encrypted segment, still on the socket
+        try:
+            with self.server.striped_uploads_lock:
+                self.server.striped_uploads[(self.client_id_binary, self.file_name)] = self.decrypted_file_size
+            with open(self.file_name, "ab"):
+                pass  # Create the file without truncating what other connections wrote
+            with open(self.file_name, "r+b") as file_out:
+                file_out.seek(offset)
+                length = self.aes_key_obj.decrypt_stream_to(body, _SegmentWriter(file_out, offset, self.decrypted_file_size))
+            self.segment_offset, self.segment_length, self.segment_state = offset, length, self.aes_key_obj.saved_state
+            self.op_code = SEGMENT_RECEIVED
+        except Exception as e:
+            self.logger.error(f"Error writing segment: {e}")
+            self.op_code = GENERAL_ERROR
+            for _ in body:  # Skip what is left of the segment to stay in sync with the client
+                pass
+
+    def _handle_stripes_complete(self) -> None:
+        """
+        Cut a striped file to its size once the client confirmed every segment, and report its checksum.
+        The file is checksummed as it was written, so a missing or damaged segment shows as a CRC mismatch.
+        Only a file this client wrote segments of, with the same size, is touched.
+        """
+        try:
+            file_size = int.from_bytes(self.payload[:4], 'big')  # Extract the size of the file
+            self.file_name = self.payload[4:4 + STRING_SIZE].split(b'\0', 1)[0].decode('utf-8')  # Extract the file name
+            with self.server.striped_uploads_lock:
+                striped_size = self.server.striped_uploads.pop((self.client_id_binary, self.file_name), None)
+            if (not self._striping_enabled() or len(self.payload) < STRIPES_COMPLETE_SIZE
+                    or striped_size != file_size or not self._is_plain_file_name(self.file_name)
+                    or not os.path.isfile(self.file_name)):
+                self.logger.warning(f"STRIPES_COMPLETE refused for {self.file_name!r}: no striped upload of that size")
+                self.op_code = GENERAL_ERROR
+                return
+            with open(self.file_name, "r+b") as file_out:
+                file_out.truncate(file_size)  # Drop the tail of an older, longer copy
+            self.encrypted_file_size, self.decrypted_file_size = file_size, file_size
+            self.cksum = self.aes_key_obj.checksum_saved_file(self.file_name)
+            self._clear_upload_progress()  # Any saved part of an earlier upload is overwritten
+
+            if self.database.add_file(self.client_id_binary, self.file_name, self.file_name, False):
+                self.database.update_file_verified(self.client_id_binary, self.file_name, False)  # Until the client confirms the CRC
+                self.op_code = RECEIVED_FILE_ACK_WITH_CRC
+            else:
+                self.op_code = GENERAL_ERROR
+        except Exception as e:
+            self.logger.error(f"Error completing striped file: {e}")
+            self.op_code = GENERAL_ERROR
+
+    @staticmethod
+    def _is_plain_file_name(file_name: str) -> bool:
+        """True if the name stays in the server directory: no path separator and no '..'."""
+        return (bool(file_name) and '/' not in file_name and '\\' not in file_name
+                and '..' not in file_name and os.path.basename(file_name) == file_name)
+
+    def _handle_receive_frame(self) -> None:
+        """
+        Decrypt the part of a file carried by a frame of a multiplexed upload. The frames of the streams
+        of a connection arrive interleaved; only the frame that ends a stream is answered, with the checksum
+        of its file. A stream that cannot be saved is answered with STREAM_FAILED as soon as the error occurs,
+        and its later frames are dropped.
+        """
+        body_size = max(self.payload_size - FRAME_HEADER_SIZE, 0)  # Metadata and body left on the socket
+        self.stream_id = int.from_bytes(self.payload[:4], 'big')  # Extract the stream id
+        flags = self.payload[4] if len(self.payload) >= FRAME_HEADER_SIZE else 0  # Extract the flags
+        self.op_code = NO_RESPONSE
+        if body_size > MAX_FRAME_SIZE + FILE_METADATA_SIZE:
+            self._discard_stream(body_size)  # Skip the frame to stay in sync with the client
+            self._fail_stream("Frame is too large")
+            return
+        data = self._receive_exact(body_size)
+        if not flags & FRAME_OPEN and self.stream_id not in self.streams:
+            return  # A frame of a stream that failed before, the failure was reported
+
+        try:
+            if not self._multiplexing_enabled():
+                raise ValueError("Multiplexing was not negotiated")
+            if flags & FRAME_OPEN:
+                self.payload = data[:FILE_METADATA_SIZE]
+                data = data[FILE_METADATA_SIZE:]
+                self._parse_file_metadata()  # Parse metadata from the received payload
+                if (self.stream_id in self.streams or len(self.streams) >= MAX_STREAMS or not self.file_name
+                        or any(stream.file_name == self.file_name for stream in self.streams.values())):
+                    raise ValueError(f"Stream {self.stream_id} of {self.file_name} cannot be opened")
+                self.streams[self.stream_id] = IncomingStream(self.aes_key_obj, self.file_name,
+                                                              self.encrypted_file_size, self.decrypted_file_size)
+            stream = self.streams[self.stream_id]
+            stream.write(data)
+            if not flags & FRAME_END:
+                return
+
+            del self.streams[self.stream_id]
+            self.file_name = stream.file_name
+            self.encrypted_file_size, self.decrypted_file_size = stream.encrypted_size, stream.file_size
+            self.cksum = stream.finish()
+            self._clear_upload_progress()  # Any saved part of an earlier upload is overwritten
+            if not self.database.add_file(self.client_id_binary, self.file_name, self.file_name, False):
+                raise ValueError(f"Could not record {self.file_name}")
+            self.database.update_file_verified(self.client_id_binary, self.file_name, False)  # Until the client confirms the CRC
+            self.op_code = STREAM_RECEIVED
+        except Exception as e:
+            self._fail_stream(f"{e}")
+
+    def _fail_stream(self, reason: str) -> None:
+        """Drop the stream of the last frame and report it once with STREAM_FAILED."""
+        self.logger.error(f"Error receiving stream {self.stream_id}: {reason}")
+        stream = self.streams.pop(self.stream_id, None)
+        if stream is not None:
+            stream.abort()
+        self.op_code = STREAM_FAILED
+
+    def _handle_stream_verdict(self) -> None:
+        """Record whether the client's CRC of a stream matched. The client does not wait for an answer."""
+        file_name = self.payload[:STRING_SIZE].split(b'\0', 1)[0].decode('utf-8')  # Extract the file name
+        verdict = self.payload[STRING_SIZE] if len(self.payload) >= STREAM_VERDICT_SIZE else None
+        if verdict == VERDICT_OK:
+            self.database.update_file_verified(self.client_id_binary, file_name, True)  # Mark the file as verified
+            self.files_verified += 1
+        else:
+            self.files_failed += 1
+        self.op_code = NO_RESPONSE
+
+    def _multiplexing_enabled(self) -> bool:
+        """Return True if the files of a batch can be sent as interleaved streams: the feature was accepted."""
+        return bool(self.accepted_features & FEATURE_MULTIPLEX) and self._batch_session()
+
+    def _striping_enabled(self) -> bool:
+        """Return True if files can be sent in segments over several connections: the feature was accepted."""
+        return bool(self.accepted_features & FEATURE_STRIPING)
+
+    def _compression_enabled(self) -> bool:
+        """Return True if files can be sent compressed: the feature was accepted."""
+        return bool(self.accepted_features & FEATURE_COMPRESSION)
+
+    def _delta_enabled(self) -> bool:
+        """Return True if files can be sent as a delta against their saved copy: the feature was accepted."""
+        return bool(self.accepted_features & FEATURE_DELTA)
+
+    def _block_repair_enabled(self) -> bool:
+        """Return True if blocks can be sent again on their own: the feature was accepted and the mode is CTR/GCM."""
+        return bool(self.accepted_features & FEATURE_BLOCK_REPAIR) and self.cipher_mode != CIPHER_CBC
+
+    def _resumable(self) -> bool:
+        """Return True if uploads of this session can be resumed: the feature was accepted and the mode is CTR/GCM."""
+        return bool(self.accepted_features & FEATURE_RESUME) and self.cipher_mode != CIPHER_CBC
+
+    def _clear_upload_progress(self) -> None:
+        """Forget the saved part of the current file."""
+        if self.file_name and self._resumable():
+            self.database.clear_upload_progress(self.client_id_binary, self.file_name)
+
+    def _process_received_file(self, resume_from: Optional[Tuple[int, int]] = None) -> None:
         """Process and save received file."""
+        # The encrypted file, still on the socket. A resumed file is not committed, nothing follows it.
+        body = (self._receive_stream(self.encrypted_file_size) if resume_from
+                else self._receive_body(self.encrypted_file_size))
         try:
-            # Decrypt the received file and save it, returning its checksum
-            self.cksum = self.aes_key_obj.decrypt_and_save_file(self.payload, self.file_name)
+            # Decrypt the received file while it is streamed from the socket and save it, returning its checksum
+            self.cksum = self.aes_key_obj.decrypt_and_save_stream(body, self.file_name, resume_from)
+            self._save_upload_progress()  # Until the client confirms the CRC, a lost reply can be resumed
 
             # Attempt to add the file to the database
             if self.database.add_file(self.client_id_binary, self.file_name, self.file_name, False):
@@ -248,12 +992,53 @@ class ClientHandler:
         except Exception as e:
             self.logger.error(f"Error processing file: {e}")  # Log any errors that occur during file processing
             self.op_code = GENERAL_ERROR  # Set operation code to indicate a general error
+            self._save_upload_progress()  # Keep what was saved before the error, the client resumes from there
+            for _ in body:  # Skip what is left of the file body to stay in sync with the client
+                pass
+
+    def _save_upload_progress(self) -> None:
+        """Record how much of the current file is saved, for a later RESUME_QUERY."""
+        if self._resumable():
+            self.database.save_upload_progress(self.client_id_binary, self.file_name, self.decrypted_file_size,
+                                               self.aes_key_obj.saved_size, self.aes_key_obj.saved_state)
 
     def _handle_crc_ok(self) -> None:
         """Handle CRC OK response from client."""
+        self._clear_upload_progress()  # The file is complete
         self.database.update_file_verified(self.client_id_binary, self.file_name, True)  # Mark the file as verified in the database
+        self.files_verified += 1
         self.op_code = RECEIVED_MESSAGE_ACK  # Set operation code to acknowledge the received message
-        self.flag_connected = False  # Set the connection flag to False, indicating the client should disconnect
+        # Set the connection flag to False, indicating the client should disconnect, unless more files follow
+        self.flag_connected = self._batch_session()
+
+    def _commit_file(self, client_checksum: bytes) -> None:
+        """
+        Verify a received file against the checksum the client sent with it, and answer with the verdict
+        instead of the checksum: FILE_COMMITTED stands for RECEIVED_FILE_ACK_WITH_CRC, CRC_OK and its
+        acknowledgement, FILE_COMMIT_FAILED for RECEIVED_FILE_ACK_WITH_CRC, CRC_NOT_OK and its acknowledgement.
+        Requests without the checksum keep the three-step exchange.
+        """
+        if self.op_code != RECEIVED_FILE_ACK_WITH_CRC or len(client_checksum) != COMMIT_CHECKSUM_SIZE:
+            return
+        if int.from_bytes(client_checksum, 'big') == self.cksum:
+            self._handle_crc_ok()
+            self.op_code = FILE_COMMITTED
+        else:
+            self._clear_upload_progress()  # The saved part cannot be trusted, the file is sent again from the start
+            self.database.update_file_verified(self.client_id_binary, self.file_name, False)  # A copy verified before was overwritten
+            self.op_code = FILE_COMMIT_FAILED
+
+    def _commit_size(self) -> int:
+        """Return the size of the checksum that follows the body of a file request."""
+        return COMMIT_CHECKSUM_SIZE if self._commit_enabled() else 0
+
+    def _commit_enabled(self) -> bool:
+        """Return True if files are committed in one round trip: the feature was accepted."""
+        return bool(self.accepted_features & FEATURE_COMMIT)
+
+    def _batch_session(self) -> bool:
+        """Return True if the client sends more files over this session and ends it with TERMINATION_REQUEST."""
+        return bool(self.accepted_features & FEATURE_BATCH)
 
     def create_header_to_send(self, opcode: int) -> bytes:
         """Create a header with the given opcode and payload."""
@@ -278,14 +1063,15 @@ class ClientHandler:
 
 
 
-    def load_client_from_db(self) -> bool:
-        """Load client information from database."""
+    def load_client_from_db(self, exchange_key: bool = True) -> bool:
+        """Load client information from database. The public key is skipped if the session is resumed from a ticket."""
         client = self.database.get_client(self.client_id_binary)  # Retrieve client information from the database using client ID
         if client:
             self.client_name, public_key, _, aes_key = client  # Unpack the retrieved client information
-            self.aes_key_obj.receive_rsa_public_key(public_key)  # Set the client's RSA public key in the AES encryption object
+            if exchange_key:
+                self.aes_key_obj.update_aes_key(aes_key)  # Update the AES key in the AES encryption object
+                self._receive_client_key(public_key)  # Set the client's public key, agreeing a new AES key if it is an X25519 key
             self.database.update_last_seen(self.client_id_binary)  # Update the last seen timestamp for the client in the database
-            self.aes_key_obj.update_aes_key(aes_key)  # Update the AES key in the AES encryption object
             return True  # Return True indicating the client was successfully loaded
         return False  # Return False if the client was not found in the database
 
@@ -0,0 +1,78 @@
+"""
+Author: Lior Klunover
+Version: 1.0.1
+"""
+import zlib
+
+from typing import BinaryIO
+from Server.AES_EncryptionKey import AES_EncryptionKey
+
+MAX_OUTPUT_CHUNK = 1024 * 1024  # Largest part of a block inflated at a time
+
+
+class Decompressor:
+    """
+    Writes a compressed file body to disk as it is decrypted. The client compresses each block of the
+    file into a zlib stream of its own, so the body is a sequence of streams: when one ends, the bytes
+    after it start the next. The CRC32 of the decompressed file is kept, as the client computed it
+    over the original file.
+    """
+
+    def __init__(self, expected_size: int, file_out: BinaryIO):
+        """
+        Args:
+            expected_size (int): The size of the original file, as announced by the client.
+            file_out (BinaryIO): The decompressed file, open for writing.
+        """
+        self.expected_size = expected_size
+        self.file_out = file_out
+        self.stream = zlib.decompressobj()
+        self.stream_started = False  # The current stream received bytes
+        self.size = 0  # Bytes of the decompressed file written
+        self.state = 0  # Running CRC32 state of the decompressed file
+
+    def write(self, data: bytes) -> None:
+        """
+        Decompresses the next bytes of the body.
+
+        Raises:
+            ValueError: If a stream is corrupt, or the file grows past its announced size.
+        """
+        try:
+            while data:
+                self.stream_started = True
+                # Inflate in bounded parts, so a small body cannot expand into memory all at once
+                output = self.stream.decompress(data, MAX_OUTPUT_CHUNK)
+                self._output(output)
+                if self.stream.eof:
+                    data = self.stream.unused_data  # The next stream starts right after this one
+                    self.stream = zlib.decompressobj()
+                    self.stream_started = False
+                else:
+                    data = self.stream.unconsumed_tail
+        except zlib.error as e:
+            raise ValueError(f"Corrupt compressed body: {e}")
+
+    def finish(self) -> int:
+        """
+        Checks the body ended with a complete stream and the file has its announced size.
+
+        Returns:
+            int: CRC32 checksum of the decompressed file.
+
+        Raises:
+            ValueError: If the body is truncated or the size differs.
+        """
+        if self.stream_started:
+            raise ValueError("Truncated compressed body")
+        if self.size != self.expected_size:
+            raise ValueError(f"Decompressed {self.size} bytes, expected {self.expected_size}")
+        return AES_EncryptionKey.finalize_checksum_crc32(self.state, self.size)
+
+    def _output(self, data: bytes) -> None:
+        """Writes bytes of the decompressed file and adds them to its checksum."""
+        if self.size + len(data) > self.expected_size:
+            raise ValueError(f"Decompressed body is larger than {self.expected_size} bytes")
+        self.file_out.write(data)
+        self.state = AES_EncryptionKey.update_checksum_crc32(self.state, data)
+        self.size += len(data)
@@ -62,6 +62,16 @@ class DataBaseManager:
                     PRIMARY KEY (client_id, file_name),
                     FOREIGN KEY (client_id) REFERENCES clients(client_id)
                 );
+
+                CREATE TABLE IF NOT EXISTS uploads (
+                    client_id BLOB,
+                    file_name TEXT NOT NULL,
+                    file_size INTEGER NOT NULL,
+                    received_size INTEGER NOT NULL,
+                    crc_state INTEGER NOT NULL,
+                    PRIMARY KEY (client_id, file_name),
+                    FOREIGN KEY (client_id) REFERENCES clients(client_id)
+                );
             ''')
 
     def add_client(self, client_name: str) -> Optional[bytes]:
@@ -163,6 +173,17 @@ class DataBaseManager:
             print(e)  # Print the error message if an SQLite error occurs
             return False  # Return False if an error occurs
 
+    def file_exists(self, client_id, file_name) -> bool:
+        """Return True if the client uploaded a file of this name before."""
+        # Acquire the shared lock to ensure thread-safe access to the database
+        with DataBaseManager.shared_lock:
+            conn = self._create_connection()
+            try:
+                return self._check_file_exists(client_id, file_name, conn)
+            finally:
+                # Close the database connection
+                conn.close()
+
     def update_file_verified(self, client_id, file_name, verified) -> None:
         # Acquire the shared lock to ensure thread-safe access to the database
         with DataBaseManager.shared_lock:
@@ -279,6 +300,77 @@ class DataBaseManager:
                 # Print the error message if an SQLite error occurs
                 print(e)
 
+    def save_upload_progress(self, client_id, file_name, file_size, received_size, crc_state) -> None:
+        """
+        Record how much of a file was received, so an interrupted upload can be resumed.
+
+        Args:
+            client_id (bytes): 16-byte client identifier
+            file_name (str): Name of the file
+            file_size (int): Total size of the decrypted file
+            received_size (int): Number of decrypted bytes saved to disk
+            crc_state (int): Running CRC32 state of the saved bytes
+        """
+        # Acquire the shared lock to ensure thread-safe access to the database
+        with DataBaseManager.shared_lock:
+            try:
+                # Create a new database connection
+                conn = self._create_connection()
+                # Insert the progress of the upload, replacing the previous one
+                conn.execute('''
+                    INSERT OR REPLACE INTO uploads (client_id, file_name, file_size, received_size, crc_state)
+                    VALUES (?, ?, ?, ?, ?)
+                ''', (client_id, file_name, file_size, received_size, crc_state))
+                # Commit the transaction to save changes
+                conn.commit()
+                # Close the database connection
+                conn.close()
+            except sqlite3.Error as e:
+                # Print the error message if an SQLite error occurs
+                print(e)
+
+    def get_upload_progress(self, client_id, file_name) -> Optional[Tuple[int, int, int]]:
+        """
+        Return (file_size, received_size, crc_state) of an interrupted upload, or None.
+        """
+        # Acquire the shared lock to ensure thread-safe access to the database
+        with DataBaseManager.shared_lock:
+            try:
+                # Create a new database connection
+                conn = self._create_connection()
+                # Execute the SQL query to retrieve the progress of the upload
+                cursor = conn.execute('''
+                    SELECT file_size, received_size, crc_state FROM uploads WHERE client_id = ? AND file_name = ?
+                ''', (client_id, file_name))
+                # Fetch the first result from the query
+                result = cursor.fetchone()
+                # Close the database connection
+                conn.close()
+                return result
+            except sqlite3.Error as e:
+                # Print the error message if an SQLite error occurs
+                print(e)
+                return None
+
+    def clear_upload_progress(self, client_id, file_name) -> None:
+        """Forget the progress of an upload, the next upload of the file starts from the beginning."""
+        # Acquire the shared lock to ensure thread-safe access to the database
+        with DataBaseManager.shared_lock:
+            try:
+                # Create a new database connection
+                conn = self._create_connection()
+                # Execute the SQL query to delete the progress of the upload
+                conn.execute('''
+                    DELETE FROM uploads WHERE client_id = ? AND file_name = ?
+                ''', (client_id, file_name))
+                # Commit the transaction to save changes
+                conn.commit()
+                # Close the database connection
+                conn.close()
+            except sqlite3.Error as e:
+                # Print the error message if an SQLite error occurs
+                print(e)
+
     def _client_exists(self, client_id: bytes, conn: sqlite3.Connection) -> bool:
         """Check if a client ID exists in the database."""
         cursor = conn.execute('SELECT 1 FROM clients WHERE client_id = ?', (client_id,))
@@ -0,0 +1,142 @@
+"""
+Author: Lior Klunover
+Version: 1.0.1
+"""
+import hashlib
+import itertools
+import math
+
+from typing import BinaryIO, List, Tuple
+from Server.AES_EncryptionKey import AES_EncryptionKey
+
+STRONG_HASH_SIZE = 16  # First bytes of the SHA-256 of a block
+MIN_BLOCK_SIZE = 2048
+MAX_BLOCK_SIZE = 64 * 1024
+MAX_LITERAL_READ = 64 * 1024  # Largest part of a copied run read at a time
+
+# Instructions of a delta
+LITERAL = 0x00  # Length (4 bytes), then the bytes
+COPY = 0x01  # First block (4 bytes), number of consecutive blocks (4 bytes)
+
+
+def delta_block_size(file_size: int) -> int:
+    """Returns the block size of the signatures of a file: about the square root of its size, as rsync does."""
+    return min(max(math.isqrt(file_size), MIN_BLOCK_SIZE), MAX_BLOCK_SIZE)
+
+
+def weak_checksum(block: bytes) -> int:
+    """
+    Rolling checksum of a block, the one the client slides over its file:
+    a = sum of the bytes, b = sum of (length - i) * byte i, both mod 2^16.
+    """
+    a = sum(block) & 0xFFFF
+    b = sum(itertools.accumulate(block)) & 0xFFFF  # Each byte is counted once per prefix it is in
+    return a | (b << 16)
+
+
+def block_signatures(filename: str, block_size: int) -> List[Tuple[int, bytes]]:
+    """
+    Computes the signature of every block of a saved file.
+
+    Args:
+        filename (str): The saved file.
+        block_size (int): The size of the blocks; the last block may be shorter.
+
+    Returns:
+        List[Tuple[int, bytes]]: The weak checksum and the strong hash of each block, in block order.
+    """
+    signatures = []
+    with open(filename, "rb") as file_in:
+        for block in iter(lambda: file_in.read(block_size), b''):
+            signatures.append((weak_checksum(block), hashlib.sha256(block).digest()[:STRONG_HASH_SIZE]))
+    return signatures
+
+
+class DeltaApplier:
+    """
+    Rebuilds a file from the saved copy it was diffed against and a delta, as the delta is decrypted.
+    It is the writer the decrypted delta goes to: write() parses the instructions as their bytes arrive,
+    copies the referenced blocks from the saved copy and writes the result to the output file, keeping
+    the CRC32 of the rebuilt file.
+    """
+
+    def __init__(self, base: BinaryIO, base_size: int, block_size: int, file_out: BinaryIO):
+        """
+        Args:
+            base (BinaryIO): The saved copy, open for reading.
+            base_size (int): Its size.
+            block_size (int): The block size of the signatures the client used.
+            file_out (BinaryIO): The rebuilt file, open for writing.
+        """
+        self.base = base
+        self.base_size = base_size
+        self.block_size = block_size
+        self.block_count = -(-base_size // block_size)
+        self.file_out = file_out
+        self.pending = bytearray()  # Bytes of an instruction header that is not complete yet
+        self.literal_left = 0  # Bytes of the current literal not received yet
+        self.size = 0  # Bytes of the rebuilt file written
+        self.state = 0  # Running CRC32 state of the rebuilt file
+
+    def write(self, data: bytes) -> None:
+        """
+        Applies the next bytes of the delta.
+
+        Raises:
+            ValueError: If an instruction is unknown or references a block the saved copy does not have.
+        """
+        self.pending += data
+        while self.pending:
+            if self.literal_left:
+                length = min(self.literal_left, len(self.pending))
+                self._output(bytes(self.pending[:length]))
+                del self.pending[:length]
+                self.literal_left -= length
+            elif self.pending[0] == LITERAL:
+                if len(self.pending) < 5:
+                    return
+                self.literal_left = int.from_bytes(self.pending[1:5], 'big')
+                del self.pending[:5]
+            elif self.pending[0] == COPY:
+                if len(self.pending) < 9:
+                    return
+                first = int.from_bytes(self.pending[1:5], 'big')
+                count = int.from_bytes(self.pending[5:9], 'big')
+                del self.pending[:9]
+                self._copy_blocks(first, count)
+            else:
+                raise ValueError(f"Unknown delta instruction: {self.pending[0]}")
+
+    def finish(self) -> int:
+        """
+        Checks the delta ended on an instruction boundary.
+
+        Returns:
+            int: CRC32 checksum of the rebuilt file.
+
+        Raises:
+            ValueError: If the delta is truncated.
+        """
+        if self.pending or self.literal_left:
+            raise ValueError("Truncated delta")
+        return AES_EncryptionKey.finalize_checksum_crc32(self.state, self.size)
+
+    def _copy_blocks(self, first: int, count: int) -> None:
+        """Copies blocks [first, first + count) of the saved copy to the output."""
+        if count == 0 or first + count > self.block_count:
+            raise ValueError(f"Delta references blocks {first}-{first + count} of {self.block_count}")
+        start = first * self.block_size
+        left = min((first + count) * self.block_size, self.base_size) - start
+        self.base.seek(start)
+        while left:
+            data = self.base.read(min(left, MAX_LITERAL_READ))
+            if not data:
+                raise ValueError("The saved copy is shorter than its signatures")
+            self._output(data)
+            left -= len(data)
+
+    def _output(self, data: bytes) -> None:
+        """Writes bytes of the rebuilt file and adds them to its checksum."""
+        self.file_out.write(data)
+        self.state = AES_EncryptionKey.update_checksum_crc32(self.state, data)
+        self.size += len(data)
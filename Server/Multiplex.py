@@ -0,0 +1,73 @@
+"""
+Author: Lior Klunover
+Version: 1.0.1
+"""
+import os
+
+from Server.AES_EncryptionKey import AES_EncryptionKey
+
+MAX_STREAMS = 64  # Streams a connection may keep open at the same time
+MAX_FRAME_SIZE = 1024 * 1024  # Largest part of a body in one frame
+STREAM_SUFFIX = '.stream.tmp'  # A stream is saved next to the file, which it replaces once it is complete
+
+
+class IncomingStream:
+    """
+    One file of a multiplexed upload. Its frames arrive interleaved with the frames of the other
+    streams of the connection, so the body is decrypted as each frame arrives and written to a
+    temporary file. The saved copy of the file is only replaced once the whole body was decrypted.
+    """
+
+    def __init__(self, aes_key_obj: AES_EncryptionKey, file_name: str, encrypted_size: int, file_size: int):
+        """
+        Args:
+            aes_key_obj (AES_EncryptionKey): The key and cipher mode of the session.
+            file_name (str): The name the file is saved under.
+            encrypted_size (int): The size of the encrypted body, as announced by the client.
+            file_size (int): The size of the decrypted file.
+        """
+        self.file_name = file_name
+        self.encrypted_size = encrypted_size
+        self.file_size = file_size
+        self.received = 0  # Encrypted bytes received
+        self.file_out = open(file_name + STREAM_SUFFIX, "wb")
+        self.decryptor = aes_key_obj.create_body_decryptor(self.file_out)
+
+    def write(self, data: bytes) -> None:
+        """
+        Decrypts the part of the body carried by a frame.
+
+        Raises:
+            ValueError: If the body grows past its announced size, or fails to decrypt.
+        """
+        self.received += len(data)
+        if self.received > self.encrypted_size:
+            raise ValueError(f"Stream of {self.file_name} is larger than {self.encrypted_size} bytes")
+        self.decryptor.write(data)
+        if self.decryptor.size > self.file_size:
+            raise ValueError(f"Stream of {self.file_name} decrypts to more than {self.file_size} bytes")
+
+    def finish(self) -> int:
+        """
+        Ends the body and replaces the saved copy of the file.
+
+        Returns:
+            int: CRC32 checksum of the file.
+
+        Raises:
+            ValueError: If the body is truncated or the file size differs.
+        """
+        if self.received != self.encrypted_size:
+            raise ValueError(f"Stream of {self.file_name} ended after {self.received} of {self.encrypted_size} bytes")
+        checksum = self.decryptor.finish()
+        if self.decryptor.size != self.file_size:
+            raise ValueError(f"Decrypted {self.decryptor.size} bytes, expected {self.file_size}")
+        self.file_out.close()
+        os.replace(self.file_name + STREAM_SUFFIX, self.file_name)
+        return checksum
+
+    def abort(self) -> None:
+        """Drops the stream; the saved copy of the file is left as it was."""
+        self.file_out.close()
+        if os.path.exists(self.file_name + STREAM_SUFFIX):
+            os.remove(self.file_name + STREAM_SUFFIX)
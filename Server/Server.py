@@ -20,6 +20,7 @@ from contextlib import contextmanager
 
 from ClientHandler import ClientHandler
 from DataBaseManager import DataBaseManager
+from SessionTicket import SessionTicketKey
 
 # Constants
 DEFAULT_HOST = '0.0.0.0'
@@ -50,6 +51,9 @@ class SecureTransferServer:
         _running (bool): Flag indicating if the server is running
         _server_socket (Optional[socket.socket]): Server socket instance
         _clients (set): Set of active client handlers
+        session_tickets (SessionTicketKey): Seals the session tickets issued to the clients
+        striped_uploads (dict): Size of each striped file being written, by (client ID, file name)
+        striped_uploads_lock (threading.Lock): Guards striped_uploads, shared by the connections of the clients
     """
 
     def __init__(self, config: ServerConfig):
@@ -64,7 +68,10 @@ class SecureTransferServer:
         self._running = False
         self._server_socket: Optional[socket.socket] = None
         self._clients = set()
-        self.version = 20
+        self.session_tickets = SessionTicketKey()
+        self.striped_uploads = {}  # Only these files are cut and checked by STRIPES_COMPLETE
+        self.striped_uploads_lock = threading.Lock()
+        self.version = 21  # 21: key exchange negotiates the cipher mode
         try:
             self.database = DataBaseManager(self.config.db_path)
             self.logger.info("Database connection established successfully")
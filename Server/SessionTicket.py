@@ -0,0 +1,74 @@
+"""
+Author: Lior Klunover
+Version: 1.0.1
+"""
+import time
+from typing import Optional
+
+from Crypto.Cipher import AES
+from Crypto.Random import get_random_bytes
+
+TICKET_LIFETIME = 3600  # Seconds a ticket resumes sessions for after it was issued
+TICKET_NONCE_SIZE = 12
+TICKET_TAG_SIZE = 16
+CLIENT_ID_SIZE = 16
+RESUMPTION_SECRET_SIZE = 32
+TICKET_CONTENT_SIZE = CLIENT_ID_SIZE + 8 + RESUMPTION_SECRET_SIZE  # Client ID, issue time and resumption secret
+TICKET_SIZE = TICKET_NONCE_SIZE + TICKET_CONTENT_SIZE + TICKET_TAG_SIZE
+
+
+class SessionTicketKey:
+    """
+    Seals and opens the session tickets of the server. A ticket carries the client ID, the time it
+    was issued and the resumption secret of the session it was issued in, encrypted and authenticated
+    with AES-GCM, so the server keeps no state per ticket. The key only lives in memory: tickets
+    issued before a restart no longer open, and their clients go through a full key exchange.
+    """
+
+    def __init__(self, lifetime: int = TICKET_LIFETIME):
+        """
+        Args:
+            lifetime (int): Seconds a ticket is accepted for after it was issued.
+        """
+        self.key = get_random_bytes(32)
+        self.lifetime = lifetime
+
+    def issue(self, client_id: bytes, resumption_secret: bytes) -> bytes:
+        """
+        Seals a ticket for the client.
+
+        Args:
+            client_id (bytes): The client ID, 16 bytes.
+            resumption_secret (bytes): The secret the sessions resumed with the ticket derive their key from.
+
+        Returns:
+            bytes: The ticket, TICKET_SIZE bytes.
+        """
+        nonce = get_random_bytes(TICKET_NONCE_SIZE)
+        content = client_id + int(time.time()).to_bytes(8, 'big') + resumption_secret
+        ciphertext, tag = AES.new(self.key, AES.MODE_GCM, nonce=nonce).encrypt_and_digest(content)
+        return nonce + ciphertext + tag
+
+    def open(self, client_id: bytes, ticket: bytes) -> Optional[bytes]:
+        """
+        Opens a ticket presented by a client.
+
+        Args:
+            client_id (bytes): The client ID of the request, which must be the one the ticket was issued to.
+            ticket (bytes): The ticket.
+
+        Returns:
+            Optional[bytes]: The resumption secret, or None if the ticket is invalid, of another client or expired.
+        """
+        if len(ticket) != TICKET_SIZE:
+            return None
+        nonce = ticket[:TICKET_NONCE_SIZE]
+        ciphertext = ticket[TICKET_NONCE_SIZE:-TICKET_TAG_SIZE]
+        try:
+            content = AES.new(self.key, AES.MODE_GCM, nonce=nonce).decrypt_and_verify(ciphertext, ticket[-TICKET_TAG_SIZE:])
+        except ValueError:
+            return None  # Not sealed with this key
+        issued = int.from_bytes(content[CLIENT_ID_SIZE:CLIENT_ID_SIZE + 8], 'big')
+        if content[:CLIENT_ID_SIZE] != client_id or not 0 <= time.time() - issued <= self.lifetime:
+            return None
+        return content[CLIENT_ID_SIZE + 8:]
@@ -0,0 +1,281 @@
+"""
+Author: Lior Klunover
+Version: 1.0.1
+"""
+import logging
+import os
+import queue
+import socket
+import statistics
+import struct
+import sys
+import threading
+import time
+from base64 import b64encode
+from typing import Optional, Tuple
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+
+from Crypto.Cipher import PKCS1_OAEP
+from Crypto.Hash import SHA256
+from Crypto.Protocol.DH import import_x25519_public_key, key_agreement
+from Crypto.Protocol.KDF import HKDF
+from Crypto.PublicKey import ECC, RSA
+
+from Server.AES_EncryptionKey import (AES_KEY_SIZE, IV_SIZE, RESUMPTION_INFO, RESUMPTION_SECRET_SIZE,
+                                      SESSION_KEY_INFO, X25519_KEY_SIZE)
+from Server.ClientHandler import (ClientHandler, FEATURE_BATCH, FEATURE_CBC, FEATURE_CTR, FEATURE_GCM,
+                                  FEATURE_TICKET, FEATURE_X25519, RECEIVED_PUBLIC_KEY,
+                                  RECEIVED_PUBLIC_KEY_ACK_SENDING_AES, RECONNECT_ACK_SENDING_AES,
+                                  RECONNECT_REQUEST, RECONNECT_WITH_TICKET, REGISTER_ACK, REGISTER_REQUEST,
+                                  REGISTER_WITH_KEY, SESSION_NONCE_SIZE, SESSION_RESUMED, STRING_SIZE)
+from Server.DataBaseManager import DataBaseManager
+from Server.SessionTicket import SessionTicketKey
+
+SERVER_VERSION = 21  # SecureTransferServer.version
+CLIENT_VERSION = 21  # Sends a feature mask in the key exchange
+RSA_KEY_SIZE = 1024  # CryptoPPKey's key size
+CLIENT_FEATURES = FEATURE_CBC | FEATURE_CTR | FEATURE_GCM | FEATURE_BATCH
+
+
+class BenchmarkServer:
+    """
+    The server's ClientHandler on an ephemeral loopback port, in this process, like SecureTransferServer
+    without its console and file logs. Records the CPU time of the thread of each connection.
+
+    Attributes:
+        port (int): Port the server listens on
+        connection_cpu (list): Server CPU seconds of each connection that ended, in the order they ended
+        session_tickets (SessionTicketKey): Seals the session tickets issued to the clients
+        striped_uploads (dict): Size of each striped file being written, by (client ID, file name)
+        striped_uploads_lock (threading.Lock): Guards striped_uploads
+    """
+
+    def __init__(self, db_path: str = 'defensive.db'):
+        self.database = DataBaseManager(db_path)
+        self.logger = logging.getLogger('benchmark_server')
+        self.logger.addHandler(logging.NullHandler())
+        self.logger.propagate = False
+        self.session_tickets = SessionTicketKey()
+        self.striped_uploads = {}
+        self.striped_uploads_lock = threading.Lock()
+        self.connection_cpu = []
+        self._listener = socket.create_server(('127.0.0.1', 0))
+        self.port = self._listener.getsockname()[1]
+        self._stdout = sys.stdout
+
+    def __enter__(self) -> 'BenchmarkServer':
+        sys.stdout = open(os.devnull, 'w')  # The handlers print every request
+        threading.Thread(target=self._accept, daemon=True).start()
+        return self
+
+    def __exit__(self, *exc_info) -> None:
+        self._listener.close()
+        sys.stdout.close()
+        sys.stdout = self._stdout
+
+    def get_server_version(self) -> int:
+        """Return the server version."""
+        return SERVER_VERSION
+
+    def _accept(self) -> None:
+        while True:
+            try:
+                client_socket, _ = self._listener.accept()
+            except OSError:
+                return
+            threading.Thread(target=self._handle, args=(client_socket,), daemon=True).start()
+
+    def _handle(self, client_socket: socket.socket) -> None:
+        start = time.thread_time()
+        ClientHandler(client_socket, self, self.database, self.logger).start()
+        self.connection_cpu.append(time.thread_time() - start)
+
+
+class DelayProxy:
+    """
+    Forwards loopback connections to a port, holding each chunk for a fixed delay in each direction. With a
+    window, at most that many bytes of a direction are in flight at once, like a TCP stream whose window
+    does not grow: each direction of a connection then carries at most window / delay bytes per second.
+    """
+
+    def __init__(self, target_port: int, delay: float, window: Optional[int] = None):
+        self.target_port = target_port
+        self.delay = delay
+        self.window = window
+        self._listener = socket.create_server(('127.0.0.1', 0))
+        self.port = self._listener.getsockname()[1]
+
+    def __enter__(self) -> 'DelayProxy':
+        threading.Thread(target=self._accept, daemon=True).start()
+        return self
+
+    def __exit__(self, *exc_info) -> None:
+        self._listener.close()
+
+    def _accept(self) -> None:
+        while True:
+            try:
+                client, _ = self._listener.accept()
+            except OSError:
+                return
+            server = socket.create_connection(('127.0.0.1', self.target_port))
+            for source, destination in ((client, server), (server, client)):
+                source.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+                threading.Thread(target=self._pump, args=(source, destination), daemon=True).start()
+
+    def _pump(self, source: socket.socket, destination: socket.socket) -> None:
+        chunks = queue.Queue()
+        in_flight = threading.Condition()
+        in_flight_bytes = 0
+
+        def forward():
+            nonlocal in_flight_bytes
+            while True:
+                due, data = chunks.get()
+                time.sleep(max(0.0, due - time.monotonic()))
+                if not data:
+                    destination.close()
+                    return
+                destination.sendall(data)
+                with in_flight:
+                    in_flight_bytes -= len(data)
+                    in_flight.notify()
+
+        threading.Thread(target=forward, daemon=True).start()
+        chunk_size = min(64 * 1024, self.window) if self.window else 64 * 1024
+        while True:
+            if self.window:
+                with in_flight:
+                    in_flight.wait_for(lambda: in_flight_bytes + chunk_size <= self.window)
+            try:
+                data = source.recv(chunk_size)
+            except OSError:
+                data = b''
+            with in_flight:
+                in_flight_bytes += len(data)
+            chunks.put((time.monotonic() + self.delay, data))
+            if not data:
+                return
+
+
+def name_field(name: str) -> bytes:
+    """A name padded to the 255 bytes of a request."""
+    return name.encode('utf-8') + b'\0' * (STRING_SIZE - len(name))
+
+
+class ProtocolClient:
+    """
+    The requests of the client's key exchange, as Client sends them, on one connection. The client's
+    key pair is passed in, since the client keeps its key across sessions.
+    """
+
+    def __init__(self, port: int, rsa_key: Optional[RSA.RsaKey] = None, x25519_key: Optional[ECC.EccKey] = None,
+                 client_id: bytes = b'\0' * 16):
+        self.socket = socket.create_connection(('127.0.0.1', port))
+        self.socket.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.rsa_key = rsa_key
+        self.x25519_key = x25519_key
+        self.client_id = client_id
+        self.aes_key = b''
+        self.iv = b''
+        self.ticket = b''
+        self.resumption_secret = b''
+        self.bytes_sent = 0  # Headers included
+        self.bytes_received = 0
+
+    def close(self) -> None:
+        self.socket.close()
+
+    def request(self, op_code: int, payload: bytes) -> Tuple[int, bytes]:
+        """Sends a request and returns the op code and the payload of the response."""
+        request = self.client_id + bytes([CLIENT_VERSION]) + struct.pack('>HI', op_code, len(payload)) + payload
+        self.socket.sendall(request)
+        self.bytes_sent += len(request)
+        _, response_code, size = struct.unpack('>BHI', self._receive(7))
+        return response_code, self._receive(size)
+
+    def _receive(self, size: int) -> bytes:
+        data = b''
+        while len(data) < size:
+            chunk = self.socket.recv(size - len(data))
+            if not chunk:
+                raise ConnectionError("The server closed the connection")
+            data += chunk
+        self.bytes_received += size
+        return data
+
+    def public_key(self) -> bytes:
+        """The key as registered: raw X25519, or the base64 DER of the RSA key."""
+        if self.x25519_key is not None:
+            return self.x25519_key.public_key().export_key(format='raw')
+        return b64encode(self.rsa_key.publickey().export_key('DER'))
+
+    def features(self) -> int:
+        return CLIENT_FEATURES | FEATURE_TICKET | (FEATURE_X25519 if self.x25519_key is not None else 0)
+
+    def register(self, name: str) -> None:
+        """REGISTER, then the public key: the key exchange of a new client before REGISTER_WITH_KEY."""
+        op_code, payload = self.request(REGISTER_REQUEST, name_field(name))
+        self._expect(op_code, REGISTER_ACK)
+        self.client_id = payload[:16]
+        op_code, payload = self.request(RECEIVED_PUBLIC_KEY,
+                                        name_field(name) + struct.pack('>I', self.features()) + self.public_key())
+        self._take_key(op_code, payload, RECEIVED_PUBLIC_KEY_ACK_SENDING_AES)
+
+    def register_with_key(self, name: str) -> None:
+        """The key exchange of a new client in one round trip."""
+        op_code, payload = self.request(REGISTER_WITH_KEY,
+                                        name_field(name) + struct.pack('>I', self.features()) + self.public_key())
+        self.client_id = payload[:16]
+        self._take_key(op_code, payload, RECEIVED_PUBLIC_KEY_ACK_SENDING_AES)
+
+    def reconnect(self, name: str) -> None:
+        """A full key exchange with the key the server has on record."""
+        op_code, payload = self.request(RECONNECT_REQUEST, name_field(name) + struct.pack('>I', self.features()))
+        self._take_key(op_code, payload, RECONNECT_ACK_SENDING_AES)
+
+    def resume(self, name: str, ticket: bytes, resumption_secret: bytes) -> None:
+        """A reconnect that presents a session ticket, resumed with symmetric crypto only."""
+        nonce = os.urandom(SESSION_NONCE_SIZE)
+        op_code, payload = self.request(RECONNECT_WITH_TICKET,
+                                        name_field(name) + struct.pack('>I', self.features()) + nonce + ticket)
+        self._expect(op_code, SESSION_RESUMED)
+        key_material = HKDF(resumption_secret, AES_KEY_SIZE + IV_SIZE, nonce + payload[16:16 + SESSION_NONCE_SIZE],
+                            SHA256, context=SESSION_KEY_INFO)
+        self.aes_key, self.iv = key_material[:AES_KEY_SIZE], key_material[AES_KEY_SIZE:]
+
+    def _take_key(self, op_code: int, payload: bytes, expected: int) -> None:
+        """Reads the AES key of a key exchange response and the session ticket that follows it."""
+        self._expect(op_code, expected)
+        offset = 16
+        if self.x25519_key is not None:
+            server_key = import_x25519_public_key(payload[offset:offset + X25519_KEY_SIZE])
+            shared_secret = key_agreement(static_priv=self.x25519_key, eph_pub=server_key, kdf=lambda secret: secret)
+            key_material = HKDF(shared_secret, AES_KEY_SIZE + IV_SIZE, self.client_id, SHA256,
+                                context=SESSION_KEY_INFO)
+            offset += X25519_KEY_SIZE
+        else:
+            key_size = self.rsa_key.size_in_bytes()
+            key_material = PKCS1_OAEP.new(self.rsa_key).decrypt(payload[offset:offset + key_size])
+            offset += key_size
+        self.aes_key, self.iv = key_material[:AES_KEY_SIZE], key_material[AES_KEY_SIZE:]
+        offset += 1 + 4  # Cipher mode and accepted features
+        features = struct.unpack('>I', payload[offset - 4:offset])[0]
+        if features & FEATURE_TICKET:
+            self.ticket = payload[offset + 4:]  # After the lifetime of the ticket
+            self.resumption_secret = HKDF(self.aes_key + self.iv, RESUMPTION_SECRET_SIZE, self.client_id, SHA256,
+                                          context=RESUMPTION_INFO)
+
+    @staticmethod
+    def _expect(op_code: int, expected: int) -> None:
+        if op_code != expected:
+            raise RuntimeError(f"The server answered {op_code}, expected {expected}")
+
+
+def median_ms(seconds: list) -> float:
+    return statistics.median(seconds) * 1000
+
+
+def median_us(seconds: list) -> float:
+    return statistics.median(seconds) * 1e6
@@ -0,0 +1,70 @@
+"""
+Author: Lior Klunover
+Version: 1.0.1
+"""
+import os
+import subprocess
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+
+from Server.AES_EncryptionKey import AES_EncryptionKey
+
+# Prefix lengths around the 8-byte slicing groups, the 16/64-byte folding blocks and the thread ranges
+LENGTHS = [0, 1, 3, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65, 127, 128, 129, 255, 256, 257,
+           1000, 4096, 65537, (1 << 20) - 1, (1 << 20) + 13, 3 * (1 << 20) + 5]
+
+
+def server_checksums(data: bytes) -> dict:
+    """
+    Computes the server's checksum of every prefix in LENGTHS, feeding the data once.
+
+    Returns:
+        dict: Checksum by prefix length.
+    """
+    checksums = {}
+    state, fed = 0, 0
+    for length in sorted(LENGTHS):
+        state = AES_EncryptionKey.update_checksum_crc32(state, data[fed:length])
+        fed = length
+        checksums[length] = AES_EncryptionKey.finalize_checksum_crc32(state, length)
+    # The whole buffer in one call too, as the server checksums a file it received
+    assert checksums[LENGTHS[-1]] == AES_EncryptionKey.calculate_checksum_crc32(data[:LENGTHS[-1]])
+    return checksums
+
+
+def main() -> int:
+    """
+    Runs crc32_test (argv[1]) on random data and compares every checksum it prints with the server's.
+
+    Returns:
+        int: 0 if they all match, 1 otherwise.
+    """
+    data = os.urandom(max(LENGTHS))
+    with tempfile.NamedTemporaryFile(delete=False) as data_file:
+        data_file.write(data)
+    try:
+        output = subprocess.run([sys.argv[1], data_file.name] + [str(length) for length in LENGTHS],
+                                check=True, capture_output=True, text=True).stdout
+    finally:
+        os.remove(data_file.name)
+
+    expected = server_checksums(data)
+    methods = set()
+    failures = 0
+    for line in output.splitlines():
+        length, method, checksum = line.split()
+        methods.add(method)
+        if int(checksum) != expected[int(length)]:
+            print(f"MISMATCH length {length} {method}: {checksum}, server {expected[int(length)]}")
+            failures += 1
+    if 'slicing-by-8' not in methods:
+        print("slicing-by-8 was not tested")
+        failures += 1
+    print(f"Checked {len(LENGTHS)} lengths with: {', '.join(sorted(m for m in methods if '@' not in m))}")
+    return 1 if failures else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
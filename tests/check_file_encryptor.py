@@ -0,0 +1,142 @@
+"""
+Author: Lior Klunover
+Version: 1.0.1
+"""
+import io
+import os
+import subprocess
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+
+from Server.AES_EncryptionKey import AES_EncryptionKey, AES_KEY_SIZE, CIPHER_CBC, CIPHER_CTR, CIPHER_GCM, IV_SIZE
+
+MODES = {'cbc': CIPHER_CBC, 'ctr': CIPHER_CTR, 'gcm': CIPHER_GCM}
+# Empty, around one AES block, around one GCM segment, and several blocks of the stream
+FILE_SIZES = [0, 1, 15, 16, 17, 65535, 65536, 65537, 3 * (1 << 20) + 5]
+BLOCK_SIZES = [4099, 1 << 20]  # An odd block size leaves partial AES blocks and GCM segments between chunks
+
+MiB = 1 << 20
+RSS_BLOCK_SIZE = MiB
+RSS_MAX_GROWTH_KIB = 24 * 1024  # Allowed peak RSS growth from the smallest to the largest input
+DEFAULT_RSS_MAX_SIZE = 1 << 30  # Size of the file written for the check, set MAMAN15_RSS_MAX_SIZE to change it
+SOURCES = ['stream', 'mapped']
+
+
+def decrypt(mode: int, key: bytes, iv: bytes, encrypted_path: str) -> tuple:
+    """
+    Decrypts a body with the server's streaming decoder, reading it in chunks like the socket.
+
+    Returns:
+        tuple: The plaintext and its CRC32 checksum, as the server computes it.
+    """
+    aes = AES_EncryptionKey()
+    aes.aes_key, aes.iv, aes.cipher_mode = key, iv, mode
+    plaintext = io.BytesIO()
+
+    def chunks():
+        with open(encrypted_path, 'rb') as body:
+            while chunk := body.read(8191):
+                yield chunk
+    aes.decrypt_stream_to(chunks(), plaintext)
+    return plaintext.getvalue(), AES_EncryptionKey.finalize_checksum_crc32(aes.saved_state, aes.saved_size)
+
+
+def check_round_trips(executable: str, directory: str) -> int:
+    """
+    Encrypts files of every size in every mode and decrypts them with the server's decoder.
+
+    Returns:
+        int: The number of failed round trips.
+    """
+    failures = 0
+    for size in FILE_SIZES:
+        data = os.urandom(size)
+        input_path = os.path.join(directory, 'plain.bin')
+        output_path = os.path.join(directory, 'encrypted.bin')
+        with open(input_path, 'wb') as plain:
+            plain.write(data)
+        for name, mode in MODES.items():
+            for block_size in BLOCK_SIZES:
+                key, iv = os.urandom(AES_KEY_SIZE), os.urandom(IV_SIZE)
+                result = subprocess.run([executable, 'encrypt', name, key.hex(), iv.hex(), input_path, output_path,
+                                         str(block_size)], capture_output=True, text=True)
+                if result.returncode != 0:
+                    print(f"FAILED {name} size {size} block {block_size}: {result.stderr.strip()}")
+                    failures += 1
+                    continue
+                try:
+                    plaintext, checksum = decrypt(mode, key, iv, output_path)
+                except ValueError as e:
+                    print(f"FAILED {name} size {size} block {block_size}: {e}")
+                    failures += 1
+                    continue
+                if plaintext != data or checksum != int(result.stdout):
+                    print(f"MISMATCH {name} size {size} block {block_size}: plaintext equal {plaintext == data}, "
+                          f"checksum {result.stdout.strip()}, server {checksum}")
+                    failures += 1
+    print(f"Checked {len(FILE_SIZES)} file sizes in {len(MODES)} modes against the server's decoder")
+    return failures
+
+
+def write_rss_input(path: str, size: int) -> None:
+    """Writes a file of the given size, one random MiB repeated, so every page holds data."""
+    pattern = os.urandom(MiB)
+    with open(path, 'wb') as file:
+        for offset in range(0, size, MiB):
+            file.write(pattern[:min(MiB, size - offset)])
+
+
+def check_rss(executable: str, directory: str) -> int:
+    """
+    Reads a file through each InputSource, from its first MiB up to all of it, encrypting it as the
+    client does, and checks the peak RSS stays flat.
+
+    Returns:
+        int: The number of sources and modes whose peak RSS grew with the input.
+    """
+    max_size = int(os.environ.get('MAMAN15_RSS_MAX_SIZE', DEFAULT_RSS_MAX_SIZE))
+    sizes = [MiB]
+    while sizes[-1] * 8 < max_size:
+        sizes.append(sizes[-1] * 8)
+    sizes.append(max_size)
+    input_path = os.path.join(directory, 'input.bin')
+    write_rss_input(input_path, max_size)
+
+    failures = 0
+    for source in SOURCES:
+        for name in MODES:
+            peaks = []
+            for size in sizes:
+                result = subprocess.run([executable, 'rss', name, source, input_path, str(size), str(RSS_BLOCK_SIZE)],
+                                        capture_output=True, text=True)
+                if result.returncode != 0:
+                    print(f"FAILED rss {source} {name} size {size}: {result.stderr.strip()}")
+                    return failures + 1
+                peaks.append(int(result.stdout))
+            growth = max(peaks) - peaks[0]
+            print(f"{source} {name}: peak RSS "
+                  f"{', '.join(f'{size // MiB} MiB -> {peak} KiB' for size, peak in zip(sizes, peaks))}")
+            if growth > RSS_MAX_GROWTH_KIB:
+                print(f"RSS of {source} {name} grew by {growth} KiB, more than {RSS_MAX_GROWTH_KIB} KiB")
+                failures += 1
+    return failures
+
+
+def main() -> int:
+    """
+    Runs file_encryptor_test (argv[1]): the round trips, or the RSS check if argv[2] is "rss".
+
+    Returns:
+        int: 0 if every check passed, 1 otherwise.
+    """
+    executable = sys.argv[1]
+    with tempfile.TemporaryDirectory() as directory:
+        if len(sys.argv) > 2 and sys.argv[2] == 'rss':
+            return 1 if check_rss(executable, directory) else 0
+        return 1 if check_round_trips(executable, directory) else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,67 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+// crc32_test.cpp
+// Prints the CRC32 of prefixes of a file, computed with every kernel the CPU supports, with the data
+// fed in uneven pieces, by combining the states of two ranges and on several threads. Each line is
+// "<length> <method> <checksum>"; check_crc32.py compares them with the server's checksum.
+//
+// Usage: crc32_test FILE LENGTH...
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "Crc32.h"
+
+namespace {
+    void print(size_t length, const std::string& method, uint32_t checksum) {
+        std::cout << length << " " << method << " " << checksum << "\n";
+    }
+
+    // Feeds the data in pieces of growing, odd sizes, so the kernels start at unaligned addresses
+    uint32_t update_in_pieces(const uint8_t* data, size_t length) {
+        uint32_t state = 0;
+        size_t piece = 1;
+        for (size_t offset = 0; offset < length; offset += piece, piece = piece * 3 + 1) {
+            piece = std::min(piece, length - offset);
+            state = Crc32::update(state, data + offset, piece);
+        }
+        return state;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: crc32_test FILE LENGTH..." << std::endl;
+        return 2;
+    }
+    std::ifstream file(argv[1], std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Could not open " << argv[1] << std::endl;
+        return 2;
+    }
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    for (int i = 2; i < argc; i++) {
+        size_t length = std::min<size_t>(std::strtoull(argv[i], nullptr, 10), data.size());
+        const uint8_t* bytes = data.data();
+
+        for (const std::string& kernel : Crc32::supported_kernels()) {
+            print(length, kernel, Crc32::finalize(Crc32::update_with(kernel, 0, bytes, length), length));
+        }
+        print(length, "pieces", Crc32::finalize(update_in_pieces(bytes, length), length));
+        for (size_t split : {size_t(0), length / 3, length - std::min<size_t>(length, 7), length}) {
+            uint32_t state_a = Crc32::update(0, bytes, split);
+            uint32_t state_b = Crc32::update(0, bytes + split, length - split);
+            print(length, "combine@" + std::to_string(split),
+                  Crc32::finalize(Crc32::combine(state_a, state_b, length - split), length));
+        }
+        print(length, "parallel", Crc32::checksum_parallel(bytes, length, 4));
+    }
+    return 0;
+}
@@ -0,0 +1,119 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+// encrypt_benchmark.cpp
+// Compares the fused CRC32 + AES pass of FileEncryptor with the two passes it replaced: the whole
+// block checksummed first, then encrypted. Both run on one thread over the same plaintext, held in
+// memory and fed one stream block at a time, so only the passes over the data differ.
+//
+// Usage: encrypt_benchmark [SIZE_MIB [BLOCK_SIZE [REPEATS]]]
+//   Prints "<mode> <method> <MB/s>" for the median of REPEATS runs, then the speedup of each mode.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cryptopp/osrng.h>
+#include "Crc32.h"
+#include "FileEncryptor.h"
+
+namespace {
+    constexpr size_t MiB = 1024 * 1024;
+
+    struct Setup {
+        CryptoPP::SecByteBlock key{32};
+        CryptoPP::SecByteBlock iv{16};
+        std::vector<uint8_t> plaintext;
+        size_t block_size;
+    };
+
+    template <typename Cipher>
+    uint32_t checksum_then_encrypt(const Setup& setup, std::vector<uint8_t>& out) {
+        Cipher cipher;
+        cipher.SetKeyWithIV(setup.key, setup.key.size(), setup.iv);
+        uint32_t state = 0;
+        for (size_t offset = 0; offset < setup.plaintext.size(); offset += setup.block_size) {
+            size_t length = std::min(setup.block_size, setup.plaintext.size() - offset);
+            state = Crc32::update(state, setup.plaintext.data() + offset, length);
+            cipher.ProcessData(out.data(), setup.plaintext.data() + offset, length);
+        }
+        return Crc32::finalize(state, setup.plaintext.size());
+    }
+
+    // Checksums each block, then encrypts it, as CryptoPPKey::encrypt_file() did before the passes were fused
+    uint32_t two_pass(const Setup& setup, CipherMode mode, std::vector<uint8_t>& out) {
+        if (mode == CipherMode::CBC) {
+            return checksum_then_encrypt<CryptoPP::CBC_Mode<CryptoPP::AES>::Encryption>(setup, out);
+        }
+        return checksum_then_encrypt<CryptoPP::CTR_Mode<CryptoPP::AES>::Encryption>(setup, out);
+    }
+
+    uint32_t fused(const Setup& setup, CipherMode mode, std::vector<uint8_t>& out) {
+        FileEncryptor encryptor(setup.key, setup.iv, setup.plaintext.size(), mode);
+        size_t remaining = setup.plaintext.size();
+        for (size_t offset = 0; offset < setup.plaintext.size(); offset += setup.block_size) {
+            size_t length = std::min(setup.block_size, remaining);
+            remaining -= length;
+            encryptor.encrypt_chunk(setup.plaintext.data() + offset, length, remaining == 0, out.data());
+        }
+        return encryptor.get_checksum();
+    }
+
+    // Median throughput of a method in MB/s
+    double measure(uint32_t (*method)(const Setup&, CipherMode, std::vector<uint8_t>&), const Setup& setup,
+                   CipherMode mode, int repeats, uint32_t& checksum) {
+        std::vector<uint8_t> out(setup.block_size + 2 * FileEncryptor::GCM_TAG_SIZE + FileEncryptor::FILE_IV_SIZE);
+        std::vector<double> rates;
+        for (int i = 0; i < repeats; i++) {
+            auto start = std::chrono::steady_clock::now();
+            checksum = method(setup, mode, out);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            rates.push_back(static_cast<double>(setup.plaintext.size()) / 1e6 / elapsed.count());
+        }
+        std::sort(rates.begin(), rates.end());
+        return rates[rates.size() / 2];
+    }
+}
+
+int main(int argc, char* argv[]) {
+    size_t size = (argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 256) * MiB;
+    size_t block_size = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : MiB; // Client::DEFAULT_STREAM_BLOCK_SIZE
+    int repeats = argc > 3 ? std::atoi(argv[3]) : 5;
+    if (size == 0 || block_size == 0 || repeats <= 0) {
+        std::cerr << "Usage: encrypt_benchmark [SIZE_MIB [BLOCK_SIZE [REPEATS]]]" << std::endl;
+        return 2;
+    }
+
+    Setup setup;
+    setup.block_size = block_size;
+    setup.plaintext.resize(size);
+    CryptoPP::AutoSeededRandomPool rng;
+    rng.GenerateBlock(setup.key, setup.key.size());
+    rng.GenerateBlock(setup.iv, setup.iv.size());
+    rng.GenerateBlock(setup.plaintext.data(), setup.plaintext.size());
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "# " << size / MiB << " MiB in blocks of " << block_size << " bytes, CRC32 kernel "
+              << Crc32::kernel_name() << ", median of " << repeats << std::endl;
+    int status = 0;
+    for (auto [name, mode] : {std::pair{"cbc", CipherMode::CBC}, std::pair{"ctr", CipherMode::CTR}}) {
+        uint32_t two_pass_checksum = 0;
+        uint32_t fused_checksum = 0;
+        double two_pass_rate = measure(two_pass, setup, mode, repeats, two_pass_checksum);
+        double fused_rate = measure(fused, setup, mode, repeats, fused_checksum);
+        std::cout << name << " two-pass " << two_pass_rate << std::endl
+                  << name << " fused " << fused_rate << std::endl
+                  << name << " speedup " << std::setprecision(2) << fused_rate / two_pass_rate
+                  << std::setprecision(1) << std::endl;
+        if (two_pass_checksum != fused_checksum) {
+            std::cerr << name << ": the two passes computed checksum " << two_pass_checksum << ", the fused pass "
+                      << fused_checksum << std::endl;
+            status = 1;
+        }
+    }
+    return status;
+}
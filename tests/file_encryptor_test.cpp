@@ -0,0 +1,145 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+// file_encryptor_test.cpp
+// Drives FileEncryptor the way a streamed SENDING_FILE body is encrypted: one block of the file at a
+// time, into one reused output buffer. check_file_encryptor.py runs it in two ways:
+//
+//   file_encryptor_test encrypt MODE KEY_HEX IV_HEX INPUT OUTPUT BLOCK_SIZE
+//     Encrypts INPUT into OUTPUT and prints the CRC32 of the plaintext, for the server's decoder.
+//   file_encryptor_test rss MODE SOURCE INPUT SIZE BLOCK_SIZE
+//     Reads the first SIZE bytes of INPUT through the InputSource the client uploads from, encrypts
+//     them, discards the ciphertext, and prints the peak RSS in KiB.
+//
+// MODE is cbc, ctr or gcm, SOURCE is stream or mapped.
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <cryptopp/osrng.h>
+#include "FileEncryptor.h"
+#include "InputSource.h"
+#include "ThreadPool.h"
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+namespace {
+    CipherMode parse_mode(const std::string& name) {
+        if (name == "cbc") {
+            return CipherMode::CBC;
+        }
+        if (name == "ctr") {
+            return CipherMode::CTR;
+        }
+        if (name == "gcm") {
+            return CipherMode::GCM;
+        }
+        throw std::invalid_argument("Unknown cipher mode: " + name);
+    }
+
+    CryptoPP::SecByteBlock parse_hex(const std::string& hex) {
+        CryptoPP::SecByteBlock bytes(hex.size() / 2);
+        for (size_t i = 0; i < bytes.size(); i++) {
+            bytes[i] = static_cast<uint8_t>(std::stoul(hex.substr(2 * i, 2), nullptr, 16));
+        }
+        return bytes;
+    }
+
+    // Encrypts a file block by block and prints the checksum of its plaintext
+    int encrypt_file(CipherMode mode, const CryptoPP::SecByteBlock& key, const CryptoPP::SecByteBlock& iv,
+                     const std::string& input_path, const std::string& output_path, size_t block_size) {
+        std::ifstream input(input_path, std::ios::binary | std::ios::ate);
+        std::ofstream output(output_path, std::ios::binary | std::ios::trunc);
+        if (!input.is_open() || !output.is_open()) {
+            std::cerr << "Could not open " << input_path << " or " << output_path << std::endl;
+            return 2;
+        }
+        uint64_t size = static_cast<uint64_t>(input.tellg());
+        input.seekg(0);
+
+        ThreadPool pool;
+        FileEncryptor encryptor(key, iv, size, mode, &pool);
+        std::vector<uint8_t> block(block_size);
+        std::vector<uint8_t> encrypted;
+        uint64_t remaining = size;
+        do {
+            size_t length = static_cast<size_t>(std::min<uint64_t>(block_size, remaining));
+            input.read(reinterpret_cast<char*>(block.data()), static_cast<std::streamsize>(length));
+            remaining -= length;
+            encryptor.encrypt_chunk(block.data(), length, remaining == 0, encrypted);
+            output.write(reinterpret_cast<const char*>(encrypted.data()), static_cast<std::streamsize>(encrypted.size()));
+        } while (remaining > 0);
+
+        std::cout << encryptor.get_checksum() << std::endl;
+        return output ? 0 : 1;
+    }
+
+    // Encrypts the start of a file block by block, as the client sends it, and prints the peak resident set size
+    int measure_rss(CipherMode mode, const std::string& source, const std::string& input_path, uint64_t size,
+                    size_t block_size) {
+#ifdef _WIN32
+        std::cerr << "The peak RSS is only measured on POSIX systems" << std::endl;
+        return 2;
+#else
+        CryptoPP::AutoSeededRandomPool rng;
+        CryptoPP::SecByteBlock key(32);
+        CryptoPP::SecByteBlock iv(16);
+        rng.GenerateBlock(key, key.size());
+        rng.GenerateBlock(iv, iv.size());
+
+        std::unique_ptr<InputSource> input = InputSource::open(input_path, block_size, source == "mapped");
+        if (input->name() != source || input->size() < size) {
+            std::cerr << "Could not read " << size << " bytes of " << input_path << " as " << source << std::endl;
+            return 2;
+        }
+        ThreadPool pool;
+        FileEncryptor encryptor(key, iv, size, mode, &pool);
+        std::vector<uint8_t> encrypted(encryptor.max_output_size(block_size));
+        uint64_t remaining = size;
+        uint64_t encrypted_size = 0;
+        do {
+            size_t length = static_cast<size_t>(std::min<uint64_t>(block_size, remaining));
+            const uint8_t* block = input->next(length);
+            remaining -= length;
+            encrypted_size += encryptor.encrypt_chunk(block, length, remaining == 0, encrypted.data());
+        } while (remaining > 0);
+        if (encrypted_size != encryptor.get_encrypted_size()) {
+            std::cerr << "Encrypted " << encrypted_size << " bytes, expected " << encryptor.get_encrypted_size() << std::endl;
+            return 1;
+        }
+
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        std::cout << usage.ru_maxrss << std::endl; // KiB on Linux
+        return 0;
+#endif
+    }
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        std::string command = argc > 1 ? argv[1] : "";
+        if (command == "encrypt" && argc == 8) {
+            return encrypt_file(parse_mode(argv[2]), parse_hex(argv[3]), parse_hex(argv[4]), argv[5], argv[6],
+                                std::strtoul(argv[7], nullptr, 10));
+        }
+        if (command == "rss" && argc == 7) {
+            return measure_rss(parse_mode(argv[2]), argv[3], argv[4], std::strtoull(argv[5], nullptr, 10),
+                               std::strtoul(argv[6], nullptr, 10));
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    std::cerr << "Usage: file_encryptor_test encrypt MODE KEY_HEX IV_HEX INPUT OUTPUT BLOCK_SIZE" << std::endl
+              << "       file_encryptor_test rss MODE SOURCE INPUT SIZE BLOCK_SIZE" << std::endl;
+    return 2;
+}
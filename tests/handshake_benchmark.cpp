@@ -0,0 +1,103 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+// handshake_benchmark.cpp
+// Measures the client's side of the key exchange with each kind of client key: taking the AES key out
+// of the server's response (RSA-OAEP decryption, or X25519 agreement and HKDF) and the bytes of the
+// registered key and of the key field of the response. handshake_benchmark.py runs it next to the
+// server's side.
+//
+// Usage: handshake_benchmark [ITERATIONS]
+//   Prints "<key> <client-us> <registered-key-bytes> <response-key-bytes>", the median of ITERATIONS.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cryptopp/osrng.h>
+#include "CryptoPPKey.h"
+
+using namespace CryptoPP;
+
+namespace {
+    constexpr size_t AES_KEY_MATERIAL_SIZE = 32 + 16; // AES-256 key and IV, as the server sends them
+
+    // Median microseconds of a step, with the client's log lines kept out of the output
+    template <typename Step>
+    double median_us(int iterations, Step step) {
+        std::ostringstream log;
+        std::streambuf* console = std::cout.rdbuf(log.rdbuf());
+        std::vector<double> times;
+        for (int i = 0; i < iterations; i++) {
+            auto start = std::chrono::steady_clock::now();
+            step();
+            times.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+            log.str("");
+        }
+        std::cout.rdbuf(console);
+        std::sort(times.begin(), times.end());
+        return times[times.size() / 2];
+    }
+
+    // The server's response to an RSA key: the AES key and IV encrypted with it
+    std::vector<uint8_t> wrap_for(const std::vector<uint8_t>& public_key_base64) {
+        std::string der;
+        StringSource(std::string(public_key_base64.begin(), public_key_base64.end()), true,
+                     new Base64Decoder(new StringSink(der)));
+        RSA::PublicKey public_key;
+        StringSource key_source(der, true);
+        public_key.Load(key_source);
+
+        AutoSeededRandomPool rng;
+        std::string key_material(AES_KEY_MATERIAL_SIZE, '\0');
+        rng.GenerateBlock(reinterpret_cast<byte*>(key_material.data()), key_material.size());
+        RSAES_OAEP_SHA_Encryptor encryptor(public_key);
+        std::string wrapped;
+        StringSource(key_material, true, new PK_EncryptorFilter(rng, encryptor, new StringSink(wrapped)));
+        return {wrapped.begin(), wrapped.end()};
+    }
+
+    // The server's response to an X25519 key: the public half of a fresh key pair
+    std::vector<uint8_t> server_agreement_key() {
+        AutoSeededRandomPool rng;
+        SecByteBlock private_key(x25519::SECRET_KEYLENGTH);
+        std::vector<uint8_t> public_key(x25519::PUBLIC_KEYLENGTH);
+        x25519().GenerateKeyPair(rng, private_key, public_key.data());
+        return public_key;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 2000;
+    if (iterations <= 0) {
+        std::cerr << "Usage: handshake_benchmark [ITERATIONS]" << std::endl;
+        return 2;
+    }
+    std::vector<uint8_t> client_id(16, 0x5a);
+
+    std::ostringstream setup_log;
+    std::streambuf* console = std::cout.rdbuf(setup_log.rdbuf());
+    CryptoPPKey rsa_key;
+    std::vector<uint8_t> rsa_public_key = rsa_key.get_public_key_base64();
+    std::vector<uint8_t> wrapped = wrap_for(rsa_public_key);
+    CryptoPPKey x25519_key;
+    x25519_key.use_key_agreement();
+    std::vector<uint8_t> agreement_key = server_agreement_key();
+    std::cout.rdbuf(console);
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "# Client side of the key exchange, median of " << iterations << std::endl;
+    std::cout << "key client-us registered-key-bytes response-key-bytes" << std::endl;
+    std::cout << "rsa-" << rsa_key.get_encrypted_aes_key_size() * 8 << " "
+              << median_us(iterations, [&] { rsa_key.decrypt_aes_key(wrapped); }) << " "
+              << rsa_public_key.size() << " " << wrapped.size() << std::endl;
+    std::cout << "x25519 "
+              << median_us(iterations, [&] { x25519_key.derive_aes_key(agreement_key, client_id); }) << " "
+              << x25519_key.get_agreement_public_key().size() << " " << agreement_key.size() << std::endl;
+    return 0;
+}
@@ -0,0 +1,116 @@
+"""
+Author: Lior Klunover
+Version: 1.0.1
+"""
+import contextlib
+import os
+import subprocess
+import sys
+import tempfile
+import time
+from base64 import b64encode
+
+from Crypto.PublicKey import ECC, RSA
+
+from benchmark_server import BenchmarkServer, ProtocolClient, RSA_KEY_SIZE, median_us
+from Server import AES_EncryptionKey as KeyExchange
+
+HANDSHAKES = 200  # Per kind of client key
+CRYPTO_ITERATIONS = 500
+
+
+def server_crypto_us(client_keys: dict) -> list:
+    """
+    Times the server's cryptography of one key exchange alone, with every X25519 backend it can load.
+
+    Returns:
+        list: (name, median microseconds) of RSA and of each X25519 backend.
+    """
+    rsa_public_key = b64encode(client_keys['rsa'].publickey().export_key('DER'))
+    x25519_public_key = client_keys['x25519'].public_key().export_key(format='raw')
+    client_id = os.urandom(16)
+
+    def measure(step) -> float:
+        times = []
+        for _ in range(CRYPTO_ITERATIONS):
+            start = time.thread_time()
+            step()
+            times.append(time.thread_time() - start)
+        return median_us(times)
+
+    def wrap_rsa():
+        key = KeyExchange.AES_EncryptionKey()
+        key.receive_rsa_public_key(rsa_public_key)
+        key.get_encrypted_aes_key()
+
+    def agree_x25519():
+        key = KeyExchange.AES_EncryptionKey()
+        key.receive_x25519_public_key(x25519_public_key)
+        key.agree_aes_key(client_id)
+
+    results = [(f'rsa-{RSA_KEY_SIZE}', measure(wrap_rsa))]
+    loaded = KeyExchange.X25519_BACKEND
+    for backend in (KeyExchange.CryptographyX25519, KeyExchange.OpenSSLX25519, KeyExchange.PycryptodomeX25519):
+        try:
+            KeyExchange.X25519_BACKEND = backend()
+        except (ImportError, OSError, AttributeError):
+            continue
+        results.append((f'x25519 ({backend.name})', measure(agree_x25519)))
+    KeyExchange.X25519_BACKEND = loaded
+    return results
+
+
+def server_handshakes(client_keys: dict) -> list:
+    """
+    Registers new clients with each kind of key through the server, one REGISTER_WITH_KEY per connection.
+
+    Returns:
+        list: (name, median server CPU microseconds per connection, request bytes, response bytes).
+    """
+    results = []
+    with BenchmarkServer() as server:
+        for kind, key in client_keys.items():
+            server.connection_cpu.clear()
+            for _ in range(HANDSHAKES):
+                client = ProtocolClient(server.port, **{f'{kind}_key': key})
+                client.register_with_key('h' + os.urandom(6).hex())
+                client.close()
+            while len(server.connection_cpu) < HANDSHAKES:
+                time.sleep(0.01)
+            name = f'rsa-{RSA_KEY_SIZE}' if kind == 'rsa' else f'x25519 ({KeyExchange.X25519_BACKEND.name})'
+            results.append((name, median_us(server.connection_cpu), client.bytes_sent, client.bytes_received))
+    return results
+
+
+def main() -> int:
+    """
+    Measures the key exchange with RSA and X25519 client keys: the server's CPU per handshake, through
+    its ClientHandler and for the cryptography alone, the bytes on the wire, and the client's side with
+    handshake_benchmark (argv[1]) if it is given.
+
+    Returns:
+        int: 0 if every handshake completed, the exit status of handshake_benchmark otherwise.
+    """
+    client_keys = {'rsa': RSA.generate(RSA_KEY_SIZE), 'x25519': ECC.generate(curve='Curve25519')}
+    with tempfile.TemporaryDirectory() as directory:
+        os.chdir(directory)
+        handshakes = server_handshakes(client_keys)
+        os.chdir('/')
+    with open(os.devnull, 'w') as devnull, contextlib.redirect_stdout(devnull):  # The key prints each step
+        crypto = server_crypto_us(client_keys)
+
+    print(f"Server, one REGISTER_WITH_KEY connection, median of {HANDSHAKES}")
+    print("key                     server-us  request-bytes  response-bytes")
+    for name, cpu, sent, received in handshakes:
+        print(f"{name:22} {cpu:10.0f} {sent:14} {received:15}")
+    print(f"Server, key exchange cryptography alone, median of {CRYPTO_ITERATIONS}")
+    for name, cpu in crypto:
+        print(f"{name:22} {cpu:10.0f}")
+    if len(sys.argv) > 1:
+        sys.stdout.flush()
+        return subprocess.run([sys.argv[1]]).returncode
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,134 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+// input_benchmark.cpp
+// Times reading a file through each InputSource and checksumming it, with the file's pages in the
+// page cache (warm) and dropped from it before every run (cold). Every source must give the same CRC32.
+//
+// Usage: input_benchmark FILE [SIZE_MIB [BLOCK_SIZE [REPEATS]]]
+//   FILE is written first if it is shorter than SIZE_MIB (default 1300). Prints
+//   "<source> <cache> <seconds> <MB/s>" for the median of REPEATS runs.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cryptopp/osrng.h>
+#include "Crc32.h"
+#include "InputSource.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    constexpr uint64_t MiB = 1024 * 1024;
+
+#ifndef _WIN32
+    // Writes one random MiB repeated up to `size`, and flushes it so its pages can be dropped
+    bool write_input(const std::string& path, uint64_t size) {
+        struct stat status{};
+        if (stat(path.c_str(), &status) == 0 && static_cast<uint64_t>(status.st_size) >= size) {
+            return true;
+        }
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        std::vector<uint8_t> pattern(MiB);
+        CryptoPP::AutoSeededRandomPool rng;
+        rng.GenerateBlock(pattern.data(), pattern.size());
+        bool written = true;
+        for (uint64_t offset = 0; offset < size && written; offset += MiB) {
+            size_t length = static_cast<size_t>(std::min(MiB, size - offset));
+            written = ::write(fd, pattern.data(), length) == static_cast<ssize_t>(length);
+        }
+        written = written && ::fsync(fd) == 0;
+        ::close(fd);
+        return written;
+    }
+
+    // Evicts the file's pages from the page cache, so the next read comes from the disk
+    void drop_cache(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd >= 0) {
+            ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            ::close(fd);
+        }
+    }
+
+    // Reads the first `size` bytes block by block, as the client encrypts them, and returns their CRC32
+    uint32_t read_file(const std::string& path, uint64_t size, size_t block_size, bool mapped) {
+        std::unique_ptr<InputSource> input = InputSource::open(path, block_size, mapped);
+        uint32_t state = 0;
+        for (uint64_t offset = 0; offset < size; offset += block_size) {
+            size_t length = static_cast<size_t>(std::min<uint64_t>(block_size, size - offset));
+            state = Crc32::update(state, input->next(length), length);
+        }
+        return Crc32::finalize(state, size);
+    }
+#endif
+}
+
+int main(int argc, char* argv[]) {
+#ifdef _WIN32
+    std::cerr << "The page cache is only dropped on POSIX systems" << std::endl;
+    return 2;
+#else
+    if (argc < 2) {
+        std::cerr << "Usage: input_benchmark FILE [SIZE_MIB [BLOCK_SIZE [REPEATS]]]" << std::endl;
+        return 2;
+    }
+    std::string path = argv[1];
+    uint64_t size = (argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1300) * MiB;
+    size_t block_size = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : MiB; // Client::DEFAULT_STREAM_BLOCK_SIZE
+    int repeats = argc > 4 ? std::atoi(argv[4]) : 5;
+    if (size == 0 || block_size == 0 || repeats <= 0 || !write_input(path, size)) {
+        std::cerr << "Could not write " << size << " bytes to " << path << std::endl;
+        return 2;
+    }
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "# " << size / MiB << " MiB of " << path << " in blocks of " << block_size << " bytes, median of "
+              << repeats << std::endl;
+    int status = 0;
+    uint32_t expected = 0;
+    bool first = true;
+    for (bool cold : {true, false}) {
+        for (bool mapped : {false, true}) {
+            read_file(path, size, block_size, mapped); // Leaves the pages cached for the warm runs
+            std::vector<double> times;
+            for (int i = 0; i < repeats; i++) {
+                if (cold) {
+                    drop_cache(path);
+                }
+                auto start = std::chrono::steady_clock::now();
+                uint32_t checksum = read_file(path, size, block_size, mapped);
+                std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                times.push_back(elapsed.count());
+                if (first) {
+                    expected = checksum;
+                    first = false;
+                } else if (checksum != expected) {
+                    std::cerr << (mapped ? "mapped" : "stream") << " read checksum " << checksum << ", expected "
+                              << expected << std::endl;
+                    status = 1;
+                }
+            }
+            std::sort(times.begin(), times.end());
+            double median = times[times.size() / 2];
+            std::cout << (mapped ? "mapped" : "stream") << " " << (cold ? "cold" : "warm") << " " << median << " "
+                      << std::setprecision(1) << static_cast<double>(size) / 1e6 / median << std::setprecision(3)
+                      << std::endl;
+        }
+    }
+    return status;
+#endif
+}
@@ -0,0 +1,65 @@
+"""
+Author: Lior Klunover
+Version: 1.0.1
+"""
+import os
+import sys
+import tempfile
+import time
+
+from Crypto.PublicKey import ECC
+
+from benchmark_server import BenchmarkServer, DelayProxy, ProtocolClient, median_ms
+
+ONE_WAY_DELAYS = [0.0, 0.040]  # Loopback, and a link of 80 ms round trip
+REGISTRATIONS = 15  # Per delay and way of registering
+
+
+def time_to_key(port: int, key: ECC.EccKey, combined: bool) -> float:
+    """
+    Registers a new client and exchanges keys with it.
+
+    Returns:
+        float: Seconds from the connection to the AES key, as a new client waits for it.
+    """
+    start = time.perf_counter()
+    client = ProtocolClient(port, x25519_key=key)
+    name = 'b' + os.urandom(6).hex()
+    if combined:
+        client.register_with_key(name)
+    else:
+        client.register(name)
+    elapsed = time.perf_counter() - start
+    client.close()
+    return elapsed
+
+
+def main() -> int:
+    """
+    Times the key exchange of new clients through the server, as REGISTER then the public key, and as
+    one REGISTER_WITH_KEY, directly and through a proxy that delays each direction.
+
+    Returns:
+        int: 0
+    """
+    key = ECC.generate(curve='Curve25519')
+    results = []
+    with tempfile.TemporaryDirectory() as directory:
+        os.chdir(directory)
+        with BenchmarkServer() as server:
+            for delay in ONE_WAY_DELAYS:
+                with DelayProxy(server.port, delay) as proxy:
+                    two_steps = [time_to_key(proxy.port, key, False) for _ in range(REGISTRATIONS)]
+                    combined = [time_to_key(proxy.port, key, True) for _ in range(REGISTRATIONS)]
+                results.append((delay, median_ms(two_steps), median_ms(combined)))
+        os.chdir('/')
+
+    print(f"Time to the AES key of a new client, median of {REGISTRATIONS}")
+    print("one-way delay  two steps  REGISTER_WITH_KEY")
+    for delay, two_steps, combined in results:
+        print(f"{delay * 1000:10.0f} ms  {two_steps:6.1f} ms  {combined:14.1f} ms")
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
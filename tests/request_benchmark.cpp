@@ -0,0 +1,185 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+// request_benchmark.cpp
+// Compares the two ways a SENDING_FILE request has been assembled and written to the socket:
+//
+//   concatenated  Each payload field built in a temporary vector, passed by value, and the whole
+//                 payload copied behind the header into header_buffer, which is written before
+//                 the first block of the body (the client before the gathered writes).
+//   gathered      The fields appended to the payload in place, and the header, the payload and the
+//                 first block written with one gathered write (Client::send_request()).
+//
+// Requests go over a loopback TCP connection to a thread that discards them. For each layout it prints
+// the heap allocations, the bytes copied in user space and the write calls per request, and requests/s.
+//
+// Usage: request_benchmark [REQUESTS [BLOCK_SIZE]]
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+
+using boost::asio::ip::tcp;
+
+namespace {
+    thread_local uint64_t allocations = 0; // Heap allocations made by this thread
+
+    constexpr size_t HEADER_SIZE = 23; // SessionProtocol::HEADER_SIZE
+    constexpr uint16_t SENDING_FILE = 828;
+    const std::string FILE_NAME = "benchmark/input.bin";
+
+    struct Totals {
+        uint64_t allocations = 0;
+        uint64_t copied = 0; // Bytes of header and payload copied after the fields were encoded
+        uint64_t writes = 0;
+    };
+
+    // Header fields after the client id
+    void put_header(uint8_t* out, uint32_t payload_size) {
+        std::fill(out, out + 16, 0x5a);
+        out[16] = 3;
+        out[17] = static_cast<uint8_t>(SENDING_FILE >> 8);
+        out[18] = static_cast<uint8_t>(SENDING_FILE & 0xFF);
+        for (int i = 0; i < 4; i++) {
+            out[19 + i] = static_cast<uint8_t>(payload_size >> (24 - 8 * i));
+        }
+    }
+
+    std::vector<uint8_t> size_field(uint32_t size) {
+        std::vector<uint8_t> bytes;
+        for (int i = 0; i < 4; i++) {
+            bytes.push_back(static_cast<uint8_t>(size >> (24 - 8 * i)));
+        }
+        return bytes;
+    }
+
+    std::vector<uint8_t> name_field(const std::string& name) {
+        std::vector<uint8_t> bytes(255, 0);
+        std::copy(name.begin(), name.end(), bytes.begin());
+        return bytes;
+    }
+
+    void append(std::vector<uint8_t>& payload, std::vector<uint8_t> data) { // By value, as add_to_payload() took it
+        payload.insert(payload.end(), data.begin(), data.end());
+    }
+
+    void send_concatenated(tcp::socket& socket, const std::vector<uint8_t>& block, Totals& totals) {
+        uint64_t start = allocations;
+        std::vector<uint8_t> payload;
+        append(payload, size_field(static_cast<uint32_t>(block.size())));
+        append(payload, size_field(static_cast<uint32_t>(block.size())));
+        append(payload, name_field(FILE_NAME));
+
+        std::vector<uint8_t> header_buffer;
+        header_buffer.reserve(HEADER_SIZE + payload.size());
+        header_buffer.resize(HEADER_SIZE);
+        put_header(header_buffer.data(), static_cast<uint32_t>(payload.size()));
+        header_buffer.insert(header_buffer.end(), payload.begin(), payload.end());
+        totals.copied += 3 * payload.size(); // Each field passed by value, appended, then copied behind the header
+
+        boost::asio::write(socket, boost::asio::buffer(header_buffer));
+        totals.writes += 1;
+        if (!block.empty()) {
+            boost::asio::write(socket, boost::asio::buffer(block));
+            totals.writes += 1;
+        }
+        totals.allocations += allocations - start;
+    }
+
+    void send_gathered(tcp::socket& socket, std::vector<uint8_t>& payload, const std::vector<uint8_t>& block,
+                       Totals& totals) {
+        uint64_t start = allocations;
+        payload.clear(); // Keeps its capacity from the previous request, as SessionProtocol::payload does
+        for (int field = 0; field < 2; field++) {
+            for (int i = 0; i < 4; i++) {
+                payload.push_back(static_cast<uint8_t>(block.size() >> (24 - 8 * i)));
+            }
+        }
+        payload.insert(payload.end(), FILE_NAME.begin(), FILE_NAME.end());
+        payload.insert(payload.end(), 255 - FILE_NAME.size(), 0);
+
+        std::array<uint8_t, HEADER_SIZE> header{};
+        put_header(header.data(), static_cast<uint32_t>(payload.size()));
+        std::array<boost::asio::const_buffer, 3> buffers{boost::asio::buffer(header), boost::asio::buffer(payload),
+                                                         boost::asio::buffer(block)};
+        boost::asio::write(socket, buffers);
+        totals.writes += 1;
+        totals.allocations += allocations - start;
+    }
+}
+
+void* operator new(size_t size) {
+    allocations++;
+    if (void* memory = std::malloc(size ? size : 1)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    std::free(memory);
+}
+
+int main(int argc, char* argv[]) {
+    int requests = argc > 1 ? std::atoi(argv[1]) : 200000;
+    size_t block_size = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 4096;
+    if (requests <= 0) {
+        std::cerr << "Usage: request_benchmark [REQUESTS [BLOCK_SIZE]]" << std::endl;
+        return 2;
+    }
+
+    boost::asio::io_context io_context;
+    tcp::acceptor acceptor(io_context, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    tcp::socket socket(io_context);
+    socket.connect(acceptor.local_endpoint());
+    tcp::socket peer = acceptor.accept();
+    socket.set_option(tcp::no_delay(true));
+
+    std::thread drain([&peer] {
+        std::vector<uint8_t> buffer(1 << 20);
+        boost::system::error_code error;
+        while (!error) {
+            peer.read_some(boost::asio::buffer(buffer), error);
+        }
+    });
+
+    std::vector<uint8_t> block(block_size, 0xa5); // First encrypted block of the body
+    std::vector<uint8_t> payload;
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "# " << requests << " SENDING_FILE requests with a " << block_size << " byte first block" << std::endl;
+    std::cout << "layout allocations/request copied-bytes/request writes/request requests/s" << std::endl;
+    for (bool gathered : {false, true}) {
+        Totals totals;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < requests; i++) {
+            if (gathered) {
+                send_gathered(socket, payload, block, totals);
+            } else {
+                send_concatenated(socket, block, totals);
+            }
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << (gathered ? "gathered " : "concatenated ")
+                  << static_cast<double>(totals.allocations) / requests << " "
+                  << static_cast<double>(totals.copied) / requests << " "
+                  << static_cast<double>(totals.writes) / requests << " "
+                  << requests / elapsed.count() << std::endl;
+    }
+
+    socket.shutdown(tcp::socket::shutdown_send);
+    drain.join();
+    return 0;
+}
@@ -0,0 +1,77 @@
+"""
+Author: Lior Klunover
+Version: 1.0.1
+"""
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+from benchmark_server import BenchmarkServer, DelayProxy
+
+FILE_SIZE = 64 * 1024 * 1024  # StripedUpload::MIN_FILE_SIZE
+ONE_WAY_DELAY = 0.040  # A link of 80 ms round trip
+# In flight per direction of a connection, about 1.6 MB/s at this delay: well under the 6 MB/s or so the
+# server's handler takes in on one core, so the link and not the server limits each connection
+WINDOW = 64 * 1024
+STRIPES = [0, 2, 4]  # --stripes of each run, 0 for a single connection
+
+
+def upload_seconds(client: str, stripes: int) -> tuple:
+    """
+    Sends the file of transfer.info again with the command-line client.
+
+    Returns:
+        tuple: Seconds the client ran, and the summary line of its striped upload, if it striped the file.
+    """
+    if os.path.exists('striped.bin'):
+        os.remove('striped.bin')  # The server's copy, or the file would be sent as a delta against it
+    start = time.perf_counter()
+    run = subprocess.run([client, '--full', '--no-compression', '--stripes', str(stripes)],
+                         stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True, timeout=600)
+    elapsed = time.perf_counter() - start
+    if run.returncode != 0:
+        raise RuntimeError(f"The client exited with {run.returncode}:\n{run.stdout[-2000:]}")
+    summary = next((line for line in run.stdout.splitlines() if line.startswith('Striped upload finished')), '')
+    return elapsed, summary
+
+
+def main() -> int:
+    """
+    Uploads a large file with the command-line client (argv[1]) through a proxy that delays each direction
+    and caps the bytes in flight of every connection, over one connection and striped over several.
+
+    Returns:
+        int: 0, or 2 without the client's path
+    """
+    if len(sys.argv) < 2:
+        print("Usage: striping_benchmark.py CLIENT", file=sys.stderr)
+        return 2
+    client = os.path.abspath(sys.argv[1])
+    results = []
+    with tempfile.TemporaryDirectory() as directory:
+        os.chdir(directory)
+        os.mkdir('client')  # The server writes the files it receives to its working directory
+        file_path = os.path.join(directory, 'client', 'striped.bin')
+        with open(file_path, 'wb') as file:
+            file.write(os.urandom(FILE_SIZE))
+        with BenchmarkServer() as server, DelayProxy(server.port, ONE_WAY_DELAY, WINDOW) as proxy:
+            with open('transfer.info', 'w') as info:
+                info.write(f"127.0.0.1:{proxy.port}\nstriping benchmark\n{file_path}\n")
+            upload_seconds(client, STRIPES[-1])  # Registers the client
+            for stripes in STRIPES:
+                results.append((stripes,) + upload_seconds(client, stripes))
+        os.chdir('/')
+
+    megabytes = FILE_SIZE / 1e6
+    print(f"{FILE_SIZE // (1024 * 1024)} MiB through {ONE_WAY_DELAY * 1000:.0f} ms each way, "
+          f"{WINDOW // 1024} KiB in flight per connection")
+    print("stripes  seconds    MB/s")
+    for stripes, seconds, summary in results:
+        print(f"{stripes:7} {seconds:8.2f} {megabytes / seconds:7.1f}  {summary}")
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
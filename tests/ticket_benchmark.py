@@ -0,0 +1,76 @@
+"""
+Author: Lior Klunover
+Version: 1.0.1
+"""
+import os
+import sys
+import tempfile
+import time
+
+from Crypto.PublicKey import ECC, RSA
+
+from benchmark_server import BenchmarkServer, ProtocolClient, RSA_KEY_SIZE, median_ms, median_us
+
+RECONNECTS = 300  # Per kind of client key and way of reconnecting
+
+
+def reconnects(server: BenchmarkServer, kind: str, key, resumed: bool) -> tuple:
+    """
+    Registers a client, then reconnects it on new connections, with a full key exchange or with the
+    session ticket of its registration.
+
+    Returns:
+        tuple: Median server CPU microseconds per connection, and median milliseconds to the AES key.
+    """
+    name = 't' + os.urandom(6).hex()
+    client = ProtocolClient(server.port, **{f'{kind}_key': key})
+    client.register_with_key(name)
+    client.close()
+    client_id, ticket, resumption_secret = client.client_id, client.ticket, client.resumption_secret
+
+    while len(server.connection_cpu) < 1:
+        time.sleep(0.01)
+    server.connection_cpu.clear()
+    latencies = []
+    for _ in range(RECONNECTS):
+        start = time.perf_counter()
+        client = ProtocolClient(server.port, **{f'{kind}_key': key}, client_id=client_id)
+        if resumed:
+            client.resume(name, ticket, resumption_secret)
+        else:
+            client.reconnect(name)
+        latencies.append(time.perf_counter() - start)
+        client.close()
+    while len(server.connection_cpu) < RECONNECTS:
+        time.sleep(0.01)
+    return median_us(server.connection_cpu), median_ms(latencies)
+
+
+def main() -> int:
+    """
+    Measures the reconnections of registered clients through the server, RECONNECT with a full key
+    exchange against RECONNECT_WITH_TICKET, for RSA and X25519 client keys.
+
+    Returns:
+        int: 0
+    """
+    client_keys = {'rsa': RSA.generate(RSA_KEY_SIZE), 'x25519': ECC.generate(curve='Curve25519')}
+    results = []
+    with tempfile.TemporaryDirectory() as directory:
+        os.chdir(directory)
+        with BenchmarkServer() as server:
+            for kind, key in client_keys.items():
+                name = f'rsa-{RSA_KEY_SIZE}' if kind == 'rsa' else kind
+                results.append((name, 'RECONNECT') + reconnects(server, kind, key, False))
+                results.append((name, 'WITH_TICKET') + reconnects(server, kind, key, True))
+        os.chdir('/')
+
+    print(f"Reconnection of a registered client, one connection each, median of {RECONNECTS}")
+    print("key       request       server-us  reconnects/s/core  ms-to-key")
+    for name, request, cpu, latency in results:
+        print(f"{name:9} {request:12} {cpu:10.0f} {1e6 / cpu:18.0f} {latency:10.2f}")
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,265 @@
+//
+// Created by lior3 on 17/10/2026.
+//
+
+// upload_benchmark.cpp
+// Sends the encrypted body of a file over a loopback connection with each upload engine of the client
+// and reports its system calls and CPU time per GiB:
+//
+//   blocking   One read and one write per block on the calling thread (Client::send_request()).
+//   pipelined  Reader, encryptor and writer threads (UploadPipeline).
+//   io_uring   Reads and sends batched on a ring (UringUpload), if the client was built with liburing.
+//
+// The receiver is a separate process, so only the sender's work is measured. The CPU time is taken
+// from getrusage() over an untraced run. The system calls are counted in a second run of the engine
+// in a child process, stopped at every system call of every thread with ptrace; only the calls made
+// during the transfer are counted.
+//
+// Usage: upload_benchmark FILE [SIZE_MIB [BLOCK_SIZE]]
+//   FILE is written first if it is shorter than SIZE_MIB (default 1024).
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <cryptopp/osrng.h>
+#include "FileEncryptor.h"
+#include "InputSource.h"
+#include "UploadPipeline.h"
+#include "UringUpload.h"
+
+#ifdef __linux__
+#include <csignal>
+#include <fcntl.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using boost::asio::ip::tcp;
+
+namespace {
+    constexpr uint64_t MiB = 1024 * 1024;
+    constexpr double GiB = 1024.0 * 1024 * 1024;
+
+#ifdef __linux__
+    struct Input {
+        std::string path;
+        uint64_t size;
+        size_t block_size;
+    };
+
+    // Writes one random MiB repeated up to `size`
+    bool write_input(const std::string& path, uint64_t size) {
+        struct stat status{};
+        if (stat(path.c_str(), &status) == 0 && static_cast<uint64_t>(status.st_size) >= size) {
+            return true;
+        }
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        std::vector<uint8_t> pattern(MiB);
+        CryptoPP::AutoSeededRandomPool rng;
+        rng.GenerateBlock(pattern.data(), pattern.size());
+        bool written = true;
+        for (uint64_t offset = 0; offset < size && written; offset += MiB) {
+            size_t length = static_cast<size_t>(std::min(MiB, size - offset));
+            written = ::write(fd, pattern.data(), length) == static_cast<ssize_t>(length);
+        }
+        ::close(fd);
+        return written;
+    }
+
+    // Accepts one connection in a child process and reads it to the end
+    pid_t start_receiver(tcp::acceptor& acceptor) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            boost::asio::io_context io_context;
+            tcp::socket peer(io_context);
+            acceptor.accept(peer);
+            std::vector<uint8_t> buffer(4 * MiB);
+            boost::system::error_code error;
+            while (!error) {
+                peer.read_some(boost::asio::buffer(buffer), error);
+            }
+            _exit(0);
+        }
+        return pid;
+    }
+
+    // Marks the start and the end of the transfer for the syscall counter
+    void mark() {
+        syscall(SYS_getppid);
+    }
+
+    uint64_t send_blocking(const Input& input, FileEncryptor& encryptor, tcp::socket& socket) {
+        std::unique_ptr<InputSource> source = InputSource::open(input.path, input.block_size);
+        std::vector<uint8_t> encrypted(encryptor.max_output_size(input.block_size));
+        uint64_t remaining = input.size;
+        uint64_t sent = 0;
+        while (remaining > 0) {
+            size_t length = static_cast<size_t>(std::min<uint64_t>(input.block_size, remaining));
+            const uint8_t* block = source->next(length);
+            remaining -= length;
+            size_t encrypted_size = encryptor.encrypt_chunk(block, length, remaining == 0, encrypted.data());
+            sent += boost::asio::write(socket, boost::asio::buffer(encrypted.data(), encrypted_size));
+        }
+        return sent;
+    }
+
+    // Connects to the receiver and sends the encrypted file with one engine
+    uint64_t send_file(const std::string& engine, const Input& input, const tcp::endpoint& receiver, bool marked) {
+        boost::asio::io_context io_context;
+        tcp::socket socket(io_context);
+        socket.connect(receiver);
+        CryptoPP::SecByteBlock key(32);
+        CryptoPP::SecByteBlock iv(16);
+        FileEncryptor encryptor(key, iv, input.size, CipherMode::CTR);
+
+        if (marked) {
+            mark();
+        }
+        uint64_t sent;
+        if (engine == "pipelined") {
+            std::unique_ptr<InputSource> source = InputSource::open(input.path, input.block_size);
+            UploadPipeline pipeline(*source, input.size, encryptor, socket, input.block_size);
+            sent = pipeline.run();
+        } else if (engine == "io_uring") {
+            UringUpload upload(input.path, 0, input.size, encryptor, socket, input.block_size);
+            sent = upload.run();
+        } else {
+            sent = send_blocking(input, encryptor, socket);
+        }
+        if (marked) {
+            mark();
+        }
+        return sent;
+    }
+
+    double cpu_seconds() {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+               static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+    }
+
+    // Runs the engine in a traced child and counts the system calls of all its threads between the marks
+    long count_syscalls(const std::string& engine, const Input& input, const tcp::endpoint& receiver) {
+        pid_t child = fork();
+        if (child == 0) {
+            ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+            raise(SIGSTOP);
+            try {
+                send_file(engine, input, receiver, true);
+            } catch (const std::exception&) {
+                _exit(1);
+            }
+            _exit(0);
+        }
+        int status = 0;
+        waitpid(child, &status, 0);
+        ptrace(PTRACE_SETOPTIONS, child, nullptr,
+               PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL);
+        ptrace(PTRACE_SYSCALL, child, nullptr, nullptr);
+
+        long count = 0;
+        int marks = 0;
+        int child_status = 1;
+        for (;;) {
+            pid_t thread = waitpid(-1, &status, __WALL);
+            if (thread < 0) {
+                break;
+            }
+            if (WIFEXITED(status) || WIFSIGNALED(status)) {
+                if (thread == child) {
+                    child_status = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+                }
+                continue;
+            }
+            int signal = 0;
+            if (WSTOPSIG(status) == (SIGTRAP | 0x80)) {
+                __ptrace_syscall_info info{};
+                ptrace(PTRACE_GET_SYSCALL_INFO, thread, sizeof(info), &info);
+                if (info.op == PTRACE_SYSCALL_INFO_ENTRY) {
+                    if (info.entry.nr == SYS_getppid) {
+                        marks++;
+                    } else if (marks == 1) {
+                        count++;
+                    }
+                }
+            } else if (WSTOPSIG(status) != SIGTRAP && WSTOPSIG(status) != SIGSTOP) {
+                signal = WSTOPSIG(status); // Not a ptrace stop, deliver it
+            }
+            ptrace(PTRACE_SYSCALL, thread, nullptr, reinterpret_cast<void*>(static_cast<long>(signal)));
+        }
+        return child_status == 0 && marks == 2 ? count : -1;
+    }
+#endif
+}
+
+int main(int argc, char* argv[]) {
+#ifndef __linux__
+    std::cerr << "The system calls are only counted on Linux" << std::endl;
+    return 2;
+#else
+    if (argc < 2) {
+        std::cerr << "Usage: upload_benchmark FILE [SIZE_MIB [BLOCK_SIZE]]" << std::endl;
+        return 2;
+    }
+    Input input{argv[1], (argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1024) * MiB,
+                argc > 3 ? std::strtoull(argv[3], nullptr, 10) : MiB}; // Client::DEFAULT_STREAM_BLOCK_SIZE
+    if (input.size == 0 || input.block_size == 0 || !write_input(input.path, input.size)) {
+        std::cerr << "Could not write " << input.size << " bytes to " << input.path << std::endl;
+        return 2;
+    }
+
+    std::vector<std::string> engines{"blocking", "pipelined"};
+    if (UringUpload::is_available()) {
+        engines.emplace_back("io_uring");
+    }
+    boost::asio::io_context io_context;
+    tcp::acceptor acceptor(io_context, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "# " << input.size / MiB << " MiB of " << input.path << " in blocks of " << input.block_size
+              << " bytes, AES-CTR" << std::endl;
+    std::cout << "engine syscalls/GiB cpu-ms/GiB seconds" << std::endl;
+    int status = 0;
+    for (const std::string& engine : engines) {
+        try {
+            pid_t receiver = start_receiver(acceptor);
+            double cpu_start = cpu_seconds();
+            auto start = std::chrono::steady_clock::now();
+            uint64_t sent = send_file(engine, input, acceptor.local_endpoint(), false);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            double cpu = cpu_seconds() - cpu_start;
+            waitpid(receiver, nullptr, 0);
+
+            receiver = start_receiver(acceptor);
+            long syscalls = count_syscalls(engine, input, acceptor.local_endpoint());
+            waitpid(receiver, nullptr, 0);
+            if (sent < input.size || syscalls < 0) {
+                std::cerr << engine << ": the transfer failed" << std::endl;
+                status = 1;
+                continue;
+            }
+            double gib = static_cast<double>(input.size) / GiB;
+            std::cout << engine << " " << static_cast<double>(syscalls) / gib << " " << cpu * 1000 / gib << " "
+                      << std::setprecision(3) << elapsed.count() << std::setprecision(1) << std::endl;
+        } catch (const std::exception& e) {
+            std::cerr << engine << ": " << e.what() << std::endl;
+            status = 1;
+        }
+    }
+    return status;
+#endif
+}